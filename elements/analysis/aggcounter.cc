@@ -331,6 +331,31 @@ AggregateCounter::reaggregate_counts()
     reaggregate_node(old_root);
 }
 
+bool
+AggregateCounter::merge_node(const Node *n)
+{
+    if (n->count) {
+	Node *m = find_node(n->aggregate, false);
+	if (!m)
+	    return false;
+	if (!m->count)
+	    _num_nonzero++;
+	m->count += n->count;
+	_count += n->count;
+    }
+    return !n->child[0]
+	|| (merge_node(n->child[0]) && merge_node(n->child[1]));
+}
+
+void
+AggregateCounter::merge_state(Element *e, ErrorHandler *errh)
+{
+    AggregateCounter *ac = static_cast<AggregateCounter *>(e->cast("AggregateCounter"));
+    if (ac && ac->_root && !merge_node(ac->_root))
+	errh->error("out of memory!");
+}
+
+
 
 // HANDLERS
 
@@ -165,6 +165,9 @@ Returns the number of aggregates that have been seen so far.
 
 =n
 
+In parallel trace mode, the counters of every copy of an AggregateCounter are
+added together when the copies finish, so its handlers report the whole trace.
+
 The aggregate identifier is stored in host byte order. Thus, the aggregate ID
 corresponding to IP address 128.0.0.0 is 2147483648.
 
@@ -200,6 +203,7 @@ class AggregateCounter : public Element { public:
     int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
     int initialize(ErrorHandler *) CLICK_COLD;
     void cleanup(CleanupStage) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
     void add_handlers() CLICK_COLD;
 
     inline bool update(Packet *, bool frozen = false);
@@ -247,6 +251,7 @@ class AggregateCounter : public Element { public:
     Node *make_peer(uint32_t, Node *, bool frozen);
     Node *find_node(uint32_t, bool frozen = false);
     void reaggregate_node(Node *);
+    bool merge_node(const Node *);
     void clear_node(Node *);
 
     void write_nodes(Node *, FILE *, WriteFormat, uint32_t *, int &, int, ErrorHandler *) const;
@@ -29,7 +29,7 @@
 #include <click/handlercall.hh>
 CLICK_DECLS
 
-#define SEC_OLDER(s1, s2)	((int)(s1 - s2) < 0)
+#define SEC_OLDER(s1, s2)	((int)((s1) - (s2)) < 0)
 
 // operations on host pairs and ports values
 
@@ -44,18 +44,6 @@ good_ip_header(const Packet *p)
 	return iph;
 }
 
-static inline bool
-operator==(const AggregateIPFlows::HostPair &a, const AggregateIPFlows::HostPair &b)
-{
-    return a.a == b.a && a.b == b.b;
-}
-
-inline hashcode_t
-AggregateIPFlows::HostPair::hashcode() const
-{
-    return (a << 12) + b + ((a >> 20) & 0x1F);
-}
-
 static inline bool
 ports_reverse_order(uint32_t ports)
 {
@@ -68,6 +56,15 @@ flip_ports(uint32_t ports)
     return ((ports >> 16) & 0xFFFF) | (ports << 16);
 }
 
+inline IPFlow5ID
+AggregateIPFlows::flow_key(const IPFlow5ID &hosts, uint32_t ports)
+{
+    // ports holds the lower address's port first, as on the wire
+    uint16_t p[2];
+    memcpy(p, &ports, sizeof(ports));
+    return IPFlow5ID(hosts.saddr(), p[0], hosts.daddr(), p[1], hosts.proto());
+}
+
 
 // actual AggregateIPFlows operations
 
@@ -100,8 +97,9 @@ AggregateIPFlows::configure(Vector<String> &conf, ErrorHandler *errh)
     _tcp_done_timeout = 30;
     _udp_timeout = 60;
     _fragment_timeout = 30;
-    _gc_interval = 20 * 60;
+    _capacity = 65536;
     _fragments = 2;
+    uint32_t reap;
     bool handle_icmp_errors = false;
     bool fragments_parsed;
     bool fragments = true;
@@ -111,7 +109,8 @@ AggregateIPFlows::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("TCP_DONE_TIMEOUT", _tcp_done_timeout)
 	.read("UDP_TIMEOUT", SecondsArg(), _udp_timeout)
 	.read("FRAGMENT_TIMEOUT", SecondsArg(), _fragment_timeout)
-	.read("REAP", SecondsArg(), _gc_interval)
+	.read("CAPACITY", _capacity)
+	.read("REAP", Args::deprecated, SecondsArg(), reap)
 	.read("ICMP", handle_icmp_errors)
 #if CLICK_USERLEVEL
 	.read("TRACEINFO", FilenameArg(), _traceinfo_filename)
@@ -121,6 +120,8 @@ AggregateIPFlows::configure(Vector<String> &conf, ErrorHandler *errh)
 	.complete() < 0)
 	return -1;
 
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
     _smallest_timeout = (_tcp_timeout < _tcp_done_timeout ? _tcp_timeout : _tcp_done_timeout);
     _smallest_timeout = (_smallest_timeout < _udp_timeout ? _smallest_timeout : _udp_timeout);
     _handle_icmp_errors = handle_icmp_errors;
@@ -132,10 +133,21 @@ AggregateIPFlows::configure(Vector<String> &conf, ErrorHandler *errh)
 int
 AggregateIPFlows::initialize(ErrorHandler *errh)
 {
-    _next = 1;
-    _active_sec = _gc_sec = 0;
     _timestamp_warning = false;
 
+    if (_state.resize() < 0)
+	return errh->error("out of memory");
+    int bits = 0;
+    while ((1 << bits) < _state.size())
+	++bits;
+    _thread_shift = 32 - bits;
+    _number_mask = bits ? (1U << _thread_shift) - 1 : 0xFFFFFFFFU;
+    for (int t = 0; t < _state.size(); ++t) {
+	_state[t].flows = new Table;
+	if (_state[t].flows->reserve(_capacity) < 0)
+	    return errh->error("out of memory");
+    }
+
 #if CLICK_USERLEVEL
     if (_traceinfo_filename == "-")
 	_traceinfo_file = stdout;
@@ -164,8 +176,20 @@ AggregateIPFlows::initialize(ErrorHandler *errh)
 void
 AggregateIPFlows::cleanup(CleanupStage)
 {
-    clean_map(_tcp_map);
-    clean_map(_udp_map);
+    for (int t = 0; t < _state.size(); ++t) {
+	ThreadState &ts = _state[t];
+	for (HeldMap::iterator it = ts.held.begin(); it.live(); ++it)
+	    for (Held *h = it.value().head; h; h = h->next)
+		h->p->kill();
+	// the pool frees the records
+	if (Table *table = ts.flows) {
+	    for (uint32_t i = 0; i != table->index_limit(); ++i)
+		if (table->live(i))
+		    delete_flowinfo(table->key(i), table->value(i));
+	    delete table;
+	}
+    }
+    _state.clear();
 #if CLICK_USERLEVEL
     if (_traceinfo_file && _traceinfo_file != stdout) {
 	fprintf(_traceinfo_file, "</trace>\n");
@@ -175,63 +199,69 @@ AggregateIPFlows::cleanup(CleanupStage)
 #endif
 }
 
-inline void
-AggregateIPFlows::delete_flowinfo(const HostPair &hp, FlowInfo *finfo, bool really_delete)
+void
+AggregateIPFlows::merge_state(Element *e, ErrorHandler *errh)
+{
+    AggregateIPFlows *af = static_cast<AggregateIPFlows *>(e->cast("AggregateIPFlows"));
+    if (!af)
+	return;
+    // Flow numbers include the thread, so flows from another thread can move
+    // here unchanged. Held fragments stay behind and are freed by 'af'.
+    for (int t = 0; t < _state.size() && t < af->_state.size(); ++t) {
+	ThreadState &ts = _state[t], &ots = af->_state[t];
+	if (!ots.flows->size())
+	    continue;
+	else if (ts.flows->size() || _thread_shift != af->_thread_shift) {
+	    errh->warning("flows from thread %d not merged", t);
+	    continue;
+	}
+	Table *flows = ts.flows;
+	ts.flows = ots.flows;
+	ots.flows = flows;
+	ts.next = ots.next;
+	ts.reap_cursor = ots.reap_cursor;
+	ts.active_sec = ots.active_sec;
+    }
+}
+
+void
+AggregateIPFlows::delete_flowinfo(const IPFlow5ID &flowid, const FlowInfo &finfo)
 {
 #if CLICK_USERLEVEL
     if (_traceinfo_file) {
-	StatFlowInfo *sinfo = static_cast<StatFlowInfo *>(finfo);
-	IPAddress src(sinfo->reverse() ? hp.b : hp.a);
-	int sport = (ntohl(sinfo->_ports) >> (sinfo->reverse() ? 0 : 16)) & 0xFFFF;
-	IPAddress dst(sinfo->reverse() ? hp.a : hp.b);
-	int dport = (ntohl(sinfo->_ports) >> (sinfo->reverse() ? 16 : 0)) & 0xFFFF;
-	Timestamp duration = sinfo->_last_timestamp - sinfo->_first_timestamp;
+	IPAddress src(finfo.reverse ? flowid.daddr() : flowid.saddr());
+	int sport = ntohs(finfo.reverse ? flowid.dport() : flowid.sport());
+	IPAddress dst(finfo.reverse ? flowid.saddr() : flowid.daddr());
+	int dport = ntohs(finfo.reverse ? flowid.sport() : flowid.dport());
+	Timestamp duration = finfo.last_timestamp - finfo.first_timestamp;
+	_traceinfo_lock.acquire();
 	fprintf(_traceinfo_file, "<flow aggregate='%u' src='%s' sport='%d' dst='%s' dport='%d' begin='" PRITIMESTAMP "' duration='" PRITIMESTAMP "'",
-
-		sinfo->_aggregate,
+		finfo.aggregate,
 		src.unparse().c_str(), sport, dst.unparse().c_str(), dport,
-		sinfo->_first_timestamp.sec(), sinfo->_first_timestamp.subsec(),
+		finfo.first_timestamp.sec(), finfo.first_timestamp.subsec(),
 		duration.sec(), duration.subsec());
-	if (sinfo->_filepos)
-	    fprintf(_traceinfo_file, " filepos='%u'", sinfo->_filepos);
+	if (finfo.filepos)
+	    fprintf(_traceinfo_file, " filepos='%u'", finfo.filepos);
 	fprintf(_traceinfo_file, ">\n\
   <stream dir='0' packets='%d' /><stream dir='1' packets='%d' />\n\
 </flow>\n",
-		sinfo->_packets[0], sinfo->_packets[1]);
-	if (really_delete)
-	    delete sinfo;
-    } else
-#endif
-	if (really_delete)
-	    delete finfo;
-}
-
-void
-AggregateIPFlows::clean_map(Map &table)
-{
-    // free completed flows and emit fragments
-    for (Map::iterator iter = table.begin(); iter.live(); iter++) {
-	HostPairInfo *hpinfo = &iter.value();
-	while (Packet *p = hpinfo->_fragment_head) {
-	    hpinfo->_fragment_head = p->next();
-	    p->kill();
-	}
-	while (FlowInfo *f = hpinfo->_flows) {
-	    hpinfo->_flows = f->_next;
-	    delete_flowinfo(iter.key(), f);
-	}
+		finfo.packets[0], finfo.packets[1]);
+	_traceinfo_lock.release();
     }
+#else
+    (void) flowid, (void) finfo;
+#endif
 }
 
 #if CLICK_USERLEVEL
 void
 AggregateIPFlows::stat_new_flow_hook(const Packet *p, FlowInfo *finfo)
 {
-    StatFlowInfo *sinfo = static_cast<StatFlowInfo *>(finfo);
-    sinfo->_first_timestamp = p->timestamp_anno();
-    sinfo->_filepos = 0;
+    finfo->first_timestamp = p->timestamp_anno();
+    finfo->filepos = 0;
+    finfo->packets[0] = finfo->packets[1] = 0;
     if (_filepos_h)
-	(void) IntArg().parse(_filepos_h->call_read().trim_space(), sinfo->_filepos);
+	(void) IntArg().parse(_filepos_h->call_read().trim_space(), finfo->filepos);
 }
 #endif
 
@@ -239,7 +269,7 @@ inline void
 AggregateIPFlows::packet_emit_hook(const Packet *p, const click_ip *iph, FlowInfo *finfo)
 {
     // account for timestamp
-    finfo->_last_timestamp = p->timestamp_anno();
+    finfo->last_timestamp = p->timestamp_anno();
 
     // check whether this indicates the flow is over
     if (iph->ip_p == IP_PROTO_TCP && IP_FIRSTFRAG(iph)
@@ -249,68 +279,80 @@ AggregateIPFlows::packet_emit_hook(const Packet *p, const click_ip *iph, FlowInf
 	&& p->transport_length() >= 14
 	&& PAINT_ANNO(p) < 2) {	// ignore ICMP errors
 	if (p->tcp_header()->th_flags & TH_RST)
-	    finfo->_flow_over = 3;
+	    finfo->flow_over = 3;
 	else if (p->tcp_header()->th_flags & TH_FIN)
-	    finfo->_flow_over |= (1 << PAINT_ANNO(p));
+	    finfo->flow_over |= (1 << PAINT_ANNO(p));
 	else if (p->tcp_header()->th_flags & TH_SYN)
-	    finfo->_flow_over = 0;
+	    finfo->flow_over = 0;
     }
 
 #if CLICK_USERLEVEL
     // count packets
-    if (stats() && PAINT_ANNO(p) < 2) {
-	StatFlowInfo *sinfo = static_cast<StatFlowInfo *>(finfo);
-	sinfo->_packets[PAINT_ANNO(p)]++;
-    }
+    if (stats() && PAINT_ANNO(p) < 2)
+	finfo->packets[PAINT_ANNO(p)]++;
 #endif
 }
 
-void
-AggregateIPFlows::reap_map(Map &table, uint32_t timeout, uint32_t done_timeout)
+bool
+AggregateIPFlows::held(ThreadState &ts, const IPFlow5ID &flowid)
 {
-    timeout = _active_sec - timeout;
-    done_timeout = _active_sec - done_timeout;
-    int frag_timeout = _active_sec - _fragment_timeout;
-
-    // free completed flows and emit fragments
-    for (Map::iterator iter = table.begin(); iter.live(); iter++) {
-	HostPairInfo *hpinfo = &iter.value();
-	Packet *head;
-	// fragments
-	while ((head = hpinfo->_fragment_head)
-	       && (head->timestamp_anno().sec() < frag_timeout
-		   || !IP_ISFRAG(good_ip_header(head))))
-	    emit_fragment_head(hpinfo);
-
-	// can't delete any flows if there are fragments
-	if (hpinfo->_fragment_head)
-	    continue;
+    IPFlow5ID hosts(flowid.saddr(), 0, flowid.daddr(), 0, flowid.proto());
+    return ts.held.get_pointer(hosts) != 0;
+}
 
-	// completed flows
-	FlowInfo **pprev = &hpinfo->_flows;
-	FlowInfo *f = *pprev;
-	while (f) {
-	    // circular comparison
-	    if (SEC_OLDER(f->_last_timestamp.sec(), (f->_flow_over == 3 ? done_timeout : timeout))) {
-		notify(f->_aggregate, AggregateListener::DELETE_AGG, 0);
-		*pprev = f->_next;
-		delete_flowinfo(iter.key(), f);
-	    } else
-		pprev = &f->_next;
-	    f = *pprev;
-	}
-	// XXX never free host pairs
+struct AggregateIPFlows::Expired {
+    AggregateIPFlows *af;
+    ThreadState &ts;
+    bool force;
+    Expired(AggregateIPFlows *af_, ThreadState &ts_, bool force_)
+	: af(af_), ts(ts_), force(force_) {
     }
-}
+    bool operator()(const IPFlow5ID &flowid, FlowInfo &finfo) const {
+	// circular comparison; flows whose host pair has held packets stay,
+	// since those packets may belong to them
+	if ((!force
+	     && !SEC_OLDER(finfo.last_timestamp.sec(),
+			   ts.active_sec - af->relevant_timeout(flowid, finfo)))
+	    || (!ts.held.empty() && af->held(ts, flowid)))
+	    return false;
+	af->notify(finfo.aggregate, AggregateListener::DELETE_AGG, 0);
+	af->delete_flowinfo(flowid, finfo);
+	return true;
+    }
+};
 
 void
-AggregateIPFlows::reap()
+AggregateIPFlows::reap(ThreadState &ts, uint32_t n, bool force)
 {
-    if (_gc_sec) {
-	reap_map(_tcp_map, _tcp_timeout, _tcp_done_timeout);
-	reap_map(_udp_map, _udp_timeout, _udp_timeout);
+    // also flush stale fragments once per pass
+    if (ts.flows->reap_step(ts.reap_cursor, n, Expired(this, ts, force))
+	&& !ts.held.empty())
+	expire_held(ts, false);
+}
+
+bool
+AggregateIPFlows::make_room(ThreadState &ts)
+{
+    // Reap the whole table; if it is still mostly full, double it.
+    Table *table = ts.flows;
+    reap(ts, table->index_limit(), false);
+    if (table->size() < table->capacity() - table->capacity() / 4)
+	return true;
+
+    Table *bigger = new Table;
+    if (bigger->reserve(table->capacity() * 2) < 0) {
+	delete bigger;
+	return false;
     }
-    _gc_sec = _active_sec + _gc_interval;
+    for (uint32_t i = 0; i != table->index_limit(); ++i)
+	if (table->live(i) && !bigger->insert(table->key(i), table->value(i))) {
+	    delete bigger;
+	    return false;
+	}
+    delete table;
+    ts.flows = bigger;
+    ts.reap_cursor = 0;
+    return true;
 }
 
 const click_ip *
@@ -332,145 +374,168 @@ AggregateIPFlows::icmp_encapsulated_header(const Packet *p)
     return 0;
 }
 
-int
-AggregateIPFlows::relevant_timeout(const FlowInfo *f, const Map &m) const
+inline int
+AggregateIPFlows::relevant_timeout(const IPFlow5ID &flowid, const FlowInfo &finfo) const
 {
-    if (&m == &_udp_map)
+    if (flowid.proto() == IP_PROTO_UDP)
 	return _udp_timeout;
-    else if (f->_flow_over == 3)
+    else if (finfo.flow_over == 3)
 	return _tcp_done_timeout;
     else
 	return _tcp_timeout;
 }
 
+inline uint32_t
+AggregateIPFlows::make_aggregate(ThreadState &ts, int thread)
+{
+    uint32_t n = ts.next++ & _number_mask;
+    if (!n)
+	n = ts.next++ & _number_mask;
+    if (_thread_shift < 32)
+	n |= (uint32_t) thread << _thread_shift;
+    return n;
+}
+
 // XXX timing when fragments are merged back in?
 
 AggregateIPFlows::FlowInfo *
-AggregateIPFlows::find_flow_info(Map &m, HostPairInfo *hpinfo, uint32_t ports, bool flipped, const Packet *p)
+AggregateIPFlows::find_flow_info(ThreadState &ts, int thread, const IPFlow5ID &flowid, bool flipped, const Packet *p)
 {
-    FlowInfo **pprev = &hpinfo->_flows;
-    for (FlowInfo *finfo = *pprev; finfo; pprev = &finfo->_next, finfo = finfo->_next)
-	if (finfo->_ports == ports) {
-	    // if this flow is actually dead (but has not yet been garbage
-	    // collected), then kill it for consistent semantics
-	    int age = p->timestamp_anno().sec() - finfo->_last_timestamp.sec();
-	    // 4.Feb.2004 - Also start a new flow if the old flow closed off,
-	    // and we have a SYN.
-	    if ((age > (int) _smallest_timeout
-		 && age > relevant_timeout(finfo, m))
-		|| (finfo->_flow_over == 3
-		    && p->ip_header()->ip_p == IP_PROTO_TCP
-		    && (p->tcp_header()->th_flags & TH_SYN))) {
-		// old aggregate has died
-		notify(finfo->aggregate(), AggregateListener::DELETE_AGG, 0);
-		const click_ip *iph = good_ip_header(p);
-		HostPair hp(iph->ip_src.s_addr, iph->ip_dst.s_addr);
-		delete_flowinfo(hp, finfo, false);
-
-		// make a new aggregate
-		finfo->_aggregate = _next;
-		_next++;
-		finfo->_reverse = flipped;
-		finfo->_flow_over = 0;
-#if CLICK_USERLEVEL
-		if (stats())
-		    stat_new_flow_hook(p, finfo);
-#endif
-		notify(finfo->aggregate(), AggregateListener::NEW_AGG, p);
-	    }
-
-	    // otherwise, move to the front of the list and return
-	    *pprev = finfo->_next;
-	    finfo->_next = hpinfo->_flows;
-	    hpinfo->_flows = finfo;
+    bool inserted;
+    FlowInfo *finfo = ts.flows->find_insert(flowid, inserted);
+    if (!finfo && make_room(ts))
+	finfo = ts.flows->find_insert(flowid, inserted);
+    if (!finfo)
+	return 0;
+
+    if (!inserted) {
+	// if this flow is actually dead (but has not yet been reaped), then
+	// kill it for consistent semantics
+	int age = p->timestamp_anno().sec() - finfo->last_timestamp.sec();
+	// 4.Feb.2004 - Also start a new flow if the old flow closed off,
+	// and we have a SYN.
+	if ((age > (int) _smallest_timeout
+	     && age > relevant_timeout(flowid, *finfo))
+	    || (finfo->flow_over == 3
+		&& p->ip_header()->ip_p == IP_PROTO_TCP
+		&& (p->tcp_header()->th_flags & TH_SYN))) {
+	    // old aggregate has died
+	    notify(finfo->aggregate, AggregateListener::DELETE_AGG, 0);
+	    delete_flowinfo(flowid, *finfo);
+	} else
 	    return finfo;
-	}
+    }
 
-    // make and install new FlowInfo pair
-    FlowInfo *finfo;
+    // make a new aggregate
+    finfo->aggregate = make_aggregate(ts, thread);
+    finfo->reverse = flipped;
+    finfo->flow_over = 0;
+    finfo->last_timestamp = p->timestamp_anno();
 #if CLICK_USERLEVEL
-    if (stats()) {
-	finfo = new StatFlowInfo(ports, hpinfo->_flows, _next);
+    if (stats())
 	stat_new_flow_hook(p, finfo);
-    } else
 #endif
-	finfo = new FlowInfo(ports, hpinfo->_flows, _next);
-
-    finfo->_reverse = flipped;
-    hpinfo->_flows = finfo;
-    _next++;
-    notify(finfo->aggregate(), AggregateListener::NEW_AGG, p);
+    notify(finfo->aggregate, AggregateListener::NEW_AGG, p);
     return finfo;
 }
 
 void
-AggregateIPFlows::emit_fragment_head(HostPairInfo *hpinfo)
+AggregateIPFlows::emit_held_head(ThreadState &ts, const IPFlow5ID &hosts, HeldList &hl)
 {
-    Packet *head = hpinfo->_fragment_head;
-    hpinfo->_fragment_head = head->next();
+    Held *h = hl.head;
+    hl.head = h->next;
+    if (!hl.head)
+	hl.tail = 0;
+    Packet *head = h->p;
+    uint32_t ports = h->ports;
+    ts.held_pool.deallocate(h);
 
     const click_ip *iph = good_ip_header(head);
     // XXX multiple linear traversals of entire fragment list!
     // want a faster method that takes up little memory?
 
     if (AGGREGATE_ANNO(head)) {
-	for (Packet *p = hpinfo->_fragment_head; p; p = p->next())
-	    if (good_ip_header(p)->ip_id == iph->ip_id) {
-		SET_AGGREGATE_ANNO(p, AGGREGATE_ANNO(head));
-		SET_PAINT_ANNO(p, PAINT_ANNO(head));
+	for (Held *x = hl.head; x; x = x->next)
+	    if (good_ip_header(x->p)->ip_id == iph->ip_id) {
+		SET_AGGREGATE_ANNO(x->p, AGGREGATE_ANNO(head));
+		SET_PAINT_ANNO(x->p, PAINT_ANNO(head));
+		x->ports = ports;
 	    }
     } else {
-	for (Packet *p = hpinfo->_fragment_head; p; p = p->next())
-	    if (good_ip_header(p)->ip_id == iph->ip_id
-		&& AGGREGATE_ANNO(p)) {
-		SET_AGGREGATE_ANNO(head, AGGREGATE_ANNO(p));
-		SET_PAINT_ANNO(head, PAINT_ANNO(p));
-		goto find_flowinfo;
-	    }
-	head->kill();
-	return;
-    }
-
-  find_flowinfo:
-    // find the packet's FlowInfo
-    FlowInfo *finfo, **pprev = &hpinfo->_flows;
-    for (finfo = *pprev; finfo; pprev = &finfo->_next, finfo = *pprev)
-	if (finfo->_aggregate == AGGREGATE_ANNO(head)) {
-	    *pprev = finfo->_next;
-	    finfo->_next = hpinfo->_flows;
-	    hpinfo->_flows = finfo;
-	    break;
+	Held *x;
+	for (x = hl.head; x; x = x->next)
+	    if (good_ip_header(x->p)->ip_id == iph->ip_id
+		&& AGGREGATE_ANNO(x->p))
+		break;
+	if (!x) {
+	    head->kill();
+	    return;
 	}
+	SET_AGGREGATE_ANNO(head, AGGREGATE_ANNO(x->p));
+	SET_PAINT_ANNO(head, PAINT_ANNO(x->p));
+	ports = x->ports;
+    }
 
-    assert(finfo);
-    packet_emit_hook(head, iph, finfo);
+    // The flow may have restarted with a new aggregate since the packet
+    // arrived; account only for the packet's own flow.
+    FlowInfo *finfo = ts.flows->find(flow_key(hosts, ports));
+    if (finfo && finfo->aggregate == AGGREGATE_ANNO(head))
+	packet_emit_hook(head, iph, finfo);
     output(0).push(head);
 }
 
+void
+AggregateIPFlows::emit_held(ThreadState &ts, const IPFlow5ID &hosts, HeldList &hl, bool force)
+{
+    // get rid of old fragments
+    int frag_timeout = ts.active_sec - _fragment_timeout;
+    while (hl.head
+	   && (force
+	       || hl.head->p->timestamp_anno().sec() < frag_timeout
+	       || !IP_ISFRAG(good_ip_header(hl.head->p))))
+	emit_held_head(ts, hosts, hl);
+}
+
+void
+AggregateIPFlows::expire_held(ThreadState &ts, bool force)
+{
+    HeldMap::iterator it = ts.held.begin();
+    while (it.live()) {
+	emit_held(ts, it.key(), it.value(), force);
+	if (!it.value().head)
+	    it = ts.held.erase(it);
+	else
+	    ++it;
+    }
+}
+
 int
-AggregateIPFlows::handle_fragment(Packet *p, HostPairInfo *hpinfo)
+AggregateIPFlows::handle_fragment(ThreadState &ts, const IPFlow5ID &hosts, Packet *p, uint32_t ports)
 {
-    if (hpinfo->_fragment_head)
-	hpinfo->_fragment_tail->set_next(p);
+    Held *h = static_cast<Held *>(ts.held_pool.allocate());
+    if (!h)
+	return ACT_DROP;
+    h->next = 0;
+    h->p = p;
+    h->ports = ports;
+
+    HeldList &hl = ts.held[hosts];
+    if (hl.head)
+	hl.tail->next = h;
     else
-	hpinfo->_fragment_head = p;
-    hpinfo->_fragment_tail = p;
-    p->set_next(0);
-    _active_sec = p->timestamp_anno().sec();
+	hl.head = h;
+    hl.tail = h;
+    ts.active_sec = p->timestamp_anno().sec();
 
-    // get rid of old fragments
-    int frag_timeout = _active_sec - _fragment_timeout;
-    Packet *head;
-    while ((head = hpinfo->_fragment_head)
-	   && (head->timestamp_anno().sec() < frag_timeout
-	       || !IP_ISFRAG(good_ip_header(head))))
-	emit_fragment_head(hpinfo);
+    emit_held(ts, hosts, hl, false);
+    if (!hl.head)
+	ts.held.erase(hosts);
 
     return ACT_NONE;
 }
 
 int
-AggregateIPFlows::handle_packet(Packet *p)
+AggregateIPFlows::handle_packet(ThreadState &ts, int thread, Packet *p)
 {
     const click_ip *iph = p->ip_header();
     int paint = 0;
@@ -492,44 +557,45 @@ AggregateIPFlows::handle_packet(Packet *p)
     }
 
     // return if not a proper TCP/UDP packet
-    if (!p->has_network_header()
+    if (!p->has_network_header() || !iph
 	|| (iph->ip_p != IP_PROTO_TCP && iph->ip_p != IP_PROTO_UDP)
 	|| (iph->ip_src.s_addr == 0 && iph->ip_dst.s_addr == 0))
 	return ACT_DROP;
 
-    // find relevant HostPairInfo
-    Map &m = (iph->ip_p == IP_PROTO_TCP ? _tcp_map : _udp_map);
-    HostPair hosts(iph->ip_src.s_addr, iph->ip_dst.s_addr);
-    if (hosts.a != iph->ip_src.s_addr)
+    // find the host pair, lower address first
+    IPFlow5ID hosts(iph->ip_src, 0, iph->ip_dst, 0, iph->ip_p);
+    if (iph->ip_src.s_addr > iph->ip_dst.s_addr) {
+	hosts = hosts.reverse();
 	paint ^= 1;
-    HostPairInfo *hpinfo = &m[hosts];
+    }
 
     // find relevant FlowInfo, if any
     FlowInfo *finfo;
+    uint32_t ports = 0;
     if (IP_FIRSTFRAG(iph)) {
 	const uint8_t *udp_ptr = reinterpret_cast<const uint8_t *>(iph) + (iph->ip_hl << 2);
 	if (udp_ptr + 4 > p->end_data())
 	    // packet not big enough
 	    return ACT_DROP;
 
-	uint32_t ports = *reinterpret_cast<const uint32_t *>(udp_ptr);
+	ports = *reinterpret_cast<const uint32_t *>(udp_ptr);
 	// 1.Jan.08: handle connections where IP addresses are the same (John
 	// Russell Lane)
-	if (hosts.a == hosts.b && ports_reverse_order(ports))
+	if (hosts.saddr() == hosts.daddr() && ports_reverse_order(ports))
 	    paint ^= 1;
 	if (paint & 1)
 	    ports = flip_ports(ports);
 
-	finfo = find_flow_info(m, hpinfo, ports, paint & 1, p);
+	finfo = find_flow_info(ts, thread, flow_key(hosts, ports), paint & 1, p);
 	if (!finfo) {
 	    click_chatter("out of memory!");
 	    return ACT_DROP;
 	}
-	if (finfo->reverse())
+	if (finfo->reverse)
 	    paint ^= 1;
 
 	// set aggregate annotations
-	SET_AGGREGATE_ANNO(p, finfo->aggregate());
+	SET_AGGREGATE_ANNO(p, finfo->aggregate);
 	SET_PAINT_ANNO(p, paint);
     } else {
 	finfo = 0;
@@ -538,13 +604,14 @@ AggregateIPFlows::handle_packet(Packet *p)
     }
 
     // check for fragment
-    if ((_fragments && IP_ISFRAG(iph)) || hpinfo->_fragment_head)
-	return handle_fragment(p, hpinfo);
+    if ((_fragments && IP_ISFRAG(iph))
+	|| (!ts.held.empty() && ts.held.get_pointer(hosts)))
+	return handle_fragment(ts, hosts, p, ports);
     else if (!finfo)
 	return ACT_DROP;
 
     // packet emit hook
-    _active_sec = p->timestamp_anno().sec();
+    ts.active_sec = p->timestamp_anno().sec();
     packet_emit_hook(p, iph, finfo);
 
     return ACT_EMIT;
@@ -553,11 +620,12 @@ AggregateIPFlows::handle_packet(Packet *p)
 void
 AggregateIPFlows::push(int, Packet *p)
 {
-    int action = handle_packet(p);
+    int thread = click_current_cpu_id();
+    ThreadState &ts = _state[thread];
+    int action = handle_packet(ts, thread, p);
 
-    // GC if necessary
-    if (_active_sec >= _gc_sec)
-	reap();
+    // expire a few flows
+    reap(ts, reap_batch, false);
 
     if (action == ACT_EMIT)
 	output(0).push(p);
@@ -569,11 +637,14 @@ Packet *
 AggregateIPFlows::pull(int)
 {
     Packet *p = input(0).pull();
-    int action = (p ? handle_packet(p) : ACT_NONE);
+    if (!p)
+	return 0;
+    int thread = click_current_cpu_id();
+    ThreadState &ts = _state[thread];
+    int action = handle_packet(ts, thread, p);
 
-    // GC if necessary
-    if (_active_sec >= _gc_sec)
-	reap();
+    // expire a few flows
+    reap(ts, reap_batch, false);
 
     if (action == ACT_EMIT)
 	return p;
@@ -582,20 +653,39 @@ AggregateIPFlows::pull(int)
     return 0;
 }
 
-enum { H_CLEAR };
+String
+AggregateIPFlows::read_handler(Element *e, void *thunk)
+{
+    AggregateIPFlows *af = static_cast<AggregateIPFlows *>(e);
+    int n = af->_state.size();
+    size_t x = 0;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	for (int t = 0; t < n; ++t)
+	    x += af->_state[t].flows->size();
+	return String(x);
+    case h_memory:
+	for (int t = 0; t < n; ++t)
+	    x += af->_state[t].flows->memory_size()
+		+ af->_state[t].held_pool.memory();
+	return String(x);
+    default:
+	return String();
+    }
+}
 
 int
 AggregateIPFlows::write_handler(const String &, Element *e, void *thunk, ErrorHandler *)
 {
     AggregateIPFlows *af = static_cast<AggregateIPFlows *>(e);
     switch ((intptr_t)thunk) {
-      case H_CLEAR: {
-	  int active_sec = af->_active_sec, gc_sec = af->_gc_sec;
-	  af->_active_sec = af->_gc_sec = 0x7FFFFFFF;
-	  af->reap();
-	  af->_active_sec = active_sec, af->_gc_sec = gc_sec;
-	  return 0;
-      }
+      case h_clear:
+	for (int t = 0; t < af->_state.size(); ++t) {
+	    ThreadState &ts = af->_state[t];
+	    af->expire_held(ts, true);
+	    af->reap(ts, ts.flows->index_limit(), true);
+	}
+	return 0;
       default:
 	return -1;
     }
@@ -604,9 +694,12 @@ AggregateIPFlows::write_handler(const String &, Element *e, void *thunk, ErrorHa
 void
 AggregateIPFlows::add_handlers()
 {
-    add_write_handler("clear", write_handler, H_CLEAR);
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("memory", read_handler, h_memory);
+    add_write_handler("clear", write_handler, h_clear);
 }
 
 ELEMENT_REQUIRES(AggregateNotifier)
 EXPORT_ELEMENT(AggregateIPFlows)
+ELEMENT_MT_SAFE(AggregateIPFlows)
 CLICK_ENDDECLS
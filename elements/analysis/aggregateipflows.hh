@@ -4,6 +4,9 @@
 #include <click/element.hh>
 #include <click/ipflowid.hh>
 #include <click/hashtable.hh>
+#include <click/cuckootable.hh>
+#include <click/hashallocator.hh>
+#include <click/sync.hh>
 #include "aggregatenotifier.hh"
 CLICK_DECLS
 class HandlerCall;
@@ -36,6 +39,22 @@ packets are on the forward or reverse subflow. (The first packet seen on each
 flow gets paint color 0; reply packets get paint color 1. ICMP errors get
 paints 2 and 3.)
 
+Each thread's flow table starts with room for CAPACITY flows and doubles
+when it fills. Each flow must be handled by a single thread, as with RSS
+(see RSSSwitch). Flow numbers stay deterministic with several threads: the
+top bits of a flow number hold the number of the thread that saw it, and the
+rest count that thread's flows. With one thread, or on thread 0, flow numbers
+are simply 1, 2, 3, and so on. Flows expire lazily: a packet for an expired
+flow starts a new flow, and each packet also examines a few other flows and
+deletes any that have expired. AggregateListeners may be notified from any
+thread.
+
+In parallel trace mode, each copy of AggregateIPFlows runs on its own
+thread, so flow numbers are unique across copies. When the copies finish,
+their flow tables are merged into the first copy, whose C<count> handler then
+reports the flows of the whole trace. Flows that are still active at the end
+are reported in the first copy's TRACEINFO file.
+
 AggregateIPFlows can optionally apply aggregate annotations to ICMP errors.
 See the ICMP keyword argument below.
 
@@ -93,9 +112,14 @@ The timeout for UDP connections, in seconds. Default is 1 minute.
 
 The timeout for fragments, in seconds, Default is 30 seconds.
 
+=item CAPACITY
+
+Unsigned integer. Initial number of flows each thread can track. Default is
+65536.
+
 =item REAP
 
-The garbage collection interval. Default is 20 minutes of packet time.
+Ignored. Flows expire as described above.
 
 =item ICMP
 
@@ -115,10 +139,19 @@ Default is true in a push context and false in a pull context.
 AggregateIPFlows is an AggregateNotifier, so AggregateListeners can request
 notifications when new aggregates are created and old ones are deleted.
 
+=h count read-only
+
+Returns the number of flows in all tables.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the flow tables.
+
 =h clear write-only
 
 Clears all flow information. Future packets will get new aggregate annotation
-values. This may cause packets to be emitted if FRAGMENTS is true.
+values. This may cause packets to be emitted if FRAGMENTS is true. Only safe
+while no packets are being processed.
 
 =e
 
@@ -141,7 +174,7 @@ remaining fragments.
 
 =a
 
-AggregateIP, AggregateIPAddrPair, AggregateCounter, DriverManager */
+AggregateIP, AggregateIPAddrPair, AggregateCounter, DriverManager, RSSSwitch */
 
 class AggregateIPFlows : public Element, public AggregateNotifier { public:
 
@@ -157,6 +190,7 @@ class AggregateIPFlows : public Element, public AggregateNotifier { public:
     int initialize(ErrorHandler *) CLICK_COLD;
     void add_handlers() CLICK_COLD;
     void cleanup(CleanupStage) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
 
 #if CLICK_USERLEVEL
     bool stats() const			{ return _traceinfo_file; }
@@ -165,63 +199,69 @@ class AggregateIPFlows : public Element, public AggregateNotifier { public:
     void push(int, Packet *);
     Packet *pull(int);
 
-    struct HostPair {
-	uint32_t a;
-	uint32_t b;
-	HostPair() : a(0), b(0) { }
-	HostPair(uint32_t aa, uint32_t bb) {
-	    aa > bb ? (a = bb, b = aa) : (a = aa, b = bb);
+  private:
+
+    // Flows are keyed by IPFlow5ID with the lower address first. The first
+    // packet seen came from the higher address iff reverse is true.
+    struct FlowInfo {
+	uint32_t aggregate;
+	bool reverse;
+	uint8_t flow_over;
+	Timestamp last_timestamp;
+	// statistics, used only with TRACEINFO
+	Timestamp first_timestamp;
+	uint32_t filepos;
+	uint32_t packets[2];
+	FlowInfo()
+	    : aggregate(0), reverse(false), flow_over(0), filepos(0) {
+	    packets[0] = packets[1] = 0;
 	}
-	inline hashcode_t hashcode() const;
     };
 
-  private:
+    typedef CuckooTable<IPFlow5ID, FlowInfo> Table;
 
-    struct FlowInfo {
-	uint32_t _ports;
-	uint32_t _aggregate;
-	Timestamp _last_timestamp;
-	unsigned _flow_over : 2;
-	bool _reverse : 1;
-	FlowInfo *_next;
-	// have 24 bytes; statistics would double
-	// + 8 + 8 = 16 bytes
-	FlowInfo(uint32_t ports, FlowInfo *next, uint32_t agg) : _ports(ports), _aggregate(agg), _flow_over(0), _next(next) { }
-	uint32_t aggregate() const { return _aggregate; }
-	bool reverse() const	{ return _reverse; }
+    // Packets held behind a fragment, per host pair. ports holds the
+    // packet's ports, lower address first, once its aggregate is known.
+    struct Held {
+	Held *next;
+	Packet *p;
+	uint32_t ports;
     };
 
-#if CLICK_USERLEVEL
-    struct StatFlowInfo : public FlowInfo {
-	Timestamp _first_timestamp;
-	uint32_t _filepos;
-	uint32_t _packets[2];
-	StatFlowInfo(uint32_t ports, FlowInfo *next, uint32_t agg) : FlowInfo(ports, next, agg) { _packets[0] = _packets[1] = 0; }
+    struct HeldList {
+	Held *head;
+	Held *tail;
+	HeldList()
+	    : head(0), tail(0) {
+	}
     };
-#endif
 
-    struct HostPairInfo {
-	FlowInfo *_flows;
-	Packet *_fragment_head;
-	Packet *_fragment_tail;
-	HostPairInfo() : _flows(0), _fragment_head(0), _fragment_tail(0) { }
-	FlowInfo *find_force(uint32_t ports);
+    // keyed by host pair and protocol, with zero ports
+    typedef HashTable<IPFlow5ID, HeldList> HeldMap;
+
+    struct ThreadState {
+	Table *flows;
+	HeldMap held;
+	SizedHashAllocator<sizeof(Held)> held_pool;
+	uint32_t next;		// next flow number, without thread prefix
+	uint32_t reap_cursor;
+	int active_sec;
+	ThreadState()
+	    : flows(0), next(1), reap_cursor(0), active_sec(0) {
+	}
     };
 
-    typedef HashTable<HostPair, HostPairInfo> Map;
-    Map _tcp_map;
-    Map _udp_map;
+    enum { reap_batch = 8 };
 
-    uint32_t _next;
-    unsigned _active_sec;
-    unsigned _gc_sec;
+    PerThread<ThreadState> _state;
+    int _thread_shift;		// flow numbers hold the thread above here
+    uint32_t _number_mask;
 
+    uint32_t _capacity;
     uint32_t _tcp_timeout;
     uint32_t _tcp_done_timeout;
     uint32_t _udp_timeout;
     uint32_t _smallest_timeout;
-
-    unsigned _gc_interval;
     unsigned _fragment_timeout;
 
     bool _handle_icmp_errors : 1;
@@ -231,32 +271,40 @@ class AggregateIPFlows : public Element, public AggregateNotifier { public:
 #if CLICK_USERLEVEL
     FILE *_traceinfo_file;
     String _traceinfo_filename;
+    Spinlock _traceinfo_lock;
 
     Element *_packet_source;
     HandlerCall *_filepos_h;
 #endif
 
     static const click_ip *icmp_encapsulated_header(const Packet *);
+    static inline IPFlow5ID flow_key(const IPFlow5ID &hosts, uint32_t ports);
 
-    void clean_map(Map &);
-    void reap_map(Map &, uint32_t, uint32_t);
-    void reap();
-
-    inline int relevant_timeout(const FlowInfo *, const Map &) const;
+    inline int relevant_timeout(const IPFlow5ID &, const FlowInfo &) const;
+    inline uint32_t make_aggregate(ThreadState &, int thread);
 #if CLICK_USERLEVEL
     void stat_new_flow_hook(const Packet *, FlowInfo *);
 #endif
     inline void packet_emit_hook(const Packet *, const click_ip *, FlowInfo *);
-    inline void delete_flowinfo(const HostPair &, FlowInfo *, bool really_delete = true);
-    void emit_fragment_head(HostPairInfo *hpinfo);
-    FlowInfo *find_flow_info(Map &, HostPairInfo *, uint32_t ports, bool flipped, const Packet *);
-
-    FlowInfo *uncommon_case(FlowInfo *finfo, const click_ip *iph);
+    void delete_flowinfo(const IPFlow5ID &, const FlowInfo &);
+    FlowInfo *find_flow_info(ThreadState &, int thread, const IPFlow5ID &,
+			     bool flipped, const Packet *);
+    bool make_room(ThreadState &);
+    struct Expired;
+    void reap(ThreadState &, uint32_t n, bool force);
+    bool held(ThreadState &, const IPFlow5ID &);
+    void emit_held_head(ThreadState &, const IPFlow5ID &hosts, HeldList &);
+    void emit_held(ThreadState &, const IPFlow5ID &hosts, HeldList &,
+		   bool force);
+    void expire_held(ThreadState &, bool force);
 
     enum { ACT_EMIT, ACT_DROP, ACT_NONE };
-    int handle_fragment(Packet *, HostPairInfo *);
-    int handle_packet(Packet *);
+    int handle_fragment(ThreadState &, const IPFlow5ID &hosts, Packet *,
+			uint32_t ports);
+    int handle_packet(ThreadState &, int thread, Packet *);
 
+    enum { h_count, h_memory, h_clear };
+    static String read_handler(Element *, void *) CLICK_COLD;
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
 
 };
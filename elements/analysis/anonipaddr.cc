@@ -252,18 +252,12 @@ AnonymizeIPAddr::handle_icmp(WritablePacket *q)
 	    return;
 
 	uint32_t src = embedded_iph->ip_src.s_addr, dst = embedded_iph->ip_dst.s_addr;
+	embedded_iph->ip_src.s_addr = anonymize_addr(src);
+	embedded_iph->ip_dst.s_addr = anonymize_addr(dst);
 
-	// incrementally update IP checksum according to RFC1624:
-	// new_sum = ~(~old_sum + ~old_halfword + new_halfword)
-	uint32_t icmp_sum = (~icmph->icmp_cksum & 0xFFFF)
-	    + (~src & 0xFFFF) + (~src >> 16) + (~dst & 0xFFFF) + (~dst >> 16);
-
-	embedded_iph->ip_src.s_addr = src = anonymize_addr(src);
-	embedded_iph->ip_dst.s_addr = dst = anonymize_addr(dst);
-
-	icmp_sum += (src & 0xFFFF) + (src >> 16) + (dst & 0xFFFF) + (dst >> 16);
-	icmp_sum = (icmp_sum & 0xFFFF) + (icmp_sum >> 16);
-	icmph->icmp_cksum = ~(icmp_sum + (icmp_sum >> 16));
+	// incrementally update ICMP checksum according to RFC1624
+	click_update_in_cksum32(&icmph->icmp_cksum, src, embedded_iph->ip_src.s_addr);
+	click_update_in_cksum32(&icmph->icmp_cksum, dst, embedded_iph->ip_dst.s_addr);
 
 	// XXX ICMP-in-ICMP?
     }
@@ -279,18 +273,12 @@ AnonymizeIPAddr::simple_action(Packet *p)
     } else if (WritablePacket *q = p->uniqueify()) {
 	click_ip *iph = q->ip_header();
 	uint32_t src = iph->ip_src.s_addr, dst = iph->ip_dst.s_addr;
+	iph->ip_src.s_addr = anonymize_addr(src);
+	iph->ip_dst.s_addr = anonymize_addr(dst);
 
-	// incrementally update IP checksum according to RFC1624:
-	// new_sum = ~(~old_sum + ~old_halfword + new_halfword)
-	uint32_t sum = (~iph->ip_sum & 0xFFFF)
-	    + (~src & 0xFFFF) + (~src >> 16) + (~dst & 0xFFFF) + (~dst >> 16);
-
-	iph->ip_src.s_addr = src = anonymize_addr(src);
-	iph->ip_dst.s_addr = dst = anonymize_addr(dst);
-
-	sum += (src & 0xFFFF) + (src >> 16) + (dst & 0xFFFF) + (dst >> 16);
-	sum = (sum & 0xFFFF) + (sum >> 16);
-	iph->ip_sum = ~(sum + (sum >> 16));
+	// incrementally update IP checksum according to RFC1624
+	click_update_in_cksum32(&iph->ip_sum, src, iph->ip_src.s_addr);
+	click_update_in_cksum32(&iph->ip_sum, dst, iph->ip_dst.s_addr);
 
 	// check encapsulated headers for ICMP
 	if (iph->ip_p == IP_PROTO_ICMP)
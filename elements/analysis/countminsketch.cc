@@ -0,0 +1,234 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * countminsketch.{cc,hh} -- estimate per-key counts with a Count-Min sketch
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "countminsketch.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+CLICK_DECLS
+
+CountMinSketch::CountMinSketch()
+{
+}
+
+CountMinSketch::~CountMinSketch()
+{
+}
+
+int
+CountMinSketch::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String key;
+    uint32_t width = 8192, depth = 4;
+    bool conservative = true;
+    if (_key.configure_keywords(conf, this, errh) < 0
+	|| Args(conf, this, errh)
+	.read_mp("KEY", AnyArg(), key)
+	.read("WIDTH", width)
+	.read("DEPTH", depth)
+	.read("CONSERVATIVE", conservative)
+	.complete() < 0)
+	return -1;
+    if (width == 0 || (width & (width - 1)) != 0 || width > 0x1000000)
+	return errh->error("WIDTH must be a power of 2 no more than %u", 0x1000000U);
+    if (depth < 1 || depth > SketchKey::max_rows)
+	return errh->error("DEPTH must be between 1 and %d", (int) SketchKey::max_rows);
+    if (_key.parse(key, this, errh) < 0)
+	return -1;
+    _width = width;
+    _depth = depth;
+    _conservative = conservative;
+    return 0;
+}
+
+int
+CountMinSketch::initialize(ErrorHandler *errh)
+{
+    if (_state.resize() < 0)
+	return errh->error("out of memory");
+    for (int t = 0; t < _state.size(); ++t)
+	if (!(_state[t].counters = new uint32_t[_width * _depth]))
+	    return errh->error("out of memory");
+    reset();
+    return 0;
+}
+
+void
+CountMinSketch::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t)
+	delete[] _state[t].counters;
+    _state.clear();
+}
+
+void
+CountMinSketch::reset()
+{
+    for (int t = 0; t < _state.size(); ++t) {
+	memset(_state[t].counters, 0, sizeof(uint32_t) * _width * _depth);
+	_state[t].count = 0;
+    }
+}
+
+inline void
+CountMinSketch::update(ThreadState &ts, uint64_t key, uint32_t amount)
+{
+    uint32_t h[SketchKey::max_rows];
+    uint32_t *c[SketchKey::max_rows];
+    SketchKey::row_hashes(SketchKey::hash(key), SketchKey::row_seeds, _depth, h);
+    for (int i = 0; i < _depth; ++i)
+	c[i] = ts.counters + i * _width + (h[i] & (_width - 1));
+
+    if (_conservative) {
+	uint32_t m = *c[0];
+	for (int i = 1; i < _depth; ++i)
+	    if (*c[i] < m)
+		m = *c[i];
+	uint32_t v = (m + amount < m ? 0xFFFFFFFFU : m + amount);
+	for (int i = 0; i < _depth; ++i)
+	    if (*c[i] < v)
+		*c[i] = v;
+    } else
+	for (int i = 0; i < _depth; ++i)
+	    *c[i] = (*c[i] + amount < *c[i] ? 0xFFFFFFFFU : *c[i] + amount);
+    ts.count += amount;
+}
+
+inline Packet *
+CountMinSketch::handle_packet(Packet *p)
+{
+    uint64_t key;
+    if (_key.extract(p, key))
+	update(_state[click_current_cpu_id()], key, _key.amount(p));
+    else if (noutputs() == 2) {
+	output(1).push(p);
+	return 0;
+    }
+    return p;
+}
+
+void
+CountMinSketch::push(int, Packet *p)
+{
+    if (Packet *q = handle_packet(p))
+	output(0).push(q);
+}
+
+Packet *
+CountMinSketch::pull(int)
+{
+    Packet *p = input(0).pull();
+    if (p)
+	p = handle_packet(p);
+    return p;
+}
+
+uint64_t
+CountMinSketch::estimate(uint64_t key) const
+{
+    uint32_t h[SketchKey::max_rows];
+    SketchKey::row_hashes(SketchKey::hash(key), SketchKey::row_seeds, _depth, h);
+    uint64_t sum = 0;
+    for (int t = 0; t < _state.size(); ++t) {
+	const uint32_t *counters = _state[t].counters;
+	uint32_t m = 0xFFFFFFFFU;
+	for (int i = 0; i < _depth; ++i) {
+	    uint32_t c = counters[i * _width + (h[i] & (_width - 1))];
+	    if (c < m)
+		m = c;
+	}
+	sum += m;
+    }
+    return sum;
+}
+
+void
+CountMinSketch::merge_state(Element *e, ErrorHandler *errh)
+{
+    CountMinSketch *o = static_cast<CountMinSketch *>(e->cast("CountMinSketch"));
+    if (!o || o->_width != _width || o->_depth != _depth
+	|| o->_state.size() != _state.size()) {
+	errh->warning("sketch sizes differ, not merged");
+	return;
+    }
+    // adding sketches gives the sketch of the combined stream
+    uint32_t n = _width * _depth;
+    for (int t = 0; t < _state.size(); ++t) {
+	uint32_t *c = _state[t].counters;
+	const uint32_t *oc = o->_state[t].counters;
+	for (uint32_t i = 0; i < n; ++i)
+	    c[i] = (c[i] + oc[i] < c[i] ? 0xFFFFFFFFU : c[i] + oc[i]);
+	_state[t].count += o->_state[t].count;
+    }
+}
+
+String
+CountMinSketch::read_handler(Element *e, void *thunk)
+{
+    CountMinSketch *cms = static_cast<CountMinSketch *>(e);
+    switch ((intptr_t) thunk) {
+    case h_count: {
+	uint64_t count = 0;
+	for (int t = 0; t < cms->_state.size(); ++t)
+	    count += cms->_state[t].count;
+	return String(count);
+    }
+    case h_key:
+	return cms->_key.unparse(e);
+    case h_width:
+	return String(cms->_width);
+    case h_depth:
+	return String(cms->_depth);
+    case h_memory:
+	return String((uint64_t) cms->_state.size() * cms->_width * cms->_depth * sizeof(uint32_t));
+    default:
+	return "<error>";
+    }
+}
+
+int
+CountMinSketch::estimate_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh)
+{
+    CountMinSketch *cms = static_cast<CountMinSketch *>(e);
+    uint64_t key;
+    if (!cms->_key.parse_key(s.trim_space(), key, e))
+	return errh->error("expected key");
+    s = String(cms->estimate(key));
+    return 0;
+}
+
+int
+CountMinSketch::reset_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    static_cast<CountMinSketch *>(e)->reset();
+    return 0;
+}
+
+void
+CountMinSketch::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("key", read_handler, h_key);
+    add_read_handler("width", read_handler, h_width);
+    add_read_handler("depth", read_handler, h_depth);
+    add_read_handler("memory", read_handler, h_memory);
+    set_handler("estimate", Handler::f_read | Handler::f_read_param, estimate_handler);
+    add_write_handler("reset", reset_handler, 0, Handler::f_button);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel SketchKey)
+EXPORT_ELEMENT(CountMinSketch)
+ELEMENT_MT_SAFE(CountMinSketch)
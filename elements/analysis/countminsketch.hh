@@ -0,0 +1,179 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_COUNTMINSKETCH_HH
+#define CLICK_COUNTMINSKETCH_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include "sketchkey.hh"
+CLICK_DECLS
+
+/*
+=c
+
+CountMinSketch(KEY, [I<KEYWORDS>])
+
+=s aggregates
+
+estimates per-key packet or byte counts in fixed memory
+
+=d
+
+CountMinSketch estimates how many packets or bytes it has seen for each
+value of a key, using a Count-Min sketch: DEPTH rows of WIDTH counters, each
+row indexed by a different hash of the key. Unlike AggregateCounter, its
+memory does not grow with the number of keys. A key's estimate is the
+smallest of its DEPTH counters. It is never less than the true count, and
+exceeds it by at most about e/WIDTH of the total count, with probability at
+least 1 - e^-DEPTH.
+
+KEY says what to count by. It is either an annotation, written C<"anno
+NAME">, or a packet field as accepted by AggregateIP, such as C<"ip src">,
+C<"ip dst/24">, or C<"tcp dport">. Annotations of 1, 2, 4, or 8 bytes are
+read in host byte order; fields may be up to 64 bits long.
+
+Each thread updates its own sketch, and handlers add the threads'
+estimates. Row hashes are computed four at a time
+with SSE2 where available.
+
+CountMinSketch may have one or two outputs. Packets lacking the key, for
+instance because they are too short, are emitted on the second output if
+there is one, and otherwise passed through uncounted.
+
+Keyword arguments are:
+
+=over 8
+
+=item WIDTH
+
+Unsigned. Number of counters per row; must be a power of 2 no more than
+2^24. Default is 8192.
+
+=item DEPTH
+
+Unsigned. Number of rows, between 1 and 16. Default is 4.
+
+=item CONSERVATIVE
+
+Boolean. If true, use conservative update: raise each of a key's counters
+only as far as its new estimate, rather than adding to all of them. This
+gives the same guarantee with much smaller overestimates. Default is true.
+
+=item BYTES
+
+Boolean. If true, then count bytes, not packets. Default is false.
+
+=item IP_BYTES
+
+Boolean. If true, then do not count bytes from the link header. Default is
+false.
+
+=item MULTIPACKET
+
+Boolean. If true, and BYTES is false, then use packets' packet count
+annotations to add to the number of packets seen. Default is true.
+
+=item EXTRA_LENGTH
+
+Boolean. If true, and BYTES is true, then include packets' extra length
+annotations in the byte counts. Default is true.
+
+=back
+
+=n
+
+Counters are 32 bits wide and saturate rather than wrap.
+
+In parallel trace mode (see click(1)), the sketches of all copies are added
+together when the driver stops.
+
+=h count read-only
+
+Returns the total number of packets or bytes counted.
+
+=h estimate "read with parameters"
+
+Takes a key, such as an IP address for C<"ip src"> keys, and returns its
+estimated count.
+
+=h key read-only
+
+Returns the KEY specification.
+
+=h width read-only
+
+Returns WIDTH.
+
+=h depth read-only
+
+Returns DEPTH.
+
+=h memory read-only
+
+Returns the number of bytes of counters, over all threads.
+
+=h reset write-only
+
+Resets all counters to zero.
+
+=e
+
+Estimate how many bytes each source address sent:
+
+  FromDump(trace.pcap, STOP true, FORCE_IP true)
+    -> cms :: CountMinSketch(ip src, BYTES true)
+    -> Discard;
+
+and then read C<cms.estimate 10.0.0.1>.
+
+=a
+
+SpaceSaving, HyperLogLog, AggregateCounter, AggregateIP */
+
+class CountMinSketch : public Element { public:
+
+    CountMinSketch() CLICK_COLD;
+    ~CountMinSketch() CLICK_COLD;
+
+    const char *class_name() const	{ return "CountMinSketch"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+    Packet *pull(int);
+
+    uint64_t estimate(uint64_t key) const;
+    void reset();
+
+  private:
+
+    struct ThreadState {
+	uint32_t *counters;	// DEPTH rows of WIDTH counters
+	uint64_t count;
+	ThreadState()
+	    : counters(0), count(0) {
+	}
+    };
+
+    PerThread<ThreadState> _state;
+    uint32_t _width;
+    int _depth;
+    bool _conservative;
+    SketchKey _key;
+
+    inline void update(ThreadState &ts, uint64_t key, uint32_t amount);
+    inline Packet *handle_packet(Packet *);
+
+    enum { h_count, h_key, h_width, h_depth, h_memory };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int estimate_handler(int, String &, Element *, const Handler *, ErrorHandler *);
+    static int reset_handler(const String &, Element *, void *, ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,555 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * flowexporter.{cc,hh} -- element exports IPFIX or NetFlow v9 flow records
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "flowexporter.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+CLICK_DECLS
+
+// Information element IDs. NetFlow v9 field types share these numbers.
+enum {
+    ie_octets = 1, ie_packets = 2, ie_proto = 4, ie_tos = 5,
+    ie_tcp_flags = 6, ie_sport = 7, ie_saddr = 8, ie_dport = 11,
+    ie_daddr = 12, ie_last_switched = 21, ie_first_switched = 22,
+    ie_sampling_interval = 34, ie_end_reason = 136,
+    ie_start_msec = 152, ie_end_msec = 153
+};
+
+static inline uint8_t *
+put16(uint8_t *x, uint16_t v)
+{
+    x[0] = v >> 8;
+    x[1] = v;
+    return x + 2;
+}
+
+static inline uint8_t *
+put32(uint8_t *x, uint32_t v)
+{
+    x[0] = v >> 24;
+    x[1] = v >> 16;
+    x[2] = v >> 8;
+    x[3] = v;
+    return x + 4;
+}
+
+static inline uint8_t *
+put64(uint8_t *x, uint64_t v)
+{
+    put32(x, v >> 32);
+    return put32(x + 4, v);
+}
+
+FlowExporter::FlowExporter()
+    : _scan_timer(scan_timer_hook, this), _f(0)
+{
+}
+
+FlowExporter::~FlowExporter()
+{
+}
+
+int
+FlowExporter::field_length(uint16_t id)
+{
+    switch (id) {
+    case ie_proto:
+    case ie_tos:
+    case ie_tcp_flags:
+    case ie_end_reason:
+	return 1;
+    case ie_sport:
+    case ie_dport:
+	return 2;
+    case ie_saddr:
+    case ie_daddr:
+    case ie_last_switched:
+    case ie_first_switched:
+    case ie_sampling_interval:
+	return 4;
+    default:
+	return 8;
+    }
+}
+
+int
+FlowExporter::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _version = 10;
+    _filename = String();
+    _domain = 0;
+    _sample = 1;
+    _mtu = 1400;
+    _capacity = 65536;
+    uint32_t active = 60, inactive = 15, template_interval = 60;
+    if (Args(conf, this, errh)
+	.read("VERSION", _version)
+	.read("FILENAME", FilenameArg(), _filename)
+	.read("DOMAIN", _domain)
+	.read("SAMPLE", _sample)
+	.read("ACTIVE_TIMEOUT", SecondsArg(), active)
+	.read("INACTIVE_TIMEOUT", SecondsArg(), inactive)
+	.read("TEMPLATE_INTERVAL", SecondsArg(), template_interval)
+	.read("MTU", _mtu)
+	.read("CAPACITY", _capacity)
+	.complete() < 0)
+	return -1;
+    if (_version != 9 && _version != 10)
+	return errh->error("VERSION must be 9 or 10");
+    if (_sample == 0)
+	return errh->error("SAMPLE must be positive");
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    _active_timeout = Timestamp(active);
+    _inactive_timeout = Timestamp(inactive);
+    _template_interval = Timestamp(template_interval);
+
+    static const uint16_t common[] = {
+	ie_saddr, ie_daddr, ie_sport, ie_dport, ie_proto, ie_tos,
+	ie_tcp_flags, ie_packets, ie_octets
+    };
+    _fields.clear();
+    for (size_t i = 0; i < sizeof(common) / sizeof(common[0]); ++i)
+	_fields.push_back(common[i]);
+    if (_version == 10) {
+	_fields.push_back(ie_start_msec);
+	_fields.push_back(ie_end_msec);
+	_fields.push_back(ie_end_reason);
+    } else {
+	_fields.push_back(ie_first_switched);
+	_fields.push_back(ie_last_switched);
+    }
+    if (_sample > 1)
+	_fields.push_back(ie_sampling_interval);
+    _record_length = 0;
+    for (int i = 0; i < _fields.size(); ++i)
+	_record_length += field_length(_fields[i]);
+
+    // header, template set, data set header, one record, padding
+    uint32_t min_mtu = (_version == 10 ? 16 : 20) + 8 + 4 * _fields.size()
+	+ 4 + _record_length + 3;
+    if (_mtu < min_mtu || _mtu > 65535)
+	return errh->error("MTU must be between %u and 65535", min_mtu);
+    return 0;
+}
+
+int
+FlowExporter::initialize(ErrorHandler *errh)
+{
+    if (_filename == "-")
+	_f = stdout;
+    else if (_filename && !(_f = fopen(_filename.c_str(), "wb")))
+	return errh->error("%s: %s", _filename.c_str(), strerror(errno));
+
+    int n = click_max_cpu_ids();
+    if (_tables.reserve(_capacity, n) < 0 || _state.resize(n) < 0)
+	return errh->error("out of memory");
+    for (int t = 0; t < n; ++t) {
+	_state[t].exporter = this;
+	_state[t].thread = t;
+	_state[t].scan_task = new Task(scan_task_hook, &_state[t]);
+	_state[t].scan_task->initialize(this, false);
+	if (n > 1)
+	    _state[t].scan_task->move_thread(t);
+    }
+    _sequence = 0;
+    _scan_timer.initialize(this);
+    _scan_timer.schedule_after_sec(1);
+    return 0;
+}
+
+void
+FlowExporter::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t) {
+	delete _state[t].scan_task;
+	if (_state[t].msg)
+	    _state[t].msg->kill();
+    }
+    _state.clear();
+    if (_f && _f != stdout)
+	fclose(_f);
+    _f = 0;
+}
+
+uint8_t
+FlowExporter::expired(const Flow &flow, const Timestamp &now) const
+{
+    if (flow.end)
+	return flow.end;
+    else if (now - flow.last >= _inactive_timeout)
+	return r_idle;
+    else if (now - flow.first >= _active_timeout)
+	return r_active;
+    else
+	return 0;
+}
+
+void
+FlowExporter::add_template(ThreadState &ts)
+{
+    uint8_t *x = ts.msg->data() + ts.msg_length;
+    x = put16(x, _version == 10 ? 2 : 0);
+    x = put16(x, 8 + 4 * _fields.size());
+    x = put16(x, template_id);
+    x = put16(x, _fields.size());
+    for (int i = 0; i < _fields.size(); ++i) {
+	x = put16(x, _fields[i]);
+	x = put16(x, field_length(_fields[i]));
+    }
+    ts.msg_length = x - ts.msg->data();
+    ts.msg_templates = 1;
+    ts.template_sent = ts.clock;
+}
+
+bool
+FlowExporter::start_message(ThreadState &ts)
+{
+    if (!(ts.msg = Packet::make(Packet::default_headroom, 0, _mtu, 0)))
+	return false;
+    ts.msg_length = _version == 10 ? 16 : 20;
+    ts.msg_records = ts.msg_templates = 0;
+    if (!ts.template_sent || ts.clock - ts.template_sent >= _template_interval)
+	add_template(ts);
+    ts.set_offset = ts.msg_length;
+    ts.msg_length += 4;
+    return true;
+}
+
+void
+FlowExporter::finish_message(ThreadState &ts)
+{
+    WritablePacket *q = ts.msg;
+    if (!q)
+	return;
+    ts.msg = 0;
+    if (ts.msg_records) {
+	// Pad the data set to a 4-byte boundary.
+	while ((ts.msg_length - ts.set_offset) & 3)
+	    q->data()[ts.msg_length++] = 0;
+	uint8_t *x = q->data() + ts.set_offset;
+	x = put16(x, template_id);
+	put16(x, ts.msg_length - ts.set_offset);
+    } else if (ts.msg_templates)
+	ts.msg_length = ts.set_offset;
+    else {
+	q->kill();
+	return;
+    }
+
+    uint8_t *x = q->data();
+    if (_version == 10) {
+	x = put16(x, 10);
+	x = put16(x, ts.msg_length);
+	x = put32(x, ts.clock.sec());
+	x = put32(x, _sequence.fetch_and_add(ts.msg_records));
+    } else {
+	x = put16(x, 9);
+	x = put16(x, ts.msg_records + ts.msg_templates);
+	x = put32(x, (ts.clock - ts.boot).msecval());
+	x = put32(x, ts.clock.sec());
+	x = put32(x, _sequence.fetch_and_add(1));
+    }
+    put32(x, _domain);
+    q->take(_mtu - ts.msg_length);
+    q->set_timestamp_anno(ts.clock);
+    ++ts.messages;
+
+    if (_f) {
+	_file_lock.acquire();
+	ignore_result(fwrite(q->data(), 1, q->length(), _f));
+	fflush(_f);
+	_file_lock.release();
+    }
+    checked_output_push(1, q);
+}
+
+void
+FlowExporter::export_flow(ThreadState &ts, const IPFlow5ID &flowid,
+			  const Flow &flow, uint8_t reason)
+{
+    // leave room for the data set's padding
+    if (ts.msg && ts.msg_length + _record_length + 3 > _mtu)
+	finish_message(ts);
+    if (!ts.msg && !start_message(ts))
+	return;
+
+    uint8_t *x = ts.msg->data() + ts.msg_length;
+    for (int i = 0; i < _fields.size(); ++i)
+	switch (_fields[i]) {
+	case ie_saddr:
+	    x = put32(x, ntohl(flowid.saddr().addr()));
+	    break;
+	case ie_daddr:
+	    x = put32(x, ntohl(flowid.daddr().addr()));
+	    break;
+	case ie_sport:
+	    x = put16(x, ntohs(flowid.sport()));
+	    break;
+	case ie_dport:
+	    x = put16(x, ntohs(flowid.dport()));
+	    break;
+	case ie_proto:
+	    *x++ = flowid.proto();
+	    break;
+	case ie_tos:
+	    *x++ = flow.tos;
+	    break;
+	case ie_tcp_flags:
+	    *x++ = flow.tcp_flags;
+	    break;
+	case ie_packets:
+	    x = put64(x, flow.packets);
+	    break;
+	case ie_octets:
+	    x = put64(x, flow.bytes);
+	    break;
+	case ie_start_msec:
+	    x = put64(x, flow.first.msecval());
+	    break;
+	case ie_end_msec:
+	    x = put64(x, flow.last.msecval());
+	    break;
+	case ie_first_switched:
+	    x = put32(x, (flow.first - ts.boot).msecval());
+	    break;
+	case ie_last_switched:
+	    x = put32(x, (flow.last - ts.boot).msecval());
+	    break;
+	case ie_end_reason:
+	    *x++ = reason;
+	    break;
+	case ie_sampling_interval:
+	    x = put32(x, _sample);
+	    break;
+	}
+    ts.msg_length += _record_length;
+    ++ts.msg_records;
+    ++ts.flows;
+}
+
+struct FlowExporter::Expired {
+    FlowExporter *fe;
+    ThreadState &ts;
+    bool force;
+    Expired(FlowExporter *fe_, ThreadState &ts_, bool force_)
+	: fe(fe_), ts(ts_), force(force_) {
+    }
+    bool operator()(const IPFlow5ID &flowid, Flow &f) const {
+	uint8_t reason = fe->expired(f, ts.clock);
+	if (!reason && force)
+	    reason = r_forced;
+	if (reason)
+	    fe->export_flow(ts, flowid, f, reason);
+	return reason;
+    }
+};
+
+void
+FlowExporter::reap(Table &table, ThreadState &ts)
+{
+    table.reap_step(ts.reap_cursor, reap_batch, Expired(this, ts, false));
+}
+
+bool
+FlowExporter::scan(Table &table, ThreadState &ts, uint32_t n, bool force)
+{
+    // Stop at the end of the table, so the caller knows a pass is done.
+    if (n > table.index_limit() - ts.scan_cursor)
+	n = table.index_limit() - ts.scan_cursor;
+    return table.reap_step(ts.scan_cursor, n, Expired(this, ts, force));
+}
+
+void
+FlowExporter::flush(ThreadState &ts)
+{
+    Table &table = _tables[ts.thread];
+    ts.scan_cursor = 0;
+    scan(table, ts, table.index_limit(), true);
+    finish_message(ts);
+}
+
+Packet *
+FlowExporter::simple_action(Packet *p)
+{
+    int thread = click_current_cpu_id();
+    ThreadState &ts = _state[thread];
+    const click_ip *iph = p->ip_header();
+    if (!p->has_network_header() || p->network_header_offset() < 0
+	|| p->network_length() < (int) sizeof(click_ip) || iph->ip_v != 4)
+	return p;
+    ++ts.packets;
+    if (_sample > 1) {
+	if (++ts.sample_count < _sample)
+	    return p;
+	ts.sample_count = 0;
+    }
+    ++ts.sampled;
+
+    if (!p->timestamp_anno())
+	p->timestamp_anno().assign_now();
+    const Timestamp &now = p->timestamp_anno();
+    if (now > ts.clock)
+	ts.clock = now;
+    if (!ts.boot)
+	ts.boot = now;
+
+    Table &table = _tables[thread];
+    reap(table, ts);
+
+    bool inserted;
+    IPFlow5ID flowid(p);
+    Flow *f = table.find_insert(flowid, inserted);
+    if (!f) {
+	++ts.failed;
+	return p;
+    }
+    uint8_t reason;
+    if (!inserted && (reason = expired(*f, now))) {
+	export_flow(ts, flowid, *f, reason);
+	inserted = true;
+    }
+    if (inserted) {
+	*f = Flow();
+	f->first = now;
+	f->tos = iph->ip_tos;
+    }
+    f->last = now;
+    ++f->packets;
+    f->bytes += ntohs(iph->ip_len);
+    if (iph->ip_p == IP_PROTO_TCP && IP_FIRSTFRAG(iph)
+	&& p->transport_length() >= 14) {
+	uint8_t flags = p->tcp_header()->th_flags;
+	f->tcp_flags |= flags;
+	if (flags & (TH_FIN | TH_RST))
+	    f->end = r_end;
+    }
+    return p;
+}
+
+void
+FlowExporter::scan_timer_hook(Timer *t, void *user_data)
+{
+    FlowExporter *fe = static_cast<FlowExporter *>(user_data);
+    for (int i = 0; i < fe->_state.size(); ++i)
+	fe->_state[i].scan_task->reschedule();
+    t->reschedule_after_sec(1);
+}
+
+bool
+FlowExporter::scan_task_hook(Task *task, void *user_data)
+{
+    ThreadState *ts = static_cast<ThreadState *>(user_data);
+    FlowExporter *fe = ts->exporter;
+    if (ts->flush_pending && ts->flush_pending.swap(0)) {
+	fe->flush(*ts);
+	return true;
+    }
+    if (ts->scan_cursor == 0) {
+	// If no packets arrived since the last pass, advance the clock by
+	// wall time, so idle flows expire.
+	Timestamp wall = Timestamp::now();
+	if (ts->clock && ts->clock == ts->scan_clock)
+	    ts->clock += wall - ts->scan_wall;
+	ts->scan_clock = ts->clock;
+	ts->scan_wall = wall;
+    }
+    // Scan in batches so a large table doesn't stall the thread.
+    if (!fe->scan(fe->_tables[ts->thread], *ts, scan_batch, false))
+	task->fast_reschedule();
+    else
+	fe->finish_message(*ts);
+    return true;
+}
+
+String
+FlowExporter::read_handler(Element *e, void *thunk)
+{
+    FlowExporter *fe = static_cast<FlowExporter *>(e);
+    int n = fe->_state.size();
+    uint64_t ThreadState::*counter;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	return String(fe->_tables.size());
+    case h_memory:
+	return String(fe->_tables.memory_size());
+    case h_packets:
+	counter = &ThreadState::packets;
+	break;
+    case h_sampled:
+	counter = &ThreadState::sampled;
+	break;
+    case h_flows:
+	counter = &ThreadState::flows;
+	break;
+    case h_messages:
+	counter = &ThreadState::messages;
+	break;
+    case h_failed:
+	counter = &ThreadState::failed;
+	break;
+    default:
+	return String();
+    }
+    uint64_t x = 0;
+    for (int i = 0; i < n; ++i)
+	x += fe->_state[i].*counter;
+    return String(x);
+}
+
+int
+FlowExporter::write_handler(const String &, Element *e, void *thunk,
+			    ErrorHandler *)
+{
+    FlowExporter *fe = static_cast<FlowExporter *>(e);
+    switch ((intptr_t) thunk) {
+    case h_flush:
+	// Only a thread may touch its own flows: flush this thread's now,
+	// and leave the others' to their scan tasks.
+	for (int t = 0; t < fe->_state.size(); ++t) {
+	    ThreadState &ts = fe->_state[t];
+	    if (t == (int) click_current_cpu_id())
+		fe->flush(ts);
+	    else {
+		ts.flush_pending = 1;
+		ts.scan_task->reschedule();
+	    }
+	}
+	return 0;
+    default:
+	return -1;
+    }
+}
+
+void
+FlowExporter::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("packets", read_handler, h_packets);
+    add_read_handler("sampled", read_handler, h_sampled);
+    add_read_handler("flows", read_handler, h_flows);
+    add_read_handler("messages", read_handler, h_messages);
+    add_read_handler("failed", read_handler, h_failed);
+    add_read_handler("memory", read_handler, h_memory);
+    add_write_handler("flush", write_handler, h_flush);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(FlowExporter)
+ELEMENT_MT_SAFE(FlowExporter)
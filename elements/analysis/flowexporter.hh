@@ -0,0 +1,264 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_FLOWEXPORTER_HH
+#define CLICK_FLOWEXPORTER_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+#include <click/atomic.hh>
+#include <click/sync.hh>
+#include <click/timer.hh>
+#include <click/task.hh>
+CLICK_DECLS
+
+/*
+=c
+
+FlowExporter([I<keywords> VERSION, FILENAME, SAMPLE, ACTIVE_TIMEOUT, INACTIVE_TIMEOUT, ...])
+
+=s analysis
+
+exports IPFIX or NetFlow v9 flow records
+
+=d
+
+FlowExporter measures the IPv4 flows passing through it and exports a flow
+record for each, in IPFIX (RFC 7011) or NetFlow version 9 (RFC 3954)
+format. Packets pass from input 0 to output 0 unchanged.
+
+A flow is a 5-tuple. Its record holds its addresses, ports and protocol,
+the type of service and TCP flags seen, its packet and byte counts, the
+timestamps of its first and last packets, and, for IPFIX, why it ended.
+Byte counts are IP lengths. A flow is exported when no packet has arrived
+for INACTIVE_TIMEOUT, when ACTIVE_TIMEOUT has passed since its first packet,
+or soon after a TCP FIN or RST. A flow that continues after an active
+timeout is exported again as a new flow.
+
+Records are packed into export messages of at most MTU bytes. A message
+leaves on output 1, if it exists, as a packet holding just the message:
+send it to a collector with UDPIPEncap and a Socket, or a ToDevice. If
+FILENAME is given, each message is also appended to that file; a file of
+IPFIX messages is an IPFIX file (RFC 5655). Each thread sends its template
+with its first message and then every TEMPLATE_INTERVAL, as exporting over
+UDP requires.
+
+FlowExporter measures time by packet timestamps, so traces are measured in
+trace time. Packets without timestamps are stamped with the current time.
+When no packets arrive, time advances with the wall clock, so idle flows
+are still exported. Header export times are measured the same way, and
+NetFlow v9 uptimes count from the first packet.
+
+If SAMPLE is greater than 1, FlowExporter measures only every SAMPLE-th
+packet, and each record carries the sampling interval; counts are not
+scaled. Unsampled packets pass through without touching the flow table.
+
+Each thread measures its own flows and builds its own messages, so each flow
+should be handled by a single thread, as with RSS (see RSSSwitch). A thread
+expires a few flows per measured packet, and a task on each thread scans its
+whole table every second. Once a thread is measuring CAPACITY flows, new
+flows are not measured; the failed handler counts their packets.
+
+Packets must have their IP header annotations set. Non-IPv4 packets pass
+through unmeasured.
+
+Keywords are:
+
+=over 8
+
+=item VERSION
+
+Either 10, for IPFIX, or 9, for NetFlow v9. Default is 10.
+
+=item FILENAME
+
+String. File to which messages are appended. C<-> means standard output.
+
+=item DOMAIN
+
+Unsigned integer. The observation domain (IPFIX) or source ID (NetFlow v9)
+in message headers. Default is 0.
+
+=item SAMPLE
+
+Unsigned integer. Sampling interval. Default is 1, meaning every packet is
+measured.
+
+=item ACTIVE_TIMEOUT
+
+Time in seconds. Default is 60 seconds.
+
+=item INACTIVE_TIMEOUT
+
+Time in seconds. Default is 15 seconds.
+
+=item TEMPLATE_INTERVAL
+
+Time in seconds. Default is 60 seconds.
+
+=item MTU
+
+Unsigned integer. Maximum message length. Default is 1400.
+
+=item CAPACITY
+
+Unsigned integer. Number of flows each thread can track. Default is 65536.
+
+=back
+
+=h count read-only
+
+Returns the number of flows in all tables.
+
+=h packets read-only
+
+Returns the number of IPv4 packets seen. The sampled handler returns the
+number measured.
+
+=h flows read-only
+
+Returns the number of flow records exported.
+
+=h messages read-only
+
+Returns the number of messages exported.
+
+=h failed read-only
+
+Returns the number of sampled packets not measured because a table was
+full.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the flow tables.
+
+=h flush write-only
+
+Exports every flow, ending it. Each thread's flows are exported by that
+thread: those of the thread calling the handler immediately, and those of
+other threads by their scan tasks, shortly afterwards.
+
+=e
+
+  FromDevice(eth0, SNAPLEN 64)
+    -> Strip(14) -> CheckIPHeader
+    -> fe :: FlowExporter(SAMPLE 16)
+    -> Discard;
+  fe[1] -> UDPIPEncap(10.0.0.1, 4739, 10.0.0.2, 4739)
+    -> EtherEncap(0x0800, 0:1:2:3:4:5, 6:7:8:9:a:b)
+    -> ToDevice(eth1);
+
+=a AggregateIPFlows, ToIPFlowDumps, ToIPSummaryDump, UDPIPEncap, Socket */
+
+class FlowExporter : public Element { public:
+
+    FlowExporter() CLICK_COLD;
+    ~FlowExporter() CLICK_COLD;
+
+    const char *class_name() const	{ return "FlowExporter"; }
+    const char *port_count() const	{ return "1/1-2"; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+    const char *flow_code() const	{ return "x/xy"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    Packet *simple_action(Packet *);
+
+  private:
+
+    enum {
+	r_idle = 1, r_active = 2, r_end = 3, r_forced = 4	// flowEndReason
+    };
+
+    struct Flow {
+	Timestamp first;
+	Timestamp last;
+	uint64_t packets;
+	uint64_t bytes;
+	uint8_t tos;
+	uint8_t tcp_flags;
+	uint8_t end;		// flowEndReason if ended by FIN or RST
+	Flow()
+	    : packets(0), bytes(0), tos(0), tcp_flags(0), end(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Flow> Table;
+
+    struct ThreadState {
+	FlowExporter *exporter;
+	int thread;
+	Task *scan_task;
+	WritablePacket *msg;	// message being built
+	uint32_t msg_length;
+	uint32_t set_offset;	// offset of the data set header
+	uint32_t msg_records;	// data records in msg
+	uint32_t msg_templates;
+	Timestamp clock;	// latest packet timestamp
+	Timestamp scan_clock;	// clock and wall time at the last scan
+	Timestamp scan_wall;
+	Timestamp boot;		// first packet timestamp (NetFlow v9 uptime)
+	Timestamp template_sent;
+	uint32_t reap_cursor;
+	uint32_t scan_cursor;
+	uint32_t sample_count;
+	uint64_t packets;
+	uint64_t sampled;
+	uint64_t flows;
+	uint64_t messages;
+	uint64_t failed;
+	atomic_uint32_t flush_pending;	// set by the flush handler
+	ThreadState()
+	    : exporter(0), thread(0), scan_task(0), msg(0), msg_length(0),
+	      set_offset(0), msg_records(0), msg_templates(0), reap_cursor(0),
+	      scan_cursor(0), sample_count(0), packets(0), sampled(0),
+	      flows(0), messages(0), failed(0) {
+	    flush_pending = 0;
+	}
+    };
+
+    enum { reap_batch = 8, scan_batch = 4096, template_id = 256 };
+
+    PerThreadCuckooTable<IPFlow5ID, Flow> _tables;
+    PerThread<ThreadState> _state;
+    Timer _scan_timer;
+    Vector<uint16_t> _fields;	// information element IDs
+    uint32_t _record_length;
+    uint32_t _capacity;
+    uint32_t _sample;
+    uint32_t _domain;
+    uint32_t _mtu;
+    Timestamp _active_timeout;
+    Timestamp _inactive_timeout;
+    Timestamp _template_interval;
+    atomic_uint32_t _sequence;	// data records (IPFIX) or messages (v9)
+    int _version;
+    String _filename;
+    FILE *_f;
+    Spinlock _file_lock;
+
+    static int field_length(uint16_t id);
+    uint8_t expired(const Flow &flow, const Timestamp &now) const;
+    void export_flow(ThreadState &ts, const IPFlow5ID &flowid,
+		     const Flow &flow, uint8_t reason);
+    bool start_message(ThreadState &ts);
+    void add_template(ThreadState &ts);
+    void finish_message(ThreadState &ts);
+    struct Expired;
+    void reap(Table &table, ThreadState &ts);
+    bool scan(Table &table, ThreadState &ts, uint32_t n, bool force);
+    void flush(ThreadState &ts);
+
+    static void scan_timer_hook(Timer *, void *);
+    static bool scan_task_hook(Task *, void *);
+
+    enum { h_count, h_packets, h_sampled, h_flows, h_messages, h_failed,
+	   h_memory, h_flush };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
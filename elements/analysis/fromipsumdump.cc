@@ -37,6 +37,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if CLICK_USERLEVEL && defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 CLICK_DECLS
 
 #ifdef i386
@@ -48,8 +51,33 @@ CLICK_DECLS
 #endif
 #define GET1(p)		((p)[0])
 
+// Return the first whitespace, control or quote character in [s, end).
+static inline const char *
+find_delimiter(const char *s, const char *end)
+{
+#if CLICK_USERLEVEL && defined(__SSE2__)
+    // bytes <= ' ', compared as signed after flipping the top bit
+    const __m128i flip = _mm_set1_epi8((char) 0x80),
+	limit = _mm_set1_epi8((char) (0x80 + ' ' + 1)),
+	quote = _mm_set1_epi8('\"');
+    for (; s + 16 <= end; s += 16) {
+	__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+	__m128i m = _mm_or_si128(_mm_cmplt_epi8(_mm_xor_si128(x, flip), limit),
+				 _mm_cmpeq_epi8(x, quote));
+	if (int mask = _mm_movemask_epi8(m))
+	    return s + __builtin_ctz(mask);
+    }
+#endif
+    for (; s != end; ++s)
+	if ((unsigned char) *s <= ' ' || *s == '\"')
+	    break;
+    return s;
+}
+
 FromIPSummaryDump::FromIPSummaryDump()
-    : _work_packet(0), _task(this), _timer(this)
+    : _work_packet(0), _task(this), _timer(this), _chunk_pos(0), _chunk_n(0),
+      _index_begun(false), _record_pos(0), _data_start(0), _partition(0),
+      _feed(0), _feed_packet(0), _feed_more(true)
 {
     _ff.set_landmark_pattern("%f:%l");
 }
@@ -73,8 +101,11 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     bool stop = false, active = true, zero = true, checksum = false, multipacket = false, timing = false, allow_nonexistent = false;
     uint8_t default_proto = IP_PROTO_TCP;
     _sampling_prob = (1 << SAMPLING_SHIFT);
-    String default_contents, default_flowid, data;
+    _burst = 1;
+    String default_contents, default_flowid, data, select;
 
+    if (_index.configure_keywords(conf, this, errh) < 0)
+	return -1;
     if (Args(conf, this, errh)
 	.read_p("FILENAME", FilenameArg(), _ff.filename())
 	.read("STOP", stop)
@@ -83,6 +114,7 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("TIMING", timing)
 	.read("CHECKSUM", checksum)
 	.read("SAMPLE", FixedPointArg(SAMPLING_SHIFT), _sampling_prob)
+	.read("BURST", _burst)
 	.read("PROTO", default_proto)
 	.read("MULTIPACKET", multipacket)
 	.read("DEFAULT_CONTENTS", AnyArg(), default_contents)
@@ -91,6 +123,9 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("CONTENTS", AnyArg(), default_contents)
 	.read("FIELDS", AnyArg(), default_contents)
 	.read("FLOWID", AnyArg(), default_flowid)
+	.read("SELECT", AnyArg(), select)
+	.read("START", _start)
+	.read("END", _end)
 	.read("ALLOW_NONEXISTENT", allow_nonexistent)
         .read("DATA", data)
 	.complete() < 0)
@@ -100,6 +135,8 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	_sampling_prob = (1 << SAMPLING_SHIFT);
     } else if (_sampling_prob == 0)
 	errh->warning("SAMPLE probability is 0; emitting no packets");
+    if (_burst == 0)
+	return errh->error("BURST must be positive");
 
     _default_proto = default_proto;
     _stop = stop;
@@ -110,7 +147,11 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     _allow_nonexistent = allow_nonexistent;
     _have_timing = false;
     _multipacket = multipacket;
-    _have_flowid = _have_aggregate = _binary = false;
+    _have_flowid = _have_aggregate = _binary = _columnar = false;
+    _index_checked = false;
+    cp_spacevec(select, _select);
+    for (String *w = _select.begin(); w != _select.end(); ++w)
+	*w = cp_unquote(*w);
     if (default_contents)
 	bang_data(default_contents, errh);
     if (default_flowid)
@@ -161,12 +202,29 @@ FromIPSummaryDump::initialize(ErrorHandler *errh)
     _format_complaint = false;
     if (output_is_push(0))
 	ScheduleInfo::initialize_task(this, &_task, _active, errh);
+    _partition = router()->trace_partition();
+
+    // in a parallel trace, the first copy reads the file for all copies
+    if (_partition && (_feed = _partition->feed(name()))) {
+	FromIPSummaryDump *fd;
+	if (_partition->index() == 0)
+	    _feed->set_source(this, output_is_push(0) ? &_task : 0);
+	else if (_feed->source()
+		 && (fd = static_cast<FromIPSummaryDump *>(_feed->source()->cast("FromIPSummaryDump")))
+		 && fd->_ff.filename() == _ff.filename()) {
+	    _feed->attach(_partition->index(), output_is_push(0) ? &_task : 0);
+	    return 0;
+	} else
+	    _feed = 0;
+    }
 
     int e = _ff.initialize(errh, _allow_nonexistent);
     if (e == -ENOENT && _allow_nonexistent)
 	return 0;
     else if (e < 0)
 	return e;
+    if (_index.initialize(_ff.filename(), errh) < 0)
+	return -1;
 
     _minor_version = IPSummaryDump::MINOR_VERSION; // expected minor version
     String line;
@@ -199,10 +257,16 @@ FromIPSummaryDump::initialize(ErrorHandler *errh)
 void
 FromIPSummaryDump::cleanup(CleanupStage)
 {
+    _index.cleanup(ErrorHandler::default_handler());
     _ff.cleanup();
     if (_work_packet)
 	_work_packet->kill();
     _work_packet = 0;
+    if (_feed_packet)
+	_feed_packet->kill();
+    _feed_packet = 0;
+    _columns.clear();
+    _chunk_pos = _chunk_n = 0;
 }
 
 int
@@ -229,6 +293,7 @@ FromIPSummaryDump::bang_data(const String &line, ErrorHandler *errh)
 
     _fields.clear();
     _field_order.clear();
+    _selected.clear();
     for (int i = 0; i < words.size(); i++) {
 	String word = cp_unquote(words[i]);
 	if (i == 0 && (word == "!data" || word == "!contents"))
@@ -243,10 +308,13 @@ FromIPSummaryDump::bang_data(const String &line, ErrorHandler *errh)
 	}
 	_fields.push_back(f);
 	_field_order.push_back(_fields.size() - 1);
+	_selected.push_back(!_select.size()
+			    || find(_select.begin(), _select.end(), word) != _select.end());
     }
 
     if (_fields.size() == 0)
 	_ff.error(errh, "no contents specified");
+    _args.resize(_fields.size());
 
     click_qsort(_field_order.begin(), _fields.size(), sizeof(int),
 		sort_fields_compare, this);
@@ -325,6 +393,183 @@ FromIPSummaryDump::bang_binary(const String &line, ErrorHandler *errh)
     _ff.set_lineno(1);
 }
 
+void
+FromIPSummaryDump::bang_columnar(const String &line, ErrorHandler *errh)
+{
+    Vector<String> words;
+    cp_spacevec(line, words);
+    if (words.size() != 1)
+	_ff.error(errh, "bad !columnar specification");
+    _columnar = true;
+    _index.invalidate();
+    _ff.set_landmark_pattern("%f:chunk %l");
+    _ff.set_lineno(0);
+}
+
+void
+FromIPSummaryDump::seek_index(ErrorHandler *errh)
+{
+    // The index block ends with its own length.
+    off_t pos = _ff.file_pos(), size = _ff.file_size(), target = -1;
+    uint8_t storage[IPSummaryDump::INDEX_ENTRY_SIZE];
+    const uint8_t *x;
+    uint32_t length, n;
+    if (size < pos + 16
+	|| _ff.seek(size - 4, errh) < 0
+	|| !(x = _ff.get_unaligned(4, storage, errh))
+	|| (length = GET4(x)) < 16
+	|| length > size - pos
+	|| _ff.seek(size - length, errh) < 0
+	|| !(x = _ff.get_unaligned(12, storage, errh))
+	|| (uint32_t) GET4(x) != IPSummaryDump::BLOCK_INDEX
+	|| (uint32_t) GET4(x + 4) != length
+	|| (n = GET4(x + 8)) != (length - 16) / IPSummaryDump::INDEX_ENTRY_SIZE)
+	goto done;
+
+    // Find the first chunk that ends at or after START.
+    target = size - length;
+    for (uint32_t i = 0; i < n; ++i) {
+	if (!(x = _ff.get_unaligned(IPSummaryDump::INDEX_ENTRY_SIZE, storage, errh)))
+	    break;
+	Timestamp last = Timestamp::make_nsec(GET4(x + 20), GET4(x + 24));
+	if (last >= _start) {
+	    target = ((off_t) (uint32_t) GET4(x) << 32) | (uint32_t) GET4(x + 4);
+	    break;
+	}
+    }
+
+  done:
+    (void) _ff.seek(target >= 0 ? target : pos, errh);
+}
+
+int
+FromIPSummaryDump::read_block(String &result, ErrorHandler *errh)
+{
+    assert(_columnar);
+    if (_start && !_index_checked) {
+	_index_checked = true;
+	seek_index(errh);
+    }
+
+    while (1) {
+	uint8_t storage[IPSummaryDump::CHUNK_HEADER_SIZE];
+	const uint8_t *header = _ff.get_unaligned(8, storage, errh);
+	if (!header)
+	    return 0;
+	uint32_t tag = GET4(header), length = GET4(header + 4);
+	if (length < 8)
+	    return _ff.error(errh, "bad block length");
+
+	if (tag == IPSummaryDump::BLOCK_TEXT) {
+	    result = _ff.get_string(length - 8, errh);
+	    return (result || length == 8 ? 2 : 0);
+	} else if (tag != IPSummaryDump::BLOCK_CHUNK) {
+	    // skip the index and unknown blocks
+	    if (_ff.seek(_ff.file_pos() + length - 8, errh) < 0)
+		return -1;
+	    continue;
+	}
+
+	_ff.set_lineno(_ff.lineno() + 1);
+	if (length < IPSummaryDump::CHUNK_HEADER_SIZE)
+	    return _ff.error(errh, "chunk too short");
+	const uint8_t *h = _ff.get_unaligned(IPSummaryDump::CHUNK_HEADER_SIZE - 8, storage + 8, errh);
+	if (!h)
+	    return 0;
+	uint32_t n = GET4(h);
+	Timestamp first = Timestamp::make_nsec(GET4(h + 4), GET4(h + 8));
+	Timestamp last = Timestamp::make_nsec(GET4(h + 12), GET4(h + 16));
+	length -= IPSummaryDump::CHUNK_HEADER_SIZE;
+
+	if (_end && first >= _end)
+	    return 0;
+	else if (_start && last < _start) {
+	    if (_ff.seek(_ff.file_pos() + length, errh) < 0)
+		return -1;
+	    continue;
+	}
+
+	_chunk_storage.resize(length);
+	const uint8_t *data = _ff.get_unaligned(length, _chunk_storage.begin(), errh);
+	if (!data || decode_chunk(data, length, n, errh) < 0)
+	    return -1;
+	return 1;
+    }
+}
+
+int
+FromIPSummaryDump::decode_chunk(const uint8_t *data, uint32_t length,
+				uint32_t n, ErrorHandler *errh)
+{
+    const uint8_t *end = data + length;
+    _columns.resize(_fields.size());
+    _chunk_pos = _chunk_n = 0;
+
+    for (int i = 0; i < _fields.size(); ++i) {
+	if (end - data < 5)
+	    return _ff.error(errh, "chunk too short");
+	int encoding = data[0];
+	uint32_t clen = GET4(data + 1);
+	data += 5;
+	if ((uint32_t) (end - data) < clen)
+	    return _ff.error(errh, "chunk too short");
+	const uint8_t *cdata = data;
+	data += clen;
+
+	Column &c = _columns[i];
+	const IPSummaryDump::FieldReader *f = _fields[i];
+	c.data = 0;
+	c.width = IPSummaryDump::binary_width(f->type);
+	c.offsets.clear();
+	if (!_selected[i] || !f->inb || !f->inject)
+	    continue;
+
+	if (encoding == IPSummaryDump::C_RAW && c.width < 0) {
+	    // variable-length values start with their length, so each takes
+	    // at least one byte
+	    if (n > clen || n == 0xFFFFFFFFU)
+		goto bad_column;
+	    c.offsets.resize(n + 1);
+	    uint32_t pos = 0;
+	    for (uint32_t j = 0; j < n; ++j) {
+		c.offsets[j] = pos;
+		if (pos >= clen)
+		    goto bad_column;
+		pos += 1 + cdata[pos];
+	    }
+	    if (pos > clen)
+		goto bad_column;
+	    c.offsets[n] = pos;
+	    c.stride = 0;
+	} else if (encoding == IPSummaryDump::C_RAW) {
+	    if (clen < (uint64_t) n * c.width)
+		goto bad_column;
+	    c.stride = c.width;
+	} else if (encoding == IPSummaryDump::C_CONSTANT) {
+	    if (c.width < 0 || clen < (uint32_t) c.width)
+		goto bad_column;
+	    c.stride = 0;
+	} else if (encoding == IPSummaryDump::C_DELTA) {
+	    // each delta takes at least one byte
+	    if ((c.width != 2 && c.width != 4 && c.width != 8)
+		|| n > clen || (uint64_t) n * c.width > 0x7FFFFFFFU)
+		goto bad_column;
+	    c.decoded.resize(n * c.width);
+	    if (!IPSummaryDump::decode_delta(c.decoded.begin(), cdata, cdata + clen, n, c.width))
+		goto bad_column;
+	    cdata = c.decoded.begin();
+	    c.stride = c.width;
+	} else {
+	  bad_column:
+	    return _ff.error(errh, "bad %<%s%> column", f->name);
+	}
+	c.data = cdata;
+    }
+
+    _chunk_n = n;
+    return 0;
+}
+
 static void
 set_checksums(WritablePacket *q, click_ip *iph)
 {
@@ -353,7 +598,7 @@ set_checksums(WritablePacket *q, click_ip *iph)
 }
 
 Packet *
-FromIPSummaryDump::read_packet(ErrorHandler *errh)
+FromIPSummaryDump::read_record(ErrorHandler *errh)
 {
     // read non-packet lines
     bool binary;
@@ -362,7 +607,17 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
     const char *end;
 
     while (1) {
-	if ((binary = _binary)) {
+	_record_pos = _ff.file_pos();
+	if (_columnar) {
+	    if (_chunk_pos < _chunk_n)
+		return read_chunk_packet(errh);
+	    int result = read_block(line, errh);
+	    if (result <= 0)
+		goto eof;
+	    else if (result == 1)
+		continue;
+	    binary = false;
+	} else if ((binary = _binary)) {
 	    int result = read_binary(line, errh);
 	    if (result <= 0)
 		goto eof;
@@ -370,6 +625,7 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 		binary = (result == 1);
 	} else if (_ff.read_line(line, errh, true) <= 0) {
 	  eof:
+	    _index.finish(_record_pos);
 	    _ff.cleanup();
 	    return 0;
 	}
@@ -383,8 +639,10 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	    /* real packet */
 	    break;
 
-	// parse bang lines
+	// parse bang lines; the index cannot seek past a change of format
 	if (data[0] == '!') {
+	    if (_index_begun && !(data + 4 <= end && memcmp(data, "!bad", 4) == 0))
+		_index.invalidate();
 	    if (data + 6 <= end && memcmp(data, "!data", 5) == 0 && isspace((unsigned char) data[5]))
 		bang_data(line, errh);
 	    else if (data + 8 <= end && memcmp(data, "!flowid", 7) == 0 && isspace((unsigned char) data[7]))
@@ -397,6 +655,8 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 		bang_binary(line, errh);
 	    else if (data + 10 <= end && memcmp(data, "!contents", 9) == 0 && isspace((unsigned char) data[9]))
 		bang_data(line, errh);
+	    else if (data + 10 <= end && memcmp(data, "!columnar", 9) == 0 && isspace((unsigned char) data[9]))
+		bang_columnar(line, errh);
 	}
     }
 
@@ -467,7 +727,7 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	     fip != _field_order.end() && d.p;
 	     ++fip) {
 	    const IPSummaryDump::FieldReader *f = _fields[*fip];
-	    if (!args[*fip] || !f->inject)
+	    if (!args[*fip] || !f->inject || !_selected[*fip])
 		continue;
 	    d.clear_values();
 	    if (f->inb(d, args[*fip], (const uint8_t *) end, f)) {
@@ -477,17 +737,18 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	}
 
     } else {
-	Vector<String> args;
-	while (args.size() < _fields.size()) {
+	// Split the line in place. The words point into the line, which
+	// outlives them.
+	String *args = _args.begin();
+	for (int i = 0; i < _fields.size(); ++i) {
 	    const char *original_data = data;
-	    while (data < end)
-		if (isspace((unsigned char) *data))
-		    break;
-		else if (*data == '\"')
+	    while ((data = find_delimiter(data, end)) != end
+		   && !isspace((unsigned char) *data))
+		if (*data == '\"')
 		    data = cp_skip_double_quote(data, end);
 		else
 		    ++data;
-	    args.push_back(line.substring(original_data, data));
+	    args[i] = String::make_stable(original_data, data - original_data);
 	    while (data < end && isspace((unsigned char) *data))
 		++data;
 	}
@@ -496,7 +757,8 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	     fip != _field_order.end() && d.p;
 	     ++fip) {
 	    const IPSummaryDump::FieldReader *f = _fields[*fip];
-	    if (!args[*fip] || args[*fip].equals("-", 1) || !f->inject)
+	    if (!args[*fip] || args[*fip].equals("-", 1) || !f->inject
+		|| !_selected[*fip])
 		continue;
 	    d.clear_values();
 	    if (f->ina(d, args[*fip], f)) {
@@ -522,6 +784,63 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	d.p = 0;
     }
 
+    return finish_packet(d);
+}
+
+Packet *
+FromIPSummaryDump::read_chunk_packet(ErrorHandler *errh)
+{
+    WritablePacket *q = Packet::make(16, (const unsigned char *) 0, 0, 1000);
+    if (!q) {
+	_ff.error(errh, strerror(ENOMEM));
+	return 0;
+    }
+    if (_zero)
+	memset(q->buffer(), 0, q->buffer_length());
+
+    IPSummaryDump::PacketOdesc d(this, q, _default_proto, (_have_flowid ? &_flowid : 0), _minor_version);
+    uint32_t i = _chunk_pos++;
+    int nfields = 0, ncolumns = 0;
+
+    for (int *fip = _field_order.begin();
+	 fip != _field_order.end() && d.p;
+	 ++fip) {
+	const Column &c = _columns[*fip];
+	if (!c.data)
+	    continue;
+	ncolumns++;
+	const IPSummaryDump::FieldReader *f = _fields[*fip];
+	const uint8_t *arg, *end;
+	if (c.width < 0) {
+	    arg = c.data + c.offsets[i];
+	    end = c.data + c.offsets[i + 1];
+	} else {
+	    arg = c.data + i * c.stride;
+	    end = arg + c.width;
+	}
+	d.clear_values();
+	if (f->inb(d, arg, end, f)) {
+	    f->inject(d, f);
+	    nfields++;
+	}
+    }
+
+    if (!nfields && ncolumns) {
+	if (!_format_complaint) {
+	    _ff.error(errh, "packet parse error");
+	    _format_complaint = true;
+	}
+	if (d.p)
+	    d.p->kill();
+	d.p = 0;
+    }
+
+    return finish_packet(d);
+}
+
+Packet *
+FromIPSummaryDump::finish_packet(IPSummaryDump::PacketOdesc &d)
+{
     // set source and destination ports even if no transport info on packet
     if (d.p && d.default_ip_flowid)
 	(void) d.make_ip(0);	// may fail
@@ -576,6 +895,80 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
     return d.p;
 }
 
+inline bool
+FromIPSummaryDump::more() const
+{
+    if (_feed && _partition->index() != 0)
+	return _feed_more;
+    else
+	return _ff.initialized();
+}
+
+Packet *
+FromIPSummaryDump::read_packet(ErrorHandler *errh)
+{
+    if (_feed) {
+	if (_partition->index() != 0) {
+	    // take packets from the first copy, and its timing
+	    Packet *p = _feed->pull(_partition->index(), _feed_more);
+	    if (p && _timing && !_have_timing) {
+		_timing_offset = static_cast<FromIPSummaryDump *>(_feed->source())->_timing_offset;
+		_have_timing = true;
+	    }
+	    return p;
+	} else if (_feed_packet) {
+	    if (!_feed->push(_feed_index, _feed_packet))
+		return 0;
+	    _feed_packet = 0;
+	}
+    }
+
+    while (1) {
+	Packet *p = read_record(errh);
+	if (p && !_index_begun && !_columnar) {
+	    // the first record: jump to START through the index
+	    _index_begun = true;
+	    _data_start = _record_pos;
+	    _index.begin(_data_start);
+	    int i;
+	    if (_start && _index.enabled() && (i = _index.lookup(_start)) > 0) {
+		if (_ff.seek(_index.offset(i), errh) >= 0) {
+		    _index.resume(i);
+		    p->kill();
+		    continue;
+		}
+		_index.invalidate();
+	    }
+	}
+	if (p)
+	    _index.note(_record_pos, p->timestamp_anno());
+	if (p && _end && p->timestamp_anno() >= _end) {
+	    p->kill();
+	    _ff.cleanup();
+	    return 0;
+	} else if (!p || !_start || p->timestamp_anno() >= _start) {
+	    int i;
+	    if (!p || !_partition
+		|| (i = _partition->partition_of(p)) == _partition->index())
+		return p;
+	    // in a parallel trace, hand other copies' packets to them, or
+	    // skip them if those copies read the file themselves
+	    if (_feed && _feed->attached(i)) {
+		if (_timing && !_have_timing) {
+		    _timing_offset = Timestamp::now_steady() - p->timestamp_anno();
+		    _have_timing = true;
+		}
+		if (_feed->push(i, p))
+		    continue;
+		_feed_packet = p;
+		_feed_index = i;
+		return 0;
+	    }
+	}
+	p->kill();
+    }
+}
+
 inline Packet *
 set_packet_lengths(Packet *p, uint32_t extra_length)
 {
@@ -690,29 +1083,53 @@ FromIPSummaryDump::run_task(Task *)
     if (!_active)
 	return false;
     Packet *p;
-
-    while (1) {
-	p = (_work_packet ? _work_packet : read_packet(0));
-	if (!p && !_ff.initialized()) {
-	    if (_stop)
-		router()->please_stop_driver();
-	    return false;
-	} else if (!p)
-	    break;
-	if (p && _timing && !check_timing(p))
-	    return false;
-	if (_multipacket)
-	    p = handle_multipacket(p);
-	// check sampling probability
-	if (_sampling_prob >= (1 << SAMPLING_SHIFT)
-	    || (click_random() & ((1 << SAMPLING_SHIFT) - 1)) < _sampling_prob)
-	    break;
-	if (p)
-	    p->kill();
+    uint32_t n = 0;
+
+    do {
+	while (1) {
+	    p = (_work_packet ? _work_packet : read_packet(0));
+	    if (!p && !more()) {
+		if (_feed)
+		    _feed->finish();
+		if (_stop)
+		    router()->please_stop_driver();
+		return n != 0;
+	    } else if (!p)
+		break;
+	    if (p && _timing && !check_timing(p)) {
+		if (_feed && _partition->index() == 0)
+		    _feed->wake_pullers();
+		return n != 0;
+	    }
+	    if (_multipacket)
+		p = handle_multipacket(p);
+	    // check sampling probability
+	    if (_sampling_prob >= (1 << SAMPLING_SHIFT)
+		|| (click_random() & ((1 << SAMPLING_SHIFT) - 1)) < _sampling_prob)
+		break;
+	    if (p)
+		p->kill();
+	}
+	if (p) {
+	    output(0).push(p);
+	    ++n;
+	}
+    } while (p && n < _burst);
+
+    // in a parallel trace, wake the other side of the feed, and sleep while
+    // there is nothing to pull or no room to push
+    if (_feed) {
+	int i = _partition->index();
+	bool sleep = !p && (_feed_packet ? _feed->sleep_push(_feed_index)
+			    : i != 0 && _feed->sleep_pull(i));
+	if (i == 0)
+	    _feed->wake_pullers(sleep || _timing ? 1 : TraceFeed::wake_batch);
+	else
+	    _feed->wake_pusher(i);
+	if (sleep)
+	    return n != 0;
     }
 
-    if (p)
-	output(0).push(p);
     _task.fast_reschedule();
     return true;
 }
@@ -726,7 +1143,9 @@ FromIPSummaryDump::pull(int)
 
     while (1) {
 	p = (_work_packet ? _work_packet : read_packet(0));
-	if (!p && !_ff.initialized()) {
+	if (!p && !more()) {
+	    if (_feed)
+		_feed->finish();
 	    if (_stop)
 		router()->please_stop_driver();
 	    _notifier.sleep();
@@ -748,8 +1167,44 @@ FromIPSummaryDump::pull(int)
     return p;
 }
 
+int
+FromIPSummaryDump::seek_time(const Timestamp &t, ErrorHandler *errh)
+{
+    if (!_ff.initialized())
+	return errh->error("end of dump reached");
+    if (_columnar) {
+	_chunk_pos = _chunk_n = 0;
+	_start = t;
+	_index_checked = true;
+	seek_index(errh);
+    } else if (_index_begun) {
+	int i = 0;
+	off_t pos = _data_start;
+	if (_index.enabled()) {
+	    i = _index.lookup(t);
+	    pos = _index.offset(i);
+	}
+	if (_ff.seek(pos, errh) < 0)
+	    return -1;
+	if (_index.enabled())
+	    _index.resume(i);
+    }
+    // otherwise, the first read will seek
+    _start = t;
+    if (_work_packet)
+	_work_packet->kill();
+    _work_packet = 0;
+    if (_active) {
+	if (output_is_push(0))
+	    _task.reschedule();
+	else
+	    _notifier.wake();
+    }
+    return 0;
+}
 
-enum { H_SAMPLING_PROB, H_ACTIVE, H_ENCAP, H_STOP };
+
+enum { H_SAMPLING_PROB, H_ACTIVE, H_ENCAP, H_STOP, H_SEEK_TIME };
 
 String
 FromIPSummaryDump::read_handler(Element *e, void *thunk)
@@ -789,6 +1244,12 @@ FromIPSummaryDump::write_handler(const String &s_in, Element *e, void *thunk, Er
 	fd->_active = false;
 	fd->router()->please_stop_driver();
 	return 0;
+      case H_SEEK_TIME: {
+	  Timestamp t;
+	  if (!cp_time(s, &t))
+	      return errh->error("'seek_time' takes a timestamp");
+	  return fd->seek_time(t, errh);
+      }
       default:
 	return -EINVAL;
     }
@@ -802,11 +1263,12 @@ FromIPSummaryDump::add_handlers()
     add_write_handler("active", write_handler, H_ACTIVE);
     add_read_handler("encap", read_handler, H_ENCAP);
     add_write_handler("stop", write_handler, H_STOP, Handler::f_button);
+    add_write_handler("seek_time", write_handler, H_SEEK_TIME);
     _ff.add_handlers(this);
     if (output_is_push(0))
 	add_task_handlers(&_task);
 }
 
-ELEMENT_REQUIRES(userlevel IPSummaryDumpInfo)
+ELEMENT_REQUIRES(userlevel IPSummaryDumpInfo TimeIndex)
 EXPORT_ELEMENT(FromIPSummaryDump)
 CLICK_ENDDECLS
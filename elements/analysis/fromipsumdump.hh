@@ -7,13 +7,15 @@
 #include <click/notifier.hh>
 #include <click/ipflowid.hh>
 #include <click/fromfile.hh>
+#include <click/tracepartition.hh>
 #include "ipsumdumpinfo.hh"
+#include "elements/userlevel/timeindex.hh"
 CLICK_DECLS
 
 /*
 =c
 
-FromIPSummaryDump(FILENAME [, I<keywords> STOP, TIMING, ACTIVE, ZERO, CHECKSUM, PROTO, MULTIPACKET, SAMPLE, FIELDS, FLOWID, DATA])
+FromIPSummaryDump(FILENAME [, I<keywords> STOP, TIMING, ACTIVE, ZERO, CHECKSUM, PROTO, MULTIPACKET, SAMPLE, FIELDS, SELECT, START, END, INDEX, FLOWID, DATA])
 
 =s traces
 
@@ -32,6 +34,14 @@ FromIPSummaryDump reads from the file named FILENAME unless FILENAME is a
 single dash 'C<->', in which case it reads from the standard input. It will
 not uncompress the standard input, however.
 
+FromIPSummaryDump reads ASCII, binary and columnar dumps (see
+ToIPSummaryDump). Columnar dumps are read a chunk at a time: each column
+of the chunk is decoded in one pass, columns for fields excluded by SELECT
+are not decoded at all, and chunks that lie entirely before START are
+skipped unread. If START is given and the file is a regular uncompressed
+file, FromIPSummaryDump jumps straight to the first chunk it needs using
+the index at the end of the file.
+
 Keyword arguments are:
 
 =over 8
@@ -47,6 +57,12 @@ Boolean. If true, then FromIPSummaryDump tries to maintain the timing of the
 original packet stream. The first packet is emitted immediately; thereafter,
 FromIPSummaryDump maintains the delays between packets. Default is false.
 
+=item BURST
+
+Unsigned integer. In push mode, the maximum number of packets
+FromIPSummaryDump parses and emits per task run. Larger bursts amortize
+scheduling overhead when reading large traces. Default is 1.
+
 =item ACTIVE
 
 Boolean. If false, then FromIPSummaryDump will not emit packets (until the
@@ -93,6 +109,39 @@ String, containing a space-separated list of field names (see
 ToIPSummaryDump for the possibilities). Defines the default fields for the
 dump.
 
+=item SELECT
+
+String, containing a space-separated list of field names. If given,
+FromIPSummaryDump sets only these fields in the packets it creates, and
+ignores the dump's other fields. This is fastest with columnar dumps.
+
+=item START
+
+Timestamp. FromIPSummaryDump will not emit packets with timestamps before
+START.
+
+=item END
+
+Timestamp. FromIPSummaryDump stops at the first packet whose timestamp is
+END or later.
+
+=item INDEX
+
+Boolean. If true, then FromIPSummaryDump uses a time index of the file,
+stored in FILENAME.tidx, to find the START time (or the time written to
+C<seek_time>) without reading the dump up to that point. The index is
+built as the dump is read, and works as for FromDump. Columnar dumps have
+their own index and ignore this one. Default is false.
+
+=item INDEX_FILE
+
+Filename. Time index file to use instead of FILENAME.tidx. Implies INDEX.
+
+=item INDEX_INTERVAL
+
+Time in seconds. The index has an entry for roughly every INDEX_INTERVAL
+seconds of dump time. Default is 1 second.
+
 =item FLOWID
 
 String, containing a space-separated flow ID (source address, source port,
@@ -113,6 +162,13 @@ from a file.
 
 =back
 
+In parallel trace mode (C<click --parallel-trace N>), only the first copy's
+FromIPSummaryDump reads the file. It hands each packet outside its own share
+of the trace to the copy whose share holds it, as chosen by a symmetric hash
+of the packets' IP addresses. Packets without IP addresses go to the first
+copy. START and END take effect in the first copy; the other copies stop
+when it reaches the end of the file. See click(1).
+
 Only available in user-level processes.
 
 =n
@@ -151,6 +207,13 @@ Returns FromIPSummaryDump's position in the file, in bytes.
 
 When written, sets 'active' to false and stops the driver.
 
+=h seek_time write-only
+
+Text is an absolute timestamp. Writing it restarts reading at that time,
+as if it were the START time, using the time index or, for columnar dumps,
+the dump's own index. This works only before the end of the dump has been
+reached. After a seek, error messages may report wrong line numbers.
+
 =a
 
 ToIPSummaryDump */
@@ -183,6 +246,7 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     Vector<int> _field_order;
     uint16_t _default_proto;
     uint32_t _sampling_prob;
+    uint32_t _burst;
     IPFlowID _flowid;
     uint32_t _aggregate;
 
@@ -198,6 +262,8 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     bool _timing : 1;
     bool _have_timing : 1;
     bool _allow_nonexistent : 1;
+    bool _columnar : 1;
+    bool _index_checked : 1;
     Packet *_work_packet;
     uint32_t _multipacket_length;
     Timestamp _multipacket_timestamp_delta;
@@ -211,7 +277,43 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     int _minor_version;
     IPFlowID _given_flowid;
 
+    Vector<String> _select;
+    Vector<int> _selected;	// per field: true if the field is injected
+    Vector<String> _args;	// words of the current text record
+    Timestamp _start;
+    Timestamp _end;
+
+    struct Column {
+	const uint8_t *data;	// null if the column is not decoded
+	uint32_t stride;	// 0 for constant columns
+	int width;		// -1 for variable-length columns
+	Vector<uint32_t> offsets;	// variable-length value offsets
+	Vector<uint8_t> decoded;
+    };
+
+    Vector<Column> _columns;	// columns of the current chunk
+    Vector<uint8_t> _chunk_storage;
+    uint32_t _chunk_pos;
+    uint32_t _chunk_n;
+
+    TimeIndex _index;
+    bool _index_begun;
+    off_t _record_pos;		// offset of the last record read
+    off_t _data_start;		// offset of the first record
+
+    const TracePartition *_partition;
+    TraceFeed *_feed;
+    Packet *_feed_packet;	// waiting for room in _feed
+    int _feed_index;
+    bool _feed_more;
+
+    inline bool more() const;
+
     int read_binary(String &, ErrorHandler *);
+    int read_block(String &, ErrorHandler *);
+    int decode_chunk(const uint8_t *data, uint32_t length, uint32_t n,
+		     ErrorHandler *);
+    void seek_index(ErrorHandler *);
 
     static int sort_fields_compare(const void *, const void *, void *);
     void bang_data(const String &, ErrorHandler *);
@@ -219,10 +321,15 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     void bang_flowid(const String &, ErrorHandler *);
     void bang_aggregate(const String &, ErrorHandler *);
     void bang_binary(const String &, ErrorHandler *);
+    void bang_columnar(const String &, ErrorHandler *);
     void check_defaults();
     bool check_timing(Packet *p);
+    Packet *finish_packet(IPSummaryDump::PacketOdesc &d);
+    Packet *read_chunk_packet(ErrorHandler *);
+    Packet *read_record(ErrorHandler *);
     Packet *read_packet(ErrorHandler *);
     Packet *handle_multipacket(Packet *);
+    int seek_time(const Timestamp &, ErrorHandler *);
 
     static String read_handler(Element *, void *) CLICK_COLD;
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
@@ -0,0 +1,226 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * hyperloglog.{cc,hh} -- estimate the number of distinct keys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "hyperloglog.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/integers.hh>
+#include <math.h>
+CLICK_DECLS
+
+HyperLogLog::HyperLogLog()
+{
+}
+
+HyperLogLog::~HyperLogLog()
+{
+}
+
+int
+HyperLogLog::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String key;
+    int precision = 12;
+    if (_key.configure_keywords(conf, this, errh) < 0
+	|| Args(conf, this, errh)
+	.read_mp("KEY", AnyArg(), key)
+	.read("PRECISION", precision)
+	.complete() < 0)
+	return -1;
+    if (precision < 4 || precision > 18)
+	return errh->error("PRECISION must be between 4 and 18");
+    if (_key.parse(key, this, errh) < 0)
+	return -1;
+    _precision = precision;
+    return 0;
+}
+
+int
+HyperLogLog::initialize(ErrorHandler *errh)
+{
+    if (_state.resize() < 0)
+	return errh->error("out of memory");
+    for (int t = 0; t < _state.size(); ++t)
+	if (!(_state[t].registers = new uint8_t[1U << _precision]))
+	    return errh->error("out of memory");
+    reset();
+    return 0;
+}
+
+void
+HyperLogLog::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t)
+	delete[] _state[t].registers;
+    _state.clear();
+}
+
+void
+HyperLogLog::reset()
+{
+    for (int t = 0; t < _state.size(); ++t) {
+	memset(_state[t].registers, 0, 1U << _precision);
+	_state[t].count = 0;
+    }
+}
+
+inline Packet *
+HyperLogLog::handle_packet(Packet *p)
+{
+    uint64_t key;
+    if (_key.extract(p, key)) {
+	ThreadState &ts = _state[click_current_cpu_id()];
+	uint64_t h = SketchKey::hash(key);
+	// the top bits pick a register; the register keeps the longest run
+	// of leading zeros seen in the remaining bits, plus one
+	uint32_t i = h >> (64 - _precision);
+	uint64_t w = (h << _precision) | ((uint64_t) 1 << (_precision - 1));
+	uint8_t rank = ffs_msb(w);
+	if (ts.registers[i] < rank)
+	    ts.registers[i] = rank;
+	ts.count += _key.amount(p);
+    } else if (noutputs() == 2) {
+	output(1).push(p);
+	return 0;
+    }
+    return p;
+}
+
+void
+HyperLogLog::push(int, Packet *p)
+{
+    if (Packet *q = handle_packet(p))
+	output(0).push(q);
+}
+
+Packet *
+HyperLogLog::pull(int)
+{
+    Packet *p = input(0).pull();
+    if (p)
+	p = handle_packet(p);
+    return p;
+}
+
+void
+HyperLogLog::merge_registers(uint8_t *r, const uint8_t *x, uint32_t n)
+{
+    uint32_t i = 0;
+#if CLICK_USERLEVEL && defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+	__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+	__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(r + i), _mm_max_epu8(a, b));
+    }
+#endif
+    for (; i < n; ++i)
+	if (r[i] < x[i])
+	    r[i] = x[i];
+}
+
+double
+HyperLogLog::estimate() const
+{
+    uint32_t m = 1U << _precision;
+    uint8_t *r = new uint8_t[m];
+    memcpy(r, _state[0].registers, m);
+    for (int t = 1; t < _state.size(); ++t)
+	merge_registers(r, _state[t].registers, m);
+
+    double z = 0;
+    uint32_t zeros = 0;
+    for (uint32_t i = 0; i < m; ++i) {
+	z += ldexp(1.0, -r[i]);
+	zeros += (r[i] == 0);
+    }
+    delete[] r;
+
+    double alpha;
+    if (m == 16)
+	alpha = 0.673;
+    else if (m == 32)
+	alpha = 0.697;
+    else if (m == 64)
+	alpha = 0.709;
+    else
+	alpha = 0.7213 / (1 + 1.079 / m);
+    double e = alpha * m * m / z;
+    // linear counting is more accurate for small cardinalities
+    if (e <= 2.5 * m && zeros)
+	e = m * log((double) m / zeros);
+    return e;
+}
+
+void
+HyperLogLog::merge_state(Element *e, ErrorHandler *errh)
+{
+    HyperLogLog *o = static_cast<HyperLogLog *>(e->cast("HyperLogLog"));
+    if (!o || o->_precision != _precision || o->_state.size() != _state.size()) {
+	errh->warning("precisions differ, not merged");
+	return;
+    }
+    for (int t = 0; t < _state.size(); ++t) {
+	merge_registers(_state[t].registers, o->_state[t].registers, 1U << _precision);
+	_state[t].count += o->_state[t].count;
+    }
+}
+
+String
+HyperLogLog::read_handler(Element *e, void *thunk)
+{
+    HyperLogLog *hll = static_cast<HyperLogLog *>(e);
+    switch ((intptr_t) thunk) {
+    case h_estimate:
+	return String((uint64_t) (hll->estimate() + 0.5));
+    case h_count: {
+	uint64_t count = 0;
+	for (int t = 0; t < hll->_state.size(); ++t)
+	    count += hll->_state[t].count;
+	return String(count);
+    }
+    case h_key:
+	return hll->_key.unparse(e);
+    case h_precision:
+	return String(hll->_precision);
+    case h_error:
+	return String(1.04 / sqrt((double) (1U << hll->_precision)));
+    default:
+	return "<error>";
+    }
+}
+
+int
+HyperLogLog::reset_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    static_cast<HyperLogLog *>(e)->reset();
+    return 0;
+}
+
+void
+HyperLogLog::add_handlers()
+{
+    add_read_handler("estimate", read_handler, h_estimate);
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("key", read_handler, h_key);
+    add_read_handler("precision", read_handler, h_precision);
+    add_read_handler("error", read_handler, h_error);
+    add_write_handler("reset", reset_handler, 0, Handler::f_button);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel SketchKey)
+EXPORT_ELEMENT(HyperLogLog)
+ELEMENT_MT_SAFE(HyperLogLog)
@@ -0,0 +1,137 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_HYPERLOGLOG_HH
+#define CLICK_HYPERLOGLOG_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include "sketchkey.hh"
+CLICK_DECLS
+
+/*
+=c
+
+HyperLogLog(KEY, [I<KEYWORDS>])
+
+=s aggregates
+
+estimates the number of distinct keys in fixed memory
+
+=d
+
+HyperLogLog estimates how many distinct values of a key it has seen, such as
+the number of distinct source addresses, using the HyperLogLog algorithm. It
+keeps 2^PRECISION one-byte registers, whatever the number of keys. The
+estimate's relative standard error is about 1.04/sqrt(2^PRECISION): 1.6% for
+the default PRECISION of 12, which uses 4 kilobytes per thread. Small counts
+use linear counting, and are nearly exact.
+
+KEY says what to count. It is either an annotation, written C<"anno NAME">,
+or a packet field as accepted by AggregateIP, such as C<"ip src">, C<"ip
+dst/24">, or C<"tcp dport">. Annotations of 1, 2, 4, or 8 bytes are read in
+host byte order; fields may be up to 64 bits long.
+
+Each thread updates its own registers. Handlers take their elementwise
+maximum, with SSE2 where available.
+
+HyperLogLog may have one or two outputs. Packets lacking the key are emitted
+on the second output if there is one, and otherwise passed through
+uncounted.
+
+Keyword arguments are:
+
+=over 8
+
+=item PRECISION
+
+Unsigned. Log base 2 of the number of registers, between 4 and 18. Default
+is 12.
+
+=back
+
+=n
+
+In parallel trace mode (see click(1)), the registers of all copies are
+merged when the driver stops.
+
+=h estimate read-only
+
+Returns the estimated number of distinct keys.
+
+=h count read-only
+
+Returns the number of packets counted.
+
+=h key read-only
+
+Returns the KEY specification.
+
+=h precision read-only
+
+Returns PRECISION.
+
+=h error read-only
+
+Returns the estimate's relative standard error.
+
+=h reset write-only
+
+Forgets all keys.
+
+=e
+
+Count distinct sources and destinations:
+
+  FromDump(trace.pcap, STOP true, FORCE_IP true)
+    -> srcs :: HyperLogLog(ip src)
+    -> dsts :: HyperLogLog(ip dst)
+    -> Discard;
+
+=a
+
+CountMinSketch, SpaceSaving, AggregateCounter, AggregateIP */
+
+class HyperLogLog : public Element { public:
+
+    HyperLogLog() CLICK_COLD;
+    ~HyperLogLog() CLICK_COLD;
+
+    const char *class_name() const	{ return "HyperLogLog"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+    Packet *pull(int);
+
+    double estimate() const;
+    void reset();
+
+  private:
+
+    struct ThreadState {
+	uint8_t *registers;
+	uint64_t count;
+	ThreadState()
+	    : registers(0), count(0) {
+	}
+    };
+
+    PerThread<ThreadState> _state;
+    int _precision;
+    SketchKey _key;
+
+    inline Packet *handle_packet(Packet *);
+    static void merge_registers(uint8_t *r, const uint8_t *x, uint32_t n);
+
+    enum { h_estimate, h_count, h_key, h_precision, h_error };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int reset_handler(const String &, Element *, void *, ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -147,7 +147,7 @@ static bool anno_ina(PacketOdesc& d, const String &s, const FieldReader *f)
     case T_TIMESTAMP:
     case T_FIRST_TIMESTAMP: {
 	Timestamp ts;
-	if (cp_time(s, &ts)) {
+	if (parse_timestamp(s.begin(), s.end(), ts) || cp_time(s, &ts)) {
 	    d.u32[0] = ts.sec();
 	    d.u32[1] = ts.nsec();
 	    return true;
@@ -260,7 +260,9 @@ static bool ip_ina(PacketOdesc& d, const String &s, const FieldReader *f)
     case T_IP_SRC:
     case T_IP_DST: {
 	IPAddress a;
-	if (IPAddressArg().parse(s, a, d.e)) {
+	if (parse_ip_address(s.begin(), s.end(), d.v))
+	    return true;
+	else if (IPAddressArg().parse(s, a, d.e)) {
 	    d.v = a.addr();
 	    return true;
 	}
@@ -582,6 +584,7 @@ void unparse_ip_opt_binary(StringAccum& sa, const uint8_t *opt, int opt_len, int
 	// store all options
 	sa.append((char)opt_len);
 	sa.append(opt, opt_len);
+	return;
     }
 
     const uint8_t *end_opt = opt + opt_len;
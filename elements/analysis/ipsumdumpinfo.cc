@@ -238,12 +238,100 @@ void num_outa(const PacketDesc& d, const FieldWriter *f)
 	*d.sa << d.v;
 }
 
+bool parse_decimal(const char *s, const char *end, uint32_t &v)
+{
+    // A leading zero means octal to IntArg.
+    if (s == end || end - s > 10 || (*s == '0' && end - s > 1))
+	return false;
+    uint64_t x = 0;
+    for (; s != end; ++s) {
+	unsigned digit = (unsigned char) *s - '0';
+	if (digit > 9)
+	    return false;
+	x = x * 10 + digit;
+    }
+    if (x > 0xFFFFFFFFU)
+	return false;
+    v = x;
+    return true;
+}
+
+#if HAVE_INT64_TYPES
+bool parse_decimal(const char *s, const char *end, uint64_t &v)
+{
+    // 19 digits cannot overflow
+    if (s == end || end - s > 19 || (*s == '0' && end - s > 1))
+	return false;
+    uint64_t x = 0;
+    for (; s != end; ++s) {
+	unsigned digit = (unsigned char) *s - '0';
+	if (digit > 9)
+	    return false;
+	x = x * 10 + digit;
+    }
+    v = x;
+    return true;
+}
+#endif
+
+bool parse_ip_address(const char *s, const char *end, uint32_t &addr)
+{
+    uint32_t a = 0;
+    for (int part = 0; part < 4; ++part) {
+	if (part && (s == end || *s++ != '.'))
+	    return false;
+	const char *start = s;
+	unsigned x = 0, digit;
+	for (; s != end && s - start < 3
+		 && (digit = (unsigned char) *s - '0') <= 9; ++s)
+	    x = x * 10 + digit;
+	if (s == start || x > 255 || (*start == '0' && s - start > 1))
+	    return false;
+	a = (a << 8) | x;
+    }
+    if (s != end)
+	return false;
+    addr = htonl(a);
+    return true;
+}
+
+bool parse_timestamp(const char *s, const char *end, Timestamp &ts)
+{
+    static const uint32_t scale[] = {
+	1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100,
+	10, 1
+    };
+#if TIMESTAMP_NANOSEC
+    const int max_frac = 9;
+#else
+    const int max_frac = 6;	// more digits need rounding
+#endif
+    const char *start = s;
+    uint64_t sec = 0;
+    unsigned digit;
+    for (; s != end && s - start < 10
+	     && (digit = (unsigned char) *s - '0') <= 9; ++s)
+	sec = sec * 10 + digit;
+    if (s == start || sec > 0x7FFFFFFF)
+	return false;
+    uint32_t frac = 0;
+    int nfrac = 0;
+    if (s != end && *s == '.')
+	for (++s; s != end && nfrac < max_frac
+		 && (digit = (unsigned char) *s - '0') <= 9; ++s, ++nfrac)
+	    frac = frac * 10 + digit;
+    if (s != end)
+	return false;
+    ts = Timestamp::make_nsec(sec, frac * scale[nfrac]);
+    return true;
+}
+
 bool num_ina(PacketOdesc& d, const String &s, const FieldReader *f)
 {
 #if HAVE_INT64_TYPES
     if (f->type == B_8) {
 	uint64_t v;
-	if (!IntArg().parse(s, v))
+	if (!parse_decimal(s.begin(), s.end(), v) && !IntArg().parse(s, v))
 	    return false;
 	d.u32[0] = v;
 	d.u32[1] = v >> 32;
@@ -252,7 +340,7 @@ bool num_ina(PacketOdesc& d, const String &s, const FieldReader *f)
 #else
     // XXX die on large numbers
 #endif
-    if (!IntArg().parse(s, d.v))
+    if (!parse_decimal(s.begin(), s.end(), d.v) && !IntArg().parse(s, d.v))
 	return false;
     if ((f->type == B_1 && d.v > 255) || (f->type == B_2 && d.v > 65535))
 	return false;
@@ -343,6 +431,133 @@ const uint8_t *inb(PacketOdesc& d, const uint8_t *s, const uint8_t *end, const F
 }
 
 
+int binary_width(int type)
+{
+    switch (type) {
+      case B_0:
+	return 0;
+      case B_1:
+	return 1;
+      case B_2:
+	return 2;
+      case B_4:
+      case B_4NET:
+	return 4;
+      case B_6PTR:
+	return 6;
+      case B_8:
+	return 8;
+      case B_16:
+	return 16;
+      default:
+	return -1;
+    }
+}
+
+static inline uint64_t get_be(const uint8_t *s, int width)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < width; ++i)
+	v = (v << 8) | s[i];
+    return v;
+}
+
+template <int W> static inline void put_be(uint8_t *s, uint64_t v)
+{
+    for (int i = W - 1; i >= 0; --i, v >>= 8)
+	s[i] = v;
+}
+
+/** @brief Encode a column of @a n values of @a width bytes each.
+ *
+ * Appends the encoded column to @a sa and returns its encoding.  A column
+ * whose values are all equal is stored as one value (C_CONSTANT).  Columns
+ * of 2-, 4- and 8-byte numbers, such as timestamps, addresses and sequence
+ * numbers, are stored as zigzag varints of the differences between
+ * successive values (C_DELTA) when that is smaller.  Other columns,
+ * including variable-length ones (@a width < 0), are stored as is (C_RAW). */
+int encode_column(StringAccum &sa, const uint8_t *data, uint32_t length,
+		  uint32_t n, int width)
+{
+    if (width > 0 && n > 1) {
+	const uint8_t *s = data + width, *end = data + length;
+	while (s < end && memcmp(s, data, width) == 0)
+	    s += width;
+	if (s == end) {
+	    sa.append(data, width);
+	    return C_CONSTANT;
+	}
+    }
+    if (width == 2 || width == 4 || width == 8) {
+	int pos = sa.length();
+	int shift = 64 - 8 * width;
+	uint64_t last = 0;
+	for (uint32_t i = 0; i < n; ++i, data += width) {
+	    uint64_t v = get_be(data, width);
+	    int64_t delta = (int64_t) ((v - last) << shift) >> shift;
+	    uint64_t zz = ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63);
+	    char *x = sa.extend(10);
+	    while (zz >= 0x80) {
+		*x++ = (zz & 0x7F) | 0x80;
+		zz >>= 7;
+	    }
+	    *x++ = zz;
+	    sa.set_length(x - sa.data());
+	    last = v;
+	}
+	if ((uint32_t) (sa.length() - pos) < length)
+	    return C_DELTA;
+	sa.set_length(pos);
+	data -= length;
+    }
+    sa.append(data, length);
+    return C_RAW;
+}
+
+template <int W> static const uint8_t *
+decode_delta_width(uint8_t *out, const uint8_t *s, const uint8_t *end,
+		   uint32_t n)
+{
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < n; ++i, out += W) {
+	uint64_t zz;
+	if (s < end && *s < 0x80)
+	    zz = *s++;
+	else {
+	    zz = 0;
+	    for (int shift = 0; ; shift += 7) {
+		if (s == end || shift > 63)
+		    return 0;
+		zz |= (uint64_t) (*s & 0x7F) << shift;
+		if (!(*s++ & 0x80))
+		    break;
+	    }
+	}
+	v += (zz >> 1) ^ -(zz & 1);
+	put_be<W>(out, v);
+    }
+    return s;
+}
+
+/** @brief Decode a C_DELTA column of @a n values of @a width bytes.
+ *
+ * Writes the values to @a out in network byte order and returns the end
+ * of the encoded data, or null if the data is corrupt. */
+const uint8_t *decode_delta(uint8_t *out, const uint8_t *s, const uint8_t *end,
+			    uint32_t n, int width)
+{
+    switch (width) {
+      case 2:
+	return decode_delta_width<2>(out, s, end, n);
+      case 4:
+	return decode_delta_width<4>(out, s, end, n);
+      case 8:
+	return decode_delta_width<8>(out, s, end, n);
+      default:
+	return 0;
+    }
+}
+
 
 void ip_prepare(PacketDesc &d, const FieldWriter *)
 {
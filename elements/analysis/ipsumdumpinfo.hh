@@ -173,6 +173,29 @@ void outb(const PacketDesc&, bool ok, const FieldWriter *);
 bool num_ina(PacketOdesc&, const String &, const FieldReader *);
 const uint8_t *inb(PacketOdesc&, const uint8_t*, const uint8_t*, const FieldReader *);
 
+// Fast parsers for the usual text forms of numbers, IP addresses and
+// timestamps. Each returns false for any other form; callers then fall
+// back to the general parsers.
+bool parse_decimal(const char *s, const char *end, uint32_t &v);
+#if HAVE_INT64_TYPES
+bool parse_decimal(const char *s, const char *end, uint64_t &v);
+#endif
+bool parse_ip_address(const char *s, const char *end, uint32_t &addr);
+bool parse_timestamp(const char *s, const char *end, Timestamp &ts);
+
+// Columnar dumps: blocks, and column encodings within chunks
+enum { BLOCK_CHUNK = 0x43484E4BU,	// "CHNK"
+       BLOCK_TEXT = 0x54455854U,	// "TEXT"
+       BLOCK_INDEX = 0x494E4458U };	// "INDX"
+enum { C_RAW = 0, C_CONSTANT = 1, C_DELTA = 2 };
+enum { CHUNK_HEADER_SIZE = 28, INDEX_ENTRY_SIZE = 28 };
+
+int binary_width(int type);
+int encode_column(StringAccum &sa, const uint8_t *data, uint32_t length,
+		  uint32_t n, int width);
+const uint8_t *decode_delta(uint8_t *out, const uint8_t *s, const uint8_t *end,
+			    uint32_t n, int width);
+
 enum { MISSING_IP = 0,
        MISSING_ETHERNET = 260 };
 inline bool field_missing(const PacketDesc &d, int proto, int l);
@@ -0,0 +1,412 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * latencyhistogram.{cc,hh} -- measure latency distributions of stamped
+ * packets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "latencyhistogram.hh"
+#include <click/args.hh>
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/packet_anno.hh>
+CLICK_DECLS
+
+LatencyHistogram::LatencyHistogram()
+{
+}
+
+LatencyHistogram::~LatencyHistogram()
+{
+}
+
+int
+LatencyHistogram::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String clock = "cycles";
+    int anno = PERFCTR_ANNO_OFFSET, offset = -1, class_anno = -1;
+    uint32_t precision = 7;
+    if (Args(conf, this, errh)
+	.read("CLOCK", WordArg(), clock)
+	.read("ANNO", AnnoArg(8), anno)
+	.read("OFFSET", offset)
+	.read("CLASS", AnnoArg(1), class_anno)
+	.read("PRECISION", precision)
+	.complete() < 0)
+	return -1;
+    if (LatencyStamp::parse_clock(clock, _clock) < 0)
+	return errh->error("CLOCK must be %<cycles%>, %<system%>, or %<timestamp%>");
+    if (_clock == LatencyStamp::clock_cycles && click_get_cycles() == 0)
+	return errh->error("no cycle counter on this platform");
+    if (precision < 1 || precision > 12)
+	return errh->error("PRECISION must be between 1 and 12");
+    _anno = anno;
+    _offset = offset;
+    _class_anno = class_anno;
+    _precision = precision;
+    return 0;
+}
+
+/** @brief Return the cycle counter's rate in cycles per second.
+ *
+ * The rate is measured against the steady clock the first time it is
+ * needed, which takes 20 milliseconds. */
+double
+LatencyHistogram::measure_cycle_rate()
+{
+    static double rate = 0;
+    if (rate == 0) {
+	Timestamp t0 = Timestamp::now_steady(), t1;
+	click_cycles_t c0 = click_get_cycles();
+	do {
+	    t1 = Timestamp::now_steady();
+	} while ((t1 - t0).msecval() < 20);
+	click_cycles_t c1 = click_get_cycles();
+	rate = (c1 - c0) / (t1 - t0).doubleval();
+    }
+    return rate;
+}
+
+int
+LatencyHistogram::initialize(ErrorHandler *errh)
+{
+    if (_clock == LatencyStamp::clock_cycles)
+	_ns_per_unit = 1e9 / measure_cycle_rate();
+    else
+	_ns_per_unit = 1;
+    if (_state.resize() < 0)
+	return errh->error("out of memory");
+    return 0;
+}
+
+void
+LatencyHistogram::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t)
+	for (int c = 0; c < nclasses; ++c)
+	    if (Histogram *h = _state[t].classes[c]) {
+		delete[] h->buckets;
+		delete h;
+	    }
+    _state.clear();
+}
+
+void
+LatencyHistogram::reset()
+{
+    // clear histograms in place, since other threads may be updating them
+    for (int t = 0; t < _state.size(); ++t) {
+	for (int c = 0; c < nclasses; ++c)
+	    if (Histogram *h = _state[t].classes[c]) {
+		uint64_t *buckets = h->buckets;
+		memset(buckets, 0, sizeof(uint64_t) * nbuckets());
+		*h = Histogram();
+		h->buckets = buckets;
+	    }
+	_state[t].unstamped = 0;
+    }
+}
+
+uint64_t
+LatencyHistogram::bucket_low(uint32_t b) const
+{
+    if (b < (2U << _precision))
+	return b;
+    int shift = (b >> _precision) - 1;
+    return (uint64_t) (b - (shift << _precision)) << shift;
+}
+
+uint64_t
+LatencyHistogram::bucket_high(uint32_t b) const
+{
+    return bucket_low(b + 1) - 1;
+}
+
+LatencyHistogram::Histogram *
+LatencyHistogram::make_class(ThreadState &ts, int c)
+{
+    Histogram *h = new Histogram;
+    if (h && !(h->buckets = new uint64_t[nbuckets()])) {
+	delete h;
+	h = 0;
+    }
+    if (h) {
+	memset(h->buckets, 0, sizeof(uint64_t) * nbuckets());
+	ts.classes[c] = h;
+    }
+    return h;
+}
+
+inline bool
+LatencyHistogram::extract(const Packet *p, uint64_t &latency) const
+{
+    uint64_t stamp;
+    if (_offset < 0) {
+	if (!(stamp = p->anno_u64(_anno)))
+	    return false;
+    } else {
+	uint32_t sig;
+	if (p->length() < (uint32_t) _offset + LatencyStamp::record_size)
+	    return false;
+	memcpy(&sig, p->data() + _offset, 4);
+	if (ntohl(sig) != LatencyStamp::clock_signature(_clock))
+	    return false;
+	memcpy(&stamp, p->data() + _offset + 4, 8);
+	stamp = ntohq(stamp);
+    }
+    uint64_t now = LatencyStamp::now(_clock, p);
+    latency = (now > stamp ? now - stamp : 0);
+    return true;
+}
+
+inline Packet *
+LatencyHistogram::handle_packet(Packet *p)
+{
+    ThreadState &ts = _state[click_current_cpu_id()];
+    uint64_t latency;
+    if (extract(p, latency)) {
+	int c = (_class_anno >= 0 ? p->anno_u8(_class_anno) : 0);
+	Histogram *h = ts.classes[c];
+	if (likely(h) || (h = make_class(ts, c))) {
+	    ++h->count;
+	    h->sum += latency;
+	    if (latency < h->min)
+		h->min = latency;
+	    if (latency > h->max)
+		h->max = latency;
+	    ++h->buckets[bucket(latency)];
+	    return p;
+	}
+    }
+    ++ts.unstamped;
+    if (noutputs() == 2) {
+	output(1).push(p);
+	return 0;
+    }
+    return p;
+}
+
+void
+LatencyHistogram::push(int, Packet *p)
+{
+    if (Packet *q = handle_packet(p))
+	output(0).push(q);
+}
+
+Packet *
+LatencyHistogram::pull(int)
+{
+    Packet *p = input(0).pull();
+    if (p)
+	p = handle_packet(p);
+    return p;
+}
+
+/** @brief Add the histograms of class @a c, or of all classes if @a c is
+ * negative, into @a h, whose buckets are stored in @a buckets. */
+void
+LatencyHistogram::combine(int c, Histogram &h, Vector<uint64_t> &buckets) const
+{
+    buckets.assign(nbuckets(), 0);
+    h = Histogram();
+    h.buckets = buckets.begin();
+    for (int t = 0; t < _state.size(); ++t)
+	for (int x = (c < 0 ? 0 : c); x < (c < 0 ? (int) nclasses : c + 1); ++x)
+	    if (const Histogram *th = _state[t].classes[x]) {
+		h.count += th->count;
+		h.sum += th->sum;
+		if (th->min < h.min)
+		    h.min = th->min;
+		if (th->max > h.max)
+		    h.max = th->max;
+		for (uint32_t b = 0; b < nbuckets(); ++b)
+		    h.buckets[b] += th->buckets[b];
+	    }
+}
+
+uint64_t
+LatencyHistogram::percentile(const Histogram &h, double p) const
+{
+    if (h.count == 0)
+	return 0;
+    // rank is ceil(p% of count), ignoring rounding error in the product
+    double r = p / 100 * h.count;
+    uint64_t rank = (uint64_t) r;
+    if (r > rank + 1e-6 || rank < 1)
+	++rank;
+    uint64_t seen = 0;
+    uint32_t b = 0;
+    for (; b < nbuckets() - 1; ++b)
+	if ((seen += h.buckets[b]) >= rank)
+	    break;
+    uint64_t v = bucket_high(b);
+    if (v > h.max)
+	v = h.max;
+    if (v < h.min)
+	v = h.min;
+    return v;
+}
+
+void
+LatencyHistogram::merge_state(Element *e, ErrorHandler *errh)
+{
+    LatencyHistogram *o = static_cast<LatencyHistogram *>(e->cast("LatencyHistogram"));
+    if (!o || o->_precision != _precision || o->_state.size() != _state.size()) {
+	errh->warning("histogram sizes differ, not merged");
+	return;
+    }
+    for (int t = 0; t < _state.size(); ++t) {
+	for (int c = 0; c < nclasses; ++c) {
+	    const Histogram *oh = o->_state[t].classes[c];
+	    Histogram *h = _state[t].classes[c];
+	    if (!oh || (!h && !(h = make_class(_state[t], c))))
+		continue;
+	    h->count += oh->count;
+	    h->sum += oh->sum;
+	    if (oh->min < h->min)
+		h->min = oh->min;
+	    if (oh->max > h->max)
+		h->max = oh->max;
+	    for (uint32_t b = 0; b < nbuckets(); ++b)
+		h->buckets[b] += oh->buckets[b];
+	}
+	_state[t].unstamped += o->_state[t].unstamped;
+    }
+}
+
+String
+LatencyHistogram::read_handler(Element *e, void *thunk)
+{
+    LatencyHistogram *lh = static_cast<LatencyHistogram *>(e);
+    switch ((intptr_t) thunk) {
+    case h_summary: {
+	static const double ps[] = { 50, 90, 99, 99.9, 99.99 };
+	StringAccum sa;
+	Histogram h;
+	Vector<uint64_t> buckets;
+	for (int c = 0; c < nclasses; ++c) {
+	    lh->combine(c, h, buckets);
+	    if (!h.count)
+		continue;
+	    sa << c << ' ' << h.count << ' ' << lh->to_ns(h.min) << ' '
+	       << lh->to_ns(h.sum / h.count);
+	    for (int i = 0; i < 5; ++i)
+		sa << ' ' << lh->to_ns(lh->percentile(h, ps[i]));
+	    sa << ' ' << lh->to_ns(h.max) << '\n';
+	}
+	return sa.take_string();
+    }
+    case h_unstamped: {
+	uint64_t unstamped = 0;
+	for (int t = 0; t < lh->_state.size(); ++t)
+	    unstamped += lh->_state[t].unstamped;
+	return String(unstamped);
+    }
+    case h_cycle_rate:
+	if (lh->_clock == LatencyStamp::clock_cycles)
+	    return String((uint64_t) (measure_cycle_rate() + 0.5));
+	return String();
+    default:
+	return "<error>";
+    }
+}
+
+int
+LatencyHistogram::param_handler(int, String &s, Element *e, const Handler *handler, ErrorHandler *errh)
+{
+    LatencyHistogram *lh = static_cast<LatencyHistogram *>(e);
+    intptr_t what = (intptr_t) handler->read_user_data();
+    String str = s.trim_space();
+    double p = 0;
+    if (what == h_percentile
+	&& !DoubleArg().parse(cp_shift_spacevec(str), p))
+	return errh->error("expected percentile");
+    if (p < 0 || p > 100)
+	return errh->error("percentile must be between 0 and 100");
+    int c = -1;
+    if (str && (!IntArg().parse(str, c) || c < 0 || c >= nclasses))
+	return errh->error("expected class");
+
+    Histogram h;
+    Vector<uint64_t> buckets;
+    lh->combine(c, h, buckets);
+    switch (what) {
+    case h_percentile:
+	s = String(lh->to_ns(lh->percentile(h, p)));
+	break;
+    case h_p50:
+	s = String(lh->to_ns(lh->percentile(h, 50)));
+	break;
+    case h_p90:
+	s = String(lh->to_ns(lh->percentile(h, 90)));
+	break;
+    case h_p99:
+	s = String(lh->to_ns(lh->percentile(h, 99)));
+	break;
+    case h_p999:
+	s = String(lh->to_ns(lh->percentile(h, 99.9)));
+	break;
+    case h_p9999:
+	s = String(lh->to_ns(lh->percentile(h, 99.99)));
+	break;
+    case h_min:
+	s = String(h.count ? lh->to_ns(h.min) : 0);
+	break;
+    case h_max:
+	s = String(lh->to_ns(h.max));
+	break;
+    case h_mean:
+	s = String(h.count ? lh->to_ns(h.sum / h.count) : 0);
+	break;
+    case h_count:
+	s = String(h.count);
+	break;
+    case h_histogram: {
+	StringAccum sa;
+	for (uint32_t b = 0; b < lh->nbuckets(); ++b)
+	    if (h.buckets[b])
+		sa << lh->to_ns(lh->bucket_low(b)) << ' '
+		   << lh->to_ns(lh->bucket_high(b)) << ' ' << h.buckets[b] << '\n';
+	s = sa.take_string();
+	break;
+    }
+    }
+    return 0;
+}
+
+int
+LatencyHistogram::reset_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    static_cast<LatencyHistogram *>(e)->reset();
+    return 0;
+}
+
+void
+LatencyHistogram::add_handlers()
+{
+    static const char * const names[] = {
+	"percentile", "p50", "p90", "p99", "p999", "p9999",
+	"min", "max", "mean", "count", "histogram"
+    };
+    for (int i = h_percentile; i <= h_histogram; ++i)
+	set_handler(names[i], Handler::f_read | Handler::f_read_param, param_handler, i);
+    add_read_handler("summary", read_handler, h_summary);
+    add_read_handler("unstamped", read_handler, h_unstamped);
+    add_read_handler("cycle_rate", read_handler, h_cycle_rate);
+    add_write_handler("reset", reset_handler, 0, Handler::f_button);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel LatencyStamp)
+EXPORT_ELEMENT(LatencyHistogram)
@@ -0,0 +1,285 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_LATENCYHISTOGRAM_HH
+#define CLICK_LATENCYHISTOGRAM_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/integers.hh>
+#include <click/vector.hh>
+#include "latencystamp.hh"
+CLICK_DECLS
+
+/*
+=c
+
+LatencyHistogram([I<KEYWORDS>])
+
+=s timestamps
+
+measures latency distributions of stamped packets
+
+=d
+
+LatencyHistogram measures the latency of packets stamped by LatencyStamp:
+the time from the stamp to the packet's arrival at LatencyHistogram. It
+keeps the full distribution of latencies, not just their average, in a
+log-linear histogram like HdrHistogram's. Each power of two is split into
+2^PRECISION buckets, so every latency is recorded to within a relative error
+of 2^-PRECISION, 0.8% for the default PRECISION of 7, and latencies below
+2^(PRECISION+1) clock units are recorded exactly. Histograms cover latencies
+up to 2^48 clock units, a day or more for every clock; longer latencies
+count as 2^48 - 1.
+
+CLOCK must match the clock of the stamps, except that C<timestamp> takes
+each packet's timestamp annotation as its arrival time, rather than the
+current time. This measures latency up to the moment the packet was
+received, excluding the time it then spent in the configuration. C<cycles>
+clock readings are converted to nanoseconds with a cycle rate measured at
+initialization, and assume that all CPUs' cycle counters are synchronized
+and run at a constant rate, as is the case for the invariant TSC of modern
+x86 processors.
+
+With CLASS, LatencyHistogram keeps a separate histogram for each value of a
+one-byte annotation, such as the paint annotation, so it can measure the
+latency of different classes of flows separately. Class histograms take
+memory only once a packet of that class arrives.
+
+Each thread updates its own histograms, so LatencyHistogram needs no
+locking. Handlers add the threads' histograms together.
+
+LatencyHistogram may have one or two outputs. Packets without a stamp,
+meaning a zero stamp annotation or, with OFFSET, no valid stamp record, are
+emitted on the second output if there is one, and otherwise passed through
+unmeasured.
+
+Keyword arguments are:
+
+=over 8
+
+=item CLOCK
+
+One of C<cycles>, C<system>, and C<timestamp>. Default is C<cycles>.
+
+=item ANNO
+
+Annotation name. The 8-byte annotation holding the stamp. Default is
+PERFCTR.
+
+=item OFFSET
+
+Unsigned. If given, read the stamp record at this offset in the packet data,
+rather than from an annotation. Records whose signature shows another
+clock's stamp count as unstamped.
+
+=item CLASS
+
+Annotation name. The one-byte annotation holding the packet's class, such as
+PAINT. Default is to keep a single histogram.
+
+=item PRECISION
+
+Unsigned. Log base 2 of the number of buckets per power of two, between 1
+and 12. Default is 7. Each class histogram takes (49 - PRECISION) *
+2^PRECISION * 8 bytes per thread: 43 kilobytes at the default.
+
+=back
+
+=n
+
+Stamps later than the arrival time, which can happen if the stamp and the
+arrival time come from different machines, count as zero latency.
+
+In parallel trace mode (see click(1)), the histograms of all copies are
+added together when the driver stops.
+
+All latencies are reported in nanoseconds. Percentiles are reported as the
+largest latency the percentile's bucket can hold, clipped to the largest
+latency seen, so they never understate the latency.
+
+=h percentile "read with parameters"
+
+Takes a percentile between 0 and 100, such as C<99.9>, and optionally a
+class, and returns that percentile of the latency distribution. Without a
+class, the distribution covers all classes.
+
+=h p50 "read with parameters"
+
+Returns the median latency. Takes an optional class, as do the following
+handlers.
+
+=h p90 "read with parameters"
+
+Returns the 90th percentile of latency.
+
+=h p99 "read with parameters"
+
+Returns the 99th percentile of latency.
+
+=h p999 "read with parameters"
+
+Returns the 99.9th percentile of latency.
+
+=h p9999 "read with parameters"
+
+Returns the 99.99th percentile of latency.
+
+=h min "read with parameters"
+
+Returns the smallest latency.
+
+=h max "read with parameters"
+
+Returns the largest latency.
+
+=h mean "read with parameters"
+
+Returns the mean latency.
+
+=h count "read with parameters"
+
+Returns the number of packets measured.
+
+=h histogram "read with parameters"
+
+Returns the nonempty buckets, one per line, in increasing order of latency.
+Each line contains the smallest and largest latencies the bucket holds, and
+the number of packets in the bucket, separated by spaces.
+
+=h summary read-only
+
+Returns one line per class that has measured packets, containing the class,
+the packet count, and the minimum, mean, 50th, 90th, 99th, 99.9th, and
+99.99th percentile, and maximum latencies, separated by spaces.
+
+=h unstamped read-only
+
+Returns the number of packets without a stamp.
+
+=h cycle_rate read-only
+
+Returns the measured cycle counter rate, in cycles per second, if CLOCK is
+C<cycles>.
+
+=h reset write-only
+
+Forgets all latencies.
+
+=e
+
+Measure the latency of a forwarding path under load, separately for
+interactive and bulk traffic:
+
+  FromDPDKDevice(0)
+    -> LatencyStamp
+    -> c :: IPClassifier(tcp port 22, -);
+  c[0] -> Paint(1) -> ...;
+  c[1] -> Paint(2) -> ...;
+  ...
+    -> lat :: LatencyHistogram(CLASS PAINT)
+    -> ToDPDKDevice(1);
+
+and then read C<lat.p999 1> and C<lat.p999 2>, or C<lat.summary>.
+
+=a
+
+LatencyStamp, TimestampAccum, CycleCountAccum, FromDPDKDevice */
+
+class LatencyHistogram : public Element { public:
+
+    LatencyHistogram() CLICK_COLD;
+    ~LatencyHistogram() CLICK_COLD;
+
+    const char *class_name() const	{ return "LatencyHistogram"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+    Packet *pull(int);
+
+    /** @brief A latency histogram.
+     *
+     * Latencies are in clock units. The buckets array has nbuckets()
+     * entries. */
+    struct Histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t *buckets;
+	Histogram()
+	    : count(0), sum(0), min(~(uint64_t) 0), max(0), buckets(0) {
+	}
+    };
+
+    void reset();
+
+  private:
+
+    enum { nclasses = 256, max_bits = 48 };
+
+    struct ThreadState {
+	Histogram *classes[nclasses];	// allocated on first use
+	uint64_t unstamped;
+	ThreadState()
+	    : unstamped(0) {
+	    memset(classes, 0, sizeof(classes));
+	}
+    };
+
+    PerThread<ThreadState> _state;
+    LatencyStamp::Clock _clock;
+    int _anno;
+    int _offset;
+    int _class_anno;
+    int _precision;
+    double _ns_per_unit;
+
+    uint32_t nbuckets() const {
+	return (max_bits + 1 - _precision) << _precision;
+    }
+    inline uint32_t bucket(uint64_t v) const;
+    uint64_t bucket_low(uint32_t b) const;
+    uint64_t bucket_high(uint32_t b) const;
+
+    inline bool extract(const Packet *p, uint64_t &latency) const;
+    inline Packet *handle_packet(Packet *);
+    Histogram *make_class(ThreadState &ts, int c);
+    void combine(int c, Histogram &h, Vector<uint64_t> &buckets) const;
+    uint64_t percentile(const Histogram &h, double p) const;
+    uint64_t to_ns(uint64_t v) const {
+	return (uint64_t) (v * _ns_per_unit + 0.5);
+    }
+    static double measure_cycle_rate();
+
+    enum { h_percentile, h_p50, h_p90, h_p99, h_p999, h_p9999,
+	   h_min, h_max, h_mean, h_count, h_histogram,
+	   h_summary, h_unstamped, h_cycle_rate };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int param_handler(int, String &, Element *, const Handler *, ErrorHandler *);
+    static int reset_handler(const String &, Element *, void *, ErrorHandler *);
+
+};
+
+/** @brief Return the bucket holding latency @a v.
+ *
+ * Latencies below 2^(PRECISION+1) have buckets of their own. Above that,
+ * a latency whose most significant bit is bit PRECISION + s falls in one of
+ * the 2^PRECISION buckets of width 2^s that cover that power of two. */
+inline uint32_t
+LatencyHistogram::bucket(uint64_t v) const
+{
+    if (v >> max_bits)
+	v = ((uint64_t) 1 << max_bits) - 1;
+    if (v < ((uint64_t) 2 << _precision))
+	return v;
+    int shift = 64 - ffs_msb(v) - _precision;
+    return (shift << _precision) + (v >> shift);
+}
+
+CLICK_ENDDECLS
+#endif
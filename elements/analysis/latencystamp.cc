@@ -0,0 +1,96 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * latencystamp.{cc,hh} -- stamp packets for latency measurement
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "latencystamp.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/integers.hh>
+#include <click/packet_anno.hh>
+CLICK_DECLS
+
+LatencyStamp::LatencyStamp()
+{
+}
+
+LatencyStamp::~LatencyStamp()
+{
+}
+
+int
+LatencyStamp::parse_clock(const String &str, Clock &clock)
+{
+    if (str.equals("cycles", 6))
+	clock = clock_cycles;
+    else if (str.equals("system", 6))
+	clock = clock_system;
+    else if (str.equals("timestamp", 9))
+	clock = clock_timestamp;
+    else
+	return -1;
+    return 0;
+}
+
+const char *
+LatencyStamp::unparse_clock(Clock clock)
+{
+    static const char * const names[] = { "cycles", "system", "timestamp" };
+    return names[clock];
+}
+
+int
+LatencyStamp::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String clock = "cycles";
+    int anno = PERFCTR_ANNO_OFFSET, offset = -1;
+    if (Args(conf, this, errh)
+	.read("CLOCK", WordArg(), clock)
+	.read("ANNO", AnnoArg(8), anno)
+	.read("OFFSET", offset)
+	.complete() < 0)
+	return -1;
+    if (parse_clock(clock, _clock) < 0)
+	return errh->error("CLOCK must be %<cycles%>, %<system%>, or %<timestamp%>");
+    if (_clock == clock_cycles && click_get_cycles() == 0)
+	return errh->error("no cycle counter on this platform");
+    _anno = anno;
+    _offset = offset;
+    return 0;
+}
+
+Packet *
+LatencyStamp::simple_action(Packet *p)
+{
+    uint64_t stamp = now(_clock, p);
+    if (_offset < 0) {
+	p->set_anno_u64(_anno, stamp);
+	return p;
+    }
+
+    int delta = _offset + record_size - p->length();
+    if (WritablePacket *q = p->put(delta < 0 ? 0 : delta)) {
+	uint32_t sig = htonl(clock_signature(_clock));
+	stamp = htonq(stamp);
+	memcpy(q->data() + _offset, &sig, 4);
+	memcpy(q->data() + _offset + 4, &stamp, 8);
+	return q;
+    } else
+	return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(int64)
+EXPORT_ELEMENT(LatencyStamp)
+ELEMENT_MT_SAFE(LatencyStamp)
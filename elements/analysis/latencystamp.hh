@@ -0,0 +1,136 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_LATENCYSTAMP_HH
+#define CLICK_LATENCYSTAMP_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+LatencyStamp([I<KEYWORDS>])
+
+=s timestamps
+
+stamps packets for latency measurement
+
+=d
+
+LatencyStamp records the current time in each packet it sees, so that a
+LatencyHistogram further along can measure how long the packet took to get
+there. The stamp is a 64-bit clock reading, stored either in an annotation
+or, with OFFSET, in the packet data.
+
+CLOCK chooses the clock:
+
+=over 8
+
+=item C<cycles>
+
+The CPU's cycle counter (the TSC on x86). This is the cheapest clock, and
+the most precise, but it can only be compared on the same machine.
+
+=item C<system>
+
+The system clock, in nanoseconds.
+
+=item C<timestamp>
+
+The packet's timestamp annotation, in nanoseconds. This is the system clock
+reading taken when the packet was received, such as the receive time
+FromDevice.u records, or the time FromDPDKDevice read the packet's burst
+with TIMESTAMP set. Stamping it measures latency from the moment Click
+received the packet.
+
+=back
+
+C<system> and C<timestamp> stamps are comparable with each other.
+
+With OFFSET, LatencyStamp writes a 12-byte record at that offset in the
+packet data, extending the packet if necessary: a 4-byte signature, which
+identifies the record and its clock, followed by the stamp, both in network
+byte order. LatencyHistogram ignores packets without a valid record, so
+stamped and unstamped packets can be mixed. Payload stamps survive leaving
+the router, so two Click routers can measure the latency of the network
+between them.
+
+Keyword arguments are:
+
+=over 8
+
+=item CLOCK
+
+One of C<cycles>, C<system>, and C<timestamp>. Default is C<cycles>.
+
+=item ANNO
+
+Annotation name. The 8-byte annotation in which to store the stamp. Default
+is PERFCTR, the annotation SetCycleCount uses.
+
+=item OFFSET
+
+Unsigned. If given, store the stamp in the packet data at this offset,
+rather than in an annotation.
+
+=back
+
+=e
+
+Measure the latency of a queue in cycles:
+
+  ... -> LatencyStamp -> Queue -> ... -> lat :: LatencyHistogram -> ...
+
+=a
+
+LatencyHistogram, SetCycleCount, StoreTimestamp, FromDPDKDevice */
+
+class LatencyStamp : public Element { public:
+
+    LatencyStamp() CLICK_COLD;
+    ~LatencyStamp() CLICK_COLD;
+
+    const char *class_name() const	{ return "LatencyStamp"; }
+    const char *port_count() const	{ return PORTS_1_1; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    bool can_live_reconfigure() const	{ return true; }
+
+    Packet *simple_action(Packet *);
+
+    enum Clock {
+	clock_cycles = 0, clock_system = 1, clock_timestamp = 2
+    };
+    enum {
+	signature = 0x4C415400U,	// "LAT" followed by the stamp's clock
+	record_size = 12
+    };
+
+    static int parse_clock(const String &str, Clock &clock);
+    static const char *unparse_clock(Clock clock);
+
+    /** @brief Return the signature of payload stamps taken with @a clock.
+     *
+     * Stamps from @a clock_system and @a clock_timestamp share a signature,
+     * since they come from the same clock. */
+    static inline uint32_t clock_signature(Clock clock) {
+	return signature | (clock == clock_cycles ? 1 : 2);
+    }
+
+    static inline uint64_t now(Clock clock, const Packet *p) {
+	if (clock == clock_cycles)
+	    return click_get_cycles();
+	else if (clock == clock_system)
+	    return Timestamp::now().nsecval();
+	else
+	    return p->timestamp_anno().nsecval();
+    }
+
+  private:
+
+    Clock _clock;
+    int _anno;
+    int _offset;
+
+};
+
+CLICK_ENDDECLS
+#endif
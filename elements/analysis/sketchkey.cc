@@ -0,0 +1,184 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * sketchkey.{cc,hh} -- packet keys and hashes for sketch elements
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "sketchkey.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/ipaddress.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+#include <clicknet/udp.h>
+CLICK_DECLS
+
+// multiples of the golden ratio, so every row hashes differently
+const uint32_t SketchKey::row_seeds[SketchKey::max_rows] = {
+    0x9E3779B9, 0x3C6EF372, 0xDAA66D2B, 0x78DDE6E4,
+    0x1715609D, 0xB54CDA56, 0x5384540F, 0xF1BBCDC8,
+    0x8FF34781, 0x2E2AC13A, 0xCC623AF3, 0x6A99B4AC,
+    0x08D12E65, 0xA708A81E, 0x454021D7, 0xE3779B90
+};
+
+SketchKey::SketchKey()
+    : _anno(-1), _anno_size(0), _offset(0), _nbytes(0), _shift(0), _mask(0),
+      _ip_prefix(false), _bytes(false), _ip_bytes(false),
+      _use_packet_count(true), _use_extra_length(true)
+{
+}
+
+int
+SketchKey::configure_keywords(Vector<String> &conf, Element *e, ErrorHandler *errh)
+{
+    bool bytes = false, ip_bytes = false, packet_count = true, extra_length = true;
+    if (Args(e, errh).bind(conf)
+	.read("BYTES", bytes)
+	.read("IP_BYTES", ip_bytes)
+	.read("MULTIPACKET", packet_count)
+	.read("EXTRA_LENGTH", extra_length)
+	.consume() < 0)
+	return -1;
+    _bytes = bytes;
+    _ip_bytes = ip_bytes;
+    _use_packet_count = packet_count;
+    _use_extra_length = extra_length;
+    return 0;
+}
+
+int
+SketchKey::parse(const String &str, Element *e, ErrorHandler *errh)
+{
+    String s = str.trim_space();
+    String word = cp_shift_spacevec(s);
+    if (word.equals("anno", 4) || word.equals("ANNO", 4)) {
+	int annoval;
+	if (!AnnoArg(0).parse(s, annoval, e))
+	    return errh->error("KEY: bad annotation %<%s%>", s.c_str());
+	_anno = ANNOTATIONINFO_OFFSET(annoval);
+	_anno_size = ANNOTATIONINFO_SIZE(annoval);
+	if (_anno_size != 1 && _anno_size != 2 && _anno_size != 8)
+	    _anno_size = 4;
+	if (_anno + _anno_size > Packet::anno_size)
+	    return errh->error("KEY: annotation %<%s%> out of range", s.c_str());
+	_mask = (_anno_size == 8 ? ~(uint64_t) 0 : ((uint64_t) 1 << (8 * _anno_size)) - 1);
+	_ip_prefix = false;
+	_anno_name = s;
+	return 0;
+    }
+
+    _anno = -1;
+    const char *end = IPField::parse(str.begin(), str.end(), -1, &_f, errh, e);
+    if (end == str.begin())
+	return -1;
+    else if (end != str.end())
+	return errh->error("KEY: garbage after field specification");
+    int bit_offset = _f.bit_offset(), bit_length = _f.bit_length();
+    _offset = bit_offset / 8;
+    _nbytes = (bit_offset % 8 + bit_length + 7) / 8;
+    if (_nbytes > 8)
+	return errh->error("KEY: field too long, max 64 bits");
+    _shift = _nbytes * 8 - bit_offset % 8 - bit_length;
+    _mask = (bit_length == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << bit_length) - 1);
+    _ip_prefix = _f.proto() == 0 && bit_length <= 32
+	&& (bit_offset == 12 * 8 || bit_offset == 16 * 8);
+    return 0;
+}
+
+String
+SketchKey::unparse(Element *e) const
+{
+    if (_anno >= 0)
+	return "anno " + _anno_name;
+    else
+	return const_cast<IPField &>(_f).unparse(e, false);
+}
+
+bool
+SketchKey::extract_field(const Packet *p, uint64_t &key) const
+{
+    if (!p->has_network_header())
+	return false;
+
+    // find the header as AggregateIP does
+    const click_ip *iph = p->ip_header();
+    int offset = p->length();
+    switch (_f.proto()) {
+    case 0:
+	offset = p->network_header_offset();
+	break;
+    case IP_PROTO_TCP_OR_UDP:
+	if (IP_FIRSTFRAG(iph) && (iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP))
+	    offset = p->transport_header_offset();
+	break;
+    case IP_PROTO_TRANSP:
+	if (IP_FIRSTFRAG(iph))
+	    offset = p->transport_header_offset();
+	break;
+    case IP_PROTO_PAYLOAD:
+	if (!IP_FIRSTFRAG(iph))
+	    /* bad; will be rejected below */;
+	else if (iph->ip_p == IP_PROTO_TCP && p->transport_header_offset() + sizeof(click_tcp) <= p->length()) {
+	    const click_tcp *tcph = (const click_tcp *) p->transport_header();
+	    offset = p->transport_header_offset() + (tcph->th_off << 2);
+	} else if (iph->ip_p == IP_PROTO_UDP)
+	    offset = p->transport_header_offset() + sizeof(click_udp);
+	break;
+    default:
+	if (IP_FIRSTFRAG(iph) && iph->ip_p == _f.proto())
+	    offset = p->transport_header_offset();
+	break;
+    }
+    offset += _offset;
+
+    if (offset + _nbytes > (int) p->length())
+	return false;
+    const uint8_t *x = p->data() + offset;
+    uint64_t v = 0;
+    for (int i = 0; i < _nbytes; ++i)
+	v = (v << 8) | x[i];
+    key = (v >> _shift) & _mask;
+    return true;
+}
+
+String
+SketchKey::unparse_key(uint64_t key) const
+{
+    if (_ip_prefix) {
+	int len = _f.bit_length();
+	IPAddress a(htonl(len ? (uint32_t) key << (32 - len) : 0));
+	return len == 32 ? a.unparse() : a.unparse() + "/" + String(len);
+    } else
+	return String(key);
+}
+
+bool
+SketchKey::parse_key(const String &str, uint64_t &key, Element *e) const
+{
+    if (_ip_prefix) {
+	IPAddress a, mask;
+	int len = _f.bit_length();
+	if (IPAddressArg().parse(str, a, e))
+	    /* OK */;
+	else if (!IPPrefixArg().parse(str, a, mask, e)
+		 || mask.mask_to_prefix_len() != len)
+	    return false;
+	key = len ? ntohl(a.addr()) >> (32 - len) : 0;
+	return true;
+    } else
+	return IntArg().parse(str, key) && (key & ~_mask) == 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel IPFieldInfo)
+ELEMENT_PROVIDES(SketchKey)
@@ -0,0 +1,169 @@
+// -*- related-file-name: "sketchkey.cc"; c-basic-offset: 4 -*-
+#ifndef CLICK_SKETCHKEY_HH
+#define CLICK_SKETCHKEY_HH
+#include <click/element.hh>
+#include <click/packet_anno.hh>
+#include "elements/ip/ipfieldinfo.hh"
+#if CLICK_USERLEVEL && defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#if CLICK_USERLEVEL && defined(__SSE4_1__)
+# include <smmintrin.h>
+#endif
+CLICK_DECLS
+
+/** @class SketchKey
+ * @brief Packet key and count for sketch elements.
+ *
+ * SketchKey holds the KEY argument and counting keywords shared by
+ * CountMinSketch, SpaceSaving, and HyperLogLog. It extracts each packet's
+ * key, either an annotation (<tt>"anno AGGREGATE"</tt>) or a packet field as
+ * accepted by AggregateIP (<tt>"ip src/24"</tt>), and the amount the packet
+ * adds to its key's count. It also supplies the sketches' hash functions. */
+class SketchKey { public:
+
+    SketchKey();
+
+    int configure_keywords(Vector<String> &conf, Element *e, ErrorHandler *errh) CLICK_COLD;
+    int parse(const String &str, Element *e, ErrorHandler *errh) CLICK_COLD;
+    String unparse(Element *e) const;
+
+    /** @brief Set @a key to @a p's key.
+     * @return true if @a p has a key */
+    inline bool extract(const Packet *p, uint64_t &key) const;
+    inline uint32_t amount(const Packet *p) const;
+
+    String unparse_key(uint64_t key) const;
+    bool parse_key(const String &str, uint64_t &key, Element *e) const;
+
+    static inline uint64_t hash(uint64_t key);
+    static inline void row_hashes(uint64_t h, const uint32_t *seeds,
+				  int n, uint32_t *out);
+
+    enum { max_rows = 16 };
+    static const uint32_t row_seeds[max_rows];
+
+  private:
+
+    int _anno;
+    int _anno_size;
+    String _anno_name;
+    IPField _f;
+    int _offset;		// byte offset of field within its header
+    int _nbytes;		// bytes spanned by field
+    int _shift;
+    uint64_t _mask;
+    bool _ip_prefix;
+
+    bool _bytes;
+    bool _ip_bytes;
+    bool _use_packet_count;
+    bool _use_extra_length;
+
+    bool extract_field(const Packet *p, uint64_t &key) const;
+
+};
+
+inline bool
+SketchKey::extract(const Packet *p, uint64_t &key) const
+{
+    if (_anno < 0)
+	return extract_field(p, key);
+    switch (_anno_size) {
+    case 1:
+	key = p->anno_u8(_anno);
+	break;
+    case 2:
+	key = p->anno_u16(_anno);
+	break;
+    case 8:
+	key = p->anno_u64(_anno);
+	break;
+    default:
+	key = p->anno_u32(_anno);
+	break;
+    }
+    return true;
+}
+
+inline uint32_t
+SketchKey::amount(const Packet *p) const
+{
+    if (!_bytes)
+	return 1 + (_use_packet_count ? EXTRA_PACKETS_ANNO(p) : 0);
+    uint32_t amount = p->length() + (_use_extra_length ? EXTRA_LENGTH_ANNO(p) : 0);
+    if (_ip_bytes && p->has_network_header())
+	amount -= p->network_header_offset();
+    return amount;
+}
+
+/** @brief Return a 64-bit hash of @a key.
+ *
+ * This is MurmurHash3's 64-bit finalizer, a bijection whose every output
+ * bit depends on every input bit. */
+inline uint64_t
+SketchKey::hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+#if CLICK_USERLEVEL && defined(__SSE2__)
+static inline __m128i
+sketch_mullo_epi32(__m128i a, __m128i b)
+{
+# if defined(__SSE4_1__)
+    return _mm_mullo_epi32(a, b);
+# else
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			      _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+# endif
+}
+#endif
+
+/** @brief Derive @a n independent 32-bit row hashes from hash @a h.
+ * @param h key hash, from hash()
+ * @param seeds @a n row seeds
+ * @param n number of rows
+ * @param[out] out @a n row hashes
+ *
+ * Row i's hash is MurmurHash3's 32-bit finalizer applied to @a h's low word
+ * XORed with seeds[i], XORed with @a h's high word. With SSE2, four rows are
+ * hashed at once. */
+inline void
+SketchKey::row_hashes(uint64_t h, const uint32_t *seeds, int n, uint32_t *out)
+{
+    uint32_t lo = h, hi = h >> 32;
+    int i = 0;
+#if CLICK_USERLEVEL && defined(__SSE2__)
+    __m128i vlo = _mm_set1_epi32(lo), vhi = _mm_set1_epi32(hi),
+	c1 = _mm_set1_epi32(0x85EBCA6B), c2 = _mm_set1_epi32(0xC2B2AE35);
+    for (; i + 4 <= n; i += 4) {
+	__m128i x = _mm_xor_si128(vlo, _mm_loadu_si128(reinterpret_cast<const __m128i *>(seeds + i)));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	x = sketch_mullo_epi32(x, c1);
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 13));
+	x = sketch_mullo_epi32(x, c2);
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_xor_si128(x, vhi));
+    }
+#endif
+    for (; i < n; ++i) {
+	uint32_t x = lo ^ seeds[i];
+	x ^= x >> 16;
+	x *= 0x85EBCA6B;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35;
+	x ^= x >> 16;
+	out[i] = x ^ hi;
+    }
+}
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,343 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * spacesaving.{cc,hh} -- find heavy hitters with the Space-Saving algorithm
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "spacesaving.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/hashtable.hh>
+CLICK_DECLS
+
+SpaceSaving::SpaceSaving()
+{
+}
+
+SpaceSaving::~SpaceSaving()
+{
+}
+
+int
+SpaceSaving::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String key;
+    uint32_t capacity = 1000;
+    if (_key.configure_keywords(conf, this, errh) < 0
+	|| Args(conf, this, errh)
+	.read_mp("KEY", AnyArg(), key)
+	.read("CAPACITY", capacity)
+	.complete() < 0)
+	return -1;
+    if (capacity == 0 || capacity > 0x1000000)
+	return errh->error("CAPACITY must be between 1 and %u", 0x1000000U);
+    if (_key.parse(key, this, errh) < 0)
+	return -1;
+    _capacity = capacity;
+    return 0;
+}
+
+int
+SpaceSaving::initialize(ErrorHandler *errh)
+{
+    if (_state.resize() < 0)
+	return errh->error("out of memory");
+    for (int t = 0; t < _state.size(); ++t) {
+	if (_state[t].table.reserve(_capacity) < 0)
+	    return errh->error("out of memory");
+	_state[t].heap.reserve(_capacity);
+    }
+    return 0;
+}
+
+void
+SpaceSaving::cleanup(CleanupStage)
+{
+    _state.clear();
+}
+
+void
+SpaceSaving::reset()
+{
+    for (int t = 0; t < _state.size(); ++t) {
+	_state[t].table.clear();
+	_state[t].heap.clear();
+	_state[t].count = 0;
+    }
+}
+
+void
+SpaceSaving::sift_up(ThreadState &ts, uint32_t pos)
+{
+    uint32_t x = ts.heap[pos];
+    uint64_t count = ts.table.value(x).count;
+    while (pos > 0) {
+	uint32_t parent = (pos - 1) / 2;
+	uint32_t y = ts.heap[parent];
+	if (ts.table.value(y).count <= count)
+	    break;
+	ts.heap[pos] = y;
+	ts.table.value(y).heap_pos = pos;
+	pos = parent;
+    }
+    ts.heap[pos] = x;
+    ts.table.value(x).heap_pos = pos;
+}
+
+void
+SpaceSaving::sift_down(ThreadState &ts, uint32_t pos)
+{
+    uint32_t n = ts.heap.size();
+    uint32_t x = ts.heap[pos];
+    uint64_t count = ts.table.value(x).count;
+    while (1) {
+	uint32_t child = 2 * pos + 1;
+	if (child >= n)
+	    break;
+	if (child + 1 < n
+	    && ts.table.value(ts.heap[child + 1]).count < ts.table.value(ts.heap[child]).count)
+	    ++child;
+	uint32_t y = ts.heap[child];
+	if (count <= ts.table.value(y).count)
+	    break;
+	ts.heap[pos] = y;
+	ts.table.value(y).heap_pos = pos;
+	pos = child;
+    }
+    ts.heap[pos] = x;
+    ts.table.value(x).heap_pos = pos;
+}
+
+inline void
+SpaceSaving::update(ThreadState &ts, uint64_t key, uint32_t amount)
+{
+    ts.count += amount;
+    uint32_t i = ts.table.find_index(key);
+    if (i != Table::invalid_index) {
+	Counter &c = ts.table.value(i);
+	c.count += amount;
+	sift_down(ts, c.heap_pos);
+	return;
+    }
+
+    // a new key takes over the smallest counter once all are in use
+    Counter old;
+    uint32_t pos = ts.heap.size();
+    if (pos == _capacity) {
+	old = ts.table.value(ts.heap[0]);
+	ts.table.erase_index(ts.heap[0]);
+	pos = 0;
+    }
+    bool inserted;
+    Counter *c = ts.table.find_insert(key, inserted);
+    if (!c) {
+	// no room in the table, which is rare: drop the old key's counter
+	if (pos == 0) {
+	    ts.heap[0] = ts.heap.back();
+	    ts.heap.pop_back();
+	    if (ts.heap.size())
+		sift_down(ts, 0);
+	}
+	return;
+    }
+    c->count = old.count + amount;
+    c->error = old.count;
+    if ((int) pos == ts.heap.size())
+	ts.heap.push_back(0);
+    ts.heap[pos] = ts.table.find_index(key);
+    if (pos == 0)
+	sift_down(ts, 0);
+    else
+	sift_up(ts, pos);
+}
+
+inline Packet *
+SpaceSaving::handle_packet(Packet *p)
+{
+    uint64_t key;
+    if (_key.extract(p, key))
+	update(_state[click_current_cpu_id()], key, _key.amount(p));
+    else if (noutputs() == 2) {
+	output(1).push(p);
+	return 0;
+    }
+    return p;
+}
+
+void
+SpaceSaving::push(int, Packet *p)
+{
+    if (Packet *q = handle_packet(p))
+	output(0).push(q);
+}
+
+Packet *
+SpaceSaving::pull(int)
+{
+    Packet *p = input(0).pull();
+    if (p)
+	p = handle_packet(p);
+    return p;
+}
+
+static int
+item_compar(const void *av, const void *bv, void *)
+{
+    const SpaceSaving::Item *a = static_cast<const SpaceSaving::Item *>(av);
+    const SpaceSaving::Item *b = static_cast<const SpaceSaving::Item *>(bv);
+    if (a->count != b->count)
+	return a->count > b->count ? -1 : 1;
+    else if (a->key != b->key)
+	return a->key < b->key ? -1 : 1;
+    else
+	return 0;
+}
+
+/** @brief Merge summaries @a s[0] through @a s[@a n - 1].
+ *
+ * A key missing from a full summary might have had up to that summary's
+ * smallest count, so it is charged that count, as both count and error.
+ * The result holds at most CAPACITY items, in decreasing order of count. */
+void
+SpaceSaving::merge(const ThreadState *const *s, int n, Vector<Item> &items) const
+{
+    uint64_t base = 0;
+    for (int t = 0; t < n; ++t)
+	base += s[t]->min_count(_capacity);
+
+    HashTable<uint64_t, int> index(-1);
+    items.clear();
+    for (int t = 0; t < n; ++t) {
+	const Table &table = s[t]->table;
+	uint64_t min = s[t]->min_count(_capacity);
+	for (uint32_t i = 0; i != table.index_limit(); ++i)
+	    if (table.live(i)) {
+		int &x = index[table.key(i)];
+		if (x < 0) {
+		    x = items.size();
+		    Item it;
+		    it.key = table.key(i);
+		    it.count = it.error = base;
+		    items.push_back(it);
+		}
+		items[x].count += table.value(i).count - min;
+		items[x].error += table.value(i).error - min;
+	    }
+    }
+
+    click_qsort(items.begin(), items.size(), sizeof(Item), item_compar, 0);
+    if (items.size() > (int) _capacity)
+	items.resize(_capacity);
+}
+
+void
+SpaceSaving::topk(Vector<Item> &items) const
+{
+    Vector<const ThreadState *> s;
+    for (int t = 0; t < _state.size(); ++t)
+	s.push_back(&_state[t]);
+    merge(s.begin(), s.size(), items);
+}
+
+void
+SpaceSaving::assign(ThreadState &ts, const Vector<Item> &items)
+{
+    ts.table.clear();
+    ts.heap.clear();
+    for (const Item *it = items.begin(); it != items.end(); ++it) {
+	bool inserted;
+	if (Counter *c = ts.table.find_insert(it->key, inserted)) {
+	    c->count = it->count;
+	    c->error = it->error;
+	    ts.heap.push_back(ts.table.find_index(it->key));
+	    sift_up(ts, ts.heap.size() - 1);
+	}
+    }
+}
+
+void
+SpaceSaving::merge_state(Element *e, ErrorHandler *errh)
+{
+    SpaceSaving *o = static_cast<SpaceSaving *>(e->cast("SpaceSaving"));
+    if (!o || o->_capacity != _capacity || o->_state.size() != _state.size()) {
+	errh->warning("capacities differ, not merged");
+	return;
+    }
+    Vector<Item> items;
+    for (int t = 0; t < _state.size(); ++t) {
+	const ThreadState *s[2] = { &_state[t], &o->_state[t] };
+	merge(s, 2, items);
+	assign(_state[t], items);
+	_state[t].count += o->_state[t].count;
+    }
+}
+
+String
+SpaceSaving::read_handler(Element *e, void *thunk)
+{
+    SpaceSaving *ss = static_cast<SpaceSaving *>(e);
+    switch ((intptr_t) thunk) {
+    case h_count: {
+	uint64_t count = 0;
+	for (int t = 0; t < ss->_state.size(); ++t)
+	    count += ss->_state[t].count;
+	return String(count);
+    }
+    case h_key:
+	return ss->_key.unparse(e);
+    case h_capacity:
+	return String(ss->_capacity);
+    default:
+	return "<error>";
+    }
+}
+
+int
+SpaceSaving::topk_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh)
+{
+    SpaceSaving *ss = static_cast<SpaceSaving *>(e);
+    uint32_t limit = ss->_capacity;
+    if (s.trim_space() && !IntArg().parse(s.trim_space(), limit))
+	return errh->error("expected number of keys");
+    Vector<Item> items;
+    ss->topk(items);
+    StringAccum sa;
+    for (int i = 0; i < items.size() && (uint32_t) i < limit; ++i)
+	sa << ss->_key.unparse_key(items[i].key) << ' ' << items[i].count
+	   << ' ' << items[i].error << '\n';
+    s = sa.take_string();
+    return 0;
+}
+
+int
+SpaceSaving::reset_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    static_cast<SpaceSaving *>(e)->reset();
+    return 0;
+}
+
+void
+SpaceSaving::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("key", read_handler, h_key);
+    add_read_handler("capacity", read_handler, h_capacity);
+    set_handler("topk", Handler::f_read | Handler::f_read_param, topk_handler);
+    add_write_handler("reset", reset_handler, 0, Handler::f_button);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel SketchKey)
+EXPORT_ELEMENT(SpaceSaving)
+ELEMENT_MT_SAFE(SpaceSaving)
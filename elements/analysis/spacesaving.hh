@@ -0,0 +1,184 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_SPACESAVING_HH
+#define CLICK_SPACESAVING_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/vector.hh>
+#include "sketchkey.hh"
+CLICK_DECLS
+
+/*
+=c
+
+SpaceSaving(KEY, [I<KEYWORDS>])
+
+=s aggregates
+
+finds the keys with the largest packet or byte counts in fixed memory
+
+=d
+
+SpaceSaving finds the heavy hitters of a key, such as the source addresses
+that sent the most bytes, with the Space-Saving algorithm. It tracks at most
+CAPACITY keys. A key that is not tracked takes the place of the tracked key
+with the smallest count, inheriting that count as its error. Every key whose
+true count exceeds the total count divided by CAPACITY is tracked. A tracked
+key's count is never less than its true count, and exceeds it by at most its
+error.
+
+KEY says what to count by. It is either an annotation, written C<"anno
+NAME">, or a packet field as accepted by AggregateIP, such as C<"ip src">,
+C<"ip dst/24">, or C<"tcp dport">. Annotations of 1, 2, 4, or 8 bytes are
+read in host byte order; fields may be up to 64 bits long.
+
+Each thread keeps its own summary, indexed by a cuckoo hash table with a
+min-heap of counts, so SpaceSaving needs no locking. Handlers merge the
+threads' summaries; a key missing from a full summary is charged that
+summary's smallest count, so merged counts keep the same guarantees.
+
+SpaceSaving may have one or two outputs. Packets lacking the key are emitted
+on the second output if there is one, and otherwise passed through
+uncounted.
+
+Keyword arguments are:
+
+=over 8
+
+=item CAPACITY
+
+Unsigned. Number of keys tracked per thread. Default is 1000.
+
+=item BYTES
+
+Boolean. If true, then count bytes, not packets. Default is false.
+
+=item IP_BYTES
+
+Boolean. If true, then do not count bytes from the link header. Default is
+false.
+
+=item MULTIPACKET
+
+Boolean. If true, and BYTES is false, then use packets' packet count
+annotations to add to the number of packets seen. Default is true.
+
+=item EXTRA_LENGTH
+
+Boolean. If true, and BYTES is true, then include packets' extra length
+annotations in the byte counts. Default is true.
+
+=back
+
+=n
+
+In parallel trace mode (see click(1)), the summaries of all copies are
+merged when the driver stops.
+
+=h topk "read with parameters"
+
+Returns the tracked keys in decreasing order of count, one per line. Each
+line contains the key, its count, and its error, separated by spaces. The
+key's true count lies between count minus error and count. Takes an optional
+parameter, the maximum number of lines to return.
+
+=h count read-only
+
+Returns the total number of packets or bytes counted.
+
+=h key read-only
+
+Returns the KEY specification.
+
+=h capacity read-only
+
+Returns CAPACITY.
+
+=h reset write-only
+
+Forgets all keys.
+
+=e
+
+Find the 10 sources that sent the most bytes:
+
+  FromDump(trace.pcap, STOP true, FORCE_IP true)
+    -> ss :: SpaceSaving(ip src, BYTES true, CAPACITY 100)
+    -> Discard;
+
+and then read C<ss.topk 10>.
+
+=a
+
+CountMinSketch, HyperLogLog, AggregateCounter, AggregateIP */
+
+class SpaceSaving : public Element { public:
+
+    SpaceSaving() CLICK_COLD;
+    ~SpaceSaving() CLICK_COLD;
+
+    const char *class_name() const	{ return "SpaceSaving"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int, Packet *);
+    Packet *pull(int);
+
+    struct Item {
+	uint64_t key;
+	uint64_t count;
+	uint64_t error;
+    };
+    void topk(Vector<Item> &items) const;
+    void reset();
+
+  private:
+
+    struct Counter {
+	uint64_t count;
+	uint64_t error;
+	uint32_t heap_pos;
+	Counter()
+	    : count(0), error(0), heap_pos(0) {
+	}
+    };
+
+    typedef CuckooTable<uint64_t, Counter> Table;
+
+    struct ThreadState {
+	Table table;
+	Vector<uint32_t> heap;	// table indexes, min-heap by count
+	uint64_t count;
+	ThreadState()
+	    : count(0) {
+	}
+	uint64_t min_count(uint32_t capacity) const {
+	    return heap.size() == (int) capacity ? table.value(heap[0]).count : 0;
+	}
+    };
+
+    PerThread<ThreadState> _state;
+    uint32_t _capacity;
+    SketchKey _key;
+
+    inline void update(ThreadState &ts, uint64_t key, uint32_t amount);
+    inline Packet *handle_packet(Packet *);
+    static void sift_up(ThreadState &ts, uint32_t pos);
+    static void sift_down(ThreadState &ts, uint32_t pos);
+    void merge(const ThreadState *const *s, int n, Vector<Item> &items) const;
+    void assign(ThreadState &ts, const Vector<Item> &items);
+
+    enum { h_count, h_key, h_capacity };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int topk_handler(int, String &, Element *, const Handler *, ErrorHandler *);
+    static int reset_handler(const String &, Element *, void *, ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -30,24 +30,34 @@
 #include <time.h>
 CLICK_DECLS
 
+#ifdef i386
+# define PUT4(p, d)	*reinterpret_cast<uint32_t *>((p)) = htonl((d))
+#else
+# define PUT4(p, d)	do { (p)[0] = (d)>>24; (p)[1] = (d)>>16; (p)[2] = (d)>>8; (p)[3] = (d); } while (0)
+#endif
+#define PUT1(p, d)	((p)[0] = (d))
+
 ToIPSummaryDump::ToIPSummaryDump()
-    : _f(0), _task(this)
+    : _f(0), _task(this), _columns(0), _chunk_count(0), _file_offset(0)
 {
 }
 
 ToIPSummaryDump::~ToIPSummaryDump()
 {
+    delete[] _columns;
 }
 
 int
 ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     String save = "timestamp ip_src";
+    _chunk_size = 16384;
     bool verbose = false;
     bool bad_packets = false;
     bool careful_trunc = true;
     bool multipacket = false;
     bool binary = false;
+    bool columnar = false;
     bool header = true;
     bool extra_length = true;
 
@@ -64,8 +74,14 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("CAREFUL_TRUNC", careful_trunc)
 	.read("EXTRA_LENGTH", extra_length)
 	.read("BINARY", binary)
+	.read("COLUMNAR", columnar)
+	.read("CHUNK", _chunk_size)
 	.complete() < 0)
 	return -1;
+    if (binary && columnar)
+	return errh->error("BINARY and COLUMNAR are mutually exclusive");
+    if (_chunk_size == 0)
+	return errh->error("CHUNK must be positive");
 
     Vector<String> v;
     cp_spacevec(save, v);
@@ -93,6 +109,8 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	int s = f->binary_size();
 	if ((s < 0 || !f->outb) && binary)
 	    errh->error("cannot use field %s with BINARY", word.c_str());
+	else if ((s < 0 || !f->outb) && columnar)
+	    errh->error("cannot use field %s with COLUMNAR", word.c_str());
 	_binary_size += s;
 
 	// remove _multipacket if packet count specified
@@ -107,7 +125,10 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     _careful_trunc = careful_trunc;
     _multipacket = multipacket;
     _binary = binary;
+    _columnar = columnar;
     _header = header;
+    if (_columnar)
+	_columns = new StringAccum[_fields.size()];
     _extra_length = extra_length;
 
     return errh->nerrors() ? -1 : 0;
@@ -158,16 +179,20 @@ ToIPSummaryDump::initialize(ErrorHandler *errh)
     sa << "!data ";
     for (int i = 0; i < _fields.size(); i++)
 	sa << (i ? " " : "")
-	   << (strcmp(_fields[i]->name, "ntimestamp") == 0 && !_binary ? "timestamp" : _fields[i]->name);
+	   << (strcmp(_fields[i]->name, "ntimestamp") == 0 && !_binary && !_columnar ? "timestamp" : _fields[i]->name);
     sa << '\n';
 
     // binary marker
     if (_binary)
 	sa << "!binary\n";
+    else if (_columnar)
+	sa << "!columnar\n";
 
     // print output
-    if (_header)
+    if (_header) {
 	ignore_result(fwrite(sa.data(), 1, sa.length(), _f));
+	_file_offset = sa.length();
+    }
 
     return 0;
 }
@@ -175,6 +200,8 @@ ToIPSummaryDump::initialize(ErrorHandler *errh)
 void
 ToIPSummaryDump::cleanup(CleanupStage)
 {
+    if (_f && _columnar)
+	write_index();
     if (_f && _f != stdout)
 	fclose(_f);
     _f = 0;
@@ -196,6 +223,14 @@ ToIPSummaryDump::summary(Packet* p, StringAccum& sa, StringAccum* bad_sa) const
 	    _fields[i]->outb(d, ok, _fields[i]);
 	}
 	*(reinterpret_cast<uint32_t*>(sa.data())) = htonl(sa.length());
+    } else if (_columnar) {
+	for (int i = 0; i < _fields.size(); i++) {
+	    d.clear_values();
+	    d.sa = &_columns[i];
+	    bool ok = _fields[i]->extract(d, _fields[i]);
+	    _fields[i]->outb(d, ok, _fields[i]);
+	}
+	d.sa = &sa;
     } else {
 	for (int i = 0; i < _fields.size(); i++) {
 	    if (i)
@@ -244,6 +279,38 @@ ToIPSummaryDump::write_packet(Packet* p, int multipacket)
 		p->timestamp_anno() += timestamp_delta;
 	}
 
+    } else if (_columnar) {
+	_bad_sa.clear();
+	Vector<int> lengths;
+	if (_bad_packets)
+	    for (int i = 0; i < _fields.size(); i++)
+		lengths.push_back(_columns[i].length());
+
+	summary(p, _sa, (_bad_packets ? &_bad_sa : 0));
+
+	if (_bad_packets && _bad_sa) {
+	    // The '!bad' line precedes the packet, so end the chunk without it.
+	    Vector<String> record;
+	    for (int i = 0; i < _fields.size(); i++) {
+		record.push_back(String(_columns[i].begin() + lengths[i], _columns[i].end()));
+		_columns[i].set_length(lengths[i]);
+	    }
+	    write_line(_bad_sa.take_string());
+	    for (int i = 0; i < _fields.size(); i++)
+		_columns[i] << record[i];
+	}
+
+	const Timestamp &ts = p->timestamp_anno();
+	if (_chunk_count == 0)
+	    _chunk_first = _chunk_last = ts;
+	else if (ts < _chunk_first)
+	    _chunk_first = ts;
+	else if (ts > _chunk_last)
+	    _chunk_last = ts;
+	if (++_chunk_count == _chunk_size)
+	    write_chunk();
+
+	_output_count++;
     } else {
 	_sa.clear();
 	_bad_sa.clear();
@@ -258,6 +325,79 @@ ToIPSummaryDump::write_packet(Packet* p, int multipacket)
     }
 }
 
+void
+ToIPSummaryDump::write_block(uint32_t tag, const char *data, uint32_t length)
+{
+    uint32_t header[2];
+    header[0] = htonl(tag);
+    header[1] = htonl(length + 8);
+    ignore_result(fwrite(header, 4, 2, _f));
+    ignore_result(fwrite(data, 1, length, _f));
+    _file_offset += length + 8;
+}
+
+void
+ToIPSummaryDump::write_chunk()
+{
+    if (!_chunk_count)
+	return;
+
+    _sa.clear();
+    char *x = _sa.extend(IPSummaryDump::CHUNK_HEADER_SIZE - 8);
+    PUT4(x, _chunk_count);
+    PUT4(x + 4, _chunk_first.sec());
+    PUT4(x + 8, _chunk_first.nsec());
+    PUT4(x + 12, _chunk_last.sec());
+    PUT4(x + 16, _chunk_last.nsec());
+
+    for (int i = 0; i < _fields.size(); i++) {
+	int pos = _sa.length();
+	_sa.extend(5);
+	int width = IPSummaryDump::binary_width(_fields[i]->type);
+	int encoding = IPSummaryDump::encode_column
+	    (_sa, (const uint8_t *) _columns[i].data(), _columns[i].length(),
+	     _chunk_count, width);
+	x = _sa.data() + pos;
+	PUT1(x, encoding);
+	PUT4(x + 1, _sa.length() - pos - 5);
+	_columns[i].clear();
+    }
+
+    IndexEntry e;
+    e.offset = _file_offset;
+    e.count = _chunk_count;
+    e.first = _chunk_first;
+    e.last = _chunk_last;
+    _index.push_back(e);
+
+    write_block(IPSummaryDump::BLOCK_CHUNK, _sa.data(), _sa.length());
+    _sa.clear();
+    _chunk_count = 0;
+}
+
+void
+ToIPSummaryDump::write_index()
+{
+    write_chunk();
+    _sa.clear();
+    char *x = _sa.extend(4 + _index.size() * IPSummaryDump::INDEX_ENTRY_SIZE + 4);
+    PUT4(x, _index.size());
+    x += 4;
+    for (IndexEntry *e = _index.begin(); e != _index.end(); ++e) {
+	PUT4(x, e->offset >> 32);
+	PUT4(x + 4, e->offset);
+	PUT4(x + 8, e->count);
+	PUT4(x + 12, e->first.sec());
+	PUT4(x + 16, e->first.nsec());
+	PUT4(x + 20, e->last.sec());
+	PUT4(x + 24, e->last.nsec());
+	x += IPSummaryDump::INDEX_ENTRY_SIZE;
+    }
+    PUT4(x, _sa.length() + 8);
+    write_block(IPSummaryDump::BLOCK_INDEX, _sa.data(), _sa.length());
+    _index.clear();
+}
+
 void
 ToIPSummaryDump::push(int, Packet *p)
 {
@@ -288,7 +428,11 @@ ToIPSummaryDump::write_line(const String& s)
 {
     if (s.length()) {
 	assert(s.back() == '\n');
-	if (_binary) {
+	if (_columnar) {
+	    write_chunk();
+	    write_block(IPSummaryDump::BLOCK_TEXT, s.data(), s.length());
+	    return;
+	} else if (_binary) {
 	    uint32_t marker = htonl(s.length() | 0x80000000U);
 	    ignore_result(fwrite(&marker, 4, 1, _f));
 	}
@@ -301,7 +445,10 @@ ToIPSummaryDump::add_note(const String &s)
 {
     if (s.length()) {
 	int extra = 1 + (s.back() == '\n' ? 0 : 1);
-	if (_binary) {
+	if (_columnar) {
+	    write_line("#" + s + (extra > 1 ? "\n" : ""));
+	    return;
+	} else if (_binary) {
 	    uint32_t marker = htonl((s.length() + extra) | 0x80000000U);
 	    ignore_result(fwrite(&marker, 4, 1, _f));
 	}
@@ -316,6 +463,8 @@ int
 ToIPSummaryDump::flush_handler(const String &, Element *e, void *, ErrorHandler *)
 {
     ToIPSummaryDump *tod = (ToIPSummaryDump *) e;
+    if (tod->_f && tod->_columnar)
+	tod->write_chunk();
     if (tod->_f)
 	fflush(tod->_f);
     return 0;
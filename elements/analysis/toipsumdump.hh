@@ -23,7 +23,8 @@ Writes summary information about incoming packets to FILENAME in a simple
 ASCII format---each line corresponds to a packet.  The FIELDS keyword
 argument determines what information is written.  Writes to standard output if
 FILENAME is a single dash `C<->'.  The BINARY keyword argument writes a packed
-binary format to save space.
+binary format to save space, and the COLUMNAR keyword argument writes a
+compressed column-oriented format that is much faster to read.
 
 ToIPSummaryDump uses packets' extra-length and extra-packet-count annotations.
 
@@ -137,6 +138,16 @@ of the dump. Ignored if HEADER is false.
 Boolean. If true, then output packet records in a binary format (explained
 below). Defaults to false.
 
+=item COLUMNAR
+
+Boolean. If true, then output packet records in the columnar binary format
+(explained below). Defaults to false.
+
+=item CHUNK
+
+Unsigned integer. The number of records in each chunk of a columnar dump.
+Defaults to 16384.
+
 =item MULTIPACKET
 
 Boolean. If true, and the FIELDS option doesn't contain 'C<count>', then
@@ -338,6 +349,42 @@ The data stored in a metadata record is just an ASCII string, ending with
 newline, same as in a regular ASCII IPSummaryDump file. 'C<!bad>' records, for
 example, are stored this way.
 
+=head1 COLUMNAR FORMAT
+
+Columnar IPSummaryDump files also begin with ASCII lines. The line
+'C<!columnar>' indicates that the rest of the file consists of blocks. Each
+block starts with a four-character tag and its length in bytes, including
+this 8-byte header. There are three kinds of block. 'C<TEXT>' blocks hold
+ASCII metadata lines, as in binary dumps. 'C<CHNK>' blocks hold up to CHUNK
+packet records, and the file ends with an 'C<INDX>' block that indexes the
+chunks.
+
+A chunk looks like this:
+
+   +----+------+-------+-----------------+-----------------+----------...
+   |CHNK|length|records|first timestamp  |last timestamp   | columns
+   +----+------+-------+-----------------+-----------------+----------...
+    <4>   <4>     <4>     <4 sec, 4 nsec>   <4 sec, 4 nsec>
+
+The timestamps are the earliest and latest packet timestamp annotations in
+the chunk. A column follows for each field in the 'C<!data>' line, in
+order. Each column starts with a 1-byte encoding and a 4-byte length, and
+holds the binary field values of all records in the chunk, as they would
+appear in the binary format. The encodings are 0, for values stored one
+after another; 1, for a column whose records all have the same value,
+stored once; and 2, for a column of 2-, 4- or 8-byte numbers stored as
+the differences between successive values (starting from 0), each
+zigzag-encoded as a little-endian base-128 varint.
+
+The index block holds the number of chunks, then, for each chunk, its
+8-byte file offset, its record count, and its first and last timestamps,
+and ends with a copy of the block length, so readers can find the index
+from the end of the file.
+
+FromIPSummaryDump decodes a chunk one column at a time, can skip the
+columns it does not need, and can skip whole chunks outside the time range
+it is asked for.
+
 =h flush write-only
 
 Flush all internal buffers to disk.
@@ -383,6 +430,7 @@ class ToIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     bool _binary : 1;
     bool _header : 1;
     bool _extra_length : 1;
+    bool _columnar : 1;
     int32_t _binary_size;
     uint32_t _output_count;
     Task _task;
@@ -393,8 +441,26 @@ class ToIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
 
     String _banner;
 
+    struct IndexEntry {
+	uint64_t offset;
+	uint32_t count;
+	Timestamp first;
+	Timestamp last;
+    };
+
+    StringAccum *_columns;	// columns of the chunk being built
+    uint32_t _chunk_size;
+    uint32_t _chunk_count;
+    Timestamp _chunk_first;
+    Timestamp _chunk_last;
+    uint64_t _file_offset;
+    Vector<IndexEntry> _index;
+
     bool summary(Packet* p, StringAccum& sa, StringAccum* bad_sa) const;
     void write_packet(Packet* p, int multipacket);
+    void write_block(uint32_t tag, const char *data, uint32_t length);
+    void write_chunk();
+    void write_index();
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
 
 };
@@ -0,0 +1,411 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * tracereplay.{cc,hh} -- element replays preloaded traces from several threads
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "tracereplay.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/router.hh>
+#include <click/master.hh>
+#include <click/glue.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+#include <clicknet/udp.h>
+CLICK_DECLS
+
+TraceReplay::TraceReplay()
+    : _outputs(0), _load_task(this), _load_timer(&_load_task), _load_idle(0),
+      _period(0), _loaded(0)
+{
+}
+
+TraceReplay::~TraceReplay()
+{
+}
+
+int
+TraceReplay::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    IPAddress address_step;
+    bool active = true;
+    _timing = true;
+    _speed = 1;
+    _rate = 0;
+    _loops = 1;
+    _port_step = 0;
+    _burst = 32;
+    _set_timestamp = true;
+    _stop = false;
+    if (Args(conf, this, errh)
+	.read("TIMING", _timing)
+	.read("SPEED", _speed)
+	.read("RATE", _rate)
+	.read("LOOPS", _loops)
+	.read("ADDRESS_STEP", address_step)
+	.read("PORT_STEP", _port_step)
+	.read("TIMESTAMP", _set_timestamp)
+	.read("BURST", _burst)
+	.read("ACTIVE", active)
+	.read("STOP", _stop)
+	.complete() < 0)
+	return -1;
+    if (_speed <= 0)
+	return errh->error("SPEED must be positive");
+    if (_burst <= 0)
+	return errh->error("BURST must be positive");
+    _address_step = ntohl(address_step.addr());
+    _active = active;
+    return 0;
+}
+
+int
+TraceReplay::initialize(ErrorHandler *)
+{
+    for (int i = 0; i < ninputs(); ++i)
+	_signals.push_back(Notifier::upstream_empty_signal(this, i));
+
+    int nthreads = master()->nthreads();
+    int home = router()->home_thread_id(this);
+    _outputs = new Output[noutputs()];
+    for (int i = 0; i < noutputs(); ++i) {
+	Output &o = _outputs[i];
+	o.replay = this;
+	o.port = i;
+	o.task = new Task(output_task_hook, &o);
+	o.task->initialize(this, false);
+	if (nthreads > 1)
+	    o.task->move_thread((home + i) % nthreads);
+	o.timer = new Timer(o.task);
+	o.timer->initialize(this);
+    }
+
+    _ready = _started = false;
+    _running = noutputs();
+    _load_task.initialize(this, true);
+    _load_timer.initialize(this);
+    return 0;
+}
+
+void
+TraceReplay::cleanup(CleanupStage)
+{
+    for (Entry *e = _load.begin(); e != _load.end(); ++e)
+	e->p->kill();
+    _load.clear();
+    if (_outputs)
+	for (int i = 0; i < noutputs(); ++i) {
+	    Output &o = _outputs[i];
+	    delete o.timer;
+	    delete o.task;
+	    for (Entry *e = o.packets.begin(); e != o.packets.end(); ++e)
+		e->p->kill();
+	}
+    delete[] _outputs;
+    _outputs = 0;
+}
+
+uint32_t
+TraceReplay::flow_hash(Packet *p)
+{
+    if (!p->has_network_header() || p->network_length() < (int) sizeof(click_ip))
+	return 0;
+    const click_ip *iph = p->ip_header();
+    if (iph->ip_v != 4)
+	return 0;
+    // XOR and add are commutative, so both directions hash alike
+    uint32_t h = iph->ip_src.s_addr ^ iph->ip_dst.s_addr;
+    if ((iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP)
+	&& IP_FIRSTFRAG(iph) && p->transport_length() >= 4) {
+	const uint16_t *ports = reinterpret_cast<const uint16_t *>(p->transport_header());
+	h += ports[0] + ports[1];
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    return h;
+}
+
+int
+TraceReplay::entry_compar(const void *a, const void *b, void *)
+{
+    const Entry *ea = reinterpret_cast<const Entry *>(a);
+    const Entry *eb = reinterpret_cast<const Entry *>(b);
+    const Timestamp &ta = ea->p->timestamp_anno();
+    const Timestamp &tb = eb->p->timestamp_anno();
+    if (ta != tb)
+	return ta < tb ? -1 : 1;
+    // while loading, due holds the load order, which breaks ties
+    return ea->due < eb->due ? -1 : (ea->due > eb->due);
+}
+
+void
+TraceReplay::finish_load()
+{
+    click_qsort(_load.begin(), _load.size(), sizeof(Entry), entry_compar);
+
+    // compute each packet's due time, then deal packets to outputs
+    int n = _load.size();
+    if (n) {
+	Timestamp first = _load[0].p->timestamp_anno();
+	int64_t span = (_load[n - 1].p->timestamp_anno() - first).nsecval();
+	int64_t gap = n > 1 ? span / (n - 1) : 0;
+	for (int i = 0; i < n; ++i) {
+	    Entry &e = _load[i];
+	    if (!_timing)
+		e.due = 0;
+	    else if (_rate)
+		e.due = (int64_t) i * 1000000000 / _rate;
+	    else
+		e.due = (int64_t) ((e.p->timestamp_anno() - first).nsecval() / _speed);
+	    _outputs[flow_hash(e.p) % noutputs()].packets.push_back(e);
+	}
+	if (!_timing)
+	    _period = 0;
+	else if (_rate)
+	    _period = (int64_t) n * 1000000000 / _rate;
+	else
+	    _period = (int64_t) ((span + gap) / _speed);
+    }
+    _load.clear();
+    _ready = true;
+    if (_active)
+	start();
+}
+
+void
+TraceReplay::start()
+{
+    if (_started || !_ready)
+	return;
+    _started = true;
+    _start = Timestamp::now_steady();
+    for (int i = 0; i < noutputs(); ++i) {
+	Output &o = _outputs[i];
+	if (o.packets.empty())
+	    finish_output(o);
+	else
+	    o.task->reschedule();
+    }
+}
+
+void
+TraceReplay::finish_output(Output &o)
+{
+    o.done = true;
+    if (_running.dec_and_test() && _stop)
+	router()->please_stop_driver();
+}
+
+bool
+TraceReplay::run_task(Task *)
+{
+    // preload every input until all of them are empty
+    bool more = false, waiting = false;
+    for (int i = 0; i < ninputs(); ++i) {
+	int n = 0;
+	while (n < 1024) {
+	    Packet *p = input(i).pull();
+	    if (!p)
+		break;
+	    Entry e;
+	    e.p = p;
+	    e.due = _load.size();
+	    _load.push_back(e);
+	    ++_loaded;
+	    ++n;
+	}
+	if (n)
+	    more = true;
+	else if (_signals[i])
+	    waiting = true;
+    }
+    if (more) {
+	_load_idle = 0;
+	_load_task.fast_reschedule();
+    } else if (waiting && _load_idle < load_idle_max) {
+	// An upstream claims to have packets but delivered none: try again
+	// after a doubling delay rather than spinning, for about a second.
+	_load_timer.schedule_after_msec(1 << _load_idle);
+	++_load_idle;
+    } else
+	finish_load();
+    return more;
+}
+
+void
+TraceReplay::rewrite(WritablePacket *p, uint32_t loop) const
+{
+    if (!p->has_network_header() || p->network_length() < (int) sizeof(click_ip))
+	return;
+    click_ip *iph = p->ip_header();
+    if (iph->ip_v != 4)
+	return;
+
+    uint16_t *xsum = 0;
+    uint16_t *ports = 0;
+    if (IP_FIRSTFRAG(iph)) {
+	if (iph->ip_p == IP_PROTO_TCP && p->transport_length() >= 18)
+	    xsum = &p->tcp_header()->th_sum;
+	else if (iph->ip_p == IP_PROTO_UDP && p->transport_length() >= 8
+		 && p->udp_header()->uh_sum)
+	    xsum = &p->udp_header()->uh_sum;
+	if (iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP)
+	    ports = reinterpret_cast<uint16_t *>(p->transport_header());
+    }
+
+    if (uint32_t delta = _address_step * loop) {
+	uint32_t src = htonl(ntohl(iph->ip_src.s_addr) + delta);
+	uint32_t dst = htonl(ntohl(iph->ip_dst.s_addr) + delta);
+	click_update_in_cksum32(&iph->ip_sum, iph->ip_src.s_addr, src);
+	click_update_in_cksum32(&iph->ip_sum, iph->ip_dst.s_addr, dst);
+	if (xsum) {
+	    click_update_in_cksum32(xsum, iph->ip_src.s_addr, src);
+	    click_update_in_cksum32(xsum, iph->ip_dst.s_addr, dst);
+	}
+	iph->ip_src.s_addr = src;
+	iph->ip_dst.s_addr = dst;
+    }
+    if (uint16_t delta = _port_step * loop)
+	if (ports && p->transport_length() >= 4)
+	    for (int i = 0; i < 2; ++i) {
+		uint16_t port = htons(ntohs(ports[i]) + delta);
+		if (xsum)
+		    click_update_in_cksum(xsum, ports[i], port);
+		ports[i] = port;
+	    }
+}
+
+bool
+TraceReplay::run_output(Output &o)
+{
+    if (!_active || o.done)
+	return false;
+
+    Timestamp now = _timing ? Timestamp::now_steady() : Timestamp();
+    int n = 0;
+    while (n < _burst) {
+	if (o.pos == (uint32_t) o.packets.size()) {
+	    o.pos = 0;
+	    ++o.loop;
+	    if (_loops && o.loop >= _loops) {
+		finish_output(o);
+		return n > 0;
+	    }
+	}
+
+	const Entry &e = o.packets[o.pos];
+	if (_timing) {
+	    Timestamp due = _start + Timestamp::make_nsec(e.due + _period * o.loop);
+	    if (now < due) {
+		// sleep until shortly before the packet is due, then poll
+		due -= Timer::adjustment();
+		if (now < due)
+		    o.timer->schedule_at_steady(due);
+		else
+		    o.task->fast_reschedule();
+		return n > 0;
+	    }
+	}
+
+	Packet *p = e.p->clone();
+	if (p && o.loop && (_address_step || _port_step)) {
+	    if (WritablePacket *q = p->uniqueify()) {
+		rewrite(q, o.loop);
+		p = q;
+	    } else
+		p = 0;
+	}
+	++o.pos;
+	++n;
+	if (p) {
+	    if (_set_timestamp)
+		p->timestamp_anno().assign_now();
+	    ++o.count;
+	    output(o.port).push(p);
+	}
+    }
+
+    o.task->fast_reschedule();
+    return true;
+}
+
+bool
+TraceReplay::output_task_hook(Task *, void *user_data)
+{
+    Output *o = static_cast<Output *>(user_data);
+    return o->replay->run_output(*o);
+}
+
+String
+TraceReplay::read_handler(Element *e, void *thunk)
+{
+    TraceReplay *tr = static_cast<TraceReplay *>(e);
+    switch ((intptr_t) thunk) {
+    case h_count: {
+	uint64_t count = 0;
+	for (int i = 0; tr->_outputs && i < tr->noutputs(); ++i)
+	    count += tr->_outputs[i].count;
+	return String(count);
+    }
+    case h_loaded:
+	return String(tr->_loaded);
+    case h_loops: {
+	uint32_t loops = 0;
+	for (int i = 0; tr->_outputs && i < tr->noutputs(); ++i)
+	    if (i == 0 || tr->_outputs[i].loop < loops)
+		loops = tr->_outputs[i].loop;
+	return String(loops);
+    }
+    case h_active:
+	return String(tr->_active);
+    default:
+	return String();
+    }
+}
+
+int
+TraceReplay::write_handler(const String &str, Element *e, void *thunk, ErrorHandler *errh)
+{
+    TraceReplay *tr = static_cast<TraceReplay *>(e);
+    switch ((intptr_t) thunk) {
+    case h_active: {
+	bool active;
+	if (!BoolArg().parse(str, active))
+	    return errh->error("syntax error");
+	tr->_active = active;
+	if (active)
+	    tr->start();
+	return 0;
+    }
+    default:
+	return -1;
+    }
+}
+
+void
+TraceReplay::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("loaded", read_handler, h_loaded);
+    add_read_handler("loops", read_handler, h_loops);
+    add_read_handler("active", read_handler, h_active, Handler::f_checkbox);
+    add_write_handler("active", write_handler, h_active);
+    add_task_handlers(&_load_task, "load_");
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(TraceReplay)
+ELEMENT_MT_SAFE(TraceReplay)
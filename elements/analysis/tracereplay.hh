@@ -0,0 +1,225 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_TRACEREPLAY_HH
+#define CLICK_TRACEREPLAY_HH
+#include <click/element.hh>
+#include <click/notifier.hh>
+#include <click/atomic.hh>
+#include <click/task.hh>
+#include <click/timer.hh>
+CLICK_DECLS
+
+/*
+=c
+
+TraceReplay([I<keywords> TIMING, SPEED, RATE, LOOPS, ADDRESS_STEP, PORT_STEP, ...])
+
+=s traces
+
+replays preloaded traces from several threads
+
+=d
+
+TraceReplay is a traffic generator that replays packet traces. It first
+preloads every packet it can pull from its inputs into memory, merging the
+inputs in timestamp order, and then replays the merged trace on its
+outputs, one task per output. Typically each input is a FromDump or
+FromIPSummaryDump element reading one file of a trace set.
+
+Packets are split across the outputs by a symmetric hash of their IPv4
+addresses and, for TCP and UDP, ports, so both directions of a flow leave
+on the same output. Non-IP packets leave on output 0. The task for output
+I<i> runs on thread I<T>+I<i> (modulo the number of threads), where I<T> is
+TraceReplay's home thread, so each output is replayed by a different
+thread. The outputs share one clock and need no locks.
+
+Packets are replayed at one of three paces. By default, TraceReplay
+maintains the trace's original timing, divided by SPEED. If RATE is given,
+packets are spaced evenly at RATE packets per second in total. If TIMING
+is false, packets are emitted as fast as possible. Packets are paced with
+timers until shortly before they are due, and then by polling the clock,
+so pacing is accurate to well under a microsecond on an idle thread. A
+thread that falls behind emits late packets immediately, up to BURST per
+task run.
+
+The trace is replayed LOOPS times. Each loop starts one trace duration
+after the previous one (plus one average packet gap). To make each loop's
+flows distinct, ADDRESS_STEP and PORT_STEP are added, multiplied by the
+loop number, to IPv4 source and destination addresses and to TCP and UDP
+ports; checksums are updated incrementally. The first loop is replayed
+unchanged.
+
+Replayed packets are clones of the preloaded packets and share their data,
+except for rewritten packets, which are copied. Elements downstream that
+modify packets therefore copy them first.
+
+Preloading ends when every input is empty and its upstream empty notifier
+reports no more packets. While a notifier reports packets that never
+arrive, TraceReplay polls again after a doubling delay, and ends preloading
+once no input has produced a packet for about a second. Do not use STOP on
+the upstream sources, since that stops the driver before the replay begins.
+
+Keywords are:
+
+=over 8
+
+=item TIMING
+
+Boolean. If false, replay as fast as possible. Default is true.
+
+=item SPEED
+
+Positive real number. Speed-up factor for the original timing. Default is
+1.
+
+=item RATE
+
+Unsigned integer. If set, replay at this many packets per second, summed
+over all outputs, rather than with the original timing.
+
+=item LOOPS
+
+Unsigned integer. Number of times to replay the trace. 0 means forever.
+Default is 1.
+
+=item ADDRESS_STEP
+
+IP address, read as a 32-bit number. Added to IPv4 addresses once per
+loop: with C<0.1.0.0>, loop 2 maps 10.0.0.1 to 10.2.0.1. Default is
+0.0.0.0.
+
+=item PORT_STEP
+
+Unsigned integer. Added to TCP and UDP ports once per loop. Default is 0.
+
+=item TIMESTAMP
+
+Boolean. If true, set replayed packets' timestamp annotations to the
+current time; otherwise they keep their trace timestamps. Default is true.
+
+=item BURST
+
+Unsigned integer. Maximum number of packets each task emits per run.
+Default is 32.
+
+=item ACTIVE
+
+Boolean. If false, preload the trace but do not start replaying until the
+C<active> handler is set to true. Default is true.
+
+=item STOP
+
+Boolean. If true, stop the driver when every output has finished. Default
+is false.
+
+=back
+
+=h count read-only
+
+Returns the number of packets replayed.
+
+=h loaded read-only
+
+Returns the number of packets preloaded.
+
+=h loops read-only
+
+Returns the number of loops every output has completed.
+
+=h active read/write
+
+Returns or sets whether the replay is running. Setting it to true starts
+the replay once the trace is loaded; setting it to false stops it for
+good.
+
+=e
+
+  tr :: TraceReplay(SPEED 2, LOOPS 10, ADDRESS_STEP 0.1.0.0);
+  FromDump(a.pcap, FORCE_IP true) -> [0] tr;
+  FromDump(b.pcap, FORCE_IP true) -> [1] tr;
+  tr[0] -> ToDevice(eth0, QUEUE 0);
+  tr[1] -> ToDevice(eth0, QUEUE 1);
+
+=a FromDump, FromIPSummaryDump, TimeSortedSched, RSSSwitch */
+
+class TraceReplay : public Element { public:
+
+    TraceReplay() CLICK_COLD;
+    ~TraceReplay() CLICK_COLD;
+
+    const char *class_name() const	{ return "TraceReplay"; }
+    const char *port_count() const	{ return "1-/1-"; }
+    const char *processing() const	{ return "l/h"; }
+    const char *flow_code() const	{ return "x/x"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    bool run_task(Task *);
+
+  private:
+
+    struct Entry {
+	Packet *p;
+	int64_t due;		// nanoseconds after the start of a loop
+    };
+
+    struct Output {
+	TraceReplay *replay;
+	int port;
+	Task *task;
+	Timer *timer;
+	Vector<Entry> packets;
+	uint32_t pos;
+	uint32_t loop;
+	uint64_t count;
+	bool done;
+	Output()
+	    : replay(0), port(0), task(0), timer(0), pos(0), loop(0), count(0),
+	      done(false) {
+	}
+    };
+
+    Output *_outputs;
+    Vector<NotifierSignal> _signals;
+    Vector<Entry> _load;	// packets preloaded so far
+    Task _load_task;
+    Timer _load_timer;		// retries a load that found nothing
+    uint32_t _load_idle;	// load passes since the last packet
+    Timestamp _start;
+    int64_t _period;		// nanoseconds between loop starts
+    uint64_t _loaded;
+    atomic_uint32_t _running;
+    double _speed;
+    uint32_t _rate;
+    uint32_t _loops;
+    uint32_t _address_step;
+    uint32_t _port_step;
+    int _burst;
+    bool _timing;
+    bool _set_timestamp;
+    bool _stop;
+    volatile bool _active;
+    bool _ready;		// preloading is complete
+    bool _started;
+
+    enum { load_idle_max = 10 };
+
+    static uint32_t flow_hash(Packet *p);
+    static int entry_compar(const void *, const void *, void *);
+    void finish_load();
+    void start();
+    void finish_output(Output &o);
+    void rewrite(WritablePacket *p, uint32_t loop) const;
+    bool run_output(Output &o);
+    static bool output_task_hook(Task *, void *);
+
+    enum { h_count, h_loaded, h_loops, h_active };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
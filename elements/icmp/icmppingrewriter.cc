@@ -70,11 +70,13 @@ ICMPPingRewriter::ICMPPingFlow::unparse(StringAccum &sa, bool direction,
 // ICMPPingRewriter
 
 ICMPPingRewriter::ICMPPingRewriter()
+    : _allocator(0)
 {
 }
 
 ICMPPingRewriter::~ICMPPingRewriter()
 {
+    delete[] _allocator;
 }
 
 void *
@@ -103,18 +105,22 @@ ICMPPingRewriter::configure(Vector<String> &conf, ErrorHandler *errh)
 	return -1;
 
     _annos = (dst_anno ? 1 : 0) + (has_reply_anno ? 2 + (reply_anno << 2) : 0);
-    return IPRewriterBase::configure(conf, errh);
+    if (IPRewriterBase::configure(conf, errh) < 0)
+	return -1;
+    _allocator = new SizedHashAllocator<sizeof(ICMPPingFlow)>[_nthreads];
+    return 0;
 }
 
 IPRewriterEntry *
 ICMPPingRewriter::get_entry(int ip_p, const IPFlowID &xflowid, int input)
 {
+    int thread = thread_index();
     if (ip_p != IP_PROTO_ICMP)
 	return 0;
     bool echo = (input != get_entry_reply);
     IPFlowID flowid(xflowid.saddr(), xflowid.sport() + !echo,
 		    xflowid.daddr(), xflowid.sport() + echo);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
     if (!m && (unsigned) input < (unsigned) _input_specs.size()) {
 	IPRewriterInput &is = _input_specs[input];
 	IPFlowID rewritten_flowid = IPFlowID::uninitialized_t();
@@ -130,22 +136,24 @@ IPRewriterEntry *
 ICMPPingRewriter::add_flow(int, const IPFlowID &flowid,
 			   const IPFlowID &rewritten_flowid, int input)
 {
+    int thread = thread_index();
     void *data;
     if ((uint16_t) (flowid.sport() + 1) != flowid.dport()
 	|| (uint16_t) (rewritten_flowid.sport() + 1) != rewritten_flowid.dport()
-	|| !(data = _allocator.allocate()))
+	|| !(data = _allocator[thread].allocate()))
 	return 0;
 
     ICMPPingFlow *flow = new(data) ICMPPingFlow
 	(&_input_specs[input], flowid, rewritten_flowid,
 	 !!_timeouts[1], click_jiffies() + relevant_timeout(_timeouts));
 
-    return store_flow(flow, input, _map);
+    return store_flow(flow, input, thread, map(thread));
 }
 
 void
 ICMPPingRewriter::push(int port, Packet *p_in)
 {
+    int thread = thread_index();
     WritablePacket *p = p_in->uniqueify();
     click_ip *iph = p->ip_header();
     click_icmp_echo *icmph = reinterpret_cast<click_icmp_echo *>(p->icmp_header());
@@ -168,7 +176,7 @@ ICMPPingRewriter::push(int port, Packet *p_in)
     IPFlowID flowid(iph->ip_src, icmph->icmp_identifier + !echo,
 		    iph->ip_dst, icmph->icmp_identifier + echo);
 
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
 
     if (!m && !echo)
 	goto mapping_fail;
@@ -189,7 +197,7 @@ ICMPPingRewriter::push(int port, Packet *p_in)
 
     ICMPPingFlow *mf = static_cast<ICMPPingFlow *>(m->flow());
     mf->apply(p, m->direction(), _annos);
-    mf->change_expiry_by_timeout(_heap, click_jiffies(), _timeouts);
+    mf->change_expiry_by_timeout(heap(thread), click_jiffies(), _timeouts);
 
     output(m->output()).push(p);
 }
@@ -201,11 +209,12 @@ ICMPPingRewriter::dump_mappings_handler(Element *e, void *)
     ICMPPingRewriter *rw = (ICMPPingRewriter *)e;
     StringAccum sa;
     click_jiffies_t now = click_jiffies();
-    for (Map::iterator iter = rw->_map.begin(); iter.live(); ++iter) {
-	ICMPPingFlow *f = static_cast<ICMPPingFlow *>(iter->flow());
-	f->unparse(sa, iter->direction(), now);
-	sa << '\n';
-    }
+    for (int t = 0; t < rw->nthreads(); ++t)
+	for (Map::iterator iter = rw->map(t).begin(); iter.live(); ++iter) {
+	    ICMPPingFlow *f = static_cast<ICMPPingFlow *>(iter->flow());
+	    f->unparse(sa, iter->direction(), now);
+	    sa << '\n';
+	}
     return sa.take_string();
 }
 
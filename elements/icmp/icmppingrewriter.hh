@@ -59,7 +59,7 @@ dropped if the mapping table is full of guaranteed flows.
 
 =item REAP_INTERVAL I<time>
 
-Reap timed-out connections every I<time> seconds. Default is 15 minutes.
+Reap timed-out connections every I<time> seconds. Default is 1 second.
 
 =item MAPPING_CAPACITY I<capacity>
 
@@ -108,7 +108,11 @@ class ICMPPingRewriter : public IPRewriterBase { public:
     IPRewriterEntry *get_entry(int ip_p, const IPFlowID &flowid, int input);
     IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 			      const IPFlowID &rewritten_flowid, int input);
-    void destroy_flow(IPRewriterFlow *flow);
+    void destroy_flow(IPRewriterFlow *flow, int thread);
+    void memory_stats(MemoryStats &ms) const {
+	allocator_stats(ms, _allocator, sizeof(ICMPPingFlow));
+	IPRewriterBase::memory_stats(ms);
+    }
 
     void push(int, Packet *);
 
@@ -116,7 +120,7 @@ class ICMPPingRewriter : public IPRewriterBase { public:
 
   private:
 
-    SizedHashAllocator<sizeof(ICMPPingFlow)> _allocator;
+    SizedHashAllocator<sizeof(ICMPPingFlow)> *_allocator;	// one per thread
     unsigned _annos;
 
     static String dump_mappings_handler(Element *, void *);
@@ -125,11 +129,11 @@ class ICMPPingRewriter : public IPRewriterBase { public:
 
 
 inline void
-ICMPPingRewriter::destroy_flow(IPRewriterFlow *flow)
+ICMPPingRewriter::destroy_flow(IPRewriterFlow *flow, int thread)
 {
-    unmap_flow(flow, _map);
+    unmap_flow(flow, thread, map(thread));
     static_cast<ICMPPingFlow *>(flow)->~ICMPPingFlow();
-    _allocator.deallocate(flow);
+    _allocator[thread].deallocate(flow);
 }
 
 CLICK_ENDDECLS
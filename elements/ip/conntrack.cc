@@ -0,0 +1,496 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * conntrack.{cc,hh} -- element tracks connection state for stateful
+ * filtering
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "conntrack.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include <click/standard/scheduleinfo.hh>
+#include <click/straccum.hh>
+#include <clicknet/ip.h>
+#include <clicknet/icmp.h>
+#include <clicknet/tcp.h>
+#include <clicknet/udp.h>
+CLICK_DECLS
+
+const char * const ConnTrack::state_names[] = {
+    "SYN_SENT", "SYN_RECV", "ESTABLISHED", "FIN_WAIT", "CLOSE"
+};
+
+ConnTrack::ConnTrack()
+    : _task(this)
+{
+}
+
+int
+ConnTrack::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _anno = PAINT_ANNO_OFFSET;
+    _capacity = 65536;
+    _burst = 32;
+    _loose = false;
+    uint32_t t[cs_nstates];
+    t[cs_tcp_syn_sent] = 120;
+    t[cs_tcp_established] = 5 * 86400;
+    t[cs_tcp_fin_wait] = 120;
+    t[cs_tcp_close] = 10;
+    t[cs_udp_unreplied] = 30;
+    t[cs_udp_replied] = 180;
+    t[cs_icmp] = 30;
+    t[cs_other_unreplied] = 600;
+    if (Args(conf, this, errh)
+	.read("ANNO", AnnoArg(1), _anno)
+	.read("CAPACITY", _capacity)
+	.read("LOOSE", _loose)
+	.read("BURST", _burst)
+	.read("TCP_SYN_TIMEOUT", SecondsArg(), t[cs_tcp_syn_sent])
+	.read("TCP_ESTABLISHED_TIMEOUT", SecondsArg(), t[cs_tcp_established])
+	.read("TCP_FIN_TIMEOUT", SecondsArg(), t[cs_tcp_fin_wait])
+	.read("TCP_CLOSE_TIMEOUT", SecondsArg(), t[cs_tcp_close])
+	.read("UDP_TIMEOUT", SecondsArg(), t[cs_udp_unreplied])
+	.read("UDP_STREAM_TIMEOUT", SecondsArg(), t[cs_udp_replied])
+	.read("ICMP_TIMEOUT", SecondsArg(), t[cs_icmp])
+	.read("GENERIC_TIMEOUT", SecondsArg(), t[cs_other_unreplied])
+	.complete() < 0)
+	return -1;
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    if (_burst <= 0 || _burst > burst_max)
+	return errh->error("BURST must be between 1 and %d", (int) burst_max);
+    t[cs_tcp_syn_recv] = t[cs_tcp_syn_sent];
+    t[cs_other_replied] = t[cs_other_unreplied];
+    for (int s = 0; s < cs_nstates; ++s)
+	_timeout_j[s] = t[s] * CLICK_HZ;
+    return 0;
+}
+
+int
+ConnTrack::initialize(ErrorHandler *errh)
+{
+    if (_tables.reserve(_capacity) < 0
+	|| _state.resize(_tables.nthreads()) < 0)
+	return errh->error("out of memory");
+    if (input_is_pull(0)) {
+	ScheduleInfo::initialize_task(this, &_task, errh);
+	_signal = Notifier::upstream_empty_signal(this, 0, &_task);
+    }
+    return 0;
+}
+
+void
+ConnTrack::canonicalize(Lookup &l)
+{
+    // Both directions of a connection share one table entry, keyed by the
+    // direction whose source sorts first.
+    uint32_t sa = l.key.saddr().addr(), da = l.key.daddr().addr();
+    if (da < sa || (da == sa && l.key.dport() < l.key.sport())) {
+	l.key = l.key.reverse();
+	l.dir = 1;
+    }
+}
+
+void
+ConnTrack::parse_icmp_error(Packet *p, Lookup &l)
+{
+    // The error quotes the IP header and first 8 bytes of a packet that
+    // belongs to the connection.
+    const uint8_t *q = p->transport_header() + sizeof(click_icmp);
+    int qlen = p->transport_length() - (int) sizeof(click_icmp);
+    const click_ip *qiph = reinterpret_cast<const click_ip *>(q);
+    if (qlen < (int) sizeof(click_ip) || qiph->ip_v != 4
+	|| qlen < (qiph->ip_hl << 2) + 8 || !IP_FIRSTFRAG(qiph))
+	return;
+    const uint8_t *qth = q + (qiph->ip_hl << 2);
+    uint16_t sport = 0, dport = 0;
+    if (qiph->ip_p == IP_PROTO_TCP || qiph->ip_p == IP_PROTO_UDP) {
+	const click_udp *udph = reinterpret_cast<const click_udp *>(qth);
+	sport = udph->uh_sport;
+	dport = udph->uh_dport;
+    } else if (qiph->ip_p == IP_PROTO_ICMP) {
+	const click_icmp_sequenced *icmph = reinterpret_cast<const click_icmp_sequenced *>(qth);
+	if (icmph->icmp_type != ICMP_ECHO && icmph->icmp_type != ICMP_ECHOREPLY
+	    && icmph->icmp_type != ICMP_TSTAMP && icmph->icmp_type != ICMP_TSTAMPREPLY
+	    && icmph->icmp_type != ICMP_IREQ && icmph->icmp_type != ICMP_IREQREPLY
+	    && icmph->icmp_type != ICMP_MASKREQ && icmph->icmp_type != ICMP_MASKREQREPLY)
+	    return;
+	sport = dport = icmph->icmp_identifier;
+    }
+    l.key = IPFlow5ID(qiph->ip_src, sport, qiph->ip_dst, dport, qiph->ip_p);
+    l.kind = k_related;
+}
+
+void
+ConnTrack::parse(Packet *p, Lookup &l)
+{
+    l.kind = k_untracked;
+    l.info = ct_invalid;
+    l.dir = 0;
+    if (!p->has_network_header()
+	|| p->network_length() < (int) sizeof(click_ip))
+	return;
+    const click_ip *iph = p->ip_header();
+    if (!IP_FIRSTFRAG(iph))
+	return;
+
+    const uint8_t *th = p->transport_header();
+    int tlen = p->transport_length();
+    uint16_t sport = 0, dport = 0;
+    switch (iph->ip_p) {
+    case IP_PROTO_TCP:
+	if (tlen < (int) sizeof(click_tcp))
+	    return;
+	sport = reinterpret_cast<const click_tcp *>(th)->th_sport;
+	dport = reinterpret_cast<const click_tcp *>(th)->th_dport;
+	l.kind = k_tcp;
+	break;
+    case IP_PROTO_UDP:
+	if (tlen < (int) sizeof(click_udp))
+	    return;
+	sport = reinterpret_cast<const click_udp *>(th)->uh_sport;
+	dport = reinterpret_cast<const click_udp *>(th)->uh_dport;
+	l.kind = k_create;
+	l.state = cs_udp_unreplied;
+	break;
+    case IP_PROTO_ICMP: {
+	if (tlen < (int) sizeof(click_icmp))
+	    return;
+	const click_icmp_sequenced *icmph = reinterpret_cast<const click_icmp_sequenced *>(th);
+	switch (icmph->icmp_type) {
+	case ICMP_ECHO:
+	case ICMP_TSTAMP:
+	case ICMP_IREQ:
+	case ICMP_MASKREQ:
+	    l.kind = k_create;
+	    l.state = cs_icmp;
+	    break;
+	case ICMP_ECHOREPLY:
+	case ICMP_TSTAMPREPLY:
+	case ICMP_IREQREPLY:
+	case ICMP_MASKREQREPLY:
+	    l.kind = k_reply;
+	    break;
+	case ICMP_UNREACH:
+	case ICMP_SOURCEQUENCH:
+	case ICMP_REDIRECT:
+	case ICMP_TIMXCEED:
+	case ICMP_PARAMPROB:
+	    parse_icmp_error(p, l);
+	    if (l.kind == k_related)
+		canonicalize(l);
+	    return;
+	default:
+	    l.info = ct_new;
+	    return;
+	}
+	sport = dport = icmph->icmp_identifier;
+	break;
+    }
+    default:
+	l.kind = k_create;
+	l.state = cs_other_unreplied;
+	break;
+    }
+    l.key = IPFlow5ID(iph->ip_src, sport, iph->ip_dst, dport, iph->ip_p);
+    canonicalize(l);
+}
+
+static inline bool
+tcp_flags_valid(uint8_t fl)
+{
+    return (fl & (TH_SYN | TH_ACK | TH_RST))
+	&& (fl & (TH_SYN | TH_FIN)) != (TH_SYN | TH_FIN)
+	&& (fl & (TH_SYN | TH_RST)) != (TH_SYN | TH_RST)
+	&& (fl & (TH_FIN | TH_ACK)) != TH_FIN;
+}
+
+int
+ConnTrack::track_tcp(Packet *p, Conn *c, int dir, bool fresh)
+{
+    uint8_t fl = p->tcp_header()->th_flags;
+    if (fl & TH_RST) {
+	c->state = cs_tcp_close;
+	return ct_new;
+    }
+    if (!fresh)
+	switch (c->state) {
+	case cs_tcp_syn_sent:
+	    // only SYN retransmits and the SYN-ACK (or simultaneous SYN)
+	    if (!(fl & TH_SYN) || (!dir && (fl & TH_ACK)))
+		return ct_invalid;
+	    if (dir)
+		c->state = cs_tcp_syn_recv;
+	    break;
+	case cs_tcp_syn_recv:
+	    if (fl & TH_SYN) {
+		if (!dir && (fl & TH_ACK))
+		    return ct_invalid;
+	    } else if (!dir)
+		c->state = cs_tcp_established;
+	    break;
+	default:
+	    // only SYN-ACK retransmits
+	    if ((fl & TH_SYN) && (!dir || !(fl & TH_ACK)))
+		return ct_invalid;
+	    break;
+	}
+    if ((fl & TH_FIN) && c->state >= cs_tcp_established) {
+	c->flags |= f_done << dir;
+	if ((c->flags & (f_done | (f_done << 1))) == (f_done | (f_done << 1)))
+	    c->state = cs_tcp_close;
+	else if (c->state == cs_tcp_established)
+	    c->state = cs_tcp_fin_wait;
+    }
+    return ct_new;
+}
+
+int
+ConnTrack::track(Packet *p, const Lookup &l, Conn *c, Table &table,
+		 ThreadState &ts, click_jiffies_t now)
+{
+    if (l.kind == k_untracked)
+	return l.info;
+    if (!c)
+	c = table.find(l.key);
+    bool live = c && !click_jiffies_less(c->expiry, now);
+    if (l.kind == k_related)
+	return live ? ct_related : ct_invalid;
+
+    uint8_t fl = 0;
+    if (l.kind == k_tcp) {
+	fl = p->tcp_header()->th_flags;
+	if (!tcp_flags_valid(fl))
+	    return ct_invalid;
+	// a new SYN reopens a closed connection
+	if (live && c->state == cs_tcp_close
+	    && (fl & (TH_SYN | TH_ACK)) == TH_SYN)
+	    live = false;
+    }
+
+    bool fresh = false;
+    if (!live) {
+	uint8_t state = l.state;
+	if (l.kind == k_reply)
+	    return ct_invalid;
+	else if (l.kind == k_tcp) {
+	    if ((fl & (TH_SYN | TH_ACK)) == TH_SYN)
+		state = cs_tcp_syn_sent;
+	    else if (_loose && !(fl & (TH_SYN | TH_RST)))
+		state = cs_tcp_established;
+	    else
+		return ct_invalid;
+	}
+	if (!c) {
+	    bool inserted;
+	    if (!(c = table.find_insert(l.key, inserted)))
+		return -1;
+	}
+	// an expired entry is reused in place
+	c->state = state;
+	c->flags = l.dir ? f_swapped : 0;
+	++ts.created;
+	fresh = true;
+    }
+
+    int dir = l.dir ^ (c->flags & f_swapped);
+    if (l.kind == k_reply && !dir)
+	return ct_invalid;
+    if (l.kind == k_tcp && track_tcp(p, c, dir, fresh) == ct_invalid)
+	return ct_invalid;
+    if (dir) {
+	c->flags |= f_replied;
+	if (c->state == cs_udp_unreplied || c->state == cs_other_unreplied)
+	    ++c->state;
+    }
+    c->expiry = now + _timeout_j[c->state];
+    return c->flags & f_replied ? ct_established : ct_new;
+}
+
+struct ConnTrack::Expired {
+    click_jiffies_t now;
+    Expired(click_jiffies_t now_)
+	: now(now_) {
+    }
+    bool operator()(const IPFlow5ID &, Conn &c) const {
+	return click_jiffies_less(c.expiry, now);
+    }
+};
+
+void
+ConnTrack::reap(Table &table, ThreadState &ts, click_jiffies_t now, int n)
+{
+    table.reap_step(ts.reap_cursor, n * reap_batch, Expired(now));
+}
+
+inline void
+ConnTrack::emit(Packet *p, int info, ThreadState &ts)
+{
+    if (unlikely(info < 0)) {
+	++ts.failed;
+	checked_output_push(1, p);
+    } else {
+	++ts.info[info];
+	p->set_anno_u8(_anno, info);
+	output(0).push(p);
+    }
+}
+
+void
+ConnTrack::push(int, Packet *p)
+{
+    int thread = click_current_cpu_id();
+    Table &table = _tables[thread];
+    ThreadState &ts = _state[thread];
+    click_jiffies_t now = click_jiffies();
+
+    reap(table, ts, now, 1);
+    Lookup l;
+    parse(p, l);
+    emit(p, track(p, l, 0, table, ts, now), ts);
+}
+
+bool
+ConnTrack::run_task(Task *)
+{
+    Packet *p[burst_max];
+    int n = 0;
+    while (n < _burst && (p[n] = input(0).pull()))
+	++n;
+    if (n == 0) {
+	if (_signal)
+	    _task.fast_reschedule();
+	return false;
+    }
+
+    int thread = click_current_cpu_id();
+    Table &table = _tables[thread];
+    ThreadState &ts = _state[thread];
+    click_jiffies_t now = click_jiffies();
+
+    // Reap first: erasing entries would invalidate the looked-up pointers.
+    // Within the batch, entries are only inserted or reused in place.
+    reap(table, ts, now, n);
+    Lookup l[burst_max];
+    IPFlow5ID keys[burst_max];
+    Conn *c[burst_max];
+    for (int i = 0; i < n; ++i) {
+	parse(p[i], l[i]);
+	keys[i] = l[i].key;
+    }
+    table.find_batch(keys, n, c);
+    for (int i = 0; i < n; ++i)
+	emit(p[i], track(p[i], l[i], c[i], table, ts, now), ts);
+
+    _task.fast_reschedule();
+    return true;
+}
+
+String
+ConnTrack::read_handler(Element *e, void *thunk)
+{
+    ConnTrack *ct = static_cast<ConnTrack *>(e);
+    uint64_t x = 0;
+    int which = (intptr_t) thunk;
+    switch (which) {
+    case h_count:
+	return String(ct->_tables.size());
+    case h_created:
+	for (int i = 0; i < ct->_state.size(); ++i)
+	    x += ct->_state[i].created;
+	return String(x);
+    case h_failed:
+	for (int i = 0; i < ct->_state.size(); ++i)
+	    x += ct->_state[i].failed;
+	return String(x);
+    case h_new:
+    case h_established:
+    case h_related:
+    case h_invalid:
+	for (int i = 0; i < ct->_state.size(); ++i)
+	    x += ct->_state[i].info[which - h_new];
+	return String(x);
+    case h_capacity:
+	return String(ct->_capacity);
+    case h_memory:
+	return String(ct->_tables.memory_size());
+    case h_table: {
+	StringAccum sa;
+	click_jiffies_t now = click_jiffies();
+	for (int t = 0; t < ct->_tables.nthreads(); ++t) {
+	    const Table &table = ct->_tables[t];
+	    for (Table::size_type i = 0; i != table.index_limit(); ++i) {
+		if (!table.live(i)
+		    || click_jiffies_less(table.value(i).expiry, now))
+		    continue;
+		const Conn &c = table.value(i);
+		IPFlow5ID f = table.key(i);
+		if (c.flags & f_swapped)
+		    f = f.reverse();
+		if (f.proto() == IP_PROTO_TCP)
+		    sa << "TCP ";
+		else if (f.proto() == IP_PROTO_UDP)
+		    sa << "UDP ";
+		else if (f.proto() == IP_PROTO_ICMP)
+		    sa << "ICMP ";
+		else
+		    sa << (int) f.proto() << ' ';
+		sa << f.saddr() << ' ' << ntohs(f.sport()) << ' '
+		   << f.daddr() << ' ' << ntohs(f.dport()) << ' ';
+		if (c.state <= cs_tcp_close)
+		    sa << state_names[c.state] << '\n';
+		else
+		    sa << (c.flags & f_replied ? "REPLIED\n" : "UNREPLIED\n");
+	    }
+	}
+	return sa.take_string();
+    }
+    default:
+	return String();
+    }
+}
+
+int
+ConnTrack::write_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    ConnTrack *ct = static_cast<ConnTrack *>(e);
+    for (int i = 0; i < ct->_tables.nthreads(); ++i) {
+	ct->_tables[i].clear();
+	ct->_state[i].reap_cursor = 0;
+    }
+    return 0;
+}
+
+void
+ConnTrack::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("created", read_handler, h_created);
+    add_read_handler("failed", read_handler, h_failed);
+    add_read_handler("new", read_handler, h_new);
+    add_read_handler("established", read_handler, h_established);
+    add_read_handler("related", read_handler, h_related);
+    add_read_handler("invalid", read_handler, h_invalid);
+    add_read_handler("capacity", read_handler, h_capacity);
+    add_read_handler("memory", read_handler, h_memory);
+    add_read_handler("table", read_handler, h_table);
+    add_write_handler("clear", write_handler, h_clear, Handler::BUTTON);
+    if (input_is_pull(0))
+	add_task_handlers(&_task, &_signal);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(ConnTrack)
+ELEMENT_MT_SAFE(ConnTrack)
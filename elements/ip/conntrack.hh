@@ -0,0 +1,302 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_CONNTRACK_HH
+#define CLICK_CONNTRACK_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+#include <click/notifier.hh>
+#include <click/task.hh>
+CLICK_DECLS
+
+/*
+=c
+
+ConnTrack([I<keywords> ANNO, CAPACITY, LOOSE, BURST, TCP_SYN_TIMEOUT, ...])
+
+=s ip
+
+tracks connection state for stateful filtering
+
+=d
+
+ConnTrack follows the state of TCP connections, and of UDP, ICMP query and
+other IP pseudo-connections, and marks each packet with the state of its
+connection as seen by a stateful firewall:
+
+=over 5
+
+=item 0 (NEW)
+
+The packet starts a connection, or belongs to one that has not yet seen a
+packet in the reply direction.
+
+=item 1 (ESTABLISHED)
+
+The packet belongs to a connection that has seen packets in both
+directions.
+
+=item 2 (RELATED)
+
+The packet is an ICMP error (destination unreachable, source quench,
+redirect, time exceeded, or parameter problem) about a tracked connection.
+
+=item 3 (INVALID)
+
+The packet belongs to no connection and cannot start one: for example, a TCP
+packet with an impossible flag combination, a TCP packet other than a SYN
+when no connection exists, an ICMP echo reply with no matching request, an
+ICMP error about an unknown connection, a non-first fragment, or a truncated
+packet.
+
+=back
+
+The mark is stored in the ANNO annotation, by default the paint
+annotation, so a PaintSwitch or IPClassifier can act on it. INVALID packets
+do not change connection state.
+
+A connection is identified by its 5-tuple; both directions map to the same
+connection. The direction of the first packet is the original direction.
+TCP connections move through the states SYN_SENT, SYN_RECV, ESTABLISHED,
+FIN_WAIT (one side has sent FIN) and CLOSE (both sides have sent FIN, or
+either side has sent RST), using the same FIN and RST rules as TCPRewriter
+and AggregateIPFlows. A SYN for a closed connection starts a new one. UDP
+and other protocols' connections are UNREPLIED until a reply arrives, and
+REPLIED after. ICMP echo, timestamp, information and address mask requests
+start connections identified by the ICMP identifier; the matching replies
+are ESTABLISHED. Each state has its own timeout, set by the keywords below;
+a connection is forgotten once it has been idle for its state's timeout.
+
+Packets must have their IP header annotations set. ConnTrack does not
+reassemble fragments; place IPReassembler upstream if fragments may arrive.
+
+Connections are tracked per thread, so both directions of a connection must
+reach the same thread, as with symmetric RSS (see RSSSwitch). Each thread
+tracks at most CAPACITY connections; once it is full, packets that would
+start a new connection are emitted on output 1, if it exists, and dropped
+otherwise.
+
+ConnTrack's input is agnostic. When it is pushed to, each packet is looked
+up as it arrives. When its input is pull, ConnTrack pulls up to BURST
+packets at a time in a task and looks them up together, overlapping their
+table accesses, before pushing them out.
+
+Keywords are:
+
+=over 8
+
+=item ANNO
+
+Annotation name or offset. The 1-byte connection state is stored there.
+Default is PAINT.
+
+=item CAPACITY
+
+Unsigned integer. Number of connections each thread can track. Default is
+65536.
+
+=item LOOSE
+
+Boolean. If true, a TCP packet other than a SYN for an unknown connection
+starts an ESTABLISHED connection (the packet is NEW), so connections that
+were open before ConnTrack started are picked up. Default is false.
+
+=item BURST
+
+Integer. Maximum number of packets pulled per task run when the input is
+pull. Default is 32.
+
+=item TCP_SYN_TIMEOUT
+
+Time in seconds. Timeout for TCP connections in SYN_SENT and SYN_RECV.
+Default is 2 minutes.
+
+=item TCP_ESTABLISHED_TIMEOUT
+
+Time in seconds. Timeout for ESTABLISHED TCP connections. Default is 5 days.
+
+=item TCP_FIN_TIMEOUT
+
+Time in seconds. Timeout for TCP connections in FIN_WAIT. Default is 2
+minutes.
+
+=item TCP_CLOSE_TIMEOUT
+
+Time in seconds. Timeout for closed TCP connections. Default is 10 seconds.
+
+=item UDP_TIMEOUT
+
+Time in seconds. Timeout for UNREPLIED UDP connections. Default is 30
+seconds.
+
+=item UDP_STREAM_TIMEOUT
+
+Time in seconds. Timeout for REPLIED UDP connections. Default is 3 minutes.
+
+=item ICMP_TIMEOUT
+
+Time in seconds. Timeout for ICMP query connections. Default is 30 seconds.
+
+=item GENERIC_TIMEOUT
+
+Time in seconds. Timeout for connections of other protocols. Default is 10
+minutes.
+
+=back
+
+=h count read-only
+
+Returns the number of connections in all tables.
+
+=h created read-only
+
+Returns the number of connections created.
+
+=h failed read-only
+
+Returns the number of packets dropped, or emitted on output 1, because a
+table was full.
+
+=h new read-only
+
+Returns the number of packets marked NEW. The established, related and
+invalid handlers are analogous.
+
+=h capacity read-only
+
+Returns CAPACITY.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the connection tables.
+
+=h table read-only
+
+Returns the live connections, one per line, as "PROTO SADDR SPORT DADDR
+DPORT STATE" in the original direction.
+
+=h clear write-only
+
+Forgets all connections. Only safe while no packets are being processed.
+
+=e
+
+  // allow established traffic, new connections only from the inside
+  ct :: ConnTrack(CAPACITY 1000000);
+  ps :: PaintSwitch;
+  FromDevice(...) -> ... -> CheckIPHeader -> ct -> ps;
+  ps[0] -> IPFilter(allow src net 10.0.0.0/8, deny all) -> out;
+  ps[1], ps[2] -> out;
+  ps[3] -> Discard;
+
+=a PaintSwitch, IPFilter, TCPRewriter, AggregateIPFlows, FlowClassifier,
+RSSSwitch */
+
+class ConnTrack : public Element { public:
+
+    ConnTrack() CLICK_COLD;
+
+    const char *class_name() const	{ return "ConnTrack"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return "a/h"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int port, Packet *);
+    bool run_task(Task *);
+
+    enum {
+	ct_new = 0, ct_established = 1, ct_related = 2, ct_invalid = 3,
+	ct_ninfo = 4
+    };
+
+  private:
+
+    enum {
+	cs_tcp_syn_sent, cs_tcp_syn_recv, cs_tcp_established,
+	cs_tcp_fin_wait, cs_tcp_close,
+	cs_udp_unreplied, cs_udp_replied,
+	cs_icmp, cs_other_unreplied, cs_other_replied,
+	cs_nstates
+    };
+
+    enum {
+	f_swapped = 1,		// original direction is the reverse of the key
+	f_replied = 2,		// a reply-direction packet has been seen
+	f_done = 4		// f_done << d: direction d has sent FIN
+    };
+
+    struct Conn {
+	click_jiffies_t expiry;
+	uint8_t state;
+	uint8_t flags;
+	Conn()
+	    : expiry(0), state(0), flags(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Conn> Table;
+
+    // How a packet relates to the connection table.
+    enum {
+	k_create,		// may create a connection
+	k_tcp,			// TCP: may create a connection, depending on flags
+	k_reply,		// ICMP reply: connection must exist
+	k_related,		// ICMP error: key is the quoted connection
+	k_untracked		// no table entry; info is fixed
+    };
+
+    struct Lookup {
+	IPFlow5ID key;
+	int kind;
+	int info;		// for k_untracked
+	int dir;		// 1 iff the packet's flow is the key's reverse
+	uint8_t state;		// initial state for a new connection
+    };
+
+    struct ThreadState {
+	uint32_t reap_cursor;
+	uint64_t created;
+	uint64_t failed;
+	uint64_t info[ct_ninfo];
+	ThreadState()
+	    : reap_cursor(0), created(0), failed(0) {
+	    for (int i = 0; i < ct_ninfo; ++i)
+		info[i] = 0;
+	}
+    };
+
+    enum { reap_batch = 8, burst_max = 256 };
+
+    PerThreadCuckooTable<IPFlow5ID, Conn> _tables;
+    PerThread<ThreadState> _state;
+    int _anno;
+    uint32_t _capacity;
+    int _burst;
+    bool _loose;
+    click_jiffies_t _timeout_j[cs_nstates];
+    Task _task;
+    NotifierSignal _signal;
+
+    static const char * const state_names[cs_nstates];
+
+    static void parse(Packet *p, Lookup &l);
+    static void parse_icmp_error(Packet *p, Lookup &l);
+    static void canonicalize(Lookup &l);
+    int track(Packet *p, const Lookup &l, Conn *c, Table &table,
+	      ThreadState &ts, click_jiffies_t now);
+    int track_tcp(Packet *p, Conn *c, int dir, bool fresh);
+    struct Expired;
+    void reap(Table &table, ThreadState &ts, click_jiffies_t now, int n);
+    inline void emit(Packet *p, int info, ThreadState &ts);
+
+    enum { h_count, h_created, h_failed, h_new, h_established, h_related,
+	   h_invalid, h_capacity, h_memory, h_table, h_clear };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -60,17 +60,12 @@ DecIPTTL::simple_action(Packet *p)
 	if (!q)
 	    return 0;
 	click_ip *ip = q->ip_header();
-	--ip->ip_ttl;
 
 	// 19.Aug.1999 - incrementally update IP checksum as suggested by SOSP
 	// reviewers, according to RFC1141, as updated by RFC1624.
-	// new_sum = ~(~old_sum + ~old_halfword + new_halfword)
-	//         = ~(~old_sum + ~old_halfword + (old_halfword - 0x0100))
-	//         = ~(~old_sum + ~old_halfword + old_halfword + ~0x0100)
-	//         = ~(~old_sum + ~0 + ~0x0100)
-	//         = ~(~old_sum + 0xFEFF)
-	unsigned long sum = (~ntohs(ip->ip_sum) & 0xFFFF) + 0xFEFF;
-	ip->ip_sum = ~htons(sum + (sum >> 16));
+	uint16_t old_hw = reinterpret_cast<uint16_t *>(ip)[4];
+	--ip->ip_ttl;
+	click_update_in_cksum(&ip->ip_sum, old_hw, reinterpret_cast<uint16_t *>(ip)[4]);
 
 	return q;
     }
@@ -24,6 +24,10 @@
 #include <click/straccum.hh>
 #include <click/router.hh>
 #include <click/error.hh>
+#include <click/args.hh>
+#if CLICK_USERLEVEL
+# include <click/userutils.hh>
+#endif
 CLICK_DECLS
 
 
@@ -484,10 +488,63 @@ DirectIPLookup::Table::remove_route(const IPRoute& route, IPRoute* old_route, Er
     return 0;
 }
 
+int
+DirectIPLookup::Table::build(const Vector<IPRoute> &routes, ErrorHandler *errh)
+{
+    // Insert routes in order of increasing prefix length, so that each
+    // insertion only overwrites less specific entries.  The counting sort is
+    // stable: of several routes for the same prefix, the last one wins.
+    int start[35];		// start[plen + 2] counts routes of length plen
+    memset(start, 0, sizeof(start));
+    Vector<uint8_t> plens(routes.size(), 0);
+    for (int i = 0; i < routes.size(); ++i) {
+	int plen = routes[i].prefix_len();
+	if (plen < 0)
+	    return errh->error("route %<%s%> has a non-prefix mask", routes[i].unparse().c_str());
+	plens[i] = plen;
+	++start[plen + 2];
+    }
+    for (int plen = 2; plen < 34; ++plen)
+	start[plen] += start[plen - 1];
+    Vector<int> order(routes.size(), 0);
+    for (int i = 0; i < routes.size(); ++i)
+	order[start[plens[i] + 1]++] = i;
+
+    flush();
+    for (int *it = order.begin(); it != order.end(); ++it) {
+	int r = add_route(routes[*it], true, 0, errh);
+	if (r == -ENOMEM)
+	    return errh->error("no memory to store route %<%s%>", routes[*it].unparse().c_str());
+	else if (r < 0)
+	    return r;
+    }
+    return 0;
+}
+
+uint32_t
+DirectIPLookup::Table::nroutes() const
+{
+    uint32_t n = _rtable_size;
+    for (int rt_i = _rt_empty_head; rt_i >= 0; rt_i = _rtable[rt_i].ll_next)
+	--n;
+    // _rtable[0] always exists, but is a route only if it isn't discarding
+    return _vport[0].port == DISCARD_PORT ? n - 1 : n;
+}
+
+size_t
+DirectIPLookup::Table::memory_size() const
+{
+    return (sizeof(uint16_t) + sizeof(uint8_t)) * ((1 << 24) + _tbl_24_31_capacity)
+	+ sizeof(VirtualPort) * _vport_capacity
+	+ sizeof(CleartextEntry) * _rtable_capacity
+	+ sizeof(int) * PREF_HASHSIZE;
+}
+
 
 // DIRECTIPLOOKUP
 
 DirectIPLookup::DirectIPLookup()
+    : _t(0), _retire_timer(this)
 {
 }
 
@@ -499,16 +556,42 @@ int
 DirectIPLookup::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     int r;
-    if ((r = _t.initialize()) < 0)
+    if (!(_t = new Table))
+	return -ENOMEM;
+    if ((r = _t->initialize()) < 0)
 	return r;
-    _t.flush();
+    _t->flush();
     return IPRouteTable::configure(conf, errh);
 }
 
+int
+DirectIPLookup::initialize(ErrorHandler *)
+{
+    _retire_timer.initialize(this);
+    return 0;
+}
+
 void
 DirectIPLookup::cleanup(CleanupStage)
 {
-    _t.cleanup();
+    delete _t;
+    _t = 0;
+    for (RetiredTable *it = _retired.begin(); it != _retired.end(); ++it)
+	delete it->table;
+    _retired.clear();
+}
+
+void
+DirectIPLookup::run_timer(Timer *)
+{
+    // Free the tables that lookups have stopped using.
+    Timestamp now = Timestamp::now_steady();
+    RetiredTable *it = _retired.begin();
+    for (; it != _retired.end() && it->expiry <= now; ++it)
+	delete it->table;
+    _retired.erase(_retired.begin(), it);
+    if (_retired.size())
+	_retire_timer.schedule_at_steady(_retired[0].expiry);
 }
 
 void
@@ -528,26 +611,27 @@ DirectIPLookup::push(int, Packet *p)
 int
 DirectIPLookup::lookup_route(IPAddress dest, IPAddress &gw) const
 {
+    const Table *t = _t;
     uint32_t ip_addr = ntohl(dest.addr());
-    uint16_t vport_i = _t._tbl_0_23[ip_addr >> 8];
+    uint16_t vport_i = t->_tbl_0_23[ip_addr >> 8];
 
     if (vport_i & 0x8000)
-        vport_i = _t._tbl_24_31[((vport_i & 0x7fff) << 8) | (ip_addr & 0xff)];
+        vport_i = t->_tbl_24_31[((vport_i & 0x7fff) << 8) | (ip_addr & 0xff)];
 
-    gw = _t._vport[vport_i].gw;
-    return _t._vport[vport_i].port;
+    gw = t->_vport[vport_i].gw;
+    return t->_vport[vport_i].port;
 }
 
 int
 DirectIPLookup::add_route(const IPRoute& route, bool allow_replace, IPRoute* old_route, ErrorHandler *errh)
 {
-    return _t.add_route(route, allow_replace, old_route, errh);
+    return _t->add_route(route, allow_replace, old_route, errh);
 }
 
 int
 DirectIPLookup::remove_route(const IPRoute& route, IPRoute* old_route, ErrorHandler *errh)
 {
-    return _t.remove_route(route, old_route, errh);
+    return _t->remove_route(route, old_route, errh);
 }
 
 int
@@ -555,14 +639,81 @@ DirectIPLookup::flush_handler(const String &, Element *e, void *,
 				ErrorHandler *)
 {
     DirectIPLookup *t = static_cast<DirectIPLookup *>(e);
-    t->_t.flush();
+    t->_t->flush();
+    return 0;
+}
+
+int
+DirectIPLookup::load_handler(const String &str, Element *e, void *thunk,
+			     ErrorHandler *errh)
+{
+    DirectIPLookup *t = static_cast<DirectIPLookup *>(e);
+    Timestamp start = Timestamp::now_steady();
+
+    String data = str;
+#if CLICK_USERLEVEL
+    if (thunk) {
+	String filename;
+	if (!FilenameArg().parse(cp_uncomment(str), filename))
+	    return errh->error("expected filename");
+	int before = errh->nerrors();
+	data = file_string(filename, errh);
+	if (errh->nerrors() != before)
+	    return -EINVAL;
+    }
+#else
+    (void) thunk;
+#endif
+
+    Vector<IPRoute> routes;
+    if (t->parse_route_list(data, routes, errh) < 0)
+	return -EINVAL;
+
+    // Build the new table off the data path, then swap it in.
+    Table *nt = new Table;
+    int r;
+    if (!nt)
+	return errh->error("out of memory");
+    else if ((r = nt->initialize()) < 0 || (r = nt->build(routes, errh)) < 0) {
+	delete nt;
+	return r == -ENOMEM ? errh->error("out of memory") : r;
+    }
+
+    // Earlier loads' tables may still be in use, so queue the old table
+    // behind them rather than freeing anything now.
+    RetiredTable old;
+    old.table = t->_t;
+    old.expiry = Timestamp::now_steady() + Timestamp::make_msec(RETIRE_DELAY_MSEC);
+    t->_retired.push_back(old);
+    click_write_fence();
+    t->_t = nt;
+    if (!t->_retire_timer.scheduled())
+	t->_retire_timer.schedule_at_steady(old.expiry);
+
+    t->_load_time = Timestamp::now_steady() - start;
     return 0;
 }
 
+String
+DirectIPLookup::read_handler(Element *e, void *thunk)
+{
+    DirectIPLookup *t = static_cast<DirectIPLookup *>(e);
+    switch ((intptr_t) thunk) {
+    case h_load_time:
+	return t->_load_time.unparse_interval();
+    case h_nroutes:
+	return String(t->_t->nroutes());
+    case h_memory:
+	return String(t->_t->memory_size());
+    default:
+	return String();
+    }
+}
+
 String
 DirectIPLookup::dump_routes()
 {
-    return _t.dump();
+    return _t->dump();
 }
 
 void
@@ -570,6 +721,13 @@ DirectIPLookup::add_handlers()
 {
     IPRouteTable::add_handlers();
     add_write_handler("flush", flush_handler, 0, Handler::BUTTON);
+    add_write_handler("load", load_handler, 0);
+#if CLICK_USERLEVEL
+    add_write_handler("load_file", load_handler, 1);
+#endif
+    add_read_handler("load_time", read_handler, h_load_time);
+    add_read_handler("nroutes", read_handler, h_nroutes);
+    add_read_handler("memory", read_handler, h_memory);
 }
 
 CLICK_ENDDECLS
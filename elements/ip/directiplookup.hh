@@ -2,6 +2,7 @@
 #ifndef CLICK_DIRECTIPLOOKUP_HH
 #define CLICK_DIRECTIPLOOKUP_HH
 #include "iproutetable.hh"
+#include <click/timer.hh>
 CLICK_DECLS
 
 /*
@@ -65,6 +66,31 @@ operation.
 
 Clears the entire routing table in a single atomic operation.
 
+=h load write-only
+
+Replaces the entire routing table with a route list.  The list is either
+text, with one `C<ADDR/MASK [GW] OUT>' route per line, or the compact binary
+format described in IPRouteTable.  The new table is built off the data path
+and swapped in atomically, so packets are always looked up in either the old
+or the new table.  Much faster than adding routes one by one.
+
+=h load_file write-only
+
+Like C<load>, but reads the route list from the named file.  User-level only.
+
+=h load_time read-only
+
+Returns the time taken by the most recent C<load> or C<load_file>, including
+parsing.
+
+=h nroutes read-only
+
+Returns the number of routes in the table.
+
+=h memory read-only
+
+Returns the number of bytes used by the lookup and maintenance tables.
+
 =n
 
 See IPRouteTable for a performance comparison of the various IP routing
@@ -94,10 +120,12 @@ class DirectIPLookup : public IPRouteTable { public:
     const char *processing() const	{ return PUSH; }
 
     int configure(Vector<String> &conf, ErrorHandler *errh) CLICK_COLD;
+    int initialize(ErrorHandler *errh) CLICK_COLD;
     void cleanup(CleanupStage stage) CLICK_COLD;
     void add_handlers() CLICK_COLD;
 
     void push(int port, Packet* p);
+    void run_timer(Timer *timer);
 
     int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
     int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
@@ -105,13 +133,16 @@ class DirectIPLookup : public IPRouteTable { public:
     String dump_routes();
 
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
+    static int load_handler(const String &, Element *, void *, ErrorHandler *);
+    static String read_handler(Element *, void *);
 
     enum {
 	RT_SIZE_MAX = 256 * 1024, // accomodate a full BGP view and more
 	tbl_24_31_capacity_limit = 32768 * 256,
 	vport_capacity_limit = 32768,
 	PREF_HASHSIZE = 64 * 1024, // must be a power of 2!
-	DISCARD_PORT = -1
+	DISCARD_PORT = -1,
+	RETIRE_DELAY_MSEC = 1000
     };
 
     struct CleartextEntry {
@@ -178,12 +209,27 @@ class DirectIPLookup : public IPRouteTable { public:
 	int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
 	int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
 	void flush();
+	int build(const Vector<IPRoute> &routes, ErrorHandler *errh);
+
+	uint32_t nroutes() const;
+	size_t memory_size() const;
 
     };
 
   protected:
 
-    Table _t;
+    // Packets are looked up in *_t.  A bulk load builds a new Table, swaps
+    // it into _t, and frees the old one after RETIRE_DELAY_MSEC.
+    struct RetiredTable {
+	Table *table;
+	Timestamp expiry;
+    };
+    Table *_t;
+    Vector<RetiredTable> _retired;	// in order of expiry
+    Timer _retire_timer;
+    Timestamp _load_time;
+
+    enum { h_load_time, h_nroutes, h_memory };
 
     friend class RangeIPLookup;
 
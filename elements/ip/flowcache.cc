@@ -0,0 +1,323 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * flowcache.{cc,hh} -- elements cache per-flow decisions of a subgraph
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "flowcache.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/handler.hh>
+#include <click/packet_anno.hh>
+#include <click/router.hh>
+#include <click/routervisitor.hh>
+#include <click/straccum.hh>
+#include <clicknet/ip.h>
+CLICK_DECLS
+
+FlowCache::FlowCache()
+{
+}
+
+FlowCache::~FlowCache()
+{
+    for (int i = 0; i < _watches.size(); ++i) {
+	delete _watches[i]->h;
+	delete _watches[i];
+    }
+}
+
+int
+FlowCache::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String annos = "DST_IP PAINT", watch;
+    _capacity = 65536;
+    uint32_t timeout = 60;
+    _offset = 0;
+    if (Args(conf, this, errh)
+	.read("ANNOS", AnyArg(), annos)
+	.read("WATCH", AnyArg(), watch)
+	.read("CAPACITY", _capacity)
+	.read("TIMEOUT", SecondsArg(), timeout)
+	.read("OFFSET", _offset)
+	.complete() < 0)
+	return -1;
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    _timeout_j = timeout * CLICK_HZ;
+
+    Vector<String> words;
+    cp_spacevec(cp_unquote(annos), words);
+    int total = 0;
+    for (int i = 0; i < words.size(); ++i) {
+	int ai;
+	if (!AnnoArg(0).parse(words[i], ai, ArgContext(this)))
+	    return errh->error("ANNOS: bad annotation %<%s%>", words[i].c_str());
+	int size = ANNOTATIONINFO_SIZE(ai);
+	if (size == 0)
+	    return errh->error("ANNOS: annotation %<%s%> has no fixed size", words[i].c_str());
+	_anno_offset.push_back(ANNOTATIONINFO_OFFSET(ai));
+	_anno_size.push_back(size);
+	total += size;
+    }
+    if (total > anno_max)
+	return errh->error("ANNOS: too many annotation bytes (at most %d)", (int) anno_max);
+
+    words.clear();
+    cp_spacevec(cp_unquote(watch), words);
+    for (int i = 0; i < words.size(); ++i) {
+	Element *e;
+	if (!ElementArg().parse(words[i], e, ArgContext(this, errh)))
+	    return -1;
+	_watch_elements.push_back(e);
+    }
+
+    _generation = 1;
+    _invalidations = 0;
+    return 0;
+}
+
+namespace {
+class FlowCacheTracker : public ElementTracker { public:
+    FlowCacheTracker(Router *router, Element *fc)
+	: ElementTracker(router), _fc(fc) {
+    }
+    bool visit(Element *e, bool isoutput, int, Element *, int, int) {
+	if (isoutput)
+	    return true;
+	if (e == _fc || e->cast("FlowCacheExit"))
+	    return false;
+	insert(e);
+	return true;
+    }
+    Element *_fc;
+};
+}
+
+int
+FlowCache::watch(Element *e, ErrorHandler *)
+{
+    // Copy the writable handlers first: replacing a handler can recycle
+    // handler slots.
+    Vector<int> hindexes;
+    Router::element_hindexes(e, hindexes);
+    Vector<Handler *> copies;
+    for (int i = 0; i < hindexes.size(); ++i) {
+	const Handler *h = Router::handler(router(), hindexes[i]);
+	if (h && h->writable())
+	    copies.push_back(new Handler(*h));
+    }
+    for (int i = 0; i < copies.size(); ++i) {
+	Watch *w = new Watch;
+	w->fc = this;
+	w->e = e;
+	w->h = copies[i];
+	_watches.push_back(w);
+	Router::add_write_handler(e, copies[i]->name(), watch_write_handler,
+				  w, copies[i]->flags());
+    }
+    return 0;
+}
+
+int
+FlowCache::watch_write_handler(const String &str, Element *e, void *thunk,
+			       ErrorHandler *errh)
+{
+    Watch *w = static_cast<Watch *>(thunk);
+    int r = w->h->call_write(str, e, errh);
+    // even a failed write may have changed some state
+    w->fc->invalidate();
+    return r;
+}
+
+int
+FlowCache::initialize(ErrorHandler *errh)
+{
+    if (_tables.reserve(_capacity) < 0
+	|| _state.resize(_tables.nthreads()) < 0)
+	return errh->error("out of memory");
+
+    FlowCacheTracker tracker(router(), this);
+    router()->visit_downstream(this, 0, &tracker);
+    for (int i = 0; i < _watch_elements.size(); ++i)
+	tracker.insert(_watch_elements[i]);
+    _watch_elements = tracker.elements();
+    for (int i = 0; i < _watch_elements.size(); ++i)
+	watch(_watch_elements[i], errh);
+    return 0;
+}
+
+struct FlowCache::Expired {
+    click_jiffies_t limit;
+    const Flow *pending;
+    Expired(click_jiffies_t limit_, const Flow *pending_)
+	: limit(limit_), pending(pending_) {
+    }
+    bool operator()(const IPFlow5ID &, Flow &f) const {
+	// The pending flow's generation is not yet recorded; keep it.
+	return click_jiffies_less(f.last, limit) && &f != pending;
+    }
+};
+
+void
+FlowCache::reap(Table &table, ThreadState &ts, click_jiffies_t now)
+{
+    table.reap_step(ts.reap_cursor, reap_batch,
+		    Expired(now - _timeout_j, ts.pending));
+}
+
+void
+FlowCache::push(int, Packet *p)
+{
+    int thread = click_current_cpu_id();
+    Table &table = _tables[thread];
+    ThreadState &ts = _state[thread];
+    click_jiffies_t now = click_jiffies();
+
+    if (_timeout_j)
+	reap(table, ts, now);
+
+    const click_ip *iph;
+    if (p->has_network_header())
+	iph = p->ip_header();
+    else {
+	iph = reinterpret_cast<const click_ip *>(p->data() + _offset);
+	unsigned hl;
+	if (p->length() < _offset + sizeof(click_ip) || iph->ip_v != 4
+	    || (hl = iph->ip_hl << 2) < sizeof(click_ip)
+	    || p->length() < _offset + hl)
+	    goto uncached;
+	p->set_ip_header(iph, hl);
+    }
+
+    if (!IP_ISFRAG(iph)) {
+	bool inserted;
+	uint32_t generation = _generation.value();
+	Flow *f = table.find_insert(IPFlow5ID(p), inserted);
+	if (likely(f && f->generation == generation)) {
+	    f->last = now;
+	    const uint8_t *a = f->anno;
+	    for (int i = 0; i < _anno_offset.size(); ++i) {
+		memcpy(p->anno_u8() + _anno_offset[i], a, _anno_size[i]);
+		a += _anno_size[i];
+	    }
+	    ++ts.hits;
+	    output(f->port).push(p);
+	    return;
+	} else if (f) {
+	    f->generation = 0;
+	    f->last = now;
+	    ts.pending = f;
+	    ts.pending_generation = generation;
+	    ++ts.misses;
+	    output(0).push(p);
+	    ts.pending = 0;
+	    return;
+	}
+    }
+
+  uncached:
+    ++ts.misses;
+    output(0).push(p);
+}
+
+String
+FlowCache::read_handler(Element *e, void *thunk)
+{
+    FlowCache *fc = static_cast<FlowCache *>(e);
+    uint64_t x = 0;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	return String(fc->_tables.size());
+    case h_hits:
+	for (int i = 0; i < fc->_state.size(); ++i)
+	    x += fc->_state[i].hits;
+	return String(x);
+    case h_misses:
+	for (int i = 0; i < fc->_state.size(); ++i)
+	    x += fc->_state[i].misses;
+	return String(x);
+    case h_capacity:
+	return String(fc->_capacity);
+    case h_memory:
+	return String(fc->_tables.memory_size());
+    case h_covered: {
+	StringAccum sa;
+	for (int i = 0; i < fc->_watch_elements.size(); ++i)
+	    sa << fc->_watch_elements[i]->name() << '\n';
+	return sa.take_string();
+    }
+    case h_invalidations:
+	return String(fc->_invalidations.value());
+    default:
+	return String();
+    }
+}
+
+int
+FlowCache::write_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    static_cast<FlowCache *>(e)->invalidate();
+    return 0;
+}
+
+void
+FlowCache::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("hits", read_handler, h_hits);
+    add_read_handler("misses", read_handler, h_misses);
+    add_read_handler("capacity", read_handler, h_capacity);
+    add_read_handler("memory", read_handler, h_memory);
+    add_read_handler("covered", read_handler, h_covered);
+    add_read_handler("invalidations", read_handler, h_invalidations);
+    add_write_handler("invalidate", write_handler, h_invalidate, Handler::BUTTON);
+}
+
+
+FlowCacheExit::FlowCacheExit()
+{
+}
+
+int
+FlowCacheExit::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    Element *e;
+    if (Args(conf, this, errh)
+	.read_mp("FLOWCACHE", ElementCastArg("FlowCache"), e)
+	.read_mp("PORT", _port)
+	.complete() < 0)
+	return -1;
+    _fc = static_cast<FlowCache *>(e);
+    return 0;
+}
+
+int
+FlowCacheExit::initialize(ErrorHandler *errh)
+{
+    if (_port < 1 || _port >= _fc->noutputs())
+	return errh->error("PORT must be between 1 and %d", _fc->noutputs() - 1);
+    return 0;
+}
+
+void
+FlowCacheExit::push(int, Packet *p)
+{
+    _fc->record(p, _port);
+    output(0).push(p);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(FlowCache FlowCacheExit)
+ELEMENT_MT_SAFE(FlowCache)
+ELEMENT_MT_SAFE(FlowCacheExit)
@@ -0,0 +1,275 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_FLOWCACHE_HH
+#define CLICK_FLOWCACHE_HH
+#include <click/element.hh>
+#include <click/atomic.hh>
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+CLICK_DECLS
+class Handler;
+
+/*
+=c
+
+FlowCache([I<keywords> ANNOS, WATCH, CAPACITY, TIMEOUT, OFFSET])
+
+=s ip
+
+caches per-flow decisions of an element subgraph
+
+=d
+
+FlowCache and FlowCacheExit let the packets of a known flow bypass a
+subgraph of elements, such as header checks, filters and route lookups,
+whose decisions depend only on a packet's 5-tuple. FlowCache's output 0
+leads into the subgraph. Each way out of the subgraph passes through a
+FlowCacheExit element naming the FlowCache and one of its other outputs,
+and that output is connected to wherever the FlowCacheExit's output goes:
+
+  fc :: FlowCache;
+  ... -> fc -> CheckIPHeader -> f :: IPFilter(allow tcp, deny all)
+      -> rt :: LinearIPLookup(...);
+  rt[0] -> FlowCacheExit(fc, 1) -> out0;    fc[1] -> out0;
+  rt[1] -> FlowCacheExit(fc, 2) -> out1;    fc[2] -> out1;
+  f[1] -> FlowCacheExit(fc, 3) -> Discard;  fc[3] -> Discard;
+
+The first packet of a flow takes output 0. When it reaches a FlowCacheExit,
+FlowCache records the exit's port and the packet's ANNOS annotations for
+the flow. Later packets of the flow skip the subgraph: FlowCache restores
+the recorded annotations and emits them on the recorded port. A packet that
+leaves the subgraph without reaching a FlowCacheExit leaves its flow
+uncached.
+
+FlowCache forgets every recorded flow when any element in the subgraph
+changes state through a write handler, such as a route added to a lookup
+table or a filter reconfigured. The subgraph is every element reachable
+downstream from output 0, stopping at FlowCacheExit elements. Elements named
+by WATCH are watched as well. Invalidation is lazy and takes constant time.
+
+The subgraph must process each packet synchronously and emit it at most
+once: no queues, and no elements such as Tee that duplicate packets.
+Cached packets are not modified, so elements that change packet data, such
+as DecIPTTL and IPRewriter, belong after the exits. Replay is only correct
+if the subgraph's decision for a packet is a function of its 5-tuple and of
+the watched elements' state; for example, an IPFilter rule on TCP flags or
+packet length breaks that assumption.
+
+FlowCache computes flows from the IP header annotation. If a packet has
+none, FlowCache marks an IPv4 header at OFFSET, as MarkIPHeader would.
+Packets with no valid IPv4 header, and IP fragments, always take output 0
+and are not cached.
+
+Each thread caches at most CAPACITY flows. Once it is full, new flows take
+output 0 uncached.
+
+Keywords are:
+
+=over 8
+
+=item ANNOS
+
+Space-separated list of annotation names. These annotations are recorded
+at the exit and restored for cached packets. Their total size must be at
+most 16 bytes. Default is C<DST_IP PAINT>.
+
+=item WATCH
+
+Space-separated list of element names. Writes to these elements' handlers
+also forget all flows. Use this for elements that affect the subgraph's
+decisions but are not in it.
+
+=item CAPACITY
+
+Unsigned integer. Number of flows each thread can cache. Default is 65536.
+
+=item TIMEOUT
+
+Time in seconds. Idle flows are forgotten after this long. Default is 60
+seconds.
+
+=item OFFSET
+
+Unsigned integer. Offset of the IP header for packets without an IP header
+annotation. Default is 0.
+
+=back
+
+=h count read-only
+
+Returns the number of cached flows, including flows invalidated but not yet
+forgotten.
+
+=h hits read-only
+
+Returns the number of packets that skipped the subgraph.
+
+=h misses read-only
+
+Returns the number of packets sent through the subgraph.
+
+=h capacity read-only
+
+Returns CAPACITY.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the flow tables.
+
+=h covered read-only
+
+Returns the names of the watched elements, one per line.
+
+=h invalidations read-only
+
+Returns the number of times all flows were forgotten.
+
+=h invalidate write-only
+
+Forgets all flows.
+
+=a FlowCacheExit, FlowClassifier, IPFilter, IPClassifier */
+
+class FlowCache : public Element { public:
+
+    FlowCache() CLICK_COLD;
+    ~FlowCache() CLICK_COLD;
+
+    const char *class_name() const	{ return "FlowCache"; }
+    const char *port_count() const	{ return "1/2-"; }
+    const char *processing() const	{ return PUSH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int port, Packet *);
+
+    /** @brief Record that the flow being processed by the subgraph on this
+     * thread, if any, leaves through @a port with @a p's annotations. */
+    inline void record(Packet *p, int port);
+
+    /** @brief Forget all flows. */
+    void invalidate() {
+	// generation 0 marks flows still in the subgraph
+	if (_generation.fetch_and_add(1) == 0xFFFFFFFFU)
+	    ++_generation;
+	++_invalidations;
+    }
+
+  private:
+
+    enum { anno_max = 16 };
+
+    struct Flow {
+	uint32_t generation;	// 0 while the first packet is in the subgraph
+	click_jiffies_t last;
+	uint16_t port;
+	uint8_t anno[anno_max];
+	Flow()
+	    : generation(0), last(0), port(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Flow> Table;
+
+    struct ThreadState {
+	Flow *pending;
+	uint32_t pending_generation;
+	uint32_t reap_cursor;
+	uint64_t hits;
+	uint64_t misses;
+	ThreadState()
+	    : pending(0), pending_generation(0), reap_cursor(0),
+	      hits(0), misses(0) {
+	}
+    };
+
+    struct Watch {
+	FlowCache *fc;
+	Element *e;
+	Handler *h;		// copy of the original handler
+    };
+
+    enum { reap_batch = 8 };
+
+    PerThreadCuckooTable<IPFlow5ID, Flow> _tables;
+    PerThread<ThreadState> _state;
+    Vector<int> _anno_offset;
+    Vector<int> _anno_size;
+    Vector<Element *> _watch_elements;
+    Vector<Watch *> _watches;
+    atomic_uint32_t _generation;
+    atomic_uint32_t _invalidations;
+    uint32_t _capacity;
+    click_jiffies_t _timeout_j;
+    unsigned _offset;
+
+    struct Expired;
+    void reap(Table &table, ThreadState &ts, click_jiffies_t now);
+    int watch(Element *e, ErrorHandler *errh) CLICK_COLD;
+    static int watch_write_handler(const String &, Element *, void *, ErrorHandler *);
+
+    enum { h_count, h_hits, h_misses, h_capacity, h_memory, h_covered,
+	   h_invalidations, h_invalidate };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+/*
+=c
+
+FlowCacheExit(FLOWCACHE, PORT)
+
+=s ip
+
+marks an exit from a FlowCache subgraph
+
+=d
+
+Passes packets from input to output unchanged. If the packet is the first
+of a flow that its thread's FlowCache is sending through the cached
+subgraph, FlowCacheExit records that later packets of the flow should be
+emitted on FLOWCACHE's output PORT. PORT must be at least 1, and FLOWCACHE's
+output PORT should lead to the same place as FlowCacheExit's output.
+
+=a FlowCache */
+
+class FlowCacheExit : public Element { public:
+
+    FlowCacheExit() CLICK_COLD;
+
+    const char *class_name() const	{ return "FlowCacheExit"; }
+    const char *port_count() const	{ return PORTS_1_1; }
+    const char *processing() const	{ return PUSH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+
+    void push(int port, Packet *);
+
+  private:
+
+    FlowCache *_fc;
+    int _port;
+
+};
+
+inline void
+FlowCache::record(Packet *p, int port)
+{
+    ThreadState &ts = _state[click_current_cpu_id()];
+    if (Flow *f = ts.pending) {
+	ts.pending = 0;
+	f->port = port;
+	uint8_t *a = f->anno;
+	for (int i = 0; i < _anno_offset.size(); ++i) {
+	    memcpy(a, p->anno_u8() + _anno_offset[i], _anno_size[i]);
+	    a += _anno_size[i];
+	}
+	f->generation = ts.pending_generation;
+    }
+}
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,148 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * flowclassifier.{cc,hh} -- element assigns flow IDs to IP packets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "flowclassifier.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+CLICK_DECLS
+
+FlowClassifier::FlowClassifier()
+{
+}
+
+int
+FlowClassifier::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _anno = AGGREGATE_ANNO_OFFSET;
+    _capacity = 65536;
+    uint32_t timeout = 60;
+    if (Args(conf, this, errh)
+	.read("ANNO", AnnoArg(4), _anno)
+	.read("CAPACITY", _capacity)
+	.read("TIMEOUT", SecondsArg(), timeout)
+	.complete() < 0)
+	return -1;
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    _timeout_j = timeout * CLICK_HZ;
+    return 0;
+}
+
+int
+FlowClassifier::initialize(ErrorHandler *errh)
+{
+    if (_tables.reserve(_capacity) < 0
+	|| _state.resize(_tables.nthreads()) < 0)
+	return errh->error("out of memory");
+    return 0;
+}
+
+struct FlowClassifier::Expired {
+    click_jiffies_t limit;
+    Expired(click_jiffies_t limit_)
+	: limit(limit_) {
+    }
+    bool operator()(const IPFlow5ID &, Flow &f) const {
+	return click_jiffies_less(f.last, limit);
+    }
+};
+
+void
+FlowClassifier::reap(Table &table, ThreadState &ts, click_jiffies_t now)
+{
+    table.reap_step(ts.reap_cursor, reap_batch, Expired(now - _timeout_j));
+}
+
+Packet *
+FlowClassifier::simple_action(Packet *p)
+{
+    int thread = click_current_cpu_id();
+    Table &table = _tables[thread];
+    ThreadState &ts = _state[thread];
+    click_jiffies_t now = click_jiffies();
+
+    if (_timeout_j)
+	reap(table, ts, now);
+
+    bool inserted;
+    Flow *f = table.find_insert(IPFlow5ID(p), inserted);
+    if (unlikely(!f)) {
+	++ts.failed;
+	checked_output_push(1, p);
+	return 0;
+    } else if (inserted) {
+	f->id = ts.next_id * _tables.nthreads() + thread + 1;
+	if (unlikely(f->id == 0))
+	    f->id = thread + 1;
+	++ts.next_id;
+	++ts.created;
+    }
+    f->last = now;
+    p->set_anno_u32(_anno, f->id);
+    return p;
+}
+
+String
+FlowClassifier::read_handler(Element *e, void *thunk)
+{
+    FlowClassifier *fc = static_cast<FlowClassifier *>(e);
+    uint64_t x = 0;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	return String(fc->_tables.size());
+    case h_created:
+	for (int i = 0; i < fc->_state.size(); ++i)
+	    x += fc->_state[i].created;
+	return String(x);
+    case h_failed:
+	for (int i = 0; i < fc->_state.size(); ++i)
+	    x += fc->_state[i].failed;
+	return String(x);
+    case h_capacity:
+	return String(fc->_capacity);
+    case h_memory:
+	return String(fc->_tables.memory_size());
+    default:
+	return String();
+    }
+}
+
+int
+FlowClassifier::write_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    FlowClassifier *fc = static_cast<FlowClassifier *>(e);
+    for (int i = 0; i < fc->_tables.nthreads(); ++i) {
+	fc->_tables[i].clear();
+	fc->_state[i].reap_cursor = 0;
+    }
+    return 0;
+}
+
+void
+FlowClassifier::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("created", read_handler, h_created);
+    add_read_handler("failed", read_handler, h_failed);
+    add_read_handler("capacity", read_handler, h_capacity);
+    add_read_handler("memory", read_handler, h_memory);
+    add_write_handler("clear", write_handler, h_clear, Handler::BUTTON);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(FlowClassifier)
+ELEMENT_MT_SAFE(FlowClassifier)
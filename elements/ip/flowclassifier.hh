@@ -0,0 +1,140 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_FLOWCLASSIFIER_HH
+#define CLICK_FLOWCLASSIFIER_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+CLICK_DECLS
+
+/*
+=c
+
+FlowClassifier([I<keywords> ANNO, CAPACITY, TIMEOUT])
+
+=s ip
+
+assigns flow IDs to IP packets
+
+=d
+
+FlowClassifier sets an annotation on every IP packet to a flow ID that
+identifies the packet's 5-tuple: source and destination addresses, source
+and destination ports, and IP protocol. Ports are zero for protocols other
+than TCP, UDP, DCCP, SCTP and UDP-Lite, and for non-first fragments (use
+AggregateIPFlows if fragments must be matched with their flows). Packets
+must have their IP header annotations set.
+
+The first packet of a new flow gets a fresh flow ID, and later packets of the
+flow get the same ID. Flow IDs are never zero. A flow is forgotten once it
+has been idle for TIMEOUT; a later packet starts a new flow with a new ID.
+
+Flows are tracked per thread. A flow whose packets arrive on two threads gets
+a different ID on each, though no ID is ever given to two flows. Each thread
+tracks at most CAPACITY flows; once it is full, packets of new flows cannot be
+classified. They are emitted on output 1, if it exists, and dropped otherwise.
+
+Keywords are:
+
+=over 8
+
+=item ANNO
+
+Annotation name or offset. The 4-byte flow ID is stored there. Default is
+AGGREGATE.
+
+=item CAPACITY
+
+Unsigned integer. Number of flows each thread can track. Default is 65536.
+
+=item TIMEOUT
+
+Time in seconds. Idle flows are forgotten after this long. Expiration is
+done a few table entries at a time as packets arrive, so flows may
+outlive TIMEOUT somewhat when traffic is light. Default is 60 seconds; 0
+means flows never expire.
+
+=back
+
+=h count read-only
+
+Returns the number of flows in all tables.
+
+=h created read-only
+
+Returns the number of flows created since the router was initialized.
+
+=h failed read-only
+
+Returns the number of packets that could not be classified because a table
+was full.
+
+=h capacity read-only
+
+Returns CAPACITY.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the flow tables.
+
+=h clear write-only
+
+Forgets all flows. Only safe while no packets are being processed.
+
+=a AggregateIPFlows, AggregateIP, AggregateCounter
+*/
+
+class FlowClassifier : public Element { public:
+
+    FlowClassifier() CLICK_COLD;
+
+    const char *class_name() const	{ return "FlowClassifier"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    Packet *simple_action(Packet *);
+
+  private:
+
+    struct Flow {
+	uint32_t id;
+	click_jiffies_t last;
+	Flow()
+	    : id(0), last(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Flow> Table;
+
+    struct ThreadState {
+	uint32_t next_id;
+	uint32_t reap_cursor;
+	uint64_t created;
+	uint64_t failed;
+	ThreadState()
+	    : next_id(0), reap_cursor(0), created(0), failed(0) {
+	}
+    };
+
+    enum { reap_batch = 8 };
+
+    PerThreadCuckooTable<IPFlow5ID, Flow> _tables;
+    PerThread<ThreadState> _state;
+    int _anno;
+    uint32_t _capacity;
+    click_jiffies_t _timeout_j;
+
+    struct Expired;
+    void reap(Table &table, ThreadState &ts, click_jiffies_t now);
+
+    enum { h_count, h_created, h_failed, h_capacity, h_memory, h_clear };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
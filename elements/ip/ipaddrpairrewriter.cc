@@ -67,11 +67,13 @@ IPAddrPairRewriter::IPAddrPairFlow::unparse(StringAccum &sa, bool direction,
 }
 
 IPAddrPairRewriter::IPAddrPairRewriter()
+    : _allocator(0)
 {
 }
 
 IPAddrPairRewriter::~IPAddrPairRewriter()
 {
+    delete[] _allocator;
 }
 
 void *
@@ -98,14 +100,18 @@ IPAddrPairRewriter::configure(Vector<String> &conf, ErrorHandler *errh)
 	return -1;
 
     _annos = 1 + (has_reply_anno ? 2 + (reply_anno << 2) : 0);
-    return IPRewriterBase::configure(conf, errh);
+    if (IPRewriterBase::configure(conf, errh) < 0)
+	return -1;
+    _allocator = new SizedHashAllocator<sizeof(IPAddrPairFlow)>[_nthreads];
+    return 0;
 }
 
 IPRewriterEntry *
 IPAddrPairRewriter::get_entry(int, const IPFlowID &xflowid, int input)
 {
+    int thread = thread_index();
     IPFlowID flowid(xflowid.saddr(), 0, xflowid.daddr(), 0);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
     if (!m && (unsigned) input < (unsigned) _input_specs.size()) {
 	IPRewriterInput &is = _input_specs[input];
 	IPFlowID rewritten_flowid = IPFlowID::uninitialized_t();
@@ -119,27 +125,29 @@ IPRewriterEntry *
 IPAddrPairRewriter::add_flow(int, const IPFlowID &flowid,
 			     const IPFlowID &rewritten_flowid, int input)
 {
+    int thread = thread_index();
     void *data;
     if (rewritten_flowid.sport()
 	|| rewritten_flowid.dport()
-	|| !(data = _allocator.allocate()))
+	|| !(data = _allocator[thread].allocate()))
 	return 0;
 
     IPAddrPairFlow *flow = new(data) IPAddrPairFlow
 	(&_input_specs[input], flowid, rewritten_flowid,
 	 !!_timeouts[1], click_jiffies() + relevant_timeout(_timeouts));
 
-    return store_flow(flow, input, _map);
+    return store_flow(flow, input, thread, map(thread));
 }
 
 void
 IPAddrPairRewriter::push(int port, Packet *p_in)
 {
+    int thread = thread_index();
     WritablePacket *p = p_in->uniqueify();
     click_ip *iph = p->ip_header();
 
     IPFlowID flowid(iph->ip_src, 0, iph->ip_dst, 0);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
 
     if (!m) {			// create new mapping
 	IPRewriterInput &is = _input_specs.unchecked_at(port);
@@ -156,7 +164,7 @@ IPAddrPairRewriter::push(int port, Packet *p_in)
 
     IPAddrPairFlow *mf = static_cast<IPAddrPairFlow *>(m->flow());
     mf->apply(p, m->direction(), _annos);
-    mf->change_expiry_by_timeout(_heap, click_jiffies(), _timeouts);
+    mf->change_expiry_by_timeout(heap(thread), click_jiffies(), _timeouts);
     output(m->output()).push(p);
 }
 
@@ -167,11 +175,12 @@ IPAddrPairRewriter::dump_mappings_handler(Element *e, void *)
     IPAddrPairRewriter *rw = (IPAddrPairRewriter *)e;
     click_jiffies_t now = click_jiffies();
     StringAccum sa;
-    for (Map::iterator iter = rw->_map.begin(); iter.live(); iter++) {
-	IPAddrPairFlow *f = static_cast<IPAddrPairFlow *>(iter->flow());
-	f->unparse(sa, iter->direction(), now);
-	sa << '\n';
-    }
+    for (int t = 0; t < rw->nthreads(); ++t)
+	for (Map::iterator iter = rw->map(t).begin(); iter.live(); iter++) {
+	    IPAddrPairFlow *f = static_cast<IPAddrPairFlow *>(iter->flow());
+	    f->unparse(sa, iter->direction(), now);
+	    sa << '\n';
+	}
     return sa.take_string();
 }
 
@@ -86,7 +86,7 @@ dropped if the mapping table is full of guaranteed flows.
 
 =item REAP_INTERVAL I<time>
 
-Reap timed-out connections every I<time> seconds. Default is 15 minutes.
+Reap timed-out connections every I<time> seconds. Default is 1 second.
 
 =item MAPPING_CAPACITY I<capacity>
 
@@ -143,7 +143,11 @@ class IPAddrPairRewriter : public IPRewriterBase { public:
     IPRewriterEntry *get_entry(int ip_p, const IPFlowID &xflowid, int input);
     IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 			      const IPFlowID &rewritten_flowid, int input);
-    void destroy_flow(IPRewriterFlow *flow);
+    void destroy_flow(IPRewriterFlow *flow, int thread);
+    void memory_stats(MemoryStats &ms) const {
+	allocator_stats(ms, _allocator, sizeof(IPAddrPairFlow));
+	IPRewriterBase::memory_stats(ms);
+    }
 
     void push(int, Packet *);
 
@@ -151,7 +155,7 @@ class IPAddrPairRewriter : public IPRewriterBase { public:
 
   private:
 
-    SizedHashAllocator<sizeof(IPAddrPairFlow)> _allocator;
+    SizedHashAllocator<sizeof(IPAddrPairFlow)> *_allocator;	// one per thread
     unsigned _annos;
 
     static String dump_mappings_handler(Element *, void *);
@@ -160,11 +164,11 @@ class IPAddrPairRewriter : public IPRewriterBase { public:
 
 
 inline void
-IPAddrPairRewriter::destroy_flow(IPRewriterFlow *flow)
+IPAddrPairRewriter::destroy_flow(IPRewriterFlow *flow, int thread)
 {
-    unmap_flow(flow, _map);
+    unmap_flow(flow, thread, map(thread));
     static_cast<IPAddrPairFlow *>(flow)->~IPAddrPairFlow();
-    _allocator.deallocate(flow);
+    _allocator[thread].deallocate(flow);
 }
 
 CLICK_ENDDECLS
@@ -68,11 +68,13 @@ IPAddrRewriter::IPAddrFlow::unparse(StringAccum &sa, bool direction,
 }
 
 IPAddrRewriter::IPAddrRewriter()
+    : _allocator(0)
 {
 }
 
 IPAddrRewriter::~IPAddrRewriter()
 {
+    delete[] _allocator;
 }
 
 void *
@@ -99,17 +101,21 @@ IPAddrRewriter::configure(Vector<String> &conf, ErrorHandler *errh)
 	return -1;
 
     _annos = 1 + (has_reply_anno ? 2 + (reply_anno << 2) : 0);
-    return IPRewriterBase::configure(conf, errh);
+    if (IPRewriterBase::configure(conf, errh) < 0)
+	return -1;
+    _allocator = new SizedHashAllocator<sizeof(IPAddrFlow)>[_nthreads];
+    return 0;
 }
 
 IPRewriterEntry *
 IPAddrRewriter::get_entry(int, const IPFlowID &xflowid, int input)
 {
+    int thread = thread_index();
     IPFlowID flowid(xflowid.saddr(), 0, IPAddress(), 0);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
     if (!m) {
 	IPFlowID rflowid(IPAddress(), 0, xflowid.daddr(), 0);
-	m = _map.get(rflowid);
+	m = map(thread).get(rflowid);
     }
     if (!m && (unsigned) input < (unsigned) _input_specs.size()) {
 	IPRewriterInput &is = _input_specs[input];
@@ -124,32 +130,34 @@ IPRewriterEntry *
 IPAddrRewriter::add_flow(int, const IPFlowID &flowid,
 			 const IPFlowID &rewritten_flowid, int input)
 {
+    int thread = thread_index();
     void *data;
     if (rewritten_flowid.sport()
 	|| rewritten_flowid.dport()
 	|| rewritten_flowid.daddr()
-	|| !(data = _allocator.allocate()))
+	|| !(data = _allocator[thread].allocate()))
 	return 0;
 
     IPAddrFlow *flow = new(data) IPAddrFlow
 	(&_input_specs[input], flowid, rewritten_flowid,
 	 !!_timeouts[1], click_jiffies() + relevant_timeout(_timeouts));
 
-    return store_flow(flow, input, _map);
+    return store_flow(flow, input, thread, map(thread));
 }
 
 void
 IPAddrRewriter::push(int port, Packet *p_in)
 {
+    int thread = thread_index();
     WritablePacket *p = p_in->uniqueify();
     click_ip *iph = p->ip_header();
 
     IPFlowID flowid(iph->ip_src, 0, IPAddress(), 0);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
 
     if (!m) {
 	IPFlowID rflowid = IPFlowID(IPAddress(), 0, iph->ip_dst, 0);
-	m = _map.get(rflowid);
+	m = map(thread).get(rflowid);
     }
 
     if (!m) {			// create new mapping
@@ -167,7 +175,7 @@ IPAddrRewriter::push(int port, Packet *p_in)
 
     IPAddrFlow *mf = static_cast<IPAddrFlow *>(m->flow());
     mf->apply(p, m->direction(), _annos);
-    mf->change_expiry_by_timeout(_heap, click_jiffies(), _timeouts);
+    mf->change_expiry_by_timeout(heap(thread), click_jiffies(), _timeouts);
     output(m->output()).push(p);
 }
 
@@ -178,11 +186,12 @@ IPAddrRewriter::dump_mappings_handler(Element *e, void *)
     IPAddrRewriter *rw = (IPAddrRewriter *)e;
     StringAccum sa;
     click_jiffies_t now = click_jiffies();
-    for (Map::iterator iter = rw->_map.begin(); iter.live(); iter++) {
-	IPAddrFlow *f = static_cast<IPAddrFlow *>(iter->flow());
-	f->unparse(sa, iter->direction(), now);
-	sa << '\n';
-    }
+    for (int t = 0; t < rw->nthreads(); ++t)
+	for (Map::iterator iter = rw->map(t).begin(); iter.live(); iter++) {
+	    IPAddrFlow *f = static_cast<IPAddrFlow *>(iter->flow());
+	    f->unparse(sa, iter->direction(), now);
+	    sa << '\n';
+	}
     return sa.take_string();
 }
 
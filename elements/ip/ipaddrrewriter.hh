@@ -85,7 +85,7 @@ dropped if the mapping table is full of guaranteed flows.
 
 =item REAP_INTERVAL I<time>
 
-Reap timed-out connections every I<time> seconds. Default is 15 minutes.
+Reap timed-out connections every I<time> seconds. Default is 1 second.
 
 =item MAPPING_CAPACITY I<capacity>
 
@@ -142,7 +142,11 @@ class IPAddrRewriter : public IPRewriterBase { public:
     inline IPRewriterEntry *get_entry(int ip_p, const IPFlowID &flowid, int input);
     IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 			      const IPFlowID &rewritten_flowid, int input);
-    void destroy_flow(IPRewriterFlow *flow);
+    void destroy_flow(IPRewriterFlow *flow, int thread);
+    void memory_stats(MemoryStats &ms) const {
+	allocator_stats(ms, _allocator, sizeof(IPAddrFlow));
+	IPRewriterBase::memory_stats(ms);
+    }
 
     void push(int, Packet *);
 
@@ -150,7 +154,7 @@ class IPAddrRewriter : public IPRewriterBase { public:
 
   protected:
 
-    SizedHashAllocator<sizeof(IPAddrFlow)> _allocator;
+    SizedHashAllocator<sizeof(IPAddrFlow)> *_allocator;	// one per thread
     unsigned _annos;
 
     static String dump_mappings_handler(Element *, void *);
@@ -159,11 +163,11 @@ class IPAddrRewriter : public IPRewriterBase { public:
 
 
 inline void
-IPAddrRewriter::destroy_flow(IPRewriterFlow *flow)
+IPAddrRewriter::destroy_flow(IPRewriterFlow *flow, int thread)
 {
-    unmap_flow(flow, _map);
+    unmap_flow(flow, thread, map(thread));
     static_cast<IPAddrFlow *>(flow)->~IPAddrFlow();
-    _allocator.deallocate(flow);
+    _allocator[thread].deallocate(flow);
 }
 
 CLICK_ENDDECLS
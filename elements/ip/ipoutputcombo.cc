@@ -183,11 +183,11 @@ IPOutputCombo::push(int, Packet *p_in)
     output(3).push(p);
     return;
   } else {
-    ip->ip_ttl--;
     // 19.Aug.1999 - incrementally update IP checksum as suggested by SOSP
     // reviewers, according to RFC1141 and RFC1624
-    unsigned long sum = (~ntohs(ip->ip_sum) & 0xFFFF) + 0xFEFF;
-    ip->ip_sum = ~htons(sum + (sum >> 16));
+    uint16_t old_hw = reinterpret_cast<uint16_t *>(ip)[4];
+    ip->ip_ttl--;
+    click_update_in_cksum(&ip->ip_sum, old_hw, reinterpret_cast<uint16_t *>(ip)[4]);
   }
 
   // Fragmenter
@@ -1,10 +1,7 @@
 // -*- c-basic-offset: 4 -*-
 #ifndef CLICK_IPREASSEMBLER_HH
 #define CLICK_IPREASSEMBLER_HH
-#include <click/element.hh>
-#include <click/glue.hh>
-#include <clicknet/ip.h>
-#include <click/timer.hh>
+#include "elements/ip/ipreassemblerbase.hh"
 CLICK_DECLS
 
 /*
@@ -20,22 +17,34 @@ Reassembles fragmented IP packets
 
 Expects IP packets as input to port 0. If input packets are fragments,
 IPReassembler holds them until it has enough fragments to recreate a complete
-packet. When a complete packet is constructed, it is emitted onto output 0. If
-a set of fragments making a single packet is incomplete and dormant for 30
-seconds, the fragments are generally dropped. If IPReassembler has two
-outputs, however, a single packet containing all the received fragments at
-their proper offsets is pushed onto output 1.
-
-IPReassembler's memory usage is bounded. When memory consumption rises above
-HIMEM bytes, IPReassembler throws away old fragments until memory consumption
-drops below 3/4*HIMEM bytes. Default HIMEM is 256K.
-
-Output packets have the same MAC header as the fragment that contains
-offset 0.  Other than that, input MAC headers are ignored.
-
-The IPREASSEMBLER annotation area is used to store packet metadata about
-packets in the process of reassembly.  On emitted reassembled packets,
-this annotation area is set to 0.
+packet. When a complete packet is constructed, it is emitted onto output 0.
+Non-fragments pass through unchanged. If a set of fragments making a single
+packet is incomplete and dormant for TIMEOUT seconds, or is dropped to bound
+memory, its fragments are dropped. If IPReassembler has two outputs,
+however, the fragment at offset 0, if it arrived, is pushed onto output 1.
+
+Packets in progress are keyed by source, destination, IP ID and protocol,
+and each thread tracks at most CAPACITY of them, so all fragments of a packet
+must reach the same thread. Fragments are held as they arrive, without
+copying, and are copied once into the reassembled packet.
+
+IPReassembler's memory usage is bounded. If the fragments held for one
+source address use more than SOURCE_HIMEM bytes, that source's least
+recently updated packets are dropped until it is within its limit, so a
+fragment flood from one source does not push out other sources' fragments.
+When a thread's memory consumption rises above its share of HIMEM bytes,
+IPReassembler drops the least recently updated packets until it is below
+3/4 of its share. Memory is charged in packet buffer sizes. Each dropped
+packet costs constant time; nothing scans the tables.
+
+A fragment that overlaps a held fragment, other than an exact duplicate,
+causes the whole packet to be dropped, since overlapping fragments are used
+to evade filters. Exact duplicates are dropped.
+
+Output packets have the same MAC header and annotations as the fragment
+that contains offset 0, and the timestamp of the fragment that completed
+them. Times are taken from the timestamp annotations, which are set to the
+current time if they are zero, so traces are reassembled as captured.
 
 Keyword arguments are:
 
@@ -43,7 +52,23 @@ Keyword arguments are:
 
 =item HIMEM
 
-The upper bound for memory consumption, in bytes. Default is 256K.
+The upper bound for memory consumption, in bytes, divided evenly among
+threads. Default is 4M.
+
+=item SOURCE_HIMEM
+
+The upper bound for memory consumption by one source address on one thread,
+in bytes. Default is a quarter of a thread's share of HIMEM.
+
+=item CAPACITY
+
+Unsigned integer. Number of packets each thread can reassemble at once.
+Default is 4096.
+
+=item TIMEOUT
+
+Time in seconds. Incomplete packets are dropped after this long without a
+new fragment. Default is 30 seconds.
 
 =item MAX_MTU_ANNO
 
@@ -58,83 +83,60 @@ is unchanged.
 You may want to attach an C<ICMPError(ADDR, timeexceeded, reassembly)> to the
 second output.
 
-IPReassembler destroys its input packets' "next packet" annotations.
+=h count read-only
 
-=a IPFragmenter */
+Returns the number of packets being reassembled.
 
-class IPReassembler : public Element { public:
+=h held read-only
 
-    IPReassembler() CLICK_COLD;
-    ~IPReassembler() CLICK_COLD;
+Returns the number of bytes of fragments held.
 
-    const char *class_name() const	{ return "IPReassembler"; }
-    const char *port_count() const	{ return PORTS_1_1X2; }
-    const char *processing() const	{ return PROCESSING_A_AH; }
+=h fragments read-only
 
-    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
-    int initialize(ErrorHandler *) CLICK_COLD;
-    void cleanup(CleanupStage) CLICK_COLD;
+Returns the number of fragments seen.
 
-    int check(ErrorHandler * = 0);
+=h reassembled read-only
 
-    Packet *simple_action(Packet *);
+Returns the number of packets reassembled.
 
-    void add_handlers() CLICK_COLD;
+=h failed read-only
 
-    struct ChunkLink {
-	uint16_t off;
-	uint16_t lastoff;
-    };
+Returns the number of incomplete packets dropped, for any reason.
 
-  private:
+=h evictions read-only
 
-    enum { REAP_TIMEOUT = 30, // seconds
-	   REAP_INTERVAL = 10, // seconds
-	   IPH_MEM_USED = 40 };
+Returns the number of incomplete packets dropped to bound memory, or
+because a table was full.
 
-    enum { NMAP = 256 };
-    WritablePacket *_map[NMAP];
+=h overlaps read-only
 
-    int _reap_time;
+Returns the number of packets dropped for overlapping fragments.
 
-    uint32_t _stat_frags_seen;
-    uint32_t _stat_good_assem;
-    uint32_t _stat_failed_assem;
-    uint32_t _stat_bad_pkts;
+=h bad read-only
 
-    uint32_t _mem_used;
-    uint32_t _mem_high_thresh;	// defaults to 256K
-    uint32_t _mem_low_thresh;	// defaults to 3/4 * _mem_high_thresh
-    int8_t _mtu_anno;
+Returns the number of malformed or inconsistent fragments dropped.
 
-    static inline int bucketno(const click_ip *);
-    static inline bool same_segment(const click_ip *, const click_ip *);
-    static String debug_dump(Element *e, void *);
+=h memory read-only
 
-    WritablePacket *find_queue(Packet *, WritablePacket ***);
-    void make_queue(Packet *, WritablePacket **);
-    static ChunkLink *next_chunk(WritablePacket *, ChunkLink *);
-    Packet *emit_whole_packet(WritablePacket *, WritablePacket **, Packet *);
-    void reap_overfull(int);
-    void reap(int);
-    static void check_error(ErrorHandler *, int, const Packet *, const char *, ...);
+Returns the number of bytes allocated by the tables and fragment records,
+not counting held fragments.
 
-};
+=a IPFragmenter, IP6Reassembler */
+
+class IPReassembler : public IPReassemblerBase { public:
+
+    IPReassembler() CLICK_COLD;
+    ~IPReassembler() CLICK_COLD;
 
+    const char *class_name() const	{ return "IPReassembler"; }
+
+    Packet *simple_action(Packet *);
 
-inline int
-IPReassembler::bucketno(const click_ip *h)
-{
-    return (h->ip_id % NMAP);
-}
+  private:
+
+    WritablePacket *assemble(const Datagram *d);
 
-inline bool
-IPReassembler::same_segment(const click_ip *h, const click_ip *h2)
-{
-    return h->ip_id == h2->ip_id && h->ip_p == h2->ip_p
-	&& h->ip_src.s_addr == h2->ip_src.s_addr
-	&& h->ip_dst.s_addr == h2->ip_dst.s_addr;
-}
+};
 
 CLICK_ENDDECLS
 #endif
@@ -0,0 +1,410 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * ipreassemblerbase.{cc,hh} -- shared fragment reassembly engine
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "ipreassemblerbase.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+CLICK_DECLS
+
+IPReassemblerBase::IPReassemblerBase(int timeout)
+    : _timeout(timeout)
+{
+    static_assert(sizeof(Key) == 40, "Key must have no padding.");
+}
+
+IPReassemblerBase::~IPReassemblerBase()
+{
+}
+
+int
+IPReassemblerBase::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _himem = 4 << 20;
+    _source_himem = 0;
+    _capacity = 4096;
+    uint32_t timeout = _timeout;
+    int mtu_anno = -1;
+    if (Args(conf, this, errh)
+	.read("HIMEM", _himem)
+	.read("SOURCE_HIMEM", _source_himem)
+	.read("CAPACITY", _capacity)
+	.read("TIMEOUT", SecondsArg(), timeout)
+	.read("MAX_MTU_ANNO", AnnoArg(2), mtu_anno)
+	.complete() < 0)
+	return -1;
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    _timeout = timeout;
+    _mtu_anno = mtu_anno;
+    return 0;
+}
+
+int
+IPReassemblerBase::initialize(ErrorHandler *errh)
+{
+    if (_tables.reserve(_capacity) < 0 || _sources.reserve(_capacity) < 0
+	|| _state.resize(_tables.nthreads()) < 0)
+	return errh->error("out of memory");
+    _thread_himem = _himem / _tables.nthreads();
+    if (_source_himem == 0)
+	_source_himem = _thread_himem / 4;
+    return 0;
+}
+
+void
+IPReassemblerBase::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t)
+	for (Datagram *d = _state[t].head; d; d = d->next)
+	    for (Fragment *f = d->frags; f; f = f->next)
+		f->p->kill();
+    // the pools free the records
+    _state.clear();
+}
+
+IPReassemblerBase::Datagram *
+IPReassemblerBase::make_datagram(int thread, ThreadState &ts, const Key &key,
+				 Datagram **slot)
+{
+    Datagram *d = static_cast<Datagram *>(ts.datagram_pool.allocate());
+    if (!d)
+	return 0;
+    d->key = key;
+    d->frags = d->tail = 0;
+    d->prev = d->next = 0;
+    d->memory = d->covered = d->total = 0;
+    d->max_length = 0;
+    d->last = 0;
+
+    SourceTable &sources = _sources[thread];
+    SourceKey skey(key);
+    bool inserted;
+    Source **sp = sources.find_insert(skey, inserted);
+    if (sp && inserted) {
+	if (Source *s = static_cast<Source *>(ts.source_pool.allocate())) {
+	    s->key = skey;
+	    s->head = s->tail = 0;
+	    s->memory = 0;
+	    *sp = s;
+	} else {
+	    sources.erase(skey);
+	    sp = 0;
+	}
+    }
+    // A datagram whose source could not be tracked is bounded only by
+    // HIMEM.
+    d->source = sp ? *sp : 0;
+    d->src_prev = d->src_next = 0;
+    if (Source *s = d->source) {
+	d->src_next = s->head;
+	if (s->head)
+	    s->head->src_prev = d;
+	else
+	    s->tail = d;
+	s->head = d;
+    }
+
+    d->next = ts.head;
+    if (ts.head)
+	ts.head->prev = d;
+    else
+	ts.tail = d;
+    ts.head = d;
+    *slot = d;
+    return d;
+}
+
+inline void
+IPReassemblerBase::touch(ThreadState &ts, Datagram *d, int now)
+{
+    d->last = now;
+    if (d != ts.head) {
+	d->prev->next = d->next;
+	if (d->next)
+	    d->next->prev = d->prev;
+	else
+	    ts.tail = d->prev;
+	d->prev = 0;
+	d->next = ts.head;
+	ts.head->prev = d;
+	ts.head = d;
+    }
+    Source *s = d->source;
+    if (s && d != s->head) {
+	d->src_prev->src_next = d->src_next;
+	if (d->src_next)
+	    d->src_next->src_prev = d->src_prev;
+	else
+	    s->tail = d->src_prev;
+	d->src_prev = 0;
+	d->src_next = s->head;
+	s->head->src_prev = d;
+	s->head = d;
+    }
+}
+
+void
+IPReassemblerBase::free_datagram(int thread, ThreadState &ts, Datagram *d,
+				 bool failed)
+{
+    _tables[thread].erase(d->key);
+
+    if (d->prev)
+	d->prev->next = d->next;
+    else
+	ts.head = d->next;
+    if (d->next)
+	d->next->prev = d->prev;
+    else
+	ts.tail = d->prev;
+
+    if (Source *s = d->source) {
+	if (d->src_prev)
+	    d->src_prev->src_next = d->src_next;
+	else
+	    s->head = d->src_next;
+	if (d->src_next)
+	    d->src_next->src_prev = d->src_prev;
+	else
+	    s->tail = d->src_prev;
+	s->memory -= d->memory;
+	if (!s->head) {
+	    _sources[thread].erase(s->key);
+	    ts.source_pool.deallocate(s);
+	}
+    }
+    ts.memory -= d->memory;
+
+    Fragment *next;
+    for (Fragment *f = d->frags; f; f = next) {
+	next = f->next;
+	if (failed && f->off == 0)
+	    checked_output_push(1, f->p);
+	else
+	    f->p->kill();
+	ts.fragment_pool.deallocate(f);
+    }
+    if (failed)
+	++ts.failed;
+    ts.datagram_pool.deallocate(d);
+}
+
+int
+IPReassemblerBase::insert(ThreadState &ts, Datagram *d, Packet *p,
+			  unsigned off, unsigned end, unsigned data)
+{
+    // Fragments usually arrive in order, so try the tail first.
+    Fragment **pp;
+    if (!d->tail || off >= d->tail->end)
+	pp = d->tail ? &d->tail->next : &d->frags;
+    else {
+	pp = &d->frags;
+	while ((*pp)->end <= off)
+	    pp = &(*pp)->next;
+	Fragment *x = *pp;
+	if (x->off == off && x->end == end)
+	    return 0;
+	else if (x->off < end)
+	    return -1;
+    }
+
+    Fragment *f = static_cast<Fragment *>(ts.fragment_pool.allocate());
+    if (!f)
+	return 0;
+    f->next = *pp;
+    f->p = p;
+    f->off = off;
+    f->end = end;
+    f->data = data;
+    *pp = f;
+    if (!f->next)
+	d->tail = f;
+
+    uint32_t c = charge(p);
+    d->memory += c;
+    ts.memory += c;
+    if (d->source)
+	d->source->memory += c;
+    d->covered += end - off;
+    if (p->network_length() > d->max_length)
+	d->max_length = p->network_length();
+    return 1;
+}
+
+void
+IPReassemblerBase::bad(Packet *p)
+{
+    ++_state[click_current_cpu_id()].bad;
+    p->kill();
+}
+
+Packet *
+IPReassemblerBase::reassemble(Packet *p, const Key &key, unsigned off,
+			      unsigned end, bool more, unsigned data)
+{
+    int thread = click_current_cpu_id();
+    ThreadState &ts = _state[thread];
+    Table &table = _tables[thread];
+    ++ts.fragments;
+
+    int now = p->timestamp_anno().sec();
+    if (!now) {
+	p->timestamp_anno().assign_now();
+	now = p->timestamp_anno().sec();
+    }
+
+    // The LRU list is in order of last activity, so expired datagrams
+    // are at its tail.
+    while (ts.tail && ts.tail->last < now - _timeout)
+	free_datagram(thread, ts, ts.tail, true);
+
+    bool inserted;
+    Datagram **slot = table.find_insert(key, inserted);
+    if (!slot && ts.tail) {
+	++ts.evictions;
+	free_datagram(thread, ts, ts.tail, true);
+	slot = table.find_insert(key, inserted);
+    }
+    if (!slot) {
+	p->kill();
+	return 0;
+    }
+    Datagram *d = *slot;
+    if (inserted && !(d = make_datagram(thread, ts, key, slot))) {
+	table.erase(key);
+	p->kill();
+	return 0;
+    }
+    touch(ts, d, now);
+
+    if (!more) {
+	if ((d->total && d->total != end) || (d->tail && d->tail->end > end)) {
+	    bad(p);
+	    return 0;
+	}
+	d->total = end;
+    } else if (d->total && end > d->total) {
+	bad(p);
+	return 0;
+    }
+
+    int r = insert(ts, d, p, off, end, data);
+    if (r < 0) {
+	++ts.overlaps;
+	p->kill();
+	free_datagram(thread, ts, d, true);
+	return 0;
+    } else if (r == 0) {
+	p->kill();
+	return 0;
+    }
+
+    if (d->total && d->covered == d->total) {
+	WritablePacket *q = assemble(d);
+	if (q) {
+	    q->set_timestamp_anno(p->timestamp_anno());
+	    if (_mtu_anno >= 0)
+		q->set_anno_u16(_mtu_anno, d->max_length);
+	    ++ts.reassembled;
+	}
+	free_datagram(thread, ts, d, false);
+	return q;
+    }
+
+    if (Source *s = d->source)
+	while (s->memory > _source_himem) {
+	    Datagram *victim = s->tail;
+	    ++ts.evictions;
+	    free_datagram(thread, ts, victim, true);
+	    if (victim == d)
+		return 0;
+	}
+    if (ts.memory > _thread_himem) {
+	size_t low = _thread_himem - _thread_himem / 4;
+	while (ts.memory > low && ts.tail) {
+	    ++ts.evictions;
+	    free_datagram(thread, ts, ts.tail, true);
+	}
+    }
+    return 0;
+}
+
+String
+IPReassemblerBase::read_handler(Element *e, void *thunk)
+{
+    IPReassemblerBase *rb = static_cast<IPReassemblerBase *>(e);
+    int n = rb->_state.size();
+    uint64_t ThreadState::*counter;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	return String(rb->_tables.size());
+    case h_held: {
+	size_t x = 0;
+	for (int i = 0; i < n; ++i)
+	    x += rb->_state[i].memory;
+	return String(x);
+    }
+    case h_memory: {
+	size_t x = rb->_tables.memory_size() + rb->_sources.memory_size();
+	for (int i = 0; i < n; ++i)
+	    x += rb->_state[i].fragment_pool.memory()
+		+ rb->_state[i].datagram_pool.memory()
+		+ rb->_state[i].source_pool.memory();
+	return String(x);
+    }
+    case h_fragments:
+	counter = &ThreadState::fragments;
+	break;
+    case h_reassembled:
+	counter = &ThreadState::reassembled;
+	break;
+    case h_failed:
+	counter = &ThreadState::failed;
+	break;
+    case h_evictions:
+	counter = &ThreadState::evictions;
+	break;
+    case h_overlaps:
+	counter = &ThreadState::overlaps;
+	break;
+    case h_bad:
+	counter = &ThreadState::bad;
+	break;
+    default:
+	return String();
+    }
+    uint64_t x = 0;
+    for (int i = 0; i < n; ++i)
+	x += rb->_state[i].*counter;
+    return String(x);
+}
+
+void
+IPReassemblerBase::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("held", read_handler, h_held);
+    add_read_handler("fragments", read_handler, h_fragments);
+    add_read_handler("reassembled", read_handler, h_reassembled);
+    add_read_handler("failed", read_handler, h_failed);
+    add_read_handler("evictions", read_handler, h_evictions);
+    add_read_handler("overlaps", read_handler, h_overlaps);
+    add_read_handler("bad", read_handler, h_bad);
+    add_read_handler("memory", read_handler, h_memory);
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(IPReassemblerBase)
@@ -0,0 +1,198 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_IPREASSEMBLERBASE_HH
+#define CLICK_IPREASSEMBLERBASE_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/hashallocator.hh>
+CLICK_DECLS
+
+/*
+ * IPReassemblerBase holds the datagram tables, memory limits and expiry
+ * shared by IPReassembler and IP6Reassembler; see IPReassembler for the
+ * keywords and handlers. Subclasses parse fragments and call reassemble(),
+ * and build complete packets in assemble().
+ */
+
+class IPReassemblerBase : public Element { public:
+
+    IPReassemblerBase(int timeout) CLICK_COLD;
+    ~IPReassemblerBase() CLICK_COLD;
+
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+  protected:
+
+    // Addresses are IPv6 or IPv4-mapped IPv6.
+    struct Key {
+	uint32_t src[4];
+	uint32_t dst[4];
+	uint32_t id;
+	uint32_t proto;
+	inline hashcode_t hashcode() const;
+	inline bool operator==(const Key &x) const;
+    };
+
+    struct SourceKey {
+	uint32_t src[4];
+	SourceKey() {
+	}
+	SourceKey(const Key &k) {
+	    memcpy(src, k.src, sizeof(src));
+	}
+	inline hashcode_t hashcode() const;
+	inline bool operator==(const SourceKey &x) const;
+    };
+
+    struct Fragment {
+	Fragment *next;
+	Packet *p;
+	uint16_t off;		// payload offset in the datagram
+	uint16_t end;
+	uint16_t data;		// payload offset from p->data()
+    };
+
+    struct Source;
+
+    struct Datagram {
+	Key key;
+	Fragment *frags;	// sorted by offset, disjoint
+	Fragment *tail;
+	Datagram *prev;		// thread LRU list, most recent first
+	Datagram *next;
+	Datagram *src_prev;	// source LRU list
+	Datagram *src_next;
+	Source *source;
+	uint32_t memory;
+	uint32_t covered;	// payload bytes held
+	uint32_t total;		// payload length, or 0 if unknown
+	uint16_t max_length;	// longest fragment's network length
+	int last;		// seconds
+    };
+
+    struct Source {
+	SourceKey key;
+	Datagram *head;
+	Datagram *tail;
+	uint32_t memory;
+    };
+
+    /** @brief Reassemble fragment @a p.
+     * @param p fragment; its timestamp annotation may be set
+     * @param key the datagram's key
+     * @param off offset of @a p's payload in the datagram
+     * @param end end of @a p's payload in the datagram
+     * @param more true iff more fragments follow
+     * @param data offset of @a p's payload from p->data()
+     * @return the reassembled packet, or null
+     *
+     * Takes ownership of @a p. */
+    Packet *reassemble(Packet *p, const Key &key, unsigned off, unsigned end,
+		       bool more, unsigned data);
+
+    /** @brief Build the reassembled packet for complete datagram @a d.
+     *
+     * The datagram's first fragment supplies the headers, and every
+     * fragment's payload is copied into place. The caller frees @a d. */
+    virtual WritablePacket *assemble(const Datagram *d) = 0;
+
+    /** @brief Count @a p as a bad fragment and free it. */
+    void bad(Packet *p);
+
+  private:
+
+    typedef CuckooTable<Key, Datagram *> Table;
+    typedef CuckooTable<SourceKey, Source *> SourceTable;
+
+    struct ThreadState {
+	SizedHashAllocator<sizeof(Fragment)> fragment_pool;
+	SizedHashAllocator<sizeof(Datagram)> datagram_pool;
+	SizedHashAllocator<sizeof(Source)> source_pool;
+	Datagram *head;
+	Datagram *tail;
+	size_t memory;
+	uint64_t fragments;
+	uint64_t reassembled;
+	uint64_t failed;
+	uint64_t evictions;
+	uint64_t overlaps;
+	uint64_t bad;
+	ThreadState()
+	    : head(0), tail(0), memory(0), fragments(0), reassembled(0),
+	      failed(0), evictions(0), overlaps(0), bad(0) {
+	}
+    };
+
+    PerThreadCuckooTable<Key, Datagram *> _tables;
+    PerThreadCuckooTable<SourceKey, Source *> _sources;
+    PerThread<ThreadState> _state;
+    uint32_t _capacity;
+    uint32_t _himem;
+    uint32_t _source_himem;
+    size_t _thread_himem;
+    int _timeout;
+    int8_t _mtu_anno;
+
+    static inline uint32_t charge(Packet *p) {
+	return sizeof(Fragment) + p->buffer_length();
+    }
+    Datagram *make_datagram(int thread, ThreadState &ts, const Key &key,
+			    Datagram **slot);
+    inline void touch(ThreadState &ts, Datagram *d, int now);
+    void free_datagram(int thread, ThreadState &ts, Datagram *d, bool failed);
+    int insert(ThreadState &ts, Datagram *d, Packet *p, unsigned off,
+	       unsigned end, unsigned data);
+
+    enum { h_count, h_held, h_fragments, h_reassembled, h_failed,
+	   h_evictions, h_overlaps, h_bad, h_memory };
+    static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+inline hashcode_t
+IPReassemblerBase::Key::hashcode() const
+{
+    // MurmurHash3's block step, so every word affects every bit
+    uint32_t h = 0;
+    const uint32_t *w = reinterpret_cast<const uint32_t *>(this);
+    for (int i = 0; i < 10; ++i) {
+	uint32_t k = w[i] * 0xCC9E2D51U;
+	k = (k << 15) | (k >> 17);
+	h ^= k * 0x1B873593U;
+	h = ((h << 13) | (h >> 19)) * 5 + 0xE6546B64U;
+    }
+    return h;
+}
+
+inline bool
+IPReassemblerBase::Key::operator==(const Key &x) const
+{
+    return memcmp(this, &x, sizeof(Key)) == 0;
+}
+
+inline hashcode_t
+IPReassemblerBase::SourceKey::hashcode() const
+{
+    uint32_t h = 0;
+    for (int i = 0; i < 4; ++i) {
+	uint32_t k = src[i] * 0xCC9E2D51U;
+	k = (k << 15) | (k >> 17);
+	h ^= k * 0x1B873593U;
+	h = ((h << 13) | (h >> 19)) * 5 + 0xE6546B64U;
+    }
+    return h;
+}
+
+inline bool
+IPReassemblerBase::SourceKey::operator==(const SourceKey &x) const
+{
+    return memcmp(src, x.src, sizeof(src)) == 0;
+}
+
+CLICK_ENDDECLS
+#endif
@@ -32,7 +32,7 @@
 #include <click/straccum.hh>
 #include <click/error.hh>
 #include <click/algorithm.hh>
-#include <click/heap.hh>
+#include <click/integers.hh>
 
 #ifdef CLICK_LINUXMODULE
 #include <click/cxxprotect.h>
@@ -63,12 +63,110 @@ IPMapper::rewrite_flowid(IPRewriterInput *, const IPFlowID &, IPFlowID &,
     return IPRewriterBase::rw_drop;
 }
 
+//
+// IPRewriterHeap
+//
+
+IPRewriterHeap::IPRewriterHeap(int thread)
+    : _capacity(0x7FFFFFFF), _use_count(1), _thread(thread)
+{
+    click_jiffies_t now_j = click_jiffies();
+    for (int which = 0; which < 2; ++which) {
+	Wheel &w = _wheels[which];
+	memset(w.nonempty, 0, sizeof(w.nonempty));
+	w.size = 0;
+	w.cursor = w.coarse_cursor = 0;
+	w.base_j = w.coarse_base_j = w.cursor_min_j = now_j;
+    }
+}
+
+size_t
+IPRewriterHeap::memory() const
+{
+    size_t n = 0;
+    for (int which = 0; which < 2; ++which)
+	for (int s = 0; s < nslots; ++s)
+	    n += _wheels[which].slot[s].capacity() * sizeof(IPRewriterFlow *);
+    return n;
+}
+
+unsigned
+IPRewriterHeap::next_nonempty(const Wheel &w, unsigned first, unsigned mask,
+			      unsigned from)
+{
+    // Return the distance from slot first + from to the next nonempty slot
+    // among slots first to first + mask, wrapping around, or mask + 1.
+    for (unsigned d = 0; d <= mask; ) {
+	unsigned i = (from + d) & mask;
+	uint32_t bits = w.nonempty[(first + i) >> 5] >> (i & 31);
+	if (bits)
+	    return d + ffs_lsb(bits) - 1;
+	d += 32 - (i & 31);
+    }
+    return mask + 1;
+}
+
+IPRewriterFlow *
+IPRewriterHeap::earliest(int which)
+{
+    // Return the earliest of the first scan_max flows in the first nonempty
+    // slot, refiling those whose expiries were extended past that slot.
+    // Each refile is paid for by the change_expiry() that extended it, so
+    // this is amortized O(1).  The flow returned expires within a slot's
+    // length of the earliest flow, and is the earliest flow when the slot
+    // holds at most scan_max flows.
+    Wheel &w = _wheels[which];
+    while (w.size) {
+	Vector<IPRewriterFlow *> &next = w.slot[w.next_coarse_slot()];
+	if (next.size()) {
+	    // The next coarse slot overlaps the fine slots; empty it first.
+	    IPRewriterFlow *flow = next.back();
+	    unfile(flow);
+	    file(flow);
+	    continue;
+	}
+	unsigned s, d;
+	click_jiffies_t end_j = 0;
+	bool last = true;
+	if (w.slot[overflow_slot].size())
+	    s = overflow_slot;
+	else if ((d = next_nonempty(w, 0, wheel_mask, w.cursor)) <= wheel_mask) {
+	    s = (w.cursor + d) & wheel_mask;
+	    end_j = w.base_j + (d + 1) * CLICK_HZ;
+	    last = d == wheel_mask;
+	} else {
+	    d = next_nonempty(w, coarse_slot0, coarse_mask, w.coarse_cursor);
+	    s = coarse_slot0 + ((w.coarse_cursor + d) & coarse_mask);
+	    end_j = w.coarse_base_j + (d + 1) * coarse_sec * CLICK_HZ;
+	    last = d == coarse_mask;
+	}
+	Vector<IPRewriterFlow *> &v = w.slot[s];
+	IPRewriterFlow *best = 0;
+	for (int i = 0, n = 0; i < v.size() && n < scan_max; ++n) {
+	    IPRewriterFlow *flow = v[i];
+	    if (!last && !click_jiffies_less(flow->_expiry_j, end_j)) {
+		unfile(flow);
+		file(flow);
+		if ((flow->_place & place_mask) != s)
+		    continue;
+	    }
+	    if (!best || click_jiffies_less(flow->_expiry_j, best->_expiry_j))
+		best = flow;
+	    ++i;
+	}
+	if (best)
+	    return best;
+    }
+    return 0;
+}
+
 //
 // IPRewriterBase
 //
 
 IPRewriterBase::IPRewriterBase()
-    : _map(0), _heap(new IPRewriterHeap), _gc_timer(gc_timer_hook, this)
+    : _nthreads(1), _heap_element(0), _capacity(0x7FFFFFFF),
+      _gc_timer(gc_timer_hook, this)
 {
     _timeouts[0] = default_timeout;
     _timeouts[1] = default_guarantee;
@@ -77,8 +175,9 @@ IPRewriterBase::IPRewriterBase()
 
 IPRewriterBase::~IPRewriterBase()
 {
-    if (_heap)
-	_heap->unuse();
+    for (int t = 0; t < _state.size(); ++t)
+	if (_state[t].heap)
+	    _state[t].heap->unuse();
 }
 
 
@@ -150,6 +249,7 @@ int
 IPRewriterBase::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     String capacity_word;
+    bool per_thread = false;
 
     if (Args(this, errh).bind(conf)
 	.read("CAPACITY", AnyArg(), capacity_word)
@@ -158,23 +258,31 @@ IPRewriterBase::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("GUARANTEE", SecondsArg(), _timeouts[1])
 	.read("REAP_INTERVAL", SecondsArg(), _gc_interval_sec)
 	.read("REAP_TIME", Args::deprecated, SecondsArg(), _gc_interval_sec)
+	.read("PER_THREAD", per_thread)
 	.consume() < 0)
 	return -1;
 
     if (capacity_word) {
 	Element *e;
-	IPRewriterBase *rwb;
-	if (IntArg().parse(capacity_word, _heap->_capacity))
+	if (IntArg().parse(capacity_word, _capacity) && _capacity >= 0)
 	    /* OK */;
 	else if ((e = cp_element(capacity_word, this))
-		 && (rwb = (IPRewriterBase *) e->cast("IPRewriterBase"))) {
-	    rwb->_heap->use();
-	    _heap->unuse();
-	    _heap = rwb->_heap;
-	} else
+		 && (_heap_element = (IPRewriterBase *) e->cast("IPRewriterBase")))
+	    /* share its heaps; see initialize() */;
+	else
 	    return errh->error("bad MAPPING_CAPACITY");
     }
 
+    _nthreads = per_thread ? click_max_cpu_ids() : 1;
+    if (_state.resize(_nthreads) < 0)
+	return errh->error("out of memory");
+    for (int t = 0; t < _nthreads; ++t) {
+	_state[t].heap = new IPRewriterHeap(t);
+	_state[t].rewriter = this;
+	_state[t].thread = t;
+    }
+    set_capacity(_capacity);
+
     if (conf.size() != ninputs())
 	return errh->error("need %d arguments, one per input port", ninputs());
 
@@ -190,16 +298,47 @@ IPRewriterBase::configure(Vector<String> &conf, ErrorHandler *errh)
     return _input_specs.size() == ninputs() ? 0 : -1;
 }
 
+IPRewriterBase *
+IPRewriterBase::heap_element()
+{
+    // Follow MAPPING_CAPACITY references to the element whose heaps are
+    // shared.  Element initialization order doesn't matter.
+    IPRewriterBase *rw = this;
+    for (int n = 0; rw->_heap_element && n < 256; ++n)
+	rw = rw->_heap_element;
+    return rw;
+}
+
 int
 IPRewriterBase::initialize(ErrorHandler *errh)
 {
+    IPRewriterBase *heap_owner = heap_element();
+    if (heap_owner->_nthreads != _nthreads)
+	return errh->error("MAPPING_CAPACITY element %<%s%> must have the same PER_THREAD setting", heap_owner->name().c_str());
+    else if (heap_owner != this)
+	for (int t = 0; t < _nthreads; ++t) {
+	    heap_owner->_state[t].heap->use();
+	    _state[t].heap->unuse();
+	    _state[t].heap = heap_owner->_state[t].heap;
+	}
+
     for (int i = 0; i < _input_specs.size(); ++i) {
 	PrefixErrorHandler cerrh(errh, "input spec " + String(i) + ": ");
-	if (_input_specs[i].reply_element->_heap != _heap)
-	    cerrh.error("reply element %<%s%> must share this MAPPING_CAPACITY", i, _input_specs[i].reply_element->name().c_str());
+	IPRewriterBase *reply_element = _input_specs[i].reply_element;
+	if (reply_element->heap_element() != heap_owner)
+	    cerrh.error("reply element %<%s%> must share this MAPPING_CAPACITY", reply_element->name().c_str());
+	if (reply_element->_nthreads != _nthreads)
+	    cerrh.error("reply element %<%s%> must have the same PER_THREAD setting", reply_element->name().c_str());
 	if (_input_specs[i].kind == IPRewriterInput::i_mapper)
 	    _input_specs[i].u.mapper->notify_rewriter(this, &_input_specs[i], &cerrh);
     }
+
+    for (int t = 0; t < _nthreads; ++t) {
+	_state[t].gc_task = new Task(gc_task_hook, &_state[t]);
+	_state[t].gc_task->initialize(this, false);
+	if (_nthreads > 1)
+	    _state[t].gc_task->move_thread(t);
+    }
     _gc_timer.initialize(this);
     if (_gc_interval_sec)
 	_gc_timer.schedule_after_sec(_gc_interval_sec);
@@ -209,7 +348,11 @@ IPRewriterBase::initialize(ErrorHandler *errh)
 void
 IPRewriterBase::cleanup(CleanupStage)
 {
-    shrink_heap(true);
+    for (int t = 0; t < _state.size(); ++t) {
+	delete _state[t].gc_task;
+	_state[t].gc_task = 0;
+	shrink_heap(true, t);
+    }
     for (int i = 0; i < _input_specs.size(); ++i)
 	if (_input_specs[i].kind == IPRewriterInput::i_pattern)
 	    _input_specs[i].u.pattern->unuse();
@@ -219,7 +362,7 @@ IPRewriterBase::cleanup(CleanupStage)
 IPRewriterEntry *
 IPRewriterBase::get_entry(int ip_p, const IPFlowID &flowid, int input)
 {
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = _state[thread_index()].map.get(flowid);
     if (m && ip_p && m->flow()->ip_p() && m->flow()->ip_p() != ip_p)
 	return 0;
     if (!m && (unsigned) input < (unsigned) _input_specs.size()) {
@@ -232,111 +375,241 @@ IPRewriterBase::get_entry(int ip_p, const IPFlowID &flowid, int input)
 }
 
 IPRewriterEntry *
-IPRewriterBase::store_flow(IPRewriterFlow *flow, int input,
+IPRewriterBase::store_flow(IPRewriterFlow *flow, int input, int thread,
 			   Map &map, Map *reply_map_ptr)
 {
     IPRewriterBase *reply_element = _input_specs[input].reply_element;
     if ((unsigned) flow->entry(false).output() >= (unsigned) noutputs()
 	|| (unsigned) flow->entry(true).output() >= (unsigned) reply_element->noutputs()) {
-	flow->owner()->owner->destroy_flow(flow);
+	flow->owner()->owner->destroy_flow(flow, thread);
 	return 0;
     }
 
     IPRewriterEntry *old = map.set(&flow->entry(false));
     assert(!old);
 
+    IPRewriterHeap *heap = _state[thread].heap;
     if (!reply_map_ptr)
-	reply_map_ptr = &reply_element->_map;
+	reply_map_ptr = &reply_element->_state[thread].map;
     old = reply_map_ptr->set(&flow->entry(true));
     if (unlikely(old)) {		// Assume every map has the same heap.
 	if (likely(old->flow() != flow))
-	    old->flow()->destroy(_heap);
+	    old->flow()->destroy(heap);
     }
 
-    Vector<IPRewriterFlow *> &myheap = _heap->_heaps[flow->guaranteed()];
-    myheap.push_back(flow);
-    push_heap(myheap.begin(), myheap.end(),
-	      IPRewriterFlow::heap_less(), IPRewriterFlow::heap_place());
+    heap->file(flow);
     ++_input_specs[input].count;
 
-    if (unlikely(_heap->size() > _heap->capacity())) {
+    if (unlikely(heap->size() > heap->capacity())) {
 	// This may destroy the newly added mapping, if it has the lowest
 	// expiration time.  How can we tell?  If (1) flows are added to the
 	// heap one at a time, so the heap was formerly no bigger than the
 	// capacity, and (2) 'flow' expires in the future, then we will only
-	// destroy 'flow' if it's the top of the heap.
+	// destroy 'flow' if it's the earliest flow.
 	click_jiffies_t now_j = click_jiffies();
 	assert(click_jiffies_less(now_j, flow->expiry())
-	       && _heap->size() == _heap->capacity() + 1);
-	if (shrink_heap_for_new_flow(flow, now_j)) {
+	       && heap->size() == heap->capacity() + 1);
+	if (shrink_heap_for_new_flow(heap, flow, now_j)) {
 	    ++_input_specs[input].failures;
 	    return 0;
 	}
     }
 
-    if (map.unbalanced())
-	map.rehash(map.bucket_count() + 1);
-    if (reply_map_ptr != &map && reply_map_ptr->unbalanced())
-	reply_map_ptr->rehash(reply_map_ptr->bucket_count() + 1);
     return &flow->entry(false);
 }
 
-void
-IPRewriterBase::shift_heap_best_effort(click_jiffies_t now_j)
+inline void
+IPRewriterBase::reap_flow(IPRewriterHeap *heap, int which,
+			  IPRewriterFlow *mf, click_jiffies_t now_j)
 {
-    // Shift flows with expired guarantees to the best-effort heap.
-    Vector<IPRewriterFlow *> &guaranteed_heap = _heap->_heaps[1];
-    while (guaranteed_heap.size() && guaranteed_heap[0]->expired(now_j)) {
-	IPRewriterFlow *mf = guaranteed_heap[0];
+    // Expired best-effort flows are destroyed; guaranteed flows whose
+    // guarantees have expired become best-effort; other flows move to the
+    // slots for their current expiries.
+    if (!mf->expired(now_j))
+	mf->refile(heap, mf->guaranteed(), mf->expiry());
+    else if (which == IPRewriterHeap::h_best_effort)
+	mf->destroy(heap);
+    else {
 	click_jiffies_t new_expiry = mf->owner()->owner->best_effort_expiry(mf);
-	mf->change_expiry(_heap, false, new_expiry);
+	mf->change_expiry(heap, false, new_expiry);
     }
 }
 
 bool
-IPRewriterBase::shrink_heap_for_new_flow(IPRewriterFlow *flow,
+IPRewriterBase::reap_wheel(IPRewriterHeap *heap, int which,
+			   click_jiffies_t now_j, int &budget)
+{
+    // Process the slots that have ended, then give the overflow list
+    // another chance.  Returns false if the budget ran out first.
+    IPRewriterHeap::Wheel &w = heap->_wheels[which];
+    while (1) {
+	if (w.size == 0) {
+	    w.base_j = w.coarse_base_j = w.cursor_min_j = now_j;
+	    return true;
+	}
+	// Move the next coarse slot's flows to fine slots before any of
+	// those fine slots can come up.
+	Vector<IPRewriterFlow *> &next = w.slot[w.next_coarse_slot()];
+	while (next.size()) {
+	    if (--budget < 0)
+		return false;
+	    IPRewriterFlow *mf = next.back();
+	    heap->unfile(mf);
+	    heap->file(mf);
+	}
+	if (click_jiffies_less(now_j, w.base_j + CLICK_HZ))
+	    return true;
+	Vector<IPRewriterFlow *> &v = w.slot[w.cursor];
+	while (v.size()) {
+	    if (--budget < 0)
+		return false;
+	    reap_flow(heap, which, v.back(), now_j);
+	}
+	w.cursor = (w.cursor + 1) & IPRewriterHeap::wheel_mask;
+	w.base_j += CLICK_HZ;
+	w.cursor_min_j = w.base_j;
+	if (w.base_j - w.coarse_base_j >= IPRewriterHeap::coarse_sec * CLICK_HZ) {
+	    w.coarse_cursor = (w.coarse_cursor + 1) & IPRewriterHeap::coarse_mask;
+	    w.coarse_base_j += IPRewriterHeap::coarse_sec * CLICK_HZ;
+	}
+	// Walking backwards visits each flow once, even those refiled into
+	// the overflow list.
+	Vector<IPRewriterFlow *> &o = w.slot[IPRewriterHeap::overflow_slot];
+	for (int i = o.size() - 1; i >= 0; --i)
+	    reap_flow(heap, which, o[i], now_j);
+    }
+}
+
+void
+IPRewriterBase::shift_heap_best_effort(IPRewriterHeap *heap,
+				       click_jiffies_t now_j)
+{
+    // Shift flows with expired guarantees to the best-effort heap.  Ended
+    // slots are handled by reap_wheel; the current slot is scanned only if
+    // one of its flows might have expired.
+    int budget = 0x7FFFFFFF;
+    reap_wheel(heap, IPRewriterHeap::h_guarantee, now_j, budget);
+    IPRewriterHeap::Wheel &w = heap->_wheels[IPRewriterHeap::h_guarantee];
+    if (w.size && !click_jiffies_less(now_j, w.cursor_min_j)) {
+	Vector<IPRewriterFlow *> &v = w.slot[w.cursor];
+	click_jiffies_t min_j = w.base_j + CLICK_HZ;
+	for (int i = v.size() - 1; i >= 0; --i) {
+	    IPRewriterFlow *mf = v[i];
+	    if (mf->expired(now_j)) {
+		click_jiffies_t new_expiry = mf->owner()->owner->best_effort_expiry(mf);
+		mf->change_expiry(heap, false, new_expiry);
+	    } else if (click_jiffies_less(mf->expiry(), min_j))
+		min_j = mf->expiry();
+	}
+	w.cursor_min_j = min_j;
+    }
+}
+
+bool
+IPRewriterBase::shrink_heap_for_new_flow(IPRewriterHeap *heap,
+					 IPRewriterFlow *flow,
 					 click_jiffies_t now_j)
 {
-    shift_heap_best_effort(now_j);
-    // At this point, all flows in the guarantee heap expire in the future.
+    shift_heap_best_effort(heap, now_j);
+    // At this point, all guaranteed flows expire in the future.
     // So remove the next-to-expire best-effort flow, unless there are none.
     // In that case we always remove the current flow to honor previous
     // guarantees (= admission control).
-    IPRewriterFlow *deadf;
-    if (_heap->_heaps[0].empty()) {
+    IPRewriterFlow *deadf = heap->earliest(IPRewriterHeap::h_best_effort);
+    if (!deadf) {
 	assert(flow->guaranteed());
 	deadf = flow;
-    } else
-	deadf = _heap->_heaps[0][0];
-    deadf->destroy(_heap);
+    }
+    deadf->destroy(heap);
     return deadf == flow;
 }
 
 void
-IPRewriterBase::shrink_heap(bool clear_all)
+IPRewriterBase::shrink_heap(bool clear_all, int thread)
 {
+    IPRewriterHeap *heap = _state[thread].heap;
+    if (clear_all) {
+	for (int which = 0; which < 2; ++which)
+	    for (int s = 0; s < IPRewriterHeap::nslots; ++s) {
+		Vector<IPRewriterFlow *> &v = heap->_wheels[which].slot[s];
+		while (v.size())
+		    v.back()->destroy(heap);
+	    }
+	return;
+    }
+
     click_jiffies_t now_j = click_jiffies();
-    shift_heap_best_effort(now_j);
-    Vector<IPRewriterFlow *> &best_effort_heap = _heap->_heaps[0];
-    while (best_effort_heap.size() && best_effort_heap[0]->expired(now_j))
-	best_effort_heap[0]->destroy(_heap);
-
-    int32_t capacity = clear_all ? 0 : _heap->_capacity;
-    while (_heap->size() > capacity) {
-	IPRewriterFlow *deadf = _heap->_heaps[_heap->_heaps[0].empty()][0];
-	deadf->destroy(_heap);
+    shift_heap_best_effort(heap, now_j);
+    int budget = 0x7FFFFFFF;
+    reap_wheel(heap, IPRewriterHeap::h_best_effort, now_j, budget);
+    IPRewriterFlow *deadf;
+    while ((deadf = heap->earliest(IPRewriterHeap::h_best_effort))
+	   && deadf->expired(now_j))
+	deadf->destroy(heap);
+
+    while (heap->size() > heap->_capacity) {
+	deadf = heap->earliest(IPRewriterHeap::h_best_effort);
+	if (!deadf)
+	    deadf = heap->earliest(IPRewriterHeap::h_guarantee);
+	deadf->destroy(heap);
     }
 }
 
+bool
+IPRewriterBase::reap(int thread)
+{
+    IPRewriterHeap *heap = _state[thread].heap;
+    click_jiffies_t now_j = click_jiffies();
+    int budget = reap_batch;
+    return reap_wheel(heap, IPRewriterHeap::h_guarantee, now_j, budget)
+	&& reap_wheel(heap, IPRewriterHeap::h_best_effort, now_j, budget);
+}
+
+void
+IPRewriterBase::set_capacity(int32_t capacity)
+{
+    // Split the capacity among the threads so the total is exact.
+    for (int t = 0; t < _nthreads; ++t)
+	_state[t].heap->_capacity = capacity / _nthreads
+	    + (t < capacity % _nthreads);
+}
+
+void
+IPRewriterBase::run_gc(uint32_t what)
+{
+    if (_nthreads == 1 && what != gc_reap)
+	shrink_heap(what & gc_clear, 0);
+    else
+	for (int t = 0; t < _nthreads; ++t) {
+	    _state[t].gc_pending |= what;
+	    _state[t].gc_task->reschedule();
+	}
+}
+
 void
 IPRewriterBase::gc_timer_hook(Timer *t, void *user_data)
 {
     IPRewriterBase *rw = static_cast<IPRewriterBase *>(user_data);
-    rw->shrink_heap(false);
+    rw->run_gc(gc_reap);
     if (rw->_gc_interval_sec)
 	t->reschedule_after_sec(rw->_gc_interval_sec);
 }
 
+bool
+IPRewriterBase::gc_task_hook(Task *task, void *user_data)
+{
+    ThreadState *ts = static_cast<ThreadState *>(user_data);
+    uint32_t what = ts->gc_pending.swap(0);
+    if (what & (gc_shrink | gc_clear))
+	ts->rewriter->shrink_heap(what & gc_clear, ts->thread);
+    else if ((what & gc_reap) && !ts->rewriter->reap(ts->thread)) {
+	// Reap in batches so a timeout burst doesn't stall the thread.
+	ts->gc_pending |= gc_reap;
+	task->fast_reschedule();
+    }
+    return what != 0;
+}
+
 String
 IPRewriterBase::read_handler(Element *e, void *user_data)
 {
@@ -359,12 +632,38 @@ IPRewriterBase::read_handler(Element *e, void *user_data)
 	sa << count;
 	break;
     }
-    case h_size:
-	sa << rw->_heap->size();
+    case h_size: {
+	uint32_t size = 0;
+	for (int t = 0; t < rw->_nthreads; ++t)
+	    size += rw->_state[t].heap->size();
+	sa << size;
 	break;
-    case h_capacity:
-	sa << rw->_heap->_capacity;
+    }
+    case h_capacity: {
+	uint32_t capacity = 0;
+	for (int t = 0; t < rw->_nthreads; ++t)
+	    capacity += rw->_state[t].heap->_capacity;
+	sa << capacity;
 	break;
+    }
+    case h_thread_sizes:
+	for (int t = 0; t < rw->_nthreads; ++t)
+	    sa << (t ? " " : "") << rw->_state[t].heap->size();
+	break;
+    case h_memory:
+    case h_bytes_per_flow:
+    case h_fragmentation: {
+	MemoryStats ms;
+	rw->memory_stats(ms);
+	size_t total = ms.flow_bytes + ms.table_bytes;
+	if (what == h_memory)
+	    sa << total;
+	else if (what == h_bytes_per_flow)
+	    sa << (ms.flows ? total / ms.flows : 0);
+	else
+	    sa << (ms.flow_bytes ? ms.free_bytes * 100 / ms.flow_bytes : 0) << '%';
+	break;
+    }
     default:
 	for (int i = 0; i < rw->_input_specs.size(); ++i) {
 	    if (what != h_patterns && what != i)
@@ -401,14 +700,16 @@ IPRewriterBase::write_handler(const String &str, Element *e, void *user_data, Er
     IPRewriterBase *rw = static_cast<IPRewriterBase *>(e);
     intptr_t what = reinterpret_cast<intptr_t>(user_data);
     if (what == h_capacity) {
+	int32_t capacity;
 	if (Args(e, errh).push_back_words(str)
-	    .read_mp("CAPACITY", rw->_heap->_capacity)
+	    .read_mp("CAPACITY", capacity)
 	    .complete() < 0)
 	    return -1;
-	rw->shrink_heap(false);
+	rw->heap_element()->set_capacity(capacity);
+	rw->run_gc(gc_shrink);
 	return 0;
     } else if (what == h_clear) {
-	rw->shrink_heap(true);
+	rw->run_gc(gc_clear);
 	return 0;
     } else
 	return -1;
@@ -424,16 +725,16 @@ IPRewriterBase::pattern_write_handler(const String &str, Element *e, void *user_
     if (r >= 0) {
 	IPRewriterInput *spec = &rw->_input_specs[what];
 
-	// remove all existing flows created by this input
-	for (int which_heap = 0; which_heap < 2; ++which_heap) {
-	    Vector<IPRewriterFlow *> &myheap = rw->_heap->_heaps[which_heap];
-	    for (int i = myheap.size() - 1; i >= 0; --i)
-		if (myheap[i]->owner() == spec) {
-		    myheap[i]->destroy(rw->_heap);
-		    if (i < myheap.size())
-			++i;
-		}
-	}
+	// remove all existing flows created by this input; pattern
+	// handlers are only writable with a single thread
+	IPRewriterHeap *heap = rw->_state[0].heap;
+	for (int which = 0; which < 2; ++which)
+	    for (int s = 0; s < IPRewriterHeap::nslots; ++s) {
+		Vector<IPRewriterFlow *> &v = heap->_wheels[which].slot[s];
+		for (int i = v.size() - 1; i >= 0; --i)
+		    if (i < v.size() && v[i]->owner() == spec)
+			v[i]->destroy(heap);
+	    }
 
 	// change pattern
 	if (spec->kind == IPRewriterInput::i_pattern)
@@ -452,16 +753,31 @@ IPRewriterBase::add_rewriter_handlers(bool writable_patterns)
     add_read_handler("patterns", read_handler, h_patterns);
     add_read_handler("size", read_handler, h_size);
     add_read_handler("capacity", read_handler, h_capacity);
+    add_read_handler("thread_sizes", read_handler, h_thread_sizes);
+    add_read_handler("memory", read_handler, h_memory);
+    add_read_handler("bytes_per_flow", read_handler, h_bytes_per_flow);
+    add_read_handler("fragmentation", read_handler, h_fragmentation);
     add_write_handler("capacity", write_handler, h_capacity);
     add_write_handler("clear", write_handler, h_clear);
     for (int i = 0; i < ninputs(); ++i) {
 	String name = "pattern" + String(i);
 	add_read_handler(name, read_handler, i);
-	if (writable_patterns)
+	if (writable_patterns && _nthreads == 1)
 	    add_write_handler(name, pattern_write_handler, i);
     }
 }
 
+void
+IPRewriterBase::memory_stats(MemoryStats &ms) const
+{
+    for (int t = 0; t < _nthreads; ++t)
+	ms.table_bytes += _state[t].map.memory();
+    // Heaps shared through MAPPING_CAPACITY are counted by their owner.
+    if (!_heap_element)
+	for (int t = 0; t < _nthreads; ++t)
+	    ms.table_bytes += _state[t].heap->memory();
+}
+
 int
 IPRewriterBase::llrpc(unsigned command, void *data)
 {
@@ -2,6 +2,9 @@
 #ifndef CLICK_IPREWRITERBASE_HH
 #define CLICK_IPREWRITERBASE_HH
 #include <click/timer.hh>
+#include <click/task.hh>
+#include <click/atomic.hh>
+#include <click/cuckootable.hh>
 #include "elements/ip/iprwmapping.hh"
 #include <click/bitvector.hh>
 CLICK_DECLS
@@ -18,15 +21,17 @@ class IPRewriterInput { public:
     int foutput;
     IPRewriterBase *reply_element;
     int routput;
-    uint32_t count;
-    uint32_t failures;
+    atomic_uint32_t count;
+    atomic_uint32_t failures;
     union {
 	IPRewriterPattern *pattern;
 	IPMapper *mapper;
     } u;
 
     IPRewriterInput()
-	: kind(i_drop), foutput(-1), routput(-1), count(0), failures(0) {
+	: kind(i_drop), foutput(-1), routput(-1) {
+	count = 0;
+	failures = 0;
 	u.pattern = 0;
     }
 
@@ -39,11 +44,17 @@ class IPRewriterInput { public:
 			      Packet *p, int mapid = mapid_default);
 };
 
+// A thread's flows, ordered by expiry for reaping and MAPPING_CAPACITY.
+// Despite the name, this is a pair of timing wheels, one for guaranteed
+// and one for best-effort flows, with one-second slots.  A flow in a slot
+// expires no earlier than the slot's start time.  Extending a flow's
+// expiry just updates the flow; the flow moves to a later slot when the
+// wheel reaches its old one.  So refreshing a flow costs O(1) and touches
+// only the flow.  Flows that find no room in their slots wait in an
+// overflow list, which is retried each time a wheel turns.
 class IPRewriterHeap { public:
 
-    IPRewriterHeap()
-	: _capacity(0x7FFFFFFF), _use_count(1) {
-    }
+    IPRewriterHeap(int thread = 0);
     ~IPRewriterHeap() {
 	assert(size() == 0);
     }
@@ -57,21 +68,65 @@ class IPRewriterHeap { public:
 	    delete this;
     }
 
-    Vector<IPRewriterFlow *>::size_type size() const {
-	return _heaps[0].size() + _heaps[1].size();
+    int size() const {
+	return _wheels[0].size + _wheels[1].size;
     }
     int32_t capacity() const {
 	return _capacity;
     }
+    /** @brief Return the index of the thread whose flows this heap holds. */
+    int thread() const {
+	return _thread;
+    }
+    /** @brief Return the number of bytes used by the wheels. */
+    size_t memory() const;
 
   private:
 
     enum {
 	h_best_effort = 0, h_guarantee = 1
     };
-    Vector<IPRewriterFlow *> _heaps[2];
+    // Each wheel has one-second fine slots covering at least the next
+    // 2 * coarse_sec seconds, and coarse slots of coarse_sec seconds for
+    // later expiries.  A coarse slot's flows move to fine slots while the
+    // previous coarse slot is current.
+    enum {
+	wheel_bits = 9, wheel_size = 1 << wheel_bits,
+	wheel_mask = wheel_size - 1,
+	coarse_bits = 8, coarse_size = 1 << coarse_bits,
+	coarse_mask = coarse_size - 1, coarse_sec = wheel_size / 2,
+	coarse_slot0 = wheel_size,
+	overflow_slot = wheel_size + coarse_size, nslots = overflow_slot + 1,
+	place_bits = 10, place_mask = (1 << place_bits) - 1,
+	slot_max = (1 << (32 - place_bits)) - 1,	// IPRewriterFlow::_place
+	scan_max = 16			// flows earliest() compares
+    };
+
+    struct Wheel {
+	// fine slots, then coarse slots, then the overflow list
+	Vector<IPRewriterFlow *> slot[nslots];
+	uint32_t nonempty[overflow_slot / 32];	// bit per fine or coarse slot
+	int size;
+	unsigned cursor;
+	unsigned coarse_cursor;
+	click_jiffies_t base_j;		// start time of slot[cursor]
+	click_jiffies_t coarse_base_j;	// start time of coarse_cursor's slot
+	click_jiffies_t cursor_min_j;	// <= expiry of flows in slot[cursor]
+	unsigned next_coarse_slot() const {
+	    return coarse_slot0 + ((coarse_cursor + 1) & coarse_mask);
+	}
+    };
+
+    Wheel _wheels[2];
     int32_t _capacity;
     uint32_t _use_count;
+    int _thread;
+
+    inline void file(IPRewriterFlow *flow);
+    inline void unfile(IPRewriterFlow *flow);
+    static unsigned next_nonempty(const Wheel &w, unsigned first,
+				  unsigned mask, unsigned from);
+    IPRewriterFlow *earliest(int which);
 
     friend class IPRewriterBase;
     friend class IPRewriterFlow;
@@ -80,7 +135,7 @@ class IPRewriterHeap { public:
 
 class IPRewriterBase : public Element { public:
 
-    typedef HashContainer<IPRewriterEntry> Map;
+    typedef IPRewriterMap Map;
     enum {
 	rw_drop = -1, rw_addmap = -2
     };
@@ -104,14 +159,26 @@ class IPRewriterBase : public Element { public:
     void add_rewriter_handlers(bool writable_patterns);
     void cleanup(CleanupStage) CLICK_COLD;
 
-    const IPRewriterHeap *flow_heap() const {
-	return _heap;
+    const IPRewriterHeap *flow_heap(int thread = 0) const {
+	return _state[thread].heap;
     }
     IPRewriterBase *reply_element(int input) const {
 	return _input_specs[input].reply_element;
     }
-    virtual HashContainer<IPRewriterEntry> *get_map(int mapid) {
-	return likely(mapid == IPRewriterInput::mapid_default) ? &_map : 0;
+
+    /** @brief Return the number of per-thread flow tables.
+     *
+     * This is 1 unless PER_THREAD is true. */
+    int nthreads() const {
+	return _nthreads;
+    }
+    /** @brief Return the index of the calling thread's flow tables. */
+    int thread_index() const {
+	return _nthreads > 1 ? click_current_cpu_id() : 0;
+    }
+
+    virtual Map *get_map(int mapid, int thread) {
+	return likely(mapid == IPRewriterInput::mapid_default) ? &_state[thread].map : 0;
     }
 
     enum {
@@ -122,20 +189,52 @@ class IPRewriterBase : public Element { public:
     virtual IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 				      const IPFlowID &rewritten_flowid,
 				      int input) = 0;
-    virtual void destroy_flow(IPRewriterFlow *flow) = 0;
+    virtual void destroy_flow(IPRewriterFlow *flow, int thread) = 0;
     virtual click_jiffies_t best_effort_expiry(const IPRewriterFlow *flow) {
 	return flow->expiry() + _timeouts[0] - _timeouts[1];
     }
 
     int llrpc(unsigned command, void *data);
 
+    struct MemoryStats {
+	size_t flows;		// live flows
+	size_t flow_bytes;	// memory held by flow allocators
+	size_t free_bytes;	// part of flow_bytes not holding live flows
+	size_t table_bytes;	// hash table and heap memory
+	MemoryStats()
+	    : flows(0), flow_bytes(0), free_bytes(0), table_bytes(0) {
+	}
+    };
+    /** @brief Add this element's memory use to @a ms.
+     *
+     * Subclasses add their flow allocators, then call this. */
+    virtual void memory_stats(MemoryStats &ms) const;
+
   protected:
 
-    Map _map;
+    // One per thread if PER_THREAD is true, otherwise one in total.  Each
+    // thread's packets only touch its own map and heap, so no locks are
+    // needed.  Handlers that destroy flows run each thread's gc_task
+    // rather than touching other threads' state directly.
+    struct ThreadState {
+	Map map;
+	IPRewriterHeap *heap;
+	Task *gc_task;
+	atomic_uint32_t gc_pending;
+	IPRewriterBase *rewriter;
+	int thread;
+	ThreadState()
+	    : heap(0), gc_task(0) {
+	    gc_pending = 0;
+	}
+    };
 
     Vector<IPRewriterInput> _input_specs;
 
-    IPRewriterHeap *_heap;
+    PerThread<ThreadState> _state;
+    int _nthreads;
+    IPRewriterBase *_heap_element;
+    int32_t _capacity;
     uint32_t _timeouts[2];
     uint32_t _gc_interval_sec;
     Timer _gc_timer;
@@ -143,26 +242,46 @@ class IPRewriterBase : public Element { public:
     enum {
 	default_timeout = 300,	   // 5 minutes
 	default_guarantee = 5,	   // 5 seconds
-	default_gc_interval = 60 * 15 // 15 minutes
+	default_gc_interval = 1	   // 1 second
     };
 
     static uint32_t relevant_timeout(const uint32_t timeouts[2]) {
 	return timeouts[1] ? timeouts[1] : timeouts[0];
     }
 
-    IPRewriterEntry *store_flow(IPRewriterFlow *flow, int input,
+    Map &map(int thread) {
+	return _state[thread].map;
+    }
+    IPRewriterHeap *heap(int thread) const {
+	return _state[thread].heap;
+    }
+
+    IPRewriterEntry *store_flow(IPRewriterFlow *flow, int input, int thread,
 				Map &map, Map *reply_map_ptr = 0);
-    inline void unmap_flow(IPRewriterFlow *flow,
+    inline void unmap_flow(IPRewriterFlow *flow, int thread,
 			   Map &map, Map *reply_map_ptr = 0);
 
+    template <typename A>
+    void allocator_stats(MemoryStats &ms, const A *allocators,
+			 size_t flow_size) const {
+	for (int t = 0; t < _nthreads; ++t) {
+	    size_t n = allocators[t].nallocated(), m = allocators[t].memory();
+	    ms.flows += n;
+	    ms.flow_bytes += m;
+	    ms.free_bytes += m - n * flow_size;
+	}
+    }
+
     static void gc_timer_hook(Timer *t, void *user_data);
+    static bool gc_task_hook(Task *t, void *user_data);
 
     int parse_input_spec(const String &str, IPRewriterInput &is,
 			 int input_number, ErrorHandler *errh);
 
     enum {			// < 0 because individual patterns are >= 0
 	h_nmappings = -1, h_mapping_failures = -2, h_patterns = -3,
-	h_size = -4, h_capacity = -5, h_clear = -6
+	h_size = -4, h_capacity = -5, h_clear = -6, h_thread_sizes = -7,
+	h_memory = -8, h_bytes_per_flow = -9, h_fragmentation = -10
     };
     static String read_handler(Element *e, void *user_data) CLICK_COLD;
     static int write_handler(const String &str, Element *e, void *user_data, ErrorHandler *errh) CLICK_COLD;
@@ -173,9 +292,25 @@ class IPRewriterBase : public Element { public:
 
   private:
 
-    void shift_heap_best_effort(click_jiffies_t now_j);
-    bool shrink_heap_for_new_flow(IPRewriterFlow *flow, click_jiffies_t now_j);
-    void shrink_heap(bool clear_all);
+    enum {
+	gc_reap = 1, gc_shrink = 2, gc_clear = 4
+    };
+    enum {
+	reap_batch = 1024	// flows examined per gc_task run
+    };
+
+    inline void reap_flow(IPRewriterHeap *heap, int which,
+			  IPRewriterFlow *mf, click_jiffies_t now_j);
+    bool reap_wheel(IPRewriterHeap *heap, int which, click_jiffies_t now_j,
+		    int &budget);
+    void shift_heap_best_effort(IPRewriterHeap *heap, click_jiffies_t now_j);
+    bool shrink_heap_for_new_flow(IPRewriterHeap *heap, IPRewriterFlow *flow,
+				  click_jiffies_t now_j);
+    void shrink_heap(bool clear_all, int thread);
+    bool reap(int thread);
+    IPRewriterBase *heap_element();
+    void set_capacity(int32_t capacity);
+    void run_gc(uint32_t what);
 
     friend class IPRewriterFlow;
 
@@ -210,12 +345,14 @@ IPRewriterInput::rewrite_flowid(const IPFlowID &flowid,
 	rewritten_flowid = flowid;
 	return IPRewriterBase::rw_addmap;
     case i_pattern: {
-	HashContainer<IPRewriterEntry> *reply_map;
+	int thread = reply_element->thread_index();
+	IPRewriterMap *reply_map;
 	if (likely(mapid == mapid_default))
-	    reply_map = &reply_element->_map;
+	    reply_map = &reply_element->_state[thread].map;
 	else
-	    reply_map = reply_element->get_map(mapid);
-	i = u.pattern->rewrite_flowid(flowid, rewritten_flowid, *reply_map);
+	    reply_map = reply_element->get_map(mapid, thread);
+	i = u.pattern->rewrite_flowid(flowid, rewritten_flowid, *reply_map,
+				      thread, reply_element->_nthreads);
 	goto check_for_failure;
     }
     case i_mapper:
@@ -231,18 +368,81 @@ IPRewriterInput::rewrite_flowid(const IPFlowID &flowid,
 }
 
 inline void
-IPRewriterBase::unmap_flow(IPRewriterFlow *flow, Map &map,
+IPRewriterHeap::file(IPRewriterFlow *flow)
+{
+    Wheel &w = _wheels[flow->_guaranteed];
+    unsigned s = nslots;
+    // An earlier slot is always correct, just less efficient.
+    if (click_jiffies_less(w.coarse_base_j, flow->_expiry_j)) {
+	click_jiffies_t c = (flow->_expiry_j - w.coarse_base_j) / (coarse_sec * CLICK_HZ);
+	if (c > (click_jiffies_t) coarse_mask)
+	    c = coarse_mask;
+	for (; c >= 2; --c) {
+	    s = coarse_slot0 + ((w.coarse_cursor + c) & coarse_mask);
+	    if (likely(w.slot[s].size() < slot_max))
+		break;
+	}
+	if (c < 2)
+	    s = nslots;
+    }
+    if (s == nslots) {
+	unsigned d = 0;
+	if (click_jiffies_less(w.base_j, flow->_expiry_j)) {
+	    click_jiffies_t delta = (flow->_expiry_j - w.base_j) / CLICK_HZ;
+	    d = delta < (click_jiffies_t) wheel_mask ? delta : (click_jiffies_t) wheel_mask;
+	}
+	// A flow due later must not land in the current slot, which
+	// reap_wheel may be emptying, so it goes to the overflow list instead.
+	unsigned late_d = d;
+	s = (w.cursor + d) & wheel_mask;
+	while (unlikely(w.slot[s].size() >= slot_max)) {
+	    if (d <= 1) {
+		s = overflow_slot;
+		// If even that is full, a later slot merely delays reaping.
+		// One has room, since a wheel holds fewer than 2^31 flows.
+		while (w.slot[s].size() >= slot_max)
+		    s = (w.cursor + ++late_d) & wheel_mask;
+		break;
+	    }
+	    s = (w.cursor + --d) & wheel_mask;
+	}
+    }
+    Vector<IPRewriterFlow *> &v = w.slot[s];
+    if (s == w.cursor && click_jiffies_less(flow->_expiry_j, w.cursor_min_j))
+	w.cursor_min_j = flow->_expiry_j;
+    if (s != overflow_slot)
+	w.nonempty[s >> 5] |= 1U << (s & 31);
+    flow->_place = (v.size() << place_bits) | s;
+    v.push_back(flow);
+    ++w.size;
+}
+
+inline void
+IPRewriterHeap::unfile(IPRewriterFlow *flow)
+{
+    Wheel &w = _wheels[flow->_guaranteed];
+    unsigned s = flow->_place & place_mask;
+    Vector<IPRewriterFlow *> &v = w.slot[s];
+    int i = flow->_place >> place_bits;
+    assert(v[i] == flow);
+    IPRewriterFlow *last = v.back();
+    v[i] = last;
+    last->_place = flow->_place;
+    v.pop_back();
+    if (v.empty() && s != overflow_slot)
+	w.nonempty[s >> 5] &= ~(1U << (s & 31));
+    --w.size;
+}
+
+inline void
+IPRewriterBase::unmap_flow(IPRewriterFlow *flow, int thread, Map &map,
 			   Map *reply_map_ptr)
 {
     //click_chatter("kill %s", hashkey().s().c_str());
     if (!reply_map_ptr)
-	reply_map_ptr = &flow->owner()->reply_element->_map;
-    Map::iterator it = map.find(flow->entry(0).hashkey());
-    if (it.get() == &flow->entry(0))
-	map.erase(it);
-    it = reply_map_ptr->find(flow->entry(1).hashkey());
-    if (it.get() == &flow->entry(1))
-	reply_map_ptr->erase(it);
+	reply_map_ptr = &flow->owner()->reply_element->_state[thread].map;
+    map.erase(&flow->entry(0));
+    reply_map_ptr->erase(&flow->entry(1));
 }
 
 CLICK_ENDDECLS
@@ -55,6 +55,89 @@ cp_ip_route(String s, IPRoute *r_store, bool remove_route, Element *context)
     return false;
 }
 
+// Fast path for bulk route lists: parses a dotted-quad address into host
+// byte order.  Returns a pointer past the address, or 0 on failure.
+static const char *
+parse_ip_quad(const char *s, const char *end, uint32_t &addr)
+{
+    uint32_t a = 0;
+    for (int part = 0; part < 4; ++part) {
+	if (part && (s == end || *s++ != '.'))
+	    return 0;
+	if (s == end || !isdigit((unsigned char) *s))
+	    return 0;
+	uint32_t x = 0;
+	int ndigits = 0;
+	while (s != end && isdigit((unsigned char) *s) && ndigits < 4) {
+	    x = x * 10 + *s++ - '0';
+	    ++ndigits;
+	}
+	if (x > 255)
+	    return 0;
+	a = (a << 8) | x;
+    }
+    addr = a;
+    return s;
+}
+
+static inline const char *
+skip_route_space(const char *s, const char *end)
+{
+    while (s != end && (*s == ' ' || *s == '\t' || *s == '\r'))
+	++s;
+    return s;
+}
+
+// Parses a route line of the form `ADDR/LEN [GW|-] OUT' without allocating.
+// Returns false for anything else; the caller falls back to cp_ip_route.
+static bool
+parse_route_fast(const char *s, const char *end, IPRoute &r)
+{
+    uint32_t addr, gw = 0;
+    if (!(s = parse_ip_quad(s, end, addr)) || s == end || *s != '/')
+	return false;
+    int plen = 0, ndigits = 0;
+    for (++s; s != end && isdigit((unsigned char) *s) && ndigits < 3; ++s, ++ndigits)
+	plen = plen * 10 + *s - '0';
+    if (!ndigits || plen > 32 || s == end || (*s != ' ' && *s != '\t'))
+	return false;
+
+    s = skip_route_space(s, end);
+    const char *word = s;
+    while (s != end && *s != ' ' && *s != '\t' && *s != '\r')
+	++s;
+    const char *word_end = s;
+    s = skip_route_space(s, end);
+    if (s != end) {
+	// three words: the middle one is a gateway
+	if (word_end - word == 1 && *word == '-')
+	    /* null gateway */;
+	else if (parse_ip_quad(word, word_end, gw) != word_end)
+	    return false;
+	word = s;
+	while (s != end && isdigit((unsigned char) *s))
+	    ++s;
+	word_end = s;
+	if (skip_route_space(s, end) != end)
+	    return false;
+    }
+
+    int port = 0;
+    if (word == word_end || word_end - word > 9)
+	return false;
+    for (; word != word_end; ++word)
+	if (isdigit((unsigned char) *word))
+	    port = port * 10 + *word - '0';
+	else
+	    return false;
+
+    r.mask = IPAddress::make_prefix(plen);
+    r.addr = IPAddress(htonl(addr)) & r.mask;
+    r.gw = IPAddress(htonl(gw));
+    r.port = port;
+    return true;
+}
+
 StringAccum&
 IPRoute::unparse(StringAccum& sa, bool tabs) const
 {
@@ -268,6 +351,56 @@ IPRouteTable::ctrl_handler(const String &conf_in, Element *e, void *, ErrorHandl
     return r;
 }
 
+int
+IPRouteTable::parse_route_list(const String &data, Vector<IPRoute> &routes, ErrorHandler *errh)
+{
+    routes.clear();
+    const unsigned char *udata = reinterpret_cast<const unsigned char *>(data.data());
+    int len = data.length();
+
+    if (len >= 8 && memcmp(udata, "IPRT", 4) == 0) {
+	// binary format: 8-byte header, then 12-byte records
+	uint32_t n = (udata[4] << 24) | (udata[5] << 16) | (udata[6] << 8) | udata[7];
+	if ((uint32_t) (len - 8) / 12 != n || (len - 8) % 12 != 0)
+	    return errh->error("binary route list truncated (%u routes expected)", n);
+	routes.reserve(n);
+	for (const unsigned char *x = udata + 8; x != udata + len; x += 12) {
+	    uint32_t addr, gw;
+	    memcpy(&addr, x, 4);
+	    memcpy(&gw, x + 4, 4);
+	    int port = (x[10] << 8) | x[11];
+	    if (x[8] > 32)
+		return errh->error("route %d: bad prefix length %d", routes.size() + 1, x[8]);
+	    else if (port >= noutputs())
+		return errh->error("route %d: bad OUTPUT", routes.size() + 1);
+	    IPAddress mask = IPAddress::make_prefix(x[8]);
+	    routes.push_back(IPRoute(IPAddress(addr) & mask, mask, IPAddress(gw), port));
+	}
+	return 0;
+    }
+
+    const char *s = data.begin(), *end = data.end();
+    for (int lineno = 1; s != end; ++lineno) {
+	const char *nl = find(s, end, '\n');
+	const char *x = skip_route_space(s, nl), *xend = nl;
+	while (xend != x && isspace((unsigned char) xend[-1]))
+	    --xend;
+	if (xend != x && xend[-1] == ',')
+	    --xend;
+	if (x != xend && *x != '#' && !(xend - x >= 2 && x[0] == '/' && x[1] == '/')) {
+	    IPRoute r;
+	    if (!parse_route_fast(x, xend, r)
+		&& !cp_ip_route(data.substring(x, xend), &r, false, this))
+		return errh->error("line %d: expected %<ADDR/MASK [GATEWAY] OUTPUT%>", lineno);
+	    if (r.port < 0 || r.port >= noutputs())
+		return errh->error("line %d: bad OUTPUT", lineno);
+	    routes.push_back(r);
+	}
+	s = (nl == end ? nl : nl + 1);
+    }
+    return 0;
+}
+
 String
 IPRouteTable::table_handler(Element *e, void *)
 {
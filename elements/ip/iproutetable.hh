@@ -155,6 +155,18 @@ up to the `C<ctrl>' handler.
 This read handler callback function returns the element's routing table via
 the B<dump_routes> function. Normally hooked up to the `C<table>' handler.
 
+=item C<int B<parse_route_list>(const String &data, VectorE<lt>IPRouteE<gt> &routes, ErrorHandler *errh)>
+
+Parses a bulk route list into C<routes>, for elements that can load a whole
+table at once.  C<data> is either text, with one `C<address/mask [gateway]
+output>' route per line (blank lines and lines starting with `C<#>' or `C<//>'
+are ignored, and a trailing comma is allowed), or binary.  The binary format
+is an 8-byte header, consisting of the characters `C<IPRT>' and a 4-byte
+big-endian route count, followed by one 12-byte record per route: the 4-byte
+address and 4-byte gateway in network byte order, a 1-byte prefix length, a
+zero byte, and a 2-byte big-endian output port.  Returns 0 on success and
+negative on failure.
+
 =back
 
 =a RadixIPLookup, DirectIPLookup, RangeIPLookup, StaticIPLookup,
@@ -204,6 +216,8 @@ class IPRouteTable : public Element { public:
     static int lookup_handler(int operation, String&, Element*, const Handler*, ErrorHandler*);
     static String table_handler(Element*, void*);
 
+    int parse_route_list(const String &data, Vector<IPRoute> &routes, ErrorHandler *errh);
+
   private:
 
     enum { CMD_ADD, CMD_SET, CMD_REMOVE };
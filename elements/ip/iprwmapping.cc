@@ -29,9 +29,116 @@
 #include <click/straccum.hh>
 #include <click/error.hh>
 #include <click/algorithm.hh>
-#include <click/heap.hh>
 CLICK_DECLS
 
+const IPRewriterMap::bucket IPRewriterMap::empty_bucket = { { 0 }, 0, 0 };
+
+IPRewriterMap::IPRewriterMap()
+    : _buckets(const_cast<bucket *>(&empty_bucket)), _mask(0), _size(0),
+      _grow_size(0), _bucket_mem(0)
+{
+    static_assert(sizeof(bucket) == 64, "IPRewriterMap bucket must be one cache line");
+}
+
+IPRewriterMap::~IPRewriterMap()
+{
+    if (_bucket_mem)
+	CLICK_LFREE(_bucket_mem, (_mask + 1) * sizeof(bucket) + CLICK_CACHE_LINE_SIZE);
+}
+
+int
+IPRewriterMap::rehash(size_t nbuckets)
+{
+    void *mem = CLICK_LALLOC(nbuckets * sizeof(bucket) + CLICK_CACHE_LINE_SIZE);
+    if (!mem)
+	return -ENOMEM;
+    uintptr_t bm = reinterpret_cast<uintptr_t>(mem);
+    bucket *buckets = reinterpret_cast<bucket *>((bm + CLICK_CACHE_LINE_SIZE - 1) & ~(uintptr_t) (CLICK_CACHE_LINE_SIZE - 1));
+    memset(buckets, 0, nbuckets * sizeof(bucket));
+
+    bucket *old_buckets = _buckets;
+    size_t old_nbuckets = _mask + 1;
+    void *old_mem = _bucket_mem;
+    _buckets = buckets;
+    _mask = nbuckets - 1;
+    _bucket_mem = mem;
+    // grow at 6/7 occupancy
+    _grow_size = nbuckets * (bucket_slots - 1);
+
+    for (size_t b = 0; b < old_nbuckets; ++b)
+	for (int i = 0; i < bucket_slots; ++i)
+	    if (uint64_t s = old_buckets[b].slot[i])
+		insert_new(s, hash(slot_entry(s)->flowid()));
+    if (old_mem)
+	CLICK_LFREE(old_mem, old_nbuckets * sizeof(bucket) + CLICK_CACHE_LINE_SIZE);
+    return 0;
+}
+
+void
+IPRewriterMap::insert_new(uint64_t s, uint32_t h)
+{
+    for (size_t b = h & _mask; ; b = (b + 1) & _mask) {
+	bucket &bk = _buckets[b];
+	for (int i = 0; i < bucket_slots; ++i)
+	    if (!bk.slot[i]) {
+		bk.slot[i] = s;
+		return;
+	    }
+	++bk.overflow;
+    }
+}
+
+IPRewriterEntry *
+IPRewriterMap::set(IPRewriterEntry *e)
+{
+    uint32_t h = hash(e->flowid());
+    uint64_t s = make_slot(h, e);
+    assert(slot_entry(s) == e);
+    uint32_t t = tag(h);
+    for (size_t b = h & _mask, n = 0; n <= _mask; b = (b + 1) & _mask, ++n) {
+	bucket &bk = _buckets[b];
+	for (int i = 0; i < bucket_slots; ++i)
+	    if (bk.slot[i] && (uint32_t) (bk.slot[i] >> ptr_bits) == t) {
+		IPRewriterEntry *old = slot_entry(bk.slot[i]);
+		if (old->flowid() == e->flowid()) {
+		    bk.slot[i] = s;
+		    return old;
+		}
+	    }
+	if (!bk.overflow)
+	    break;
+    }
+
+    if (_size >= _grow_size
+	&& rehash(_bucket_mem ? (_mask + 1) * 2 : (size_t) initial_buckets) < 0)
+	return 0;
+    insert_new(s, h);
+    ++_size;
+    return 0;
+}
+
+bool
+IPRewriterMap::erase(IPRewriterEntry *e)
+{
+    uint32_t h = hash(e->flowid());
+    uint64_t s = make_slot(h, e);
+    size_t home = h & _mask;
+    for (size_t b = home, n = 0; n <= _mask; b = (b + 1) & _mask, ++n) {
+	bucket &bk = _buckets[b];
+	for (int i = 0; i < bucket_slots; ++i)
+	    if (bk.slot[i] == s) {
+		bk.slot[i] = 0;
+		for (size_t x = home; x != b; x = (x + 1) & _mask)
+		    --_buckets[x].overflow;
+		--_size;
+		return true;
+	    }
+	if (!bk.overflow)
+	    break;
+    }
+    return false;
+}
+
 IPRewriterFlow::IPRewriterFlow(IPRewriterInput *owner, const IPFlowID &flowid,
 			       const IPFlowID &rewritten_flowid,
 			       uint8_t ip_p, bool guaranteed,
@@ -90,37 +197,21 @@ IPRewriterFlow::apply(WritablePacket *p, bool direction, unsigned annos)
 }
 
 void
-IPRewriterFlow::change_expiry(IPRewriterHeap *h, bool guaranteed,
-			      click_jiffies_t expiry_j)
+IPRewriterFlow::refile(IPRewriterHeap *h, bool guaranteed,
+		       click_jiffies_t expiry_j)
 {
-    Vector<IPRewriterFlow *> &current_heap = h->_heaps[_guaranteed];
-    assert(current_heap[_place] == this);
+    h->unfile(this);
     _expiry_j = expiry_j;
-    if (_guaranteed != guaranteed) {
-	remove_heap(current_heap.begin(), current_heap.end(),
-		    current_heap.begin() + _place,
-		    heap_less(), heap_place());
-	current_heap.pop_back();
-	_guaranteed = guaranteed;
-	Vector<IPRewriterFlow *> &new_heap = h->_heaps[_guaranteed];
-	new_heap.push_back(this);
-	push_heap(new_heap.begin(), new_heap.end(),
-		  heap_less(), heap_place());
-    } else
-	change_heap(current_heap.begin(), current_heap.end(),
-		    current_heap.begin() + _place,
-		    heap_less(), heap_place());
+    _guaranteed = guaranteed;
+    h->file(this);
 }
 
 void
 IPRewriterFlow::destroy(IPRewriterHeap *heap)
 {
-    Vector<IPRewriterFlow *> &myheap = heap->_heaps[_guaranteed];
-    remove_heap(myheap.begin(), myheap.end(), myheap.begin() + _place,
-		heap_less(), heap_place());
-    myheap.pop_back();
+    heap->unfile(this);
     --_owner->count;
-    _owner->owner->destroy_flow(this);
+    _owner->owner->destroy_flow(this, heap->thread());
 }
 
 void
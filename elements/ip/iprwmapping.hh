@@ -26,7 +26,6 @@ class IPRewriterEntry { public:
 	_flowid = flowid;
 	_output = output;
 	_direction = direction;
-	_hashnext = 0;
     }
 
     const IPFlowID &flowid() const {
@@ -58,9 +57,156 @@ class IPRewriterEntry { public:
     IPFlowID _flowid;
     uint32_t _output : 24;
     uint8_t _direction;
-    IPRewriterEntry *_hashnext;
 
-    friend class HashContainer_adapter<IPRewriterEntry>;
+};
+
+
+/** @brief Hash table mapping flow IDs to IPRewriterEntry objects.
+ *
+ * Buckets are one cache line of slots, each holding an entry pointer and
+ * 16 bits of that entry's hash.  A lookup reads its home bucket, compares
+ * tags, and dereferences only an entry whose tag matches, so finding a
+ * flow touches the bucket and the flow itself, and a failed lookup
+ * usually touches only the bucket.  Full buckets spill into the next
+ * bucket; each bucket counts the entries that spilled past it, so lookups
+ * stop at the first bucket whose count is zero.  Entries are not
+ * chained, so IPRewriterEntry needs no link pointer. */
+class IPRewriterMap { public:
+
+    IPRewriterMap();
+    ~IPRewriterMap();
+
+    /** @brief Return the number of entries. */
+    size_t size() const {
+	return _size;
+    }
+    bool empty() const {
+	return _size == 0;
+    }
+    /** @brief Return the number of bytes of bucket memory. */
+    size_t memory() const {
+	return _bucket_mem ? (_mask + 1) * sizeof(bucket) : 0;
+    }
+
+    /** @brief Return the entry for @a flowid, or null if there is none. */
+    inline IPRewriterEntry *get(const IPFlowID &flowid) const;
+
+    /** @brief Add @a e, replacing any entry with the same flow ID.
+     * @return the replaced entry, or null
+     *
+     * Returns null without adding @a e if memory is exhausted. */
+    IPRewriterEntry *set(IPRewriterEntry *e);
+
+    /** @brief Remove @a e if it is in the map.
+     * @return true if @a e was removed */
+    bool erase(IPRewriterEntry *e);
+
+    class iterator;
+    iterator begin() const;
+
+  private:
+
+    enum {
+	bucket_slots = 7,
+	initial_buckets = 8,
+	ptr_bits = sizeof(void *) == 8 ? 48 : 32,
+	tag_bits = 64 - ptr_bits
+    };
+
+    struct bucket {
+	uint64_t slot[bucket_slots];	// tag << ptr_bits | entry; 0 if empty
+	uint32_t overflow;	// number of entries stored past this bucket
+	uint32_t pad;
+    };
+
+    bucket *_buckets;
+    size_t _mask;
+    size_t _size;
+    size_t _grow_size;
+    void *_bucket_mem;
+
+    static const bucket empty_bucket;
+
+    static inline uint32_t hash(const IPFlowID &flowid) {
+	// IPFlowID::hashcode() leaves the low bits poorly mixed; buckets
+	// are indexed by the low bits and tagged with the high bits.
+	uint32_t h = flowid.hashcode();
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	return h;
+    }
+    static inline uint32_t tag(uint32_t h) {
+	return h >> (32 - tag_bits);
+    }
+    static inline uint64_t make_slot(uint32_t h, const IPRewriterEntry *e) {
+	return ((uint64_t) tag(h) << ptr_bits)
+	    | ((uint64_t) reinterpret_cast<uintptr_t>(e) & (~(uint64_t) 0 >> tag_bits));
+    }
+    static inline IPRewriterEntry *slot_entry(uint64_t s) {
+	// sign-extend so kernel addresses survive
+	return reinterpret_cast<IPRewriterEntry *>((intptr_t) ((int64_t) (s << tag_bits) >> tag_bits));
+    }
+
+    int rehash(size_t nbuckets);
+    void insert_new(uint64_t s, uint32_t h);
+
+    IPRewriterMap(const IPRewriterMap &);
+    IPRewriterMap &operator=(const IPRewriterMap &);
+
+    friend class iterator;
+
+};
+
+class IPRewriterMap::iterator { public:
+
+    bool live() const {
+	return _b <= _map->_mask;
+    }
+    operator bool() const {
+	return live();
+    }
+    IPRewriterEntry *get() const {
+	return slot_entry(_map->_buckets[_b].slot[_i]);
+    }
+    IPRewriterEntry *operator->() const {
+	return get();
+    }
+    IPRewriterEntry &operator*() const {
+	return *get();
+    }
+
+    void operator++() {
+	advance();
+    }
+    void operator++(int) {
+	advance();
+    }
+
+  private:
+
+    const IPRewriterMap *_map;
+    size_t _b;
+    int _i;
+
+    iterator(const IPRewriterMap *map)
+	: _map(map), _b(0), _i(-1) {
+	advance();
+    }
+
+    void advance() {
+	while (_b <= _map->_mask) {
+	    if (++_i == bucket_slots) {
+		_i = -1;
+		++_b;
+	    } else if (_map->_buckets[_b].slot[_i])
+		break;
+	}
+    }
+
+    friend class IPRewriterMap;
 
 };
 
@@ -99,8 +245,8 @@ class IPRewriterFlow { public:
      * @param h heap containing this flow
      * @param guaranteed whether the flow is guaranteed
      * @param expiry_j expiration time in absolute jiffies */
-    void change_expiry(IPRewriterHeap *h, bool guaranteed,
-		       click_jiffies_t expiry_j);
+    inline void change_expiry(IPRewriterHeap *h, bool guaranteed,
+			      click_jiffies_t expiry_j);
 
     /** @brief Set expiration time to a timeout after @a now_j.
      * @param h heap containing this flow
@@ -140,24 +286,13 @@ class IPRewriterFlow { public:
     void unparse(StringAccum &sa, bool direction, click_jiffies_t now) const;
     void unparse_ports(StringAccum &sa, bool direction, click_jiffies_t now) const;
 
-    struct heap_less {
-	inline bool operator()(IPRewriterFlow *a, IPRewriterFlow *b) {
-	    return click_jiffies_less(a->expiry(), b->expiry());
-	}
-    };
-    struct heap_place {
-	inline void operator()(IPRewriterFlow **begin, IPRewriterFlow **it) {
-	    (*it)->_place = it - begin;
-	}
-    };
-
   protected:
 
     IPRewriterEntry _e[2];
     uint16_t _ip_csum_delta;
     uint16_t _udp_csum_delta;
     click_jiffies_t _expiry_j;
-    size_t _place : 32;
+    size_t _place : 32;		// IPRewriterHeap slot and index
     uint8_t _ip_p;
     uint8_t _tflags;
     bool _guaranteed;
@@ -166,10 +301,12 @@ class IPRewriterFlow { public:
 
     friend class IPRewriterBase;
     friend class IPRewriterEntry;
+    friend class IPRewriterHeap;
 
   private:
 
     void destroy(IPRewriterHeap *heap);
+    void refile(IPRewriterHeap *h, bool guaranteed, click_jiffies_t expiry_j);
 
 };
 
@@ -180,6 +317,45 @@ IPRewriterEntry::rewritten_flowid() const
     return (this + (_direction ? -1 : 1))->_flowid.reverse();
 }
 
+inline IPRewriterEntry *
+IPRewriterMap::get(const IPFlowID &flowid) const
+{
+    uint32_t h = hash(flowid);
+    uint32_t t = tag(h);
+    for (size_t b = h & _mask, n = 0; n <= _mask; b = (b + 1) & _mask, ++n) {
+	const bucket &bk = _buckets[b];
+	for (int i = 0; i < bucket_slots; ++i) {
+	    uint64_t s = bk.slot[i];
+	    if (s && (uint32_t) (s >> ptr_bits) == t) {
+		IPRewriterEntry *e = slot_entry(s);
+		if (e->flowid() == flowid)
+		    return e;
+	    }
+	}
+	if (!bk.overflow)
+	    break;
+    }
+    return 0;
+}
+
+inline IPRewriterMap::iterator
+IPRewriterMap::begin() const
+{
+    return iterator(this);
+}
+
+inline void
+IPRewriterFlow::change_expiry(IPRewriterHeap *h, bool guaranteed,
+			      click_jiffies_t expiry_j)
+{
+    // A later expiry leaves the flow in its wheel slot.
+    if (likely(guaranteed == _guaranteed
+	       && !click_jiffies_less(expiry_j, _expiry_j)))
+	_expiry_j = expiry_j;
+    else
+	refile(h, guaranteed, expiry_j);
+}
+
 inline void
 IPRewriterFlow::update_csum(uint16_t *csum, bool direction, uint16_t csum_delta)
 {
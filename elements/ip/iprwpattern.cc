@@ -39,8 +39,9 @@ IPRewriterPattern::IPRewriterPattern(const IPAddress &saddr, int sport,
 		       bool is_napt, bool sequential, bool same_first,
 		       uint32_t variation_top)
     : _saddr(saddr), _sport(sport), _daddr(daddr), _dport(dport),
-      _variation_top(variation_top), _next_variation(0), _is_napt(is_napt),
-      _sequential(sequential), _same_first(same_first), _refcount(0)
+      _variation_top(variation_top), _next_variation(click_max_cpu_ids(), 0),
+      _is_napt(is_napt), _sequential(sequential), _same_first(same_first),
+      _refcount(0)
 {
 }
 
@@ -219,7 +220,8 @@ IPRewriterPattern::parse_with_ports(const String &conf, IPRewriterInput *input,
 int
 IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
 				  IPFlowID &rewritten_flowid,
-				  const HashContainer<IPRewriterEntry> &reply_map)
+				  const IPRewriterMap &reply_map,
+				  int thread, int nthreads)
 {
     rewritten_flowid = flowid;
     if (_saddr)
@@ -234,27 +236,42 @@ IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
     if (_variation_top) {
 	IPFlowID lookup = rewritten_flowid.reverse();
 	uint32_t base = (_is_napt ? ntohs(_sport) : ntohl(_saddr.addr()));
+	uint32_t top = _variation_top;
+
+	// With per-thread flow tables, each thread allocates from its own
+	// slice of the range, so threads never hand out the same port (or
+	// address) and a reply's destination identifies its thread.
+	if (nthreads > 1) {
+	    uint64_t n = (uint64_t) _variation_top + 1;
+	    uint32_t lo = n * thread / nthreads;
+	    uint32_t hi = n * (thread + 1) / nthreads;
+	    if (lo == hi)
+		return IPRewriterBase::rw_drop;
+	    base += lo;
+	    top = hi - lo - 1;
+	}
+	uint32_t &next_variation = _next_variation[thread];
 
 	uint32_t val;
 	if (_same_first
-	    && (val = ntohs(flowid.sport()) - base) <= _variation_top) {
+	    && (val = ntohs(flowid.sport()) - base) <= top) {
 	    lookup.set_dport(flowid.sport());
-	    if (!reply_map.find(lookup))
+	    if (!reply_map.get(lookup))
 		goto found_variation;
 	}
 
 	if (_sequential)
-	    val = (_next_variation > _variation_top ? 0 : _next_variation);
+	    val = (next_variation > top ? 0 : next_variation);
 	else
-	    val = click_random(0, _variation_top);
+	    val = click_random(0, top);
 
-	for (uint32_t count = 0; count <= _variation_top;
-	     ++count, val = (val == _variation_top ? 0 : val + 1)) {
+	for (uint32_t count = 0; count <= top;
+	     ++count, val = (val == top ? 0 : val + 1)) {
 	    if (_is_napt)
 		lookup.set_dport(htons(base + val));
 	    else
 		lookup.set_daddr(htonl(base + val));
-	    if (!reply_map.find(lookup))
+	    if (!reply_map.get(lookup))
 		goto found_variation;
 	}
 
@@ -265,7 +282,7 @@ IPRewriterPattern::rewrite_flowid(const IPFlowID &flowid,
 	    rewritten_flowid.set_sport(lookup.dport());
 	else
 	    rewritten_flowid.set_saddr(lookup.daddr());
-	_next_variation = val + 1;
+	next_variation = val + 1;
     }
 
     return IPRewriterBase::rw_addmap;
@@ -2,12 +2,13 @@
 #ifndef CLICK_IPRW_PATTERN_HH
 #define CLICK_IPRW_PATTERN_HH
 #include <click/element.hh>
-#include <click/hashcontainer.hh>
 #include <click/ipflowid.hh>
+#include <click/vector.hh>
 CLICK_DECLS
 class IPRewriterFlow;
 class IPRewriterEntry;
 class IPRewriterInput;
+class IPRewriterMap;
 
 class IPRewriterPattern { public:
 
@@ -38,7 +39,8 @@ class IPRewriterPattern { public:
     }
 
     int rewrite_flowid(const IPFlowID &flowid, IPFlowID &rewritten_flowid,
-		       const HashContainer<IPRewriterEntry> &reply_map);
+		       const IPRewriterMap &reply_map,
+		       int thread = 0, int nthreads = 1);
 
     String unparse() const;
 
@@ -50,7 +52,7 @@ class IPRewriterPattern { public:
     int _dport;			// net byte order
 
     uint32_t _variation_top;
-    uint32_t _next_variation;
+    Vector<uint32_t> _next_variation;	// per thread
 
     bool _is_napt;
     bool _sequential;
@@ -0,0 +1,496 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * patternmatch.{cc,hh} -- element searches packet payloads for byte patterns
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "patternmatch.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/confparse.hh>
+#include <click/algorithm.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+#include <clicknet/udp.h>
+#if CLICK_USERLEVEL
+# include <click/userutils.hh>
+#endif
+#if CLICK_USERLEVEL && defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+CLICK_DECLS
+
+PatternMatch::PatternMatch()
+    : _delta(0), _out(0), _nstates(0), _nclasses(0), _nstart(0),
+      _prefixes(0), _npatterns(0)
+{
+}
+
+PatternMatch::~PatternMatch()
+{
+    delete[] _delta;
+    delete[] _out;
+    delete[] _prefixes;
+}
+
+static inline int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+	return (c | 0x20) - 'a' + 10;
+    else
+	return -1;
+}
+
+int
+PatternMatch::parse_pattern(const String &str, String &result, ErrorHandler *errh)
+{
+    String s = cp_unquote(str);
+    StringAccum sa;
+    const char *x = s.begin(), *end = s.end();
+    while (x != end) {
+	if (*x != '|') {
+	    sa << *x++;
+	    continue;
+	}
+	for (++x; x != end && *x != '|'; ) {
+	    if (isspace((unsigned char) *x)) {
+		++x;
+		continue;
+	    }
+	    int hi = hex_value(*x), lo = (x + 1 != end ? hex_value(x[1]) : -1);
+	    if (hi < 0 || lo < 0)
+		return errh->error("bad hex bytes in %<%s%>", s.c_str());
+	    sa << (char) ((hi << 4) | lo);
+	    x += 2;
+	}
+	if (x == end)
+	    return errh->error("unterminated %<|%> in %<%s%>", s.c_str());
+	++x;
+    }
+    if (!sa.length())
+	return errh->error("empty pattern");
+    result = sa.take_string();
+    return 0;
+}
+
+int
+PatternMatch::compile(const Vector<String> &patterns, ErrorHandler *errh)
+{
+    // Byte classes: each byte that occurs in a pattern gets its own class;
+    // all other bytes share class 0.  Rows of the transition table then
+    // have one column per class rather than 256.
+    memset(_class, 0, sizeof(_class));
+    _nclasses = 1;
+    for (int i = 0; i < patterns.size(); ++i)
+	for (const char *x = patterns[i].begin(); x != patterns[i].end(); ++x)
+	    if (!_class[(unsigned char) *x])
+		_class[(unsigned char) *x] = _nclasses++;
+    if (_nocase)
+	for (int c = 'A'; c <= 'Z'; ++c)
+	    _class[c] = _class[c - 'A' + 'a'];
+
+    // Build the trie.  Children are kept in sibling lists.
+    Vector<uint32_t> child, sibling, own;
+    Vector<uint8_t> edge;
+    child.push_back(0);
+    sibling.push_back(0);
+    own.push_back(0);
+    edge.push_back(0);
+    for (int i = 0; i < patterns.size(); ++i) {
+	uint32_t u = 0;
+	for (const char *x = patterns[i].begin(); x != patterns[i].end(); ++x) {
+	    uint8_t c = _class[(unsigned char) *x];
+	    uint32_t v = child[u];
+	    while (v && edge[v] != c)
+		v = sibling[v];
+	    if (!v) {
+		v = child.size();
+		child.push_back(0);
+		sibling.push_back(child[u]);
+		own.push_back(0);
+		edge.push_back(c);
+		child[u] = v;
+	    }
+	    u = v;
+	}
+	if (!own[u])
+	    own[u] = i + 1;
+    }
+
+    _nstates = child.size();
+    if ((uint64_t) _nstates * _nclasses >= match_bit)
+	return errh->error("too many patterns");
+    delete[] _delta;
+    delete[] _out;
+    _delta = new uint32_t[_nstates * _nclasses];
+    _out = new uint32_t[_nstates];
+    if (!_delta || !_out)
+	return errh->error("out of memory");
+
+    // Fill transitions in breadth-first order, so that each state's
+    // failure state already has its row.
+    Vector<uint32_t> fail(_nstates, 0), queue;
+    queue.reserve(_nstates);
+    queue.push_back(0);
+    _out[0] = 0;
+    for (int qi = 0; qi < queue.size(); ++qi) {
+	uint32_t u = queue[qi];
+	uint32_t *row = _delta + u * _nclasses;
+	if (u == 0)
+	    memset(row, 0, _nclasses * sizeof(uint32_t));
+	else
+	    memcpy(row, _delta + fail[u] * _nclasses, _nclasses * sizeof(uint32_t));
+	for (uint32_t v = child[u]; v; v = sibling[v]) {
+	    fail[v] = (u == 0 ? 0 : _delta[fail[u] * _nclasses + edge[v]]);
+	    _out[v] = (own[v] ? own[v] : _out[fail[v]]);
+	    row[edge[v]] = v;
+	    queue.push_back(v);
+	}
+    }
+
+    // Convert state numbers into row offsets, marking matching states.
+    for (uint32_t i = 0; i != _nstates * _nclasses; ++i) {
+	uint32_t v = _delta[i];
+	_delta[i] = v * _nclasses | (_out[v] ? (uint32_t) match_bit : 0);
+    }
+
+    // The prefilter needs the set of bytes that leave the root.
+    _nstart = 0;
+    for (int c = 0; c < 256; ++c)
+	if (_delta[_class[c]]) {
+	    if (_nstart < (int) prefilter_max)
+		_start[_nstart] = c;
+	    ++_nstart;
+	}
+    delete[] _prefixes;
+    _prefixes = 0;
+    if (_nstart <= (int) prefilter_max)
+	return 0;
+
+    // With more start bytes, mark the three-byte strings that can begin a
+    // match: those that reach a depth-3 state, and those whose first byte
+    // or two already form a pattern.  From any other string, the automaton
+    // ends up where it would starting at the second byte, so the scan can
+    // restart from the root there.
+    uint32_t nwords = 1U << (prefix_bits - 5);
+    if (!(_prefixes = new uint32_t[nwords]))
+	return errh->error("out of memory");
+    memset(_prefixes, 0, nwords * sizeof(uint32_t));
+    for (uint32_t v1 = child[0]; v1; v1 = sibling[v1])
+	for (int a = 0; a < 256; ++a) {
+	    if (_class[a] != edge[v1])
+		continue;
+	    if (own[v1]) {
+		for (uint32_t x = 0; x < 65536; ++x)
+		    set_prefix(a | x << 8);
+		continue;
+	    }
+	    for (uint32_t v2 = child[v1]; v2; v2 = sibling[v2])
+		for (int b = 0; b < 256; ++b) {
+		    if (_class[b] != edge[v2])
+			continue;
+		    uint32_t ab = a | b << 8;
+		    if (own[v2]) {
+			for (uint32_t c = 0; c < 256; ++c)
+			    set_prefix(ab | c << 16);
+			continue;
+		    }
+		    for (uint32_t v3 = child[v2]; v3; v3 = sibling[v3])
+			for (uint32_t c = 0; c < 256; ++c)
+			    if (_class[c] == edge[v3])
+				set_prefix(ab | c << 16);
+		}
+	}
+    return 0;
+}
+
+int
+PatternMatch::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String filename;
+    _anno = -1;
+    _nocase = false;
+    _payload = true;
+    _stream = false;
+    _stream_capacity = 65536;
+    uint32_t stream_timeout = 60;
+    if (Args(this, errh).bind(conf)
+#if CLICK_USERLEVEL
+	.read("FILE", FilenameArg(), filename)
+#endif
+	.read("ANNO", AnnoArg(4), _anno)
+	.read("NOCASE", _nocase)
+	.read("PAYLOAD", _payload)
+	.read("STREAM", _stream)
+	.read("STREAM_CAPACITY", _stream_capacity)
+	.read("STREAM_TIMEOUT", SecondsArg(), stream_timeout)
+	.consume() < 0)
+	return -1;
+    _stream_timeout_j = stream_timeout * CLICK_HZ;
+
+    Vector<String> patterns;
+    for (int i = 0; i < conf.size(); ++i) {
+	String pat;
+	PrefixErrorHandler perrh(errh, "pattern " + String(i + 1) + ": ");
+	if (parse_pattern(conf[i], pat, &perrh) < 0)
+	    return -1;
+	patterns.push_back(pat);
+    }
+
+#if CLICK_USERLEVEL
+    if (filename) {
+	String data = file_string(filename, errh);
+	if (!data && errh->nerrors())
+	    return -1;
+	const char *s = data.begin(), *end = data.end();
+	for (int lineno = 1; s != end; ++lineno) {
+	    const char *eol = find(s, end, '\n');
+	    String line = cp_uncomment(data.substring(s, eol));
+	    s = (eol == end ? eol : eol + 1);
+	    if (!line || line[0] == '#')
+		continue;
+	    String pat;
+	    PrefixErrorHandler perrh(errh, filename + ":" + String(lineno) + ": ");
+	    if (parse_pattern(line, pat, &perrh) < 0)
+		return -1;
+	    patterns.push_back(pat);
+	}
+    }
+#endif
+
+    if (!patterns.size())
+	return errh->error("no patterns");
+    if (_nocase)
+	for (int i = 0; i < patterns.size(); ++i)
+	    patterns[i] = patterns[i].lower();
+    _npatterns = patterns.size();
+    return compile(patterns, errh);
+}
+
+int
+PatternMatch::initialize(ErrorHandler *errh)
+{
+    if ((_stream && _streams.reserve(_stream_capacity) < 0)
+	|| _state.resize() < 0)
+	return errh->error("out of memory");
+    return 0;
+}
+
+inline const unsigned char *
+PatternMatch::skip(const unsigned char *s, const unsigned char *end) const
+{
+    // Called in the root state: find the next byte that starts a pattern.
+    if (_prefixes) {
+	// The last two bytes are left to the automaton.
+	if (end - s >= 3) {
+	    uint32_t x = s[0] | s[1] << 8;
+	    for (; end - s >= 3; ++s) {
+		x |= s[2] << 16;
+		uint32_t h = prefix_hash(x);
+		if (_prefixes[h >> 5] & (1U << (h & 31)))
+		    return s;
+		x >>= 8;
+	    }
+	}
+	return s;
+    } else if (_nstart == 1) {
+	const void *x = memchr(s, _start[0], end - s);
+	return x ? reinterpret_cast<const unsigned char *>(x) : end;
+    }
+#if CLICK_USERLEVEL && defined(__SSE2__)
+    __m128i b0 = _mm_set1_epi8(_start[0]), b1 = _mm_set1_epi8(_start[1]),
+	b2 = _mm_set1_epi8(_start[_nstart > 2 ? 2 : 0]),
+	b3 = _mm_set1_epi8(_start[_nstart > 3 ? 3 : 0]);
+    for (; end - s >= 16; s += 16) {
+	__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+	__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, b0),
+					      _mm_cmpeq_epi8(x, b1)),
+				 _mm_or_si128(_mm_cmpeq_epi8(x, b2),
+					      _mm_cmpeq_epi8(x, b3)));
+	if (int mask = _mm_movemask_epi8(m))
+	    return s + __builtin_ctz(mask);
+    }
+#endif
+    while (s != end && !_delta[_class[*s]])
+	++s;
+    return s;
+}
+
+inline uint32_t
+PatternMatch::scan(const unsigned char *&s, const unsigned char *end, uint32_t &state) const
+{
+    uint32_t st = state;
+    const unsigned char *first = s;
+    while (s != end) {
+	if (st == 0) {
+	    s = skip(s, end);
+	    if (s == end)
+		break;
+	} else if (_prefixes && s != first
+		   && st == (_delta[_class[s[-1]]] & ~match_bit)) {
+	    // A state that only remembers the last byte is as good as the
+	    // root one byte back, so the prefilter can skip from there too.
+	    const unsigned char *r = skip(s - 1, end);
+	    if (r != s - 1) {
+		st = 0;
+		s = r;
+		if (s == end)
+		    break;
+	    }
+	}
+	st = _delta[st + _class[*s]];
+	++s;
+	if (st & match_bit) {
+	    st &= ~match_bit;
+	    state = st;
+	    return _out[st / _nclasses];
+	}
+    }
+    state = st;
+    return 0;
+}
+
+inline const unsigned char *
+PatternMatch::payload(Packet *p) const
+{
+    if (!_payload || !p->has_network_header())
+	return p->data();
+    if (!p->has_transport_header())
+	return p->network_header();
+    const unsigned char *th = p->transport_header(), *end = p->end_data();
+    const click_ip *iph = p->ip_header();
+    if (iph->ip_v == 4 && IP_FIRSTFRAG(iph)) {
+	if (iph->ip_p == IP_PROTO_TCP && th + sizeof(click_tcp) <= end)
+	    th += reinterpret_cast<const click_tcp *>(th)->th_off << 2;
+	else if (iph->ip_p == IP_PROTO_UDP)
+	    th += sizeof(click_udp);
+    }
+    return th < end ? th : end;
+}
+
+struct PatternMatch::Expired {
+    click_jiffies_t limit;
+    Expired(click_jiffies_t limit_)
+	: limit(limit_) {
+    }
+    bool operator()(const IPFlow5ID &, Stream &s) const {
+	return click_jiffies_less(s.last, limit);
+    }
+};
+
+void
+PatternMatch::reap(StreamTable &table, ThreadState &ts, click_jiffies_t now)
+{
+    table.reap_step(ts.reap_cursor, reap_batch,
+		    Expired(now - _stream_timeout_j));
+}
+
+Packet *
+PatternMatch::simple_action(Packet *p)
+{
+    int thread = click_current_cpu_id();
+    ThreadState &ts = _state[thread];
+    const unsigned char *s = payload(p), *end = p->end_data();
+    uint32_t state = 0;
+    Stream *stream = 0;
+
+    if (_stream && p->has_network_header() && p->ip_header()->ip_v == 4) {
+	StreamTable &table = _streams[thread];
+	click_jiffies_t now = click_jiffies();
+	reap(table, ts, now);
+	bool inserted;
+	if ((stream = table.find_insert(IPFlow5ID(p), inserted))) {
+	    state = stream->state;
+	    stream->last = now;
+	}
+    }
+
+    uint32_t id = scan(s, end, state);
+    if (stream) {
+	// finish the packet so the next one resumes from the right state
+	uint32_t state_copy = state;
+	while (s != end)
+	    scan(s, end, state_copy);
+	stream->state = state_copy;
+    }
+
+    ++ts.count;
+    if (_anno >= 0)
+	p->set_anno_u32(_anno, id);
+    if (id) {
+	++ts.matched;
+	return p;
+    } else if (noutputs() == 2) {
+	output(1).push(p);
+	return 0;
+    } else
+	return p;
+}
+
+String
+PatternMatch::read_handler(Element *e, void *thunk)
+{
+    PatternMatch *pm = static_cast<PatternMatch *>(e);
+    uint64_t x = 0;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	for (int i = 0; i < pm->_state.size(); ++i)
+	    x += pm->_state[i].count;
+	return String(x);
+    case h_matched:
+	for (int i = 0; i < pm->_state.size(); ++i)
+	    x += pm->_state[i].matched;
+	return String(x);
+    case h_npatterns:
+	return String(pm->_npatterns);
+    case h_nstates:
+	return String(pm->_nstates);
+    case h_memory:
+	return String(pm->_nstates * (pm->_nclasses + 1) * sizeof(uint32_t)
+		      + (pm->_prefixes ? (1U << prefix_bits) / 8 : 0)
+		      + pm->_streams.memory_size());
+    case h_streams:
+	return String(pm->_streams.size());
+    default:
+	return String();
+    }
+}
+
+int
+PatternMatch::write_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    PatternMatch *pm = static_cast<PatternMatch *>(e);
+    for (int i = 0; i < pm->_state.size(); ++i)
+	pm->_state[i].count = pm->_state[i].matched = 0;
+    return 0;
+}
+
+void
+PatternMatch::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("matched", read_handler, h_matched);
+    add_read_handler("npatterns", read_handler, h_npatterns);
+    add_read_handler("nstates", read_handler, h_nstates);
+    add_read_handler("memory", read_handler, h_memory);
+    add_read_handler("streams", read_handler, h_streams);
+    add_write_handler("reset_counts", write_handler, h_reset_counts, Handler::BUTTON);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(PatternMatch)
+ELEMENT_MT_SAFE(PatternMatch)
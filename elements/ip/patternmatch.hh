@@ -0,0 +1,220 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_PATTERNMATCH_HH
+#define CLICK_PATTERNMATCH_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+CLICK_DECLS
+
+/*
+=c
+
+PatternMatch(PATTERN1, PATTERN2, ..., [I<keywords> FILE, ANNO, NOCASE, PAYLOAD, STREAM, STREAM_CAPACITY, STREAM_TIMEOUT])
+
+=s ip
+
+searches packet payloads for byte patterns
+
+=d
+
+PatternMatch searches each packet for any of a set of byte-string
+patterns. Packets containing at least one pattern are emitted on output 0.
+Other packets are emitted on output 1, if it exists, and on output 0
+otherwise.
+
+Patterns are numbered from 1 in configuration order, with the patterns from
+FILE following the PATTERNs. Each pattern is a string that may contain
+hexadecimal byte sequences between vertical bars, as in Snort content
+rules: C<"GET |2f|"> and C<"GET /"> are equivalent. Write a literal vertical
+bar as C<|7c|>. Quote patterns that contain commas or spaces.
+
+PatternMatch compiles all patterns into one Aho-Corasick automaton, stored
+as a table of transitions over byte classes, so each payload byte costs one
+table lookup no matter how many patterns there are. Outside any partial
+match, a prefilter skips ahead to the next position that could start a
+pattern. When the patterns start with at most a few distinct bytes, it
+searches for those bytes with vector instructions; otherwise it looks up
+each three-byte string in a 16-kilobyte hashed bitmap of the patterns'
+first three bytes, so even with thousands of patterns the automaton, which
+may not fit in cache, is only walked where a pattern might begin.
+
+If STREAM is true, PatternMatch remembers the automaton state at the end of
+each IPv4 5-tuple flow's previous packet, so patterns that span packet
+boundaries are found. This assumes packets arrive in order and that each
+flow is handled by one thread. Retransmissions and reordering may cause
+missed or spurious matches.
+
+Keywords are:
+
+=over 8
+
+=item FILE
+
+Filename. Read additional patterns from this file, one per line. Blank lines
+and lines starting with `#' are ignored. User-level only.
+
+=item ANNO
+
+Annotation name or offset. If set, PatternMatch stores the number of a
+pattern found in the packet in this 4-byte annotation, or 0 if there was no
+match. When several patterns occur, the reported pattern is one that ends
+earliest in the payload. Default is not to set an annotation.
+
+=item NOCASE
+
+Boolean. If true, ASCII letters match regardless of case. Default is false.
+
+=item PAYLOAD
+
+Boolean. If true, then for IP packets the search starts after the transport
+header (after the TCP header for TCP, the UDP header for UDP, and the IP
+header for other protocols and non-first fragments). If false, or if the
+packet has no network header annotation, the whole packet is searched.
+Default is true.
+
+=item STREAM
+
+Boolean. If true, keep per-flow automaton state across packets. Default is
+false.
+
+=item STREAM_CAPACITY
+
+Unsigned integer. Number of flows each thread can track in STREAM mode. When
+a thread's table is full, new flows are searched packet by packet. Default
+is 65536.
+
+=item STREAM_TIMEOUT
+
+Time in seconds. Flow state is forgotten after this long without packets.
+Default is 60 seconds.
+
+=back
+
+=h count read-only
+
+Returns the number of packets searched.
+
+=h matched read-only
+
+Returns the number of packets that contained a pattern.
+
+=h npatterns read-only
+
+Returns the number of patterns.
+
+=h nstates read-only
+
+Returns the number of automaton states.
+
+=h memory read-only
+
+Returns the number of bytes used by the automaton and flow tables.
+
+=h streams read-only
+
+Returns the number of flows with remembered state (STREAM mode only).
+
+=h reset_counts write-only
+
+Resets the count and matched counters to 0.
+
+=e
+
+  // divert traffic containing either signature to a monitor
+  c :: PatternMatch("/etc/passwd", "|90 90 90 90 e8|", NOCASE true);
+  c[0] -> ToDump(alerts.pcap);
+  c[1] -> Queue -> ...
+
+=a Classifier, IPClassifier, CheckPattern
+*/
+
+class PatternMatch : public Element { public:
+
+    PatternMatch() CLICK_COLD;
+    ~PatternMatch() CLICK_COLD;
+
+    const char *class_name() const	{ return "PatternMatch"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PROCESSING_A_AH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    Packet *simple_action(Packet *);
+
+  private:
+
+    enum {
+	match_bit = 0x80000000U,	// transition leads to a matching state
+	prefilter_max = 4,		// most start bytes searched for directly
+	prefix_bits = 17		// log2 size of the _prefixes bitmap
+    };
+
+    // The automaton.  A state is represented by the offset of its row in
+    // _delta, i.e. state number * _nclasses; the root is 0.
+    uint32_t *_delta;
+    uint32_t *_out;			// state number -> pattern number
+    uint32_t _nstates;
+    uint32_t _nclasses;
+    uint8_t _class[256];
+    int _nstart;
+    uint8_t _start[prefilter_max];
+    uint32_t *_prefixes;		// hashed bitmap: first three bytes of a match
+
+    int _npatterns;
+    int _anno;
+    bool _nocase;
+    bool _payload;
+    bool _stream;
+    uint32_t _stream_capacity;
+    click_jiffies_t _stream_timeout_j;
+
+    struct Stream {
+	uint32_t state;
+	click_jiffies_t last;
+	Stream()
+	    : state(0), last(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Stream> StreamTable;
+
+    struct ThreadState {
+	uint64_t count;
+	uint64_t matched;
+	uint32_t reap_cursor;
+	ThreadState()
+	    : count(0), matched(0), reap_cursor(0) {
+	}
+    };
+
+    enum { reap_batch = 8 };
+
+    PerThreadCuckooTable<IPFlow5ID, Stream> _streams;
+    PerThread<ThreadState> _state;
+
+    static int parse_pattern(const String &str, String &result, ErrorHandler *errh);
+    int compile(const Vector<String> &patterns, ErrorHandler *errh) CLICK_COLD;
+    static inline uint32_t prefix_hash(uint32_t x) {
+	return (x * 0x9E3779B1U) >> (32 - prefix_bits);
+    }
+    void set_prefix(uint32_t x) {
+	uint32_t h = prefix_hash(x);
+	_prefixes[h >> 5] |= 1U << (h & 31);
+    }
+    inline const unsigned char *skip(const unsigned char *s, const unsigned char *end) const;
+    inline uint32_t scan(const unsigned char *&s, const unsigned char *end, uint32_t &state) const;
+    inline const unsigned char *payload(Packet *p) const;
+    struct Expired;
+    void reap(StreamTable &table, ThreadState &ts, click_jiffies_t now);
+
+    enum { h_count, h_matched, h_npatterns, h_nstates, h_memory, h_streams,
+	   h_reset_counts };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -24,37 +24,81 @@
 #include <click/straccum.hh>
 #include <click/router.hh>
 #include <click/error.hh>
+#include <click/args.hh>
+#if CLICK_USERLEVEL
+# include <click/userutils.hh>
+#endif
 CLICK_DECLS
 
-RangeIPLookup::RangeIPLookup()
-    : _range_base((uint32_t *) CLICK_LALLOC((1 << KICKSTART_BITS) * sizeof(uint32_t))),
-      _range_len((uint32_t *) CLICK_LALLOC((1 << KICKSTART_BITS) * sizeof(uint32_t))),
-      _range_t((uint32_t *) CLICK_LALLOC(RANGES_MAX * sizeof(uint32_t))),
-      _active(false)
+int
+RangeIPLookup::Table::initialize()
 {
+    assert(!_range_base && !_range_len && !_range_t);
+    _range_t_size = 0;
+    _range_t_capacity = RANGES_INIT;
+    if ((_range_base = (uint32_t *) CLICK_LALLOC((1 << KICKSTART_BITS) * sizeof(uint32_t)))
+	&& (_range_len = (uint32_t *) CLICK_LALLOC((1 << KICKSTART_BITS) * sizeof(uint32_t)))
+	&& (_range_t = (uint32_t *) CLICK_LALLOC(_range_t_capacity * sizeof(uint32_t))))
+	return _helper.initialize();
+    else
+	return -ENOMEM;
 }
 
-RangeIPLookup::~RangeIPLookup()
+void
+RangeIPLookup::Table::cleanup()
 {
     CLICK_LFREE(_range_base, (1 << KICKSTART_BITS) * sizeof(uint32_t));
     CLICK_LFREE(_range_len, (1 << KICKSTART_BITS) * sizeof(uint32_t));
-    CLICK_LFREE(_range_t, RANGES_MAX * sizeof(uint32_t));
+    CLICK_LFREE(_range_t, _range_t_capacity * sizeof(uint32_t));
+    _range_base = _range_len = _range_t = 0;
+    _helper.cleanup();
+}
+
+void
+RangeIPLookup::Table::flush()
+{
+    _helper.flush();
+    memset(_range_base, 0, (1 << KICKSTART_BITS) * sizeof(*_range_base));
+    memset(_range_len, 0, (1 << KICKSTART_BITS) * sizeof(*_range_len));
+    memset(_range_t, 0, _range_t_capacity * sizeof(*_range_t));
+    _range_t_size = 1;
+}
+
+size_t
+RangeIPLookup::Table::memory_size() const
+{
+    return 2 * (1 << KICKSTART_BITS) * sizeof(uint32_t)
+	+ _range_t_capacity * sizeof(uint32_t);
+}
+
+
+RangeIPLookup::RangeIPLookup()
+    : _t(0), _retire_timer(this), _active(false)
+{
+}
+
+RangeIPLookup::~RangeIPLookup()
+{
 }
 
 int
 RangeIPLookup::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     int r;
-    if ((r = _helper.initialize()) < 0)
+    if (!(_t = new Table))
+	return -ENOMEM;
+    if ((r = _t->initialize()) < 0)
 	return r;
-    flush_table();
+    _t->flush();
     return IPRouteTable::configure(conf, errh);
 }
 
 int
 RangeIPLookup::initialize(ErrorHandler *)
 {
-    expand();
+    if (_t->expand() < 0)
+	return -ENOMEM;
+    _retire_timer.initialize(this);
     _active = true;
     return 0;
 }
@@ -62,7 +106,24 @@ RangeIPLookup::initialize(ErrorHandler *)
 void
 RangeIPLookup::cleanup(CleanupStage)
 {
-    _helper.cleanup();
+    delete _t;
+    _t = 0;
+    for (RetiredTable *it = _retired.begin(); it != _retired.end(); ++it)
+	delete it->table;
+    _retired.clear();
+}
+
+void
+RangeIPLookup::run_timer(Timer *)
+{
+    // Free the tables that lookups have stopped using.
+    Timestamp now = Timestamp::now_steady();
+    RetiredTable *it = _retired.begin();
+    for (; it != _retired.end() && it->expiry <= now; ++it)
+	delete it->table;
+    _retired.erase(_retired.begin(), it);
+    if (_retired.size())
+	_retire_timer.schedule_at_steady(_retired[0].expiry);
 }
 
 void
@@ -74,7 +135,7 @@ RangeIPLookup::push(int, Packet *p)
 #ifdef RANGEIPLOOKUP_VERBOSE
     // Consistency check - does directiplookup yied the same result?
     IPAddress gw1;
-    int port1 = _helper.lookup_route(p->dst_ip_anno(), gw1);
+    int port1 = _t->_helper.lookup_route(p->dst_ip_anno(), gw1);
     if (port != port1 || gw != gw1)
 	click_chatter("RangeIPLookup: consistency check failed!");
 #endif
@@ -90,21 +151,22 @@ RangeIPLookup::push(int, Packet *p)
 int
 RangeIPLookup::lookup_route(IPAddress dest, IPAddress &gw) const
 {
+    const Table *t = _t;
     uint32_t ip_addr = ntohl(dest.addr());
     uint32_t lowerbound, upperbound, middle;
     uint32_t i = ip_addr >> RANGE_SHIFT; // kickstart table index = MS bits
     uint16_t vport_i;
 
-    lowerbound = _range_base[i];
-    upperbound = lowerbound + _range_len[i];
+    lowerbound = t->_range_base[i];
+    upperbound = lowerbound + t->_range_len[i];
     i = ip_addr & RANGE_MASK;		// Compare only masked LS bits
 
     // Binary search for a matching range
     while (upperbound > lowerbound) {
 	middle = (upperbound + lowerbound) >> 1;
-	if (i < (_range_t[middle] & RANGE_MASK))
+	if (i < (t->_range_t[middle] & RANGE_MASK))
 	    upperbound = middle;
-	else if (i < (_range_t[middle + 1] & RANGE_MASK)) {
+	else if (i < (t->_range_t[middle + 1] & RANGE_MASK)) {
 	    lowerbound = middle;
 	    break;
 	} else
@@ -112,9 +174,9 @@ RangeIPLookup::lookup_route(IPAddress dest, IPAddress &gw) const
     }
 
     // MS bits of the found range contain an index into the output port table
-    vport_i = _range_t[lowerbound] >> RANGE_SHIFT;
-    gw = _helper._vport[vport_i].gw;
-    return _helper._vport[vport_i].port;
+    vport_i = t->_range_t[lowerbound] >> RANGE_SHIFT;
+    gw = t->_helper._vport[vport_i].gw;
+    return t->_helper._vport[vport_i].port;
 }
 
 void
@@ -122,23 +184,31 @@ RangeIPLookup::add_handlers()
 {
     IPRouteTable::add_handlers();
     add_write_handler("flush", flush_handler, 0, Handler::BUTTON);
+    add_write_handler("load", load_handler, 0);
+#if CLICK_USERLEVEL
+    add_write_handler("load_file", load_handler, 1);
+#endif
+    add_read_handler("load_time", read_handler, h_load_time);
+    add_read_handler("nroutes", read_handler, h_nroutes);
+    add_read_handler("nranges", read_handler, h_nranges);
+    add_read_handler("memory", read_handler, h_memory);
 }
 
 int
 RangeIPLookup::add_route(const IPRoute& route, bool allow_replace, IPRoute* old_route, ErrorHandler *errh)
 {
-    int error = _helper.add_route(route, allow_replace, old_route, errh);
+    int error = _t->_helper.add_route(route, allow_replace, old_route, errh);
     if (error == 0 && _active)
-	expand();
+	error = _t->expand();
     return error;
 }
 
 int
 RangeIPLookup::remove_route(const IPRoute& route, IPRoute* old_route, ErrorHandler *errh)
 {
-    int error = _helper.remove_route(route, old_route, errh);
+    int error = _t->_helper.remove_route(route, old_route, errh);
     if (error == 0 && _active)
-	expand();
+	error = _t->expand();
     return error;
 }
 
@@ -149,9 +219,10 @@ RangeIPLookup::remove_route(const IPRoute& route, IPRoute* old_route, ErrorHandl
  * 32 + 16 = 48 MBytes of directiplookup tables.  We should implement a
  * more efficient method for updating range-based lookup structures in
  * the future, which would not depend on huge directiplookup tables.
+ * Bulk loads avoid the cost by expanding only once.
  */
-void
-RangeIPLookup::expand()
+int
+RangeIPLookup::Table::expand()
 {
     uint32_t range_t_index = 0;
     uint32_t tbl_0_23_index = 0;
@@ -167,6 +238,16 @@ RangeIPLookup::expand()
 	for (range_len = 0;
 	  tbl_0_23_index < ((range_base + 1) << (24 - KICKSTART_BITS));
 	  tbl_0_23_index++) {
+	    // Make room for up to 256 more ranges
+	    if (range_t_index + 256 > _range_t_capacity) {
+		uint32_t *new_range_t = (uint32_t *) CLICK_LALLOC(2 * _range_t_capacity * sizeof(uint32_t));
+		if (!new_range_t)
+		    return -ENOMEM;
+		memcpy(new_range_t, _range_t, range_t_index * sizeof(uint32_t));
+		CLICK_LFREE(_range_t, _range_t_capacity * sizeof(uint32_t));
+		_range_t = new_range_t;
+		_range_t_capacity *= 2;
+	    }
 	    if (_helper._tbl_0_23[tbl_0_23_index] & 0x8000) {
 		uint32_t tbl_24_31_index, j;
 		tbl_24_31_index =
@@ -198,36 +279,101 @@ RangeIPLookup::expand()
 	}
 	_range_len[range_base] = range_len - 1;
     }
+    _range_t_size = range_t_index;
 
 #ifdef RANGEIPLOOKUP_VERBOSE
     click_chatter("Range expansion done: %d ranges using %d + %d bytes",
-		  range_t_index, sizeof(_range_base) + sizeof(_range_len),
+		  range_t_index, 2 * (1 << KICKSTART_BITS) * sizeof(uint32_t),
 		  range_t_index * sizeof(uint32_t));
 #endif
+    return 0;
 }
 
-void
-RangeIPLookup::flush_table()
+int
+RangeIPLookup::flush_handler(const String &, Element *e, void *,
+                                ErrorHandler *)
 {
-    _helper.flush();
-    memset(_range_base, 0, (1 << KICKSTART_BITS) * sizeof(*_range_base));
-    memset(_range_len, 0, (1 << KICKSTART_BITS) * sizeof(*_range_len));
-    memset(_range_t, 0, RANGES_MAX * sizeof(*_range_t));
+    RangeIPLookup *t = static_cast<RangeIPLookup *>(e);
+    t->_t->flush();
+    return 0;
 }
 
 int
-RangeIPLookup::flush_handler(const String &, Element *e, void *,
-                                ErrorHandler *)
+RangeIPLookup::load_handler(const String &str, Element *e, void *thunk,
+			    ErrorHandler *errh)
 {
     RangeIPLookup *t = static_cast<RangeIPLookup *>(e);
-    t->flush_table();
+    Timestamp start = Timestamp::now_steady();
+
+    String data = str;
+#if CLICK_USERLEVEL
+    if (thunk) {
+	String filename;
+	if (!FilenameArg().parse(cp_uncomment(str), filename))
+	    return errh->error("expected filename");
+	int before = errh->nerrors();
+	data = file_string(filename, errh);
+	if (errh->nerrors() != before)
+	    return -EINVAL;
+    }
+#else
+    (void) thunk;
+#endif
+
+    Vector<IPRoute> routes;
+    if (t->parse_route_list(data, routes, errh) < 0)
+	return -EINVAL;
+
+    // Build both tables off the data path, expanding only once, then swap.
+    Table *nt = new Table;
+    int r;
+    if (!nt)
+	return errh->error("out of memory");
+    else if ((r = nt->initialize()) < 0
+	     || (r = nt->_helper.build(routes, errh)) < 0
+	     || (r = nt->expand()) < 0) {
+	delete nt;
+	return r == -ENOMEM ? errh->error("out of memory") : r;
+    }
+
+    // Earlier loads' tables may still be in use, so queue the old table
+    // behind them rather than freeing anything now.
+    RetiredTable old;
+    old.table = t->_t;
+    old.expiry = Timestamp::now_steady() + Timestamp::make_msec(RETIRE_DELAY_MSEC);
+    t->_retired.push_back(old);
+    click_write_fence();
+    t->_t = nt;
+    if (!t->_retire_timer.scheduled())
+	t->_retire_timer.schedule_at_steady(old.expiry);
+
+    t->_load_time = Timestamp::now_steady() - start;
     return 0;
 }
 
+String
+RangeIPLookup::read_handler(Element *e, void *thunk)
+{
+    RangeIPLookup *t = static_cast<RangeIPLookup *>(e);
+    switch ((intptr_t) thunk) {
+    case h_load_time:
+	return t->_load_time.unparse_interval();
+    case h_nroutes:
+	return String(t->_t->_helper.nroutes());
+    case h_nranges:
+	return String(t->_t->_range_t_size);
+    case h_memory:
+	return String(t->_t->memory_size()) + " "
+	    + String(t->_t->_helper.memory_size());
+    default:
+	return String();
+    }
+}
+
 String
 RangeIPLookup::dump_routes()
 {
-    return _helper.dump();
+    return _t->_helper.dump();
 }
 
 CLICK_ENDDECLS
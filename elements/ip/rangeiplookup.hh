@@ -3,6 +3,7 @@
 #define CLICK_RANGEIPLOOKUP_HH
 #include "iproutetable.hh"
 #include "directiplookup.hh"
+#include <click/timer.hh>
 CLICK_DECLS
 
 /*
@@ -70,6 +71,37 @@ operation.
 
 Clears the entire routing table in a single atomic operation.
 
+=h load write-only
+
+Replaces the entire routing table with a route list.  The list is either
+text, with one `C<ADDR/MASK [GW] OUT>' route per line, or the compact binary
+format described in IPRouteTable.  Both the subsidiary DirectIPLookup table
+and the range table are built once, off the data path, and swapped in
+atomically.  Use this rather than C<ctrl> or many C<add>s for large tables:
+those re-expand the range table after every route.
+
+=h load_file write-only
+
+Like C<load>, but reads the route list from the named file.  User-level only.
+
+=h load_time read-only
+
+Returns the time taken by the most recent C<load> or C<load_file>, including
+parsing.
+
+=h nroutes read-only
+
+Returns the number of routes in the table.
+
+=h nranges read-only
+
+Returns the number of address ranges in the lookup table.
+
+=h memory read-only
+
+Returns the number of bytes used by the lookup table, followed by the number
+of bytes used by the subsidiary table.
+
 =n
 
 See IPRouteTable for a performance comparison of the various IP routing
@@ -94,6 +126,7 @@ class RangeIPLookup : public IPRouteTable { public:
     void cleanup(CleanupStage) CLICK_COLD;
     void add_handlers() CLICK_COLD;
     void push(int port, Packet* p);
+    void run_timer(Timer *timer);
 
     int add_route(const IPRoute&, bool, IPRoute*, ErrorHandler *);
     int remove_route(const IPRoute&, IPRoute*, ErrorHandler *);
@@ -101,23 +134,54 @@ class RangeIPLookup : public IPRouteTable { public:
     String dump_routes();
 
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
+    static int load_handler(const String &, Element *, void *, ErrorHandler *);
+    static String read_handler(Element *, void *);
 
   protected:
 
-    void flush_table();
-    void expand();
-
     enum { KICKSTART_BITS = 12 };
-    enum { RANGES_MAX = 256 * 1024 };
+    enum { RANGES_INIT = 256 * 1024 };
     enum { RANGE_MASK = 0xffffffff >> KICKSTART_BITS };
     enum { RANGE_SHIFT = 32 - KICKSTART_BITS };
-
-    uint32_t *_range_base;
-    uint32_t *_range_len;
-    uint32_t *_range_t;
+    enum { RETIRE_DELAY_MSEC = 1000 };
+
+    struct Table {
+	uint32_t *_range_base;
+	uint32_t *_range_len;
+	uint32_t *_range_t;
+	uint32_t _range_t_size;
+	uint32_t _range_t_capacity;
+
+	DirectIPLookup::Table _helper;
+
+	Table()
+	    : _range_base(0), _range_len(0), _range_t(0) {
+	}
+
+	~Table() {
+	    cleanup();
+	}
+
+	int initialize();
+	void cleanup();
+	void flush();
+	int expand();
+	size_t memory_size() const;
+    };
+
+    // Packets are looked up in *_t.  A bulk load builds a new Table, swaps
+    // it into _t, and frees the old one after RETIRE_DELAY_MSEC.
+    struct RetiredTable {
+	Table *table;
+	Timestamp expiry;
+    };
+    Table *_t;
+    Vector<RetiredTable> _retired;	// in order of expiry
+    Timer _retire_timer;
+    Timestamp _load_time;
     bool _active;
 
-    DirectIPLookup::Table _helper;
+    enum { h_load_time, h_nroutes, h_nranges, h_memory };
 
 };
 
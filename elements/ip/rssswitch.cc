@@ -0,0 +1,284 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * rssswitch.{cc,hh} -- element spreads IP flows across outputs by Toeplitz
+ * hash
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "rssswitch.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <clicknet/ip.h>
+#include <clicknet/ip6.h>
+#include <clicknet/tcp.h>
+CLICK_DECLS
+
+static const unsigned char default_key[] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+RSSSwitch::RSSSwitch()
+{
+}
+
+void
+RSSSwitch::set_key(const String &key)
+{
+    const unsigned char *k = reinterpret_cast<const unsigned char *>(key.data());
+    for (int i = 0; i < input_max_len; ++i) {
+	// window[j] holds the 32 key bits starting at bit 8*i + j
+	uint64_t bits = 0;
+	for (int j = 0; j < 8; ++j)
+	    bits = (bits << 8) | (i + j < key.length() ? k[i + j] : 0);
+	uint32_t window[8];
+	for (int j = 0; j < 8; ++j)
+	    window[j] = bits >> (32 - j);
+	for (int b = 0; b < 256; ++b) {
+	    uint32_t h = 0;
+	    for (int j = 0; j < 8; ++j)
+		if (b & (0x80 >> j))
+		    h ^= window[j];
+	    _tbl[i][b] = h;
+	}
+    }
+}
+
+static int
+parse_hex(const String &str, String &result)
+{
+    StringAccum sa;
+    const char *s = str.begin(), *end = str.end();
+    int nibble = -1;
+    for (; s != end; ++s) {
+	int v;
+	if (*s >= '0' && *s <= '9')
+	    v = *s - '0';
+	else if ((*s | 0x20) >= 'a' && (*s | 0x20) <= 'f')
+	    v = (*s | 0x20) - 'a' + 10;
+	else if (*s == ':' || isspace((unsigned char) *s))
+	    continue;
+	else
+	    return -1;
+	if (nibble < 0)
+	    nibble = v;
+	else {
+	    sa << (char) ((nibble << 4) | v);
+	    nibble = -1;
+	}
+    }
+    if (nibble >= 0)
+	return -1;
+    result = sa.take_string();
+    return 0;
+}
+
+int
+RSSSwitch::parse_table(const String &str, Vector<int> &table, ErrorHandler *errh) const
+{
+    Vector<String> words;
+    cp_spacevec(str, words);
+    if (words.size() != _table.size())
+	return errh->error("table must have %d entries", _table.size());
+    table.resize(words.size());
+    for (int i = 0; i < words.size(); ++i)
+	if (!IntArg().parse(words[i], table[i])
+	    || table[i] < 0 || table[i] >= noutputs())
+	    return errh->error("bad output %<%s%>", words[i].c_str());
+    return 0;
+}
+
+int
+RSSSwitch::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String key_str, table_str;
+    bool symmetric = false;
+    uint32_t table_size = 128;
+    _nactive = noutputs();
+    _anno = -1;
+    _ports = true;
+    _consistent = true;
+    if (Args(conf, this, errh)
+	.read("KEY", AnyArg(), key_str)
+	.read("SYMMETRIC", symmetric)
+	.read("PORTS", _ports)
+	.read("TABLE_SIZE", table_size)
+	.read("TABLE", AnyArg(), table_str)
+	.read("ACTIVE", _nactive)
+	.read("CONSISTENT", _consistent)
+	.read("ANNO", AnnoArg(4), _anno)
+	.complete() < 0)
+	return -1;
+
+    String key;
+    if (symmetric) {
+	StringAccum sa;
+	for (int i = 0; i < key_min_len; ++i)
+	    sa << (char) (i & 1 ? 0x5a : 0x6d);
+	key = sa.take_string();
+    } else if (key_str) {
+	if (parse_hex(cp_unquote(key_str), key) < 0)
+	    return errh->error("KEY must be hexadecimal");
+	if (key.length() < key_min_len)
+	    return errh->error("KEY must have at least %d bytes", (int) key_min_len);
+    } else
+	key = String::make_stable(reinterpret_cast<const char *>(default_key), sizeof(default_key));
+    set_key(key);
+
+    if (table_size == 0 || (table_size & (table_size - 1)) || table_size > 65536)
+	return errh->error("TABLE_SIZE must be a power of two");
+    if (_nactive <= 0 || _nactive > noutputs())
+	return errh->error("ACTIVE must be between 1 and %d", noutputs());
+    _table.resize(table_size);
+    _table_mask = table_size - 1;
+    if (table_str)
+	return parse_table(table_str, _table, errh);
+    for (uint32_t i = 0; i < table_size; ++i)
+	_table[i] = i % _nactive;
+    return 0;
+}
+
+inline uint32_t
+RSSSwitch::hash_bytes(const unsigned char *x, int pos, int len) const
+{
+    uint32_t h = 0;
+    for (int i = 0; i < len; ++i)
+	h ^= _tbl[pos + i][x[i]];
+    return h;
+}
+
+uint32_t
+RSSSwitch::hash(Packet *p) const
+{
+    if (!p->has_network_header())
+	return 0;
+    const unsigned char *nh = p->network_header(), *end = p->end_data();
+    const unsigned char *th;
+    int nxt, pos;
+    uint32_t h;
+    if (nh + sizeof(click_ip) <= end && (nh[0] >> 4) == 4) {
+	const click_ip *iph = reinterpret_cast<const click_ip *>(nh);
+	h = _tbl[0][nh[12]] ^ _tbl[1][nh[13]] ^ _tbl[2][nh[14]] ^ _tbl[3][nh[15]]
+	    ^ _tbl[4][nh[16]] ^ _tbl[5][nh[17]] ^ _tbl[6][nh[18]] ^ _tbl[7][nh[19]];
+	if (!IP_FIRSTFRAG(iph) || (iph->ip_off & htons(IP_MF)))
+	    return h;
+	nxt = iph->ip_p;
+	th = nh + (iph->ip_hl << 2);
+	pos = 8;
+    } else if (nh + sizeof(click_ip6) <= end && (nh[0] >> 4) == 6) {
+	const click_ip6 *ip6h = reinterpret_cast<const click_ip6 *>(nh);
+	h = hash_bytes(nh + 8, 0, 32);
+	nxt = ip6h->ip6_nxt;
+	th = nh + sizeof(click_ip6);
+	pos = 32;
+    } else
+	return 0;
+    if (_ports && (nxt == IP_PROTO_TCP || nxt == IP_PROTO_UDP) && th + 4 <= end)
+	h ^= _tbl[pos][th[0]] ^ _tbl[pos + 1][th[1]]
+	    ^ _tbl[pos + 2][th[2]] ^ _tbl[pos + 3][th[3]];
+    return h;
+}
+
+void
+RSSSwitch::push(int, Packet *p)
+{
+    uint32_t h = hash(p);
+    if (_anno >= 0)
+	p->set_anno_u32(_anno, h);
+    output(_table[h & _table_mask]).push(p);
+}
+
+void
+RSSSwitch::rebalance(int nactive)
+{
+    int n = _table.size();
+    if (!_consistent) {
+	for (int i = 0; i < n; ++i)
+	    _table[i] = i % nactive;
+	_nactive = nactive;
+	return;
+    }
+
+    // Each active output's quota is n/nactive entries, rounded so the
+    // quotas sum to n.  An entry moves only if its output is inactive or
+    // over quota, so growing from N to N+1 outputs moves about n/(N+1)
+    // entries.
+    Vector<int> count(noutputs(), 0), quota(noutputs(), 0), moving;
+    for (int o = 0; o < nactive; ++o)
+	quota[o] = n / nactive + (o < n % nactive);
+    for (int i = 0; i < n; ++i) {
+	int o = _table[i];
+	if (count[o] < quota[o])
+	    ++count[o];
+	else
+	    moving.push_back(i);
+    }
+    int o = 0;
+    for (int j = 0; j < moving.size(); ++j) {
+	while (count[o] >= quota[o])
+	    ++o;
+	_table[moving[j]] = o;
+	++count[o];
+    }
+    _nactive = nactive;
+}
+
+String
+RSSSwitch::read_handler(Element *e, void *thunk)
+{
+    RSSSwitch *rs = static_cast<RSSSwitch *>(e);
+    if ((intptr_t) thunk == h_active)
+	return String(rs->_nactive);
+    StringAccum sa;
+    for (int i = 0; i < rs->_table.size(); ++i)
+	sa << (i ? " " : "") << rs->_table[i];
+    return sa.take_string();
+}
+
+int
+RSSSwitch::write_handler(const String &str, Element *e, void *thunk, ErrorHandler *errh)
+{
+    RSSSwitch *rs = static_cast<RSSSwitch *>(e);
+    if ((intptr_t) thunk == h_active) {
+	int nactive;
+	if (!IntArg().parse(str, nactive) || nactive <= 0 || nactive > rs->noutputs())
+	    return errh->error("active must be between 1 and %d", rs->noutputs());
+	rs->rebalance(nactive);
+	return 0;
+    } else {
+	// entries are ints, so concurrent readers see either old or new
+	Vector<int> table;
+	if (rs->parse_table(str, table, errh) < 0)
+	    return -1;
+	for (int i = 0; i < table.size(); ++i)
+	    rs->_table[i] = table[i];
+	return 0;
+    }
+}
+
+void
+RSSSwitch::add_handlers()
+{
+    add_read_handler("active", read_handler, h_active);
+    add_write_handler("active", write_handler, h_active);
+    add_read_handler("table", read_handler, h_table);
+    add_write_handler("table", write_handler, h_table);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(RSSSwitch)
+ELEMENT_MT_SAFE(RSSSwitch)
@@ -0,0 +1,144 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_RSSSWITCH_HH
+#define CLICK_RSSSWITCH_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+RSSSwitch([I<keywords> KEY, SYMMETRIC, PORTS, TABLE_SIZE, TABLE, ACTIVE, CONSISTENT, ANNO])
+
+=s ip
+
+spreads IP flows across outputs like NIC receive-side scaling
+
+=d
+
+RSSSwitch computes the Toeplitz hash that network cards use for receive-side
+scaling (RSS) over each packet's IPv4 or IPv6 addresses and, for TCP and
+UDP, ports. The hash's low bits index an indirection table, whose entry is
+the output port for the packet. All packets of a flow therefore leave on the
+same output, and with the same KEY and table, RSSSwitch sends a flow to the
+same output number as a NIC would send it to a queue number. Typically each
+output leads to a different thread.
+
+Packets must have their network header annotations set. Non-IP packets,
+and IP packets whose headers cannot be parsed, hash to 0. IP fragments and
+protocols other than TCP and UDP are hashed over addresses only. IPv6
+extension headers are not followed.
+
+Keywords are:
+
+=over 8
+
+=item KEY
+
+Hexadecimal string of at least 40 bytes. The Toeplitz key. Default is the
+standard key used by most NIC drivers, which starts with 6d5a56da.
+
+=item SYMMETRIC
+
+Boolean. If true, use a key consisting of repeated 6d5a bytes, which makes
+the hash symmetric: both directions of a connection hash to the same
+value. Overrides KEY. Default is false.
+
+=item PORTS
+
+Boolean. If false, hash over addresses only. Default is true.
+
+=item TABLE_SIZE
+
+Power of two. Number of indirection table entries. Default is 128, the
+size used by many NICs.
+
+=item TABLE
+
+Space-separated list of TABLE_SIZE output numbers: the initial indirection
+table. Default spreads entries evenly over the active outputs.
+
+=item ACTIVE
+
+Integer. Number of active outputs; the default table uses outputs 0 to
+ACTIVE-1. Default is the number of outputs.
+
+=item CONSISTENT
+
+Boolean. If true, changing the number of active outputs moves as few table
+entries as possible, so most flows keep their output: growing from N to N+1
+outputs moves about 1/(N+1) of the flows. If false, the table is rebuilt
+round-robin, which moves most flows. Default is true.
+
+=item ANNO
+
+Annotation name or offset. If set, RSSSwitch stores the 4-byte hash in
+this annotation, as NICs report the RSS hash in receive descriptors.
+
+=back
+
+=h active read/write
+
+Returns or sets the number of active outputs. Setting it rebalances the
+indirection table, consistently if CONSISTENT is true.
+
+=h table read/write
+
+Returns or sets the indirection table.
+
+=e
+
+  // fan out from a single-queue device to four threads
+  FromDevice(eth0) -> Strip(14) -> CheckIPHeader
+    -> rss :: RSSSwitch(SYMMETRIC true);
+  rss[0] -> Queue -> ...  StaticThreadSched(...)
+
+=a HashSwitch, RoundRobinSwitch, CPUSwitch, FlowClassifier
+*/
+
+class RSSSwitch : public Element { public:
+
+    RSSSwitch() CLICK_COLD;
+
+    const char *class_name() const	{ return "RSSSwitch"; }
+    const char *port_count() const	{ return "1/1-"; }
+    const char *processing() const	{ return PUSH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int port, Packet *);
+
+    /** @brief Return the Toeplitz hash of @a p's flow. */
+    uint32_t hash(Packet *p) const;
+
+  private:
+
+    enum {
+	key_min_len = 40,	// covers an IPv6 address/port 4-tuple
+	input_max_len = 36
+    };
+
+    // _tbl[i][b] is the hash contribution of byte value b at input
+    // position i, so hashing costs one lookup per input byte rather
+    // than one XOR per set bit.
+    uint32_t _tbl[input_max_len][256];
+    Vector<int> _table;
+    uint32_t _table_mask;
+    int _nactive;
+    int _anno;
+    bool _ports;
+    bool _consistent;
+
+    void set_key(const String &key);
+    inline uint32_t hash_bytes(const unsigned char *x, int pos, int len) const;
+    void rebalance(int nactive);
+
+    enum { h_active, h_table };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+    int parse_table(const String &str, Vector<int> &table, ErrorHandler *errh) const;
+
+};
+
+CLICK_ENDDECLS
+#endif
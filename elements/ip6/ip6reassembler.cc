@@ -0,0 +1,117 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * ip6reassembler.{cc,hh} -- element reassembles IPv6 fragments
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "ip6reassembler.hh"
+#include <clicknet/ip6.h>
+CLICK_DECLS
+
+IP6Reassembler::IP6Reassembler()
+    : IPReassemblerBase(60)
+{
+}
+
+IP6Reassembler::~IP6Reassembler()
+{
+}
+
+/* Find the Fragment header in the IPv6 packet at @a h, @a len bytes long.
+   Sets @a pos to its offset from @a h and @a nxt_pos to the offset of the
+   next header field naming it. Returns false if there is none. */
+static bool
+find_fragment_header(const uint8_t *h, unsigned len, unsigned &pos,
+		     unsigned &nxt_pos)
+{
+    nxt_pos = 6;		// click_ip6::ip6_nxt
+    pos = sizeof(click_ip6);
+    while (1) {
+	uint8_t nxt = h[nxt_pos];
+	if (nxt == IP6PROTO_FRAGMENT)
+	    return pos + sizeof(click_ip6_fragment) <= len;
+	else if ((nxt != 0 && nxt != 43 && nxt != 60) || pos + 8 > len)
+	    // not Hop-by-Hop Options, Routing or Destination Options
+	    return false;
+	nxt_pos = pos;
+	pos += (h[pos + 1] + 1) << 3;
+    }
+}
+
+Packet *
+IP6Reassembler::simple_action(Packet *p)
+{
+    const click_ip6 *ip6 = p->ip6_header();
+    const uint8_t *h = p->network_header();
+    unsigned len = p->network_length();
+    unsigned pos, nxt_pos;
+    if (likely(ip6->ip6_nxt != IP6PROTO_FRAGMENT && ip6->ip6_nxt != 0
+	       && ip6->ip6_nxt != 43 && ip6->ip6_nxt != 60)
+	|| !find_fragment_header(h, len, pos, nxt_pos))
+	return p;
+
+    const click_ip6_fragment *fh = reinterpret_cast<const click_ip6_fragment *>(h + pos);
+    unsigned plen_end = sizeof(click_ip6) + ntohs(ip6->ip6_plen);
+    unsigned data = pos + sizeof(click_ip6_fragment);
+    unsigned off = ntohs(fh->ip6_frag_offset) & IP6_OFFMASK;
+    bool more = (fh->ip6_frag_offset & htons(IP6_MF)) != 0;
+    unsigned end = off + plen_end - data;
+    if (plen_end > len || plen_end <= data || end > 0xFFFF
+	|| (more && ((plen_end - data) & 7) != 0)
+	|| p->network_header_offset() < 0) {
+	bad(p);
+	return 0;
+    }
+
+    Key key;
+    memcpy(key.src, &ip6->ip6_src, sizeof(key.src));
+    memcpy(key.dst, &ip6->ip6_dst, sizeof(key.dst));
+    key.id = fh->ip6_frag_id;
+    key.proto = fh->ip6_frag_nxt;
+    return reassemble(p, key, off, end, more, p->network_header_offset() + data);
+}
+
+WritablePacket *
+IP6Reassembler::assemble(const Datagram *d)
+{
+    const Fragment *first = d->frags;
+    const Packet *fp = first->p;
+    unsigned pos, nxt_pos;
+    find_fragment_header(fp->network_header(), fp->network_length(), pos, nxt_pos);
+    // the unfragmentable part ends at the Fragment header
+    unsigned nh = fp->network_header_offset();
+    unsigned unfrag = nh + pos;
+    WritablePacket *q = Packet::make(fp->headroom(), 0, unfrag + d->total, 0);
+    if (!q)
+	return 0;
+    memcpy(q->data(), fp->data(), unfrag);
+    for (const Fragment *f = first; f; f = f->next)
+	memcpy(q->data() + unfrag + f->off, f->p->data() + f->data,
+	       f->end - f->off);
+
+    q->copy_annotations(fp);
+    if (fp->has_mac_header() && fp->mac_header_offset() >= 0)
+	q->set_mac_header(q->data() + fp->mac_header_offset(),
+			  fp->mac_header_length());
+    q->set_ip6_header(reinterpret_cast<click_ip6 *>(q->data() + nh));
+
+    const click_ip6_fragment *fh = reinterpret_cast<const click_ip6_fragment *>(fp->network_header() + pos);
+    q->data()[nh + nxt_pos] = fh->ip6_frag_nxt;
+    q->ip6_header()->ip6_plen = htons(pos - sizeof(click_ip6) + d->total);
+    return q;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(IPReassemblerBase)
+EXPORT_ELEMENT(IP6Reassembler)
+ELEMENT_MT_SAFE(IP6Reassembler)
@@ -0,0 +1,58 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_IP6REASSEMBLER_HH
+#define CLICK_IP6REASSEMBLER_HH
+#include "elements/ip/ipreassemblerbase.hh"
+CLICK_DECLS
+
+/*
+=c
+
+IP6Reassembler([I<KEYWORDS>])
+
+=s ip6
+
+Reassembles fragmented IPv6 packets
+
+=d
+
+Expects IPv6 packets, with their network header annotations set, as input
+to port 0. Packets with a Fragment header are held until all fragments of
+their packet have arrived; the reassembled packet, with the Fragment header
+removed and the payload length set, is emitted on output 0. Other packets
+pass through unchanged. The Fragment header may follow Hop-by-Hop Options,
+Routing and Destination Options headers, which are copied from the fragment
+at offset 0, as RFC 8200 specifies.
+
+Fragments are identified by source address, destination address,
+identification, and the Fragment header's next header. A fragment other
+than the last whose length is not a multiple of 8, a fragment that would
+extend the packet beyond 65535 bytes, or a fragment inconsistent with the
+packet's known length is dropped. A fragment that overlaps a held fragment,
+other than an exact duplicate, causes the whole packet to be dropped, as
+RFC 5722 requires.
+
+IP6Reassembler shares its tables, memory bounds, keywords and handlers with
+IPReassembler. If IP6Reassembler has two outputs, the fragment at offset 0
+of each packet that could not be reassembled, if it arrived, is pushed onto
+output 1, for example to an C<ICMP6Error(ADDR, 3, 1)>. The default TIMEOUT
+is 60 seconds, as RFC 8200 recommends.
+
+=a IPReassembler, IP6Fragmenter, MarkIP6Header */
+
+class IP6Reassembler : public IPReassemblerBase { public:
+
+    IP6Reassembler() CLICK_COLD;
+    ~IP6Reassembler() CLICK_COLD;
+
+    const char *class_name() const	{ return "IP6Reassembler"; }
+
+    Packet *simple_action(Packet *);
+
+  private:
+
+    WritablePacket *assemble(const Datagram *d);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -85,6 +85,15 @@ Counter::initialize(ErrorHandler *errh)
   return 0;
 }
 
+void
+Counter::merge_state(Element *e, ErrorHandler *)
+{
+  if (Counter *c = static_cast<Counter *>(e->cast("Counter"))) {
+    _count += c->_count;
+    _byte_count += c->_byte_count;
+  }
+}
+
 Packet *
 Counter::simple_action(Packet *p)
 {
@@ -39,6 +39,9 @@ emitting the packet.
 
 =back
 
+In parallel trace mode, the counts of every copy of a Counter are added
+together when the copies finish; rates are not merged.
+
 =h count read-only
 
 Returns the number of packets that have passed through since the last reset.
@@ -110,6 +113,7 @@ class Counter : public Element { public:
 
     int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
     int initialize(ErrorHandler *) CLICK_COLD;
+    void merge_state(Element *, ErrorHandler *) CLICK_COLD;
     void add_handlers() CLICK_COLD;
     int llrpc(unsigned, void *);
 
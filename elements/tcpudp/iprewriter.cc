@@ -29,12 +29,14 @@
 CLICK_DECLS
 
 IPRewriter::IPRewriter()
-    : _udp_map(0)
+    : _udp_map(0), _udp_allocator(0)
 {
 }
 
 IPRewriter::~IPRewriter()
 {
+    delete[] _udp_map;
+    delete[] _udp_allocator;
 }
 
 void *
@@ -70,7 +72,11 @@ IPRewriter::configure(Vector<String> &conf, ErrorHandler *errh)
     _udp_timeouts[1] *= CLICK_HZ;
     _udp_streaming_timeout *= CLICK_HZ; // IPRewriterBase handles the others
 
-    return TCPRewriter::configure(conf, errh);
+    if (TCPRewriter::configure(conf, errh) < 0)
+	return -1;
+    _udp_map = new Map[_nthreads];
+    _udp_allocator = new SizedHashAllocator<sizeof(UDPFlow)>[_nthreads];
+    return 0;
 }
 
 inline IPRewriterEntry *
@@ -80,7 +86,8 @@ IPRewriter::get_entry(int ip_p, const IPFlowID &flowid, int input)
 	return TCPRewriter::get_entry(ip_p, flowid, input);
     if (ip_p != IP_PROTO_UDP)
 	return 0;
-    IPRewriterEntry *m = _udp_map.get(flowid);
+    int thread = thread_index();
+    IPRewriterEntry *m = _udp_map[thread].get(flowid);
     if (!m && (unsigned) input < (unsigned) _input_specs.size()) {
 	IPRewriterInput &is = _input_specs[input];
 	IPFlowID rewritten_flowid = IPFlowID::uninitialized_t();
@@ -97,8 +104,9 @@ IPRewriter::add_flow(int ip_p, const IPFlowID &flowid,
     if (ip_p == IP_PROTO_TCP)
 	return TCPRewriter::add_flow(ip_p, flowid, rewritten_flowid, input);
 
+    int thread = thread_index();
     void *data;
-    if (!(data = _udp_allocator.allocate()))
+    if (!(data = _udp_allocator[thread].allocate()))
 	return 0;
 
     IPRewriterInput *rwinput = &_input_specs[input];
@@ -106,12 +114,14 @@ IPRewriter::add_flow(int ip_p, const IPFlowID &flowid,
 	(rwinput, flowid, rewritten_flowid, ip_p,
 	 !!_udp_timeouts[1], click_jiffies() + relevant_timeout(_udp_timeouts));
 
-    return store_flow(flow, input, _udp_map, &reply_udp_map(rwinput));
+    return store_flow(flow, input, thread, _udp_map[thread],
+		      &reply_udp_map(rwinput, thread));
 }
 
 void
 IPRewriter::push(int port, Packet *p_in)
 {
+    int thread = thread_index();
     WritablePacket *p = p_in->uniqueify();
     click_ip *iph = p->ip_header();
 
@@ -128,7 +138,7 @@ IPRewriter::push(int port, Packet *p_in)
     }
 
     IPFlowID flowid(p);
-    HashContainer<IPRewriterEntry> *map = (iph->ip_p == IP_PROTO_TCP ? &_map : &_udp_map);
+    Map *map = (iph->ip_p == IP_PROTO_TCP ? &_state[thread].map : &_udp_map[thread]);
     IPRewriterEntry *m = map->get(flowid);
 
     if (!m) {			// create new mapping
@@ -150,16 +160,16 @@ IPRewriter::push(int port, Packet *p_in)
 	TCPFlow *tcpmf = static_cast<TCPFlow *>(mf);
 	tcpmf->apply(p, m->direction(), _annos);
 	if (_timeouts[1])
-	    tcpmf->change_expiry(_heap, true, now_j + _timeouts[1]);
+	    tcpmf->change_expiry(heap(thread), true, now_j + _timeouts[1]);
 	else
-	    tcpmf->change_expiry(_heap, false, now_j + tcp_flow_timeout(tcpmf));
+	    tcpmf->change_expiry(heap(thread), false, now_j + tcp_flow_timeout(tcpmf));
     } else {
 	UDPFlow *udpmf = static_cast<UDPFlow *>(mf);
 	udpmf->apply(p, m->direction(), _annos);
 	if (_udp_timeouts[1])
-	    udpmf->change_expiry(_heap, true, now_j + _udp_timeouts[1]);
+	    udpmf->change_expiry(heap(thread), true, now_j + _udp_timeouts[1]);
 	else
-	    udpmf->change_expiry(_heap, false, now_j + udp_flow_timeout(udpmf));
+	    udpmf->change_expiry(heap(thread), false, now_j + udp_flow_timeout(udpmf));
     }
 
     output(m->output()).push(p);
@@ -171,10 +181,11 @@ IPRewriter::udp_mappings_handler(Element *e, void *)
     IPRewriter *rw = (IPRewriter *)e;
     click_jiffies_t now = click_jiffies();
     StringAccum sa;
-    for (Map::iterator iter = rw->_udp_map.begin(); iter.live(); ++iter) {
-	iter->flow()->unparse(sa, iter->direction(), now);
-	sa << '\n';
-    }
+    for (int t = 0; t < rw->nthreads(); ++t)
+	for (Map::iterator iter = rw->_udp_map[t].begin(); iter.live(); ++iter) {
+	    iter->flow()->unparse(sa, iter->direction(), now);
+	    sa << '\n';
+	}
     return sa.take_string();
 }
 
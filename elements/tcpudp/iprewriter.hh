@@ -156,7 +156,12 @@ UDP connection mappings are guaranteed to exist for I<time> seconds after each s
 
 =item REAP_INTERVAL I<time>
 
-Reap timed-out connections every I<time> seconds. Default is 15 minutes.
+Reap timed-out connections every I<time> seconds. Default is 1 second.
+Mappings are kept in timing wheels with one-second slots, so each reap
+visits only the slots that have ended since the previous one, and at most
+a bounded batch of mappings at a time; a large backlog is reaped over
+several task runs rather than all at once. Refreshing a mapping on each
+packet does not move it between slots.
 
 =item MAPPING_CAPACITY I<capacity>
 
@@ -164,6 +169,20 @@ Set the maximum number of mappings this rewriter can hold to I<capacity>.
 I<Capacity> can either be an integer or the name of another rewriter-like
 element, in which case this element will share the other element's capacity.
 
+=item PER_THREAD
+
+Boolean. If true, each Click thread keeps its own mapping table and expiry
+state, so the rewriter can run on several threads without locking. Each
+thread allocates source ports (or, for address ranges, source addresses) from
+its own slice of every pattern's range: with N threads, thread I gets the Ith
+of N equal consecutive slices. A reply's destination port thus identifies the
+thread that owns its mapping. Packets of a flow, and its replies, must be
+handled by the thread that created the mapping; use symmetric RSS, or steer
+replies by destination port range. MAPPING_CAPACITY is divided evenly among
+the threads. With PER_THREAD, the 'clear' and 'capacity' handlers take effect
+on each thread shortly after they are written, and the patternI<n> handlers
+are read-only. Default is false.
+
 =item DST_ANNO
 
 Boolean. If true, then set the destination IP address annotation on passing
@@ -193,6 +212,26 @@ space-separated numbers, where the first is the capacity and the second is the
 short-term flow reservation.  When writing, the short-term reservation can be
 omitted; it is then set to the minimum of 50 and one-eighth the capacity.
 
+=h thread_sizes r
+
+Returns the number of flows in each thread's flow set, separated by spaces.
+There is one number unless PER_THREAD is true.
+
+=h memory r
+
+Returns the number of bytes held for flows: flow allocator memory, including
+freed flows awaiting reuse, plus flow tables and expiry heaps.
+
+=h bytes_per_flow r
+
+Returns B<memory> divided by the number of live flows.
+
+=h fragmentation r
+
+Returns the percentage of flow allocator memory not holding live flows.
+Flow memory freed when flows expire is reused for new flows but is not
+returned to the system, so this is high after a burst of flows has expired.
+
 =h tcp_table read-only
 
 Returns a human-readable description of the IPRewriter's current TCP mapping
@@ -229,17 +268,23 @@ class IPRewriter : public TCPRewriter { public:
     int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
 
     IPRewriterEntry *get_entry(int ip_p, const IPFlowID &flowid, int input);
-    HashContainer<IPRewriterEntry> *get_map(int mapid) {
+    Map *get_map(int mapid, int thread) {
 	if (mapid == IPRewriterInput::mapid_default)
-	    return &_map;
+	    return &_state[thread].map;
 	else if (mapid == IPRewriterInput::mapid_iprewriter_udp)
-	    return &_udp_map;
+	    return &_udp_map[thread];
 	else
 	    return 0;
     }
     IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 			      const IPFlowID &rewritten_flowid, int input);
-    void destroy_flow(IPRewriterFlow *flow);
+    void destroy_flow(IPRewriterFlow *flow, int thread);
+    void memory_stats(MemoryStats &ms) const {
+	allocator_stats(ms, _udp_allocator, sizeof(UDPFlow));
+	for (int t = 0; t < _nthreads; ++t)
+	    ms.table_bytes += _udp_map[t].memory();
+	TCPRewriter::memory_stats(ms);
+    }
     click_jiffies_t best_effort_expiry(const IPRewriterFlow *flow) {
 	if (flow->ip_p() == IP_PROTO_TCP)
 	    return TCPRewriter::best_effort_expiry(flow);
@@ -253,8 +298,8 @@ class IPRewriter : public TCPRewriter { public:
 
   private:
 
-    Map _udp_map;
-    SizedHashAllocator<sizeof(UDPFlow)> _udp_allocator;
+    Map *_udp_map;				// one per thread
+    SizedHashAllocator<sizeof(UDPFlow)> *_udp_allocator;	// one per thread
     uint32_t _udp_timeouts[2];
     uint32_t _udp_streaming_timeout;
 
@@ -265,9 +310,9 @@ class IPRewriter : public TCPRewriter { public:
 	    return _udp_timeouts[0];
     }
 
-    static inline Map &reply_udp_map(IPRewriterInput *rwinput) {
+    static inline Map &reply_udp_map(IPRewriterInput *rwinput, int thread) {
 	IPRewriter *x = static_cast<IPRewriter *>(rwinput->reply_element);
-	return x->_udp_map;
+	return x->_udp_map[thread];
     }
     static String udp_mappings_handler(Element *e, void *user_data);
 
@@ -275,14 +320,15 @@ class IPRewriter : public TCPRewriter { public:
 
 
 inline void
-IPRewriter::destroy_flow(IPRewriterFlow *flow)
+IPRewriter::destroy_flow(IPRewriterFlow *flow, int thread)
 {
     if (flow->ip_p() == IP_PROTO_TCP)
-	TCPRewriter::destroy_flow(flow);
+	TCPRewriter::destroy_flow(flow, thread);
     else {
-	unmap_flow(flow, _udp_map, &reply_udp_map(flow->owner()));
+	unmap_flow(flow, thread, _udp_map[thread],
+		   &reply_udp_map(flow->owner(), thread));
 	flow->~IPRewriterFlow();
-	_udp_allocator.deallocate(flow);
+	_udp_allocator[thread].deallocate(flow);
     }
 }
 
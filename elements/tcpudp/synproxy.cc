@@ -0,0 +1,554 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * synproxy.{cc,hh} -- element absorbs TCP SYN floods with SYN cookies
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "synproxy.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+CLICK_DECLS
+
+// Client MSS values a cookie can encode, in increasing order.
+const uint16_t SYNProxy::mss_table[nmss] = {
+    536, 1200, 1300, 1360, 1400, 1440, 1460, 8960
+};
+
+// Cookie layout: 5 bits of period, 3 bits of MSS index, 24 bits of hash.
+// A period is 64 seconds, and cookies from the previous period are still
+// accepted.
+#define COOKIE_PERIOD(j)	((uint32_t) ((j) / (CLICK_HZ * 64)))
+
+static inline uint64_t
+rotl64(uint64_t x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND(v0, v1, v2, v3) do {					\
+	v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);	\
+	v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;			\
+	v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;			\
+	v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);	\
+    } while (0)
+
+// SipHash-2-4 of n 64-bit words.
+static uint64_t
+siphash24(const uint64_t key[2], const uint64_t *m, int n)
+{
+    uint64_t v0 = key[0] ^ 0x736F6D6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646F72616E646F6DULL;
+    uint64_t v2 = key[0] ^ 0x6C7967656E657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+    for (int i = 0; i <= n; ++i) {
+	uint64_t x = i < n ? m[i] : (uint64_t) (n * 8) << 56;
+	v3 ^= x;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= x;
+    }
+    v2 ^= 0xFF;
+    for (int i = 0; i < 4; ++i)
+	SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+SYNProxy::SYNProxy()
+{
+}
+
+SYNProxy::~SYNProxy()
+{
+}
+
+int
+SYNProxy::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    uint32_t mss = 1460, window = 65535;
+    String secret;
+    bool secret_given;
+    _capacity = 65536;
+    _hold = 4;
+    uint32_t handshake_timeout = 5, timeout = 86400, close_timeout = 10;
+    if (Args(conf, this, errh)
+	.read("MSS", mss)
+	.read("WINDOW", window)
+	.read("SECRET", secret).read_status(secret_given)
+	.read("CAPACITY", _capacity)
+	.read("HOLD", _hold)
+	.read("HANDSHAKE_TIMEOUT", SecondsArg(), handshake_timeout)
+	.read("TIMEOUT", SecondsArg(), timeout)
+	.read("CLOSE_TIMEOUT", SecondsArg(), close_timeout)
+	.complete() < 0)
+	return -1;
+    if (mss < 64 || mss > 65535)
+	return errh->error("MSS out of range");
+    if (window > 65535)
+	return errh->error("WINDOW out of range");
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    if (_hold > 255)
+	return errh->error("HOLD out of range");
+    _mss = mss;
+    _window = window;
+    _handshake_timeout_j = handshake_timeout * CLICK_HZ;
+    _timeout_j = timeout * CLICK_HZ;
+    _close_timeout_j = close_timeout * CLICK_HZ;
+
+    if (secret_given) {
+	// Derive the key from the secret's bytes.
+	Vector<uint64_t> words((secret.length() + 7) / 8, 0);
+	if (words.size())
+	    memcpy(words.begin(), secret.data(), secret.length());
+	uint64_t k[2] = { 0, 0 };
+	_key[0] = siphash24(k, words.begin(), words.size());
+	k[0] = 1;
+	_key[1] = siphash24(k, words.begin(), words.size());
+    } else
+	for (int i = 0; i < 2; ++i)
+	    _key[i] = ((uint64_t) click_random() << 42)
+		^ ((uint64_t) click_random() << 21) ^ click_random();
+    return 0;
+}
+
+int
+SYNProxy::initialize(ErrorHandler *errh)
+{
+    if (_tables.reserve(_capacity) < 0
+	|| _state.resize(_tables.nthreads()) < 0)
+	return errh->error("out of memory");
+    return 0;
+}
+
+void
+SYNProxy::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t) {
+	Table &table = _tables[t];
+	for (uint32_t i = 0; i < table.index_limit(); ++i)
+	    if (table.live(i))
+		release(&table.value(i));
+    }
+    _state.clear();
+}
+
+uint32_t
+SYNProxy::cookie(const click_ip *iph, const click_tcp *tcph, uint32_t isn,
+		 uint32_t period, int mss_index) const
+{
+    uint64_t m[3];
+    m[0] = ((uint64_t) iph->ip_src.s_addr << 32) | iph->ip_dst.s_addr;
+    m[1] = ((uint64_t) tcph->th_sport << 48) | ((uint64_t) tcph->th_dport << 32)
+	| isn;
+    m[2] = (period << 3) | mss_index;
+    uint32_t h = siphash24(_key, m, 3);
+    return ((period & 31) << 27) | (mss_index << 24) | (h & 0xFFFFFF);
+}
+
+int
+SYNProxy::check_cookie(const click_ip *iph, const click_tcp *tcph,
+		       uint32_t period) const
+{
+    uint32_t c = ntohl(tcph->th_ack) - 1;
+    uint32_t age = (period - (c >> 27)) & 31;
+    if (age > 1)
+	return -1;
+    int mss_index = (c >> 24) & 7;
+    if (cookie(iph, tcph, ntohl(tcph->th_seq) - 1, period - age, mss_index)
+	!= c)
+	return -1;
+    return mss_index;
+}
+
+WritablePacket *
+SYNProxy::make_packet(Packet *model, bool reply, uint32_t seq, uint32_t ack,
+		      uint8_t flags, uint16_t window, uint16_t mss)
+{
+    int link = model->network_header_offset();
+    if (link < 0)
+	link = 0;
+    unsigned thl = sizeof(click_tcp) + (mss ? TCPOLEN_MAXSEG : 0);
+    unsigned len = sizeof(click_ip) + thl;
+    WritablePacket *q = Packet::make(Packet::default_headroom, 0, link + len, 0);
+    if (!q)
+	return 0;
+    if (link) {
+	memcpy(q->data(), model->data(), link);
+	if (reply && link >= 12) {
+	    // swap Ethernet addresses
+	    memcpy(q->data(), model->data() + 6, 6);
+	    memcpy(q->data() + 6, model->data(), 6);
+	}
+    }
+
+    const click_ip *miph = model->ip_header();
+    const click_tcp *mtcph = model->tcp_header();
+    click_ip *iph = reinterpret_cast<click_ip *>(q->data() + link);
+    memset(iph, 0, len);
+    iph->ip_v = 4;
+    iph->ip_hl = sizeof(click_ip) >> 2;
+    iph->ip_len = htons(len);
+    iph->ip_ttl = 64;
+    iph->ip_p = IP_PROTO_TCP;
+    iph->ip_src = reply ? miph->ip_dst : miph->ip_src;
+    iph->ip_dst = reply ? miph->ip_src : miph->ip_dst;
+    iph->ip_sum = click_in_cksum((const unsigned char *) iph, sizeof(click_ip));
+
+    click_tcp *tcph = reinterpret_cast<click_tcp *>(iph + 1);
+    tcph->th_sport = reply ? mtcph->th_dport : mtcph->th_sport;
+    tcph->th_dport = reply ? mtcph->th_sport : mtcph->th_dport;
+    tcph->th_seq = htonl(seq);
+    tcph->th_ack = htonl(ack);
+    tcph->th_off = thl >> 2;
+    tcph->th_flags = flags;
+    tcph->th_win = htons(window);
+    if (mss) {
+	uint8_t *opt = reinterpret_cast<uint8_t *>(tcph + 1);
+	opt[0] = TCPOPT_MAXSEG;
+	opt[1] = TCPOLEN_MAXSEG;
+	opt[2] = mss >> 8;
+	opt[3] = mss;
+    }
+    unsigned csum = click_in_cksum((const unsigned char *) tcph, thl);
+    tcph->th_sum = click_in_cksum_pseudohdr(csum, iph, thl);
+
+    q->set_ip_header(iph, sizeof(click_ip));
+    if (link)
+	q->set_mac_header(q->data(), link);
+    q->set_timestamp_anno(model->timestamp_anno());
+    return q;
+}
+
+void
+SYNProxy::translate(Packet *&p, bool from_client, const Conn *c)
+{
+    WritablePacket *q = p->uniqueify();
+    p = q;
+    if (!q)
+	return;
+    click_tcp *tcph = q->tcp_header();
+    uint32_t old_w, new_w;
+    if (from_client) {
+	if (!(tcph->th_flags & TH_ACK))
+	    return;
+	old_w = tcph->th_ack;
+	new_w = htonl(ntohl(old_w) + c->delta);
+	tcph->th_ack = new_w;
+    } else {
+	old_w = tcph->th_seq;
+	new_w = htonl(ntohl(old_w) - c->delta);
+	tcph->th_seq = new_w;
+    }
+    click_update_in_cksum32(&tcph->th_sum, old_w, new_w);
+}
+
+void
+SYNProxy::track_close(Conn *c, uint8_t flags, bool from_client,
+		      click_jiffies_t now)
+{
+    if (flags & TH_FIN)
+	c->flags |= from_client ? f_fin_client : f_fin_server;
+    if ((flags & TH_RST)
+	|| (c->flags & (f_fin_client | f_fin_server))
+	   == (f_fin_client | f_fin_server)) {
+	if (!(c->flags & f_closed)) {
+	    c->flags |= f_closed;
+	    c->expiry = now + _close_timeout_j;
+	}
+    } else if (!(c->flags & f_closed))
+	c->expiry = now + _timeout_j;
+}
+
+void
+SYNProxy::release(Conn *c)
+{
+    while (Packet *p = c->held) {
+	c->held = p->next();
+	p->kill();
+    }
+    c->nheld = 0;
+}
+
+struct SYNProxy::Expired {
+    click_jiffies_t now;
+    Expired(click_jiffies_t now_)
+	: now(now_) {
+    }
+    bool operator()(const IPFlow5ID &, Conn &c) const {
+	if (!click_jiffies_less(c.expiry, now))
+	    return false;
+	release(&c);
+	return true;
+    }
+};
+
+void
+SYNProxy::reap(Table &table, ThreadState &ts, click_jiffies_t now)
+{
+    table.reap_step(ts.reap_cursor, reap_batch, Expired(now));
+}
+
+void
+SYNProxy::client_packet(Packet *p, Table &table, ThreadState &ts,
+			click_jiffies_t now)
+{
+    const click_ip *iph = p->ip_header();
+    const click_tcp *tcph = p->tcp_header();
+    uint8_t flags = tcph->th_flags;
+
+    if ((flags & (TH_SYN | TH_ACK | TH_RST)) == TH_SYN) {
+	// Answer statelessly. The cookie encodes the largest table MSS not
+	// above the client's.
+	unsigned client_mss = 536;
+	const uint8_t *opt = reinterpret_cast<const uint8_t *>(tcph + 1);
+	const uint8_t *end = reinterpret_cast<const uint8_t *>(tcph)
+	    + (tcph->th_off << 2);
+	while (opt < end && *opt != TCPOPT_EOL) {
+	    if (*opt == TCPOPT_NOP) {
+		++opt;
+		continue;
+	    } else if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+		break;
+	    if (opt[0] == TCPOPT_MAXSEG && opt[1] == TCPOLEN_MAXSEG)
+		client_mss = (opt[2] << 8) | opt[3];
+	    opt += opt[1];
+	}
+	int mss_index = nmss - 1;
+	while (mss_index > 0 && mss_table[mss_index] > client_mss)
+	    --mss_index;
+	uint32_t isn = ntohl(tcph->th_seq);
+	uint32_t c = cookie(iph, tcph, isn, COOKIE_PERIOD(now), mss_index);
+	if (WritablePacket *q = make_packet(p, true, c, isn + 1,
+					    TH_SYN | TH_ACK, _window, _mss)) {
+	    ++ts.syns;
+	    output(1).push(q);
+	}
+	p->kill();
+	return;
+    }
+
+    IPFlow5ID flow(p);
+    Conn *c = table.find(flow);
+    if (c && (c->flags & f_closed) && (flags & (TH_SYN | TH_RST)) == 0
+	&& (flags & TH_ACK) && check_cookie(iph, tcph, COOKIE_PERIOD(now)) >= 0) {
+	// a new connection reusing a closed connection's ports
+	release(c);
+	table.erase(flow);
+	c = 0;
+    }
+
+    if (!c) {
+	int mss_index;
+	if ((flags & (TH_SYN | TH_ACK | TH_RST)) != TH_ACK
+	    || (mss_index = check_cookie(iph, tcph, COOKIE_PERIOD(now))) < 0) {
+	    ++ts.invalid;
+	    p->kill();
+	    return;
+	}
+	++ts.valid;
+	bool inserted;
+	if (!(c = table.find_insert(flow, inserted))) {
+	    ++ts.failed;
+	    p->kill();
+	    return;
+	}
+	uint32_t isn = ntohl(tcph->th_seq) - 1;
+	*c = Conn();
+	c->isn = isn;
+	c->cookie = ntohl(tcph->th_ack) - 1;
+	c->window = ntohs(tcph->th_win);
+	c->state = cs_handshake;
+	c->expiry = now + _handshake_timeout_j;
+	if (WritablePacket *q = make_packet(p, false, isn, 0, TH_SYN, c->window,
+					    mss_table[mss_index]))
+	    output(0).push(q);
+	// Fall through to hold the ACK if it carries data.
+    }
+
+    if (c->state == cs_handshake) {
+	if (flags & TH_RST) {
+	    release(c);
+	    table.erase(flow);
+	    output(0).push(p);
+	} else if (ntohs(iph->ip_len) > (iph->ip_hl << 2) + (tcph->th_off << 2)
+		   || (flags & TH_FIN)) {
+	    if (c->nheld < _hold) {
+		p->set_next(0);
+		if (Packet *tail = c->held) {
+		    while (tail->next())
+			tail = tail->next();
+		    tail->set_next(p);
+		} else
+		    c->held = p;
+		++c->nheld;
+	    } else
+		p->kill();
+	} else
+	    // the handshake ACK, or a retransmission of it
+	    p->kill();
+	return;
+    }
+
+    if (c->state == cs_established)
+	translate(p, true, c);
+    track_close(c, flags, true, now);
+    if (p)
+	output(0).push(p);
+}
+
+void
+SYNProxy::server_packet(Packet *p, Table &table, ThreadState &ts,
+			click_jiffies_t now)
+{
+    const click_tcp *tcph = p->tcp_header();
+    uint8_t flags = tcph->th_flags;
+    IPFlow5ID flow(p, true);
+    Conn *c = table.find(flow);
+
+    if (!c) {
+	if ((flags & (TH_SYN | TH_ACK | TH_RST)) == TH_SYN) {
+	    bool inserted;
+	    if ((c = table.find_insert(flow, inserted))) {
+		*c = Conn();
+		c->state = cs_passthrough;
+		c->expiry = now + _timeout_j;
+	    }
+	}
+	output(1).push(p);
+	return;
+    }
+
+    if (c->state == cs_handshake) {
+	if ((flags & (TH_SYN | TH_ACK | TH_RST)) == (TH_SYN | TH_ACK)
+	    && ntohl(tcph->th_ack) == c->isn + 1) {
+	    uint32_t server_isn = ntohl(tcph->th_seq);
+	    c->delta = server_isn - c->cookie;
+	    c->state = cs_established;
+	    c->expiry = now + _timeout_j;
+	    ++ts.established;
+	    if (WritablePacket *q = make_packet(p, true, c->isn + 1,
+						server_isn + 1, TH_ACK,
+						c->window, 0))
+		output(0).push(q);
+	    p->kill();
+	    while (Packet *q = c->held) {
+		c->held = q->next();
+		q->set_next(0);
+		uint8_t qflags = q->tcp_header()->th_flags;
+		translate(q, true, c);
+		track_close(c, qflags, true, now);
+		if (q)
+		    output(0).push(q);
+	    }
+	    c->nheld = 0;
+	} else if ((flags & TH_RST) && ntohl(tcph->th_ack) == c->isn + 1) {
+	    // The server refused the connection, so reset the client.
+	    if (WritablePacket *q = make_packet(p, false, c->cookie + 1, 0,
+						TH_RST, 0, 0))
+		output(1).push(q);
+	    p->kill();
+	    release(c);
+	    table.erase(flow);
+	} else
+	    p->kill();
+	return;
+    }
+
+    if (c->state == cs_established)
+	translate(p, false, c);
+    track_close(c, flags, false, now);
+    if (p)
+	output(1).push(p);
+}
+
+void
+SYNProxy::push(int port, Packet *p)
+{
+    int thread = click_current_cpu_id();
+    Table &table = _tables[thread];
+    ThreadState &ts = _state[thread];
+    click_jiffies_t now = click_jiffies();
+
+    reap(table, ts, now);
+
+    const click_ip *iph = p->ip_header();
+    if (!p->has_network_header() || p->network_header_offset() < 0
+	|| iph->ip_p != IP_PROTO_TCP || IP_ISFRAG(iph)
+	|| p->transport_length() < (int) sizeof(click_tcp)
+	|| p->transport_length() < (p->tcp_header()->th_off << 2)
+	|| (p->tcp_header()->th_off << 2) < (int) sizeof(click_tcp)) {
+	output(port).push(p);
+	return;
+    }
+
+    if (port == 0)
+	client_packet(p, table, ts, now);
+    else
+	server_packet(p, table, ts, now);
+}
+
+String
+SYNProxy::read_handler(Element *e, void *thunk)
+{
+    SYNProxy *sp = static_cast<SYNProxy *>(e);
+    int n = sp->_state.size();
+    uint64_t ThreadState::*counter;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	return String(sp->_tables.size());
+    case h_capacity:
+	return String(sp->_capacity);
+    case h_memory:
+	return String(sp->_tables.memory_size());
+    case h_syns:
+	counter = &ThreadState::syns;
+	break;
+    case h_valid:
+	counter = &ThreadState::valid;
+	break;
+    case h_invalid:
+	counter = &ThreadState::invalid;
+	break;
+    case h_established:
+	counter = &ThreadState::established;
+	break;
+    case h_failed:
+	counter = &ThreadState::failed;
+	break;
+    default:
+	return String();
+    }
+    uint64_t x = 0;
+    for (int i = 0; i < n; ++i)
+	x += sp->_state[i].*counter;
+    return String(x);
+}
+
+void
+SYNProxy::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("syns", read_handler, h_syns);
+    add_read_handler("valid", read_handler, h_valid);
+    add_read_handler("invalid", read_handler, h_invalid);
+    add_read_handler("established", read_handler, h_established);
+    add_read_handler("failed", read_handler, h_failed);
+    add_read_handler("capacity", read_handler, h_capacity);
+    add_read_handler("memory", read_handler, h_memory);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(SYNProxy)
+ELEMENT_MT_SAFE(SYNProxy)
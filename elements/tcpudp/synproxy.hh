@@ -0,0 +1,243 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_SYNPROXY_HH
+#define CLICK_SYNPROXY_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+CLICK_DECLS
+
+/*
+=c
+
+SYNProxy([I<keywords> MSS, WINDOW, SECRET, CAPACITY, HOLD, TIMEOUT, ...])
+
+=s tcpudp
+
+absorbs TCP SYN floods with SYN cookies
+
+=d
+
+SYNProxy sits between clients and servers and completes each TCP handshake
+with the client itself, before anything downstream sees the connection.
+Packets from clients arrive on input 0 and leave on output 0; packets from
+servers arrive on input 1 and leave on output 1.
+
+SYNProxy answers every client SYN with a SYN-ACK whose initial sequence
+number is a SYN cookie: a keyed SipHash of the connection's addresses,
+ports and initial sequence number, a coarse timestamp, and an index into a
+table of MSS values. Answering a SYN allocates no state, so a SYN flood
+costs only the SYN-ACKs. The SYNs themselves never reach output 0.
+
+When the client's ACK arrives, SYNProxy checks its cookie. An ACK whose
+cookie is wrong or more than about two minutes old is dropped. A valid ACK
+creates a connection entry, and SYNProxy replays the handshake to the
+server: it sends a SYN with the client's initial sequence number and MSS
+on output 0, and when the server's SYN-ACK arrives, it answers with an ACK
+and does not forward the SYN-ACK. Client packets that arrive before the
+server answers, up to HOLD per connection, are held and then forwarded.
+If the server resets the connection, the client is reset.
+
+From then on SYNProxy translates sequence numbers between the cookie the
+client knows and the server's real initial sequence number: acknowledgment
+numbers from the client and sequence numbers from the server are adjusted,
+with incremental checksum updates. Connections are forgotten after RST, or
+after FINs in both directions, once CLOSE_TIMEOUT passes, or after TIMEOUT
+without traffic.
+
+Only the MSS option survives the cookie, so proxied connections do not use
+window scaling, selective acknowledgments or timestamps. Connections that
+servers open are tracked, not proxied: a server SYN on input 1 creates an
+entry that lets the connection's packets through in both directions
+unchanged. Other server packets, and non-TCP packets, pass through
+unchanged. Client packets that belong to no connection, other than SYNs
+and ACKs with valid cookies, are dropped.
+
+Both directions of a connection must reach the same thread, as with
+symmetric RSS (see RSSSwitch), since the sequence offset lives in that
+thread's table. Packets must have their IP header annotations set. Generated
+packets copy the link-level header, if any, of the packet they answer, with
+Ethernet addresses swapped for replies.
+
+Keywords are:
+
+=over 8
+
+=item MSS
+
+Unsigned integer. The MSS advertised to clients. Default is 1460.
+
+=item WINDOW
+
+Unsigned integer. The window advertised to clients. Default is 65535.
+
+=item SECRET
+
+String. Cookie hash key. Elements with the same SECRET accept each
+other's cookies. Default is a random key.
+
+=item CAPACITY
+
+Unsigned integer. Number of connections each thread can track. Default is
+65536.
+
+=item HOLD
+
+Unsigned integer. Number of client packets held per connection while the
+server handshake completes. Default is 4.
+
+=item HANDSHAKE_TIMEOUT
+
+Time in seconds. Timeout for a server's SYN-ACK. Default is 5 seconds.
+
+=item TIMEOUT
+
+Time in seconds. Timeout for idle connections. Default is 24 hours.
+
+=item CLOSE_TIMEOUT
+
+Time in seconds. Timeout for closed connections. Default is 10 seconds.
+
+=back
+
+=h count read-only
+
+Returns the number of connections in all tables.
+
+=h syns read-only
+
+Returns the number of SYNs answered with cookies.
+
+=h valid read-only
+
+Returns the number of ACKs with valid cookies.
+
+=h invalid read-only
+
+Returns the number of client packets dropped because they belonged to no
+connection.
+
+=h established read-only
+
+Returns the number of server handshakes completed.
+
+=h failed read-only
+
+Returns the number of valid ACKs dropped because a table was full.
+
+=h capacity read-only
+
+Returns CAPACITY.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the connection tables.
+
+=e
+
+  sp :: SYNProxy;
+  FromDevice(outside) -> CheckIPHeader(14) -> [0] sp [0] -> ... -> ToDevice(inside);
+  FromDevice(inside) -> CheckIPHeader(14) -> [1] sp [1] -> ... -> ToDevice(outside);
+
+=a TCPRewriter, ConnTrack, StatelessTCPResponder, RSSSwitch */
+
+class SYNProxy : public Element { public:
+
+    SYNProxy() CLICK_COLD;
+    ~SYNProxy() CLICK_COLD;
+
+    const char *class_name() const	{ return "SYNProxy"; }
+    const char *port_count() const	{ return "2/2"; }
+    const char *processing() const	{ return PUSH; }
+    const char *flow_code() const	{ return "xy/xy"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int port, Packet *);
+
+  private:
+
+    enum {
+	cs_handshake,		// SYN sent to server, waiting for SYN-ACK
+	cs_established,
+	cs_passthrough		// opened by the server, not translated
+    };
+
+    enum { f_fin_client = 1, f_fin_server = 2,
+	   f_closed = 4 };		// RST, or FIN in both directions
+
+    struct Conn {
+	click_jiffies_t expiry;
+	Packet *held;		// client packets sent during the handshake
+	uint32_t isn;		// client's initial sequence number
+	uint32_t cookie;	// initial sequence number sent to the client
+	uint32_t delta;		// server's initial sequence number - cookie
+	uint16_t window;	// client's window
+	uint8_t nheld;
+	uint8_t state;
+	uint8_t flags;
+	Conn()
+	    : expiry(0), held(0), isn(0), cookie(0), delta(0), window(0),
+	      nheld(0), state(0), flags(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Conn> Table;
+
+    struct ThreadState {
+	uint32_t reap_cursor;
+	uint64_t syns;
+	uint64_t valid;
+	uint64_t invalid;
+	uint64_t established;
+	uint64_t failed;
+	ThreadState()
+	    : reap_cursor(0), syns(0), valid(0), invalid(0), established(0),
+	      failed(0) {
+	}
+    };
+
+    enum { reap_batch = 8, nmss = 8 };
+
+    PerThreadCuckooTable<IPFlow5ID, Conn> _tables;
+    PerThread<ThreadState> _state;
+    uint64_t _key[2];
+    uint32_t _capacity;
+    uint16_t _mss;
+    uint16_t _window;
+    unsigned _hold;
+    click_jiffies_t _handshake_timeout_j;
+    click_jiffies_t _timeout_j;
+    click_jiffies_t _close_timeout_j;
+
+    static const uint16_t mss_table[nmss];
+
+    uint32_t cookie(const click_ip *iph, const click_tcp *tcph, uint32_t isn,
+		    uint32_t period, int mss_index) const;
+    int check_cookie(const click_ip *iph, const click_tcp *tcph,
+		     uint32_t period) const;
+    static WritablePacket *make_packet(Packet *model, bool reply,
+				       uint32_t seq, uint32_t ack,
+				       uint8_t flags, uint16_t window,
+				       uint16_t mss);
+    void client_packet(Packet *p, Table &table, ThreadState &ts,
+		       click_jiffies_t now);
+    void server_packet(Packet *p, Table &table, ThreadState &ts,
+		       click_jiffies_t now);
+    static void translate(Packet *&p, bool from_client, const Conn *c);
+    void track_close(Conn *c, uint8_t flags, bool from_client,
+		     click_jiffies_t now);
+    static void release(Conn *c);
+    struct Expired;
+    void reap(Table &table, ThreadState &ts, click_jiffies_t now);
+
+    enum { h_count, h_syns, h_valid, h_invalid, h_established, h_failed,
+	   h_capacity, h_memory };
+    static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
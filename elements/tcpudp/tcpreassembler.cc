@@ -0,0 +1,479 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * tcpreassembler.{cc,hh} -- element puts TCP segments back in order
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "tcpreassembler.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+CLICK_DECLS
+
+TCPReassembler::TCPReassembler()
+{
+}
+
+TCPReassembler::~TCPReassembler()
+{
+}
+
+int
+TCPReassembler::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String policy = "FIRST";
+    _capacity = 65536;
+    _flow_memory = 256 << 10;
+    _memory = 64 << 20;
+    uint32_t timeout = 60;
+    if (Args(conf, this, errh)
+	.read("POLICY", WordArg(), policy)
+	.read("CAPACITY", _capacity)
+	.read("FLOW_MEMORY", _flow_memory)
+	.read("MEMORY", _memory)
+	.read("TIMEOUT", SecondsArg(), timeout)
+	.complete() < 0)
+	return -1;
+    if (policy == "FIRST")
+	_keep_last = false;
+    else if (policy == "LAST")
+	_keep_last = true;
+    else
+	return errh->error("POLICY must be FIRST or LAST");
+    if (_capacity == 0)
+	return errh->error("CAPACITY must be positive");
+    _timeout_j = timeout * CLICK_HZ;
+    return 0;
+}
+
+int
+TCPReassembler::initialize(ErrorHandler *errh)
+{
+    if (_tables.reserve(_capacity) < 0
+	|| _state.resize(_tables.nthreads()) < 0)
+	return errh->error("out of memory");
+    _thread_memory = _memory / _tables.nthreads();
+    return 0;
+}
+
+void
+TCPReassembler::cleanup(CleanupStage)
+{
+    for (int t = 0; t < _state.size(); ++t) {
+	Table &table = _tables[t];
+	for (uint32_t i = 0; i < table.index_limit(); ++i)
+	    if (table.live(i))
+		release(table.value(i), _state[t]);
+    }
+    _state.clear();
+}
+
+bool
+TCPReassembler::hold(Segment **pp, Stream &s, ThreadState &ts, Packet *p,
+		     bool clone, uint32_t seq, uint32_t end,
+		     uint32_t pseq, uint32_t plen)
+{
+    Segment *x = static_cast<Segment *>(ts.pool.allocate());
+    if (!x)
+	return false;
+    if (clone && !(p = p->clone())) {
+	ts.pool.deallocate(x);
+	return false;
+    }
+    x->next = *pp;
+    x->p = p;
+    x->seq = seq;
+    x->end = end;
+    x->pseq = pseq;
+    x->plen = plen;
+    *pp = x;
+    uint32_t c = charge(p);
+    s.memory += c;
+    ts.memory += c;
+    return true;
+}
+
+Packet *
+TCPReassembler::unhold(Segment **pp, Stream &s, ThreadState &ts)
+{
+    Segment *x = *pp;
+    Packet *p = x->p;
+    *pp = x->next;
+    uint32_t c = charge(p);
+    s.memory -= c;
+    ts.memory -= c;
+    ts.pool.deallocate(x);
+    return p;
+}
+
+bool
+TCPReassembler::insert_first(Stream &s, ThreadState &ts, Packet *p,
+			     uint32_t seq, uint32_t end,
+			     uint32_t pseq, uint32_t plen)
+{
+    // Held bytes win: hold only the parts of [seq, end) not already held.
+    // Each part after the first holds a clone of p.
+    Segment **pp = &s.held;
+    bool used = false;
+    while (SEQ_LT(seq, end)) {
+	while (*pp && SEQ_LEQ((*pp)->end, seq))
+	    pp = &(*pp)->next;
+	Segment *x = *pp;
+	uint32_t part_end = end;
+	if (x && SEQ_LT(x->seq, end))
+	    part_end = x->seq;
+	if (SEQ_LT(seq, part_end)) {
+	    if (!hold(pp, s, ts, p, used, seq, part_end, pseq, plen))
+		break;
+	    used = true;
+	    pp = &(*pp)->next;
+	}
+	if (part_end == end)
+	    break;
+	seq = x->end;
+    }
+    return used;
+}
+
+bool
+TCPReassembler::insert_last(Stream &s, ThreadState &ts, Packet *p,
+			    uint32_t seq, uint32_t end,
+			    uint32_t pseq, uint32_t plen)
+{
+    // New bytes win: cut [seq, end) out of the held segments, then hold it.
+    Segment **pp = &s.held;
+    while (*pp && SEQ_LEQ((*pp)->end, seq))
+	pp = &(*pp)->next;
+    Segment *x = *pp;
+    if (x && SEQ_LT(x->seq, seq)) {
+	// x starts first; keep its head, and its tail if it ends last
+	if (SEQ_GT(x->end, end))
+	    hold(&x->next, s, ts, x->p, true, end, x->end, x->pseq, x->plen);
+	x->end = seq;
+	pp = &x->next;
+    }
+    while ((x = *pp) && SEQ_LEQ(x->end, end))
+	unhold(pp, s, ts)->kill();
+    if (x && SEQ_LT(x->seq, end))
+	x->seq = end;
+    return hold(pp, s, ts, p, false, seq, end, pseq, plen);
+}
+
+Packet *
+TCPReassembler::trim(Packet *p, uint32_t seq, uint32_t end,
+		     uint32_t pseq, uint32_t plen, ThreadState &ts)
+{
+    const click_tcp *tcph = p->tcp_header();
+    uint32_t data_end = pseq + plen;
+    if (seq == pseq && end == data_end + ((tcph->th_flags & TH_FIN) != 0))
+	return p;
+
+    uint32_t skip = seq - pseq;
+    uint32_t len = (SEQ_LT(end, data_end) ? end : data_end) - seq;
+    WritablePacket *q = p->uniqueify();
+    if (!q)
+	return 0;
+    unsigned iphl = q->ip_header()->ip_hl << 2;
+    unsigned thl = q->tcp_header()->th_off << 2;
+    unsigned hl = q->transport_header_offset() + thl;
+    q->take(q->length() - (hl + skip + len));
+    if (skip) {
+	// Slide the headers up to the first byte kept.
+	int nh_off = q->network_header_offset();
+	bool shift_mac = q->has_mac_header() && q->mac_header_offset() >= 0;
+	int mac_off = shift_mac ? q->mac_header_offset() : 0;
+	memmove(q->data() + skip, q->data(), hl);
+	q->pull(skip);
+	if (shift_mac)
+	    q->set_mac_header(q->data() + mac_off);
+	q->set_ip_header(reinterpret_cast<click_ip *>(q->data() + nh_off), iphl);
+    }
+
+    click_ip *iph = q->ip_header();
+    click_tcp *th = q->tcp_header();
+    if (skip) {
+	th->th_seq = htonl(seq);
+	th->th_flags &= ~TH_SYN;
+    }
+    if (!SEQ_GT(end, data_end))
+	th->th_flags &= ~TH_FIN;
+    iph->ip_len = htons(iphl + thl + len);
+    iph->ip_sum = 0;
+    iph->ip_sum = click_in_cksum(reinterpret_cast<unsigned char *>(iph), iphl);
+    th->th_sum = 0;
+    unsigned csum = click_in_cksum(reinterpret_cast<unsigned char *>(th), thl + len);
+    th->th_sum = click_in_cksum_pseudohdr(csum, iph, thl + len);
+    ++ts.trimmed;
+    return q;
+}
+
+void
+TCPReassembler::drain(Stream &s, ThreadState &ts)
+{
+    Segment *x;
+    while ((x = s.held) && SEQ_LEQ(x->seq, s.next)) {
+	uint32_t seq = s.next, end = x->end, pseq = x->pseq, plen = x->plen;
+	Packet *p = unhold(&s.held, s, ts);
+	if (SEQ_LEQ(end, seq)) {
+	    // only reachable past a FIN
+	    ++ts.duplicates;
+	    checked_output_push(1, p);
+	    continue;
+	}
+	s.next = end;
+	if (SEQ_GT(end, pseq + plen))
+	    s.flags |= s_closed;
+	if ((p = trim(p, seq, end, pseq, plen, ts)))
+	    output(0).push(p);
+    }
+}
+
+void
+TCPReassembler::skip_hole(Stream &s, ThreadState &ts)
+{
+    ++ts.holes;
+    ts.hole_bytes += s.held->seq - s.next;
+    s.next = s.held->seq;
+    drain(s, ts);
+}
+
+void
+TCPReassembler::flush(Stream &s, ThreadState &ts)
+{
+    while (s.held)
+	skip_hole(s, ts);
+}
+
+void
+TCPReassembler::release(Stream &s, ThreadState &ts)
+{
+    while (s.held)
+	unhold(&s.held, s, ts)->kill();
+}
+
+void
+TCPReassembler::evict(Table &table, ThreadState &ts)
+{
+    // Flush streams round-robin until the thread is well below its limit.
+    size_t low = _thread_memory - _thread_memory / 4;
+    uint32_t i = ts.evict_cursor;
+    for (uint32_t n = table.index_limit(); n && ts.memory > low; --n) {
+	if (table.live(i) && table.value(i).held) {
+	    flush(table.value(i), ts);
+	    ++ts.evictions;
+	}
+	if (++i == table.index_limit())
+	    i = 0;
+    }
+    ts.evict_cursor = i;
+}
+
+struct TCPReassembler::Expired {
+    TCPReassembler *tr;
+    ThreadState &ts;
+    click_jiffies_t limit;
+    Expired(TCPReassembler *tr_, ThreadState &ts_, click_jiffies_t limit_)
+	: tr(tr_), ts(ts_), limit(limit_) {
+    }
+    bool operator()(const IPFlow5ID &, Stream &s) const {
+	// An idle stream's held data will never be completed; send it on.
+	if (!click_jiffies_less(s.last, limit))
+	    return false;
+	tr->flush(s, ts);
+	return true;
+    }
+};
+
+void
+TCPReassembler::reap(Table &table, ThreadState &ts, click_jiffies_t now)
+{
+    table.reap_step(ts.reap_cursor, reap_batch,
+		    Expired(this, ts, now - _timeout_j));
+}
+
+void
+TCPReassembler::push(int, Packet *p)
+{
+    int thread = click_current_cpu_id();
+    Table &table = _tables[thread];
+    ThreadState &ts = _state[thread];
+    click_jiffies_t now = click_jiffies();
+
+    if (_timeout_j)
+	reap(table, ts, now);
+
+    const click_ip *iph = p->ip_header();
+    const click_tcp *tcph = p->tcp_header();
+    unsigned iphl, thl, plen;
+    if (!p->has_network_header() || p->network_header_offset() < 0
+	|| iph->ip_p != IP_PROTO_TCP || IP_ISFRAG(iph)
+	|| p->transport_length() < (int) sizeof(click_tcp)
+	|| (thl = tcph->th_off << 2) < sizeof(click_tcp)
+	|| ntohs(iph->ip_len) < (iphl = iph->ip_hl << 2) + thl
+	|| p->transport_length() < (int) (ntohs(iph->ip_len) - iphl))
+	goto untracked;
+    plen = ntohs(iph->ip_len) - iphl - thl;
+
+    {
+	bool inserted;
+	Stream *s = table.find_insert(IPFlow5ID(p), inserted);
+	if (!s)
+	    goto untracked;
+
+	uint8_t flags = tcph->th_flags;
+	uint32_t pseq = ntohl(tcph->th_seq) + ((flags & TH_SYN) != 0);
+	uint32_t end = pseq + plen + ((flags & TH_FIN) != 0);
+	s->last = now;
+	if (inserted
+	    || ((flags & TH_SYN) && (s->flags & s_closed) && pseq != s->next)) {
+	    release(*s, ts);
+	    s->next = pseq;
+	    s->flags = 0;
+	}
+
+	if (flags & TH_RST) {
+	    flush(*s, ts);
+	    s->flags |= s_closed;
+	    output(0).push(p);
+	    return;
+	} else if (pseq == end) {
+	    // no payload
+	    output(0).push(p);
+	    return;
+	} else if (SEQ_LEQ(end, s->next)) {
+	    ++ts.duplicates;
+	    checked_output_push(1, p);
+	    return;
+	} else if (pseq == s->next && !s->held) {
+	    s->next = end;
+	    if (flags & TH_FIN)
+		s->flags |= s_closed;
+	    ++ts.in_order;
+	    output(0).push(p);
+	    return;
+	}
+
+	uint32_t seq = SEQ_LT(pseq, s->next) ? s->next : pseq;
+	if (seq != s->next)
+	    ++ts.reordered;
+	bool used;
+	if (_keep_last)
+	    used = insert_last(*s, ts, p, seq, end, pseq, plen);
+	else
+	    used = insert_first(*s, ts, p, seq, end, pseq, plen);
+	if (!used) {
+	    ++ts.duplicates;
+	    checked_output_push(1, p);
+	}
+
+	drain(*s, ts);
+	while (s->memory > _flow_memory && s->held)
+	    skip_hole(*s, ts);
+	if (ts.memory > _thread_memory)
+	    evict(table, ts);
+	return;
+    }
+
+  untracked:
+    ++ts.untracked;
+    output(0).push(p);
+}
+
+String
+TCPReassembler::read_handler(Element *e, void *thunk)
+{
+    TCPReassembler *tr = static_cast<TCPReassembler *>(e);
+    int n = tr->_state.size();
+    uint64_t ThreadState::*counter;
+    switch ((intptr_t) thunk) {
+    case h_count:
+	return String(tr->_tables.size());
+    case h_held: {
+	size_t x = 0;
+	for (int i = 0; i < n; ++i)
+	    x += tr->_state[i].memory;
+	return String(x);
+    }
+    case h_memory: {
+	size_t x = tr->_tables.memory_size();
+	for (int i = 0; i < n; ++i)
+	    x += tr->_state[i].pool.memory();
+	return String(x);
+    }
+    case h_in_order:
+	counter = &ThreadState::in_order;
+	break;
+    case h_reordered:
+	counter = &ThreadState::reordered;
+	break;
+    case h_duplicates:
+	counter = &ThreadState::duplicates;
+	break;
+    case h_trimmed:
+	counter = &ThreadState::trimmed;
+	break;
+    case h_holes:
+	counter = &ThreadState::holes;
+	break;
+    case h_hole_bytes:
+	counter = &ThreadState::hole_bytes;
+	break;
+    case h_evictions:
+	counter = &ThreadState::evictions;
+	break;
+    case h_untracked:
+	counter = &ThreadState::untracked;
+	break;
+    default:
+	return String();
+    }
+    uint64_t x = 0;
+    for (int i = 0; i < n; ++i)
+	x += tr->_state[i].*counter;
+    return String(x);
+}
+
+int
+TCPReassembler::write_handler(const String &, Element *e, void *, ErrorHandler *)
+{
+    TCPReassembler *tr = static_cast<TCPReassembler *>(e);
+    for (int t = 0; t < tr->_state.size(); ++t) {
+	Table &table = tr->_tables[t];
+	for (uint32_t i = 0; i < table.index_limit(); ++i)
+	    if (table.live(i))
+		tr->flush(table.value(i), tr->_state[t]);
+    }
+    return 0;
+}
+
+void
+TCPReassembler::add_handlers()
+{
+    add_read_handler("count", read_handler, h_count);
+    add_read_handler("held", read_handler, h_held);
+    add_read_handler("in_order", read_handler, h_in_order);
+    add_read_handler("reordered", read_handler, h_reordered);
+    add_read_handler("duplicates", read_handler, h_duplicates);
+    add_read_handler("trimmed", read_handler, h_trimmed);
+    add_read_handler("holes", read_handler, h_holes);
+    add_read_handler("hole_bytes", read_handler, h_hole_bytes);
+    add_read_handler("evictions", read_handler, h_evictions);
+    add_read_handler("untracked", read_handler, h_untracked);
+    add_read_handler("memory", read_handler, h_memory);
+    add_write_handler("flush", write_handler, h_flush, Handler::BUTTON);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(TCPReassembler)
+ELEMENT_MT_SAFE(TCPReassembler)
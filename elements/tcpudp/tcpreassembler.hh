@@ -0,0 +1,255 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_TCPREASSEMBLER_HH
+#define CLICK_TCPREASSEMBLER_HH
+#include <click/element.hh>
+#include <click/cuckootable.hh>
+#include <click/hashallocator.hh>
+#include <click/ipflowid.hh>
+CLICK_DECLS
+
+/*
+=c
+
+TCPReassembler([I<keywords> POLICY, CAPACITY, FLOW_MEMORY, MEMORY, TIMEOUT])
+
+=s tcpudp
+
+puts TCP segments back in sequence order
+
+=d
+
+TCPReassembler reorders the segments of each TCP stream so that they leave
+in sequence order, with retransmitted and overlapping bytes removed. The
+payloads of the packets emitted for a stream, concatenated, form the
+stream's byte stream. Downstream elements can therefore analyze payloads
+packet by packet without handling reordering or retransmissions themselves.
+
+Each direction of a connection is a separate stream, identified by its
+5-tuple. A stream's first packet sets its initial sequence number: the
+sequence number after a SYN, or the packet's sequence number otherwise, so
+streams already in progress are picked up. A SYN for a stream that has
+ended with a FIN or RST starts the stream over.
+
+A segment that continues the stream is emitted immediately, followed by any
+held segments it makes contiguous. A segment that arrives ahead of a hole
+is held. Held segments share packet buffers with the packets that carried
+them, so holding a segment copies nothing. A segment whose bytes were all
+emitted already is a duplicate; it is emitted on output 1, if it exists, and
+dropped otherwise. Packets that overlap emitted bytes are trimmed to their
+new bytes, and their IP and TCP checksums are recomputed; this is the only
+time TCPReassembler changes a packet. Packets without payload, such as pure
+ACKs, are emitted unchanged as they arrive.
+
+When a held segment overlaps another held segment, POLICY chooses which
+bytes to keep. FIRST keeps the bytes that arrived first, as BSD and Linux
+do; LAST keeps the bytes that arrived last, as some other stacks do.
+
+Memory is bounded per stream and per thread. If a stream's held segments
+use more than FLOW_MEMORY bytes, TCPReassembler gives up on its earliest
+holes: it skips to the next held byte, counting a hole, and emits the
+segments that are now contiguous, until the stream is within its limit. If
+a thread's held segments use more than its share of MEMORY, TCPReassembler
+evicts streams, skipping all of their holes, until the thread is down to
+three quarters of its share. Streams idle for TIMEOUT are forgotten, after
+their held segments are emitted in the same way. Memory is charged in
+packet buffer sizes, so it matches what the held packets really pin.
+
+Packets must have their IP header annotations set. Non-TCP packets, IP
+fragments, truncated packets, and packets of new streams when the thread's
+CAPACITY streams are in use are emitted unchanged on output 0. All
+segments of a stream must reach the same thread, as with RSS (see
+RSSSwitch).
+
+Keywords are:
+
+=over 8
+
+=item POLICY
+
+Either C<FIRST> or C<LAST>. Overlap policy for held segments. Default is
+C<FIRST>.
+
+=item CAPACITY
+
+Unsigned integer. Number of streams each thread can track. Default is
+65536.
+
+=item FLOW_MEMORY
+
+Unsigned integer. Maximum number of bytes held for one stream. Default is
+256 kilobytes.
+
+=item MEMORY
+
+Unsigned integer. Maximum number of bytes held for all streams, divided
+evenly among threads. Default is 64 megabytes.
+
+=item TIMEOUT
+
+Time in seconds. Idle streams are forgotten after this long. Default is 60
+seconds.
+
+=back
+
+=h count read-only
+
+Returns the number of streams in all tables.
+
+=h held read-only
+
+Returns the number of bytes of packet buffers held.
+
+=h in_order read-only
+
+Returns the number of packets emitted as they arrived.
+
+=h reordered read-only
+
+Returns the number of packets held because they arrived ahead of a hole.
+
+=h duplicates read-only
+
+Returns the number of packets containing only bytes already seen.
+
+=h trimmed read-only
+
+Returns the number of packets emitted with overlapping bytes removed.
+
+=h holes read-only
+
+Returns the number of holes skipped. The hole_bytes handler returns the
+number of sequence numbers skipped.
+
+=h evictions read-only
+
+Returns the number of streams whose holes were skipped to free memory.
+
+=h untracked read-only
+
+Returns the number of packets passed through without reassembly.
+
+=h memory read-only
+
+Returns the number of bytes allocated by the stream tables and segment
+records, not counting held packets.
+
+=h flush write-only
+
+Skips every hole and emits all held segments. Only safe while no packets
+are being processed, as at the end of a trace.
+
+=e
+
+  FromDump(trace.pcap, STOP true, FORCE_IP true)
+    -> CheckIPHeader
+    -> IPClassifier(tcp port 80)
+    -> TCPReassembler
+    -> ToDump(ordered.pcap);
+
+=a IPReassembler, TCPFragmenter, AggregateIPFlows, RSSSwitch */
+
+class TCPReassembler : public Element { public:
+
+    TCPReassembler() CLICK_COLD;
+    ~TCPReassembler() CLICK_COLD;
+
+    const char *class_name() const	{ return "TCPReassembler"; }
+    const char *port_count() const	{ return PORTS_1_1X2; }
+    const char *processing() const	{ return PUSH; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void push(int port, Packet *);
+
+  private:
+
+    // A held range of sequence space, [seq, end), taken from packet p.
+    // The range may include p's FIN.
+    struct Segment {
+	Segment *next;
+	Packet *p;
+	uint32_t seq;
+	uint32_t end;
+	uint32_t pseq;		// sequence number of p's first payload byte
+	uint32_t plen;		// p's payload length
+    };
+
+    enum { s_closed = 1 };
+
+    struct Stream {
+	Segment *held;		// sorted by sequence number, disjoint
+	uint32_t next;		// next sequence number to emit
+	uint32_t memory;	// bytes charged for held segments
+	click_jiffies_t last;
+	uint8_t flags;
+	Stream()
+	    : held(0), next(0), memory(0), last(0), flags(0) {
+	}
+    };
+
+    typedef CuckooTable<IPFlow5ID, Stream> Table;
+
+    struct ThreadState {
+	SizedHashAllocator<sizeof(Segment)> pool;
+	size_t memory;
+	uint32_t reap_cursor;
+	uint32_t evict_cursor;
+	uint64_t in_order;
+	uint64_t reordered;
+	uint64_t duplicates;
+	uint64_t trimmed;
+	uint64_t holes;
+	uint64_t hole_bytes;
+	uint64_t evictions;
+	uint64_t untracked;
+	ThreadState()
+	    : memory(0), reap_cursor(0), evict_cursor(0), in_order(0),
+	      reordered(0), duplicates(0), trimmed(0), holes(0),
+	      hole_bytes(0), evictions(0), untracked(0) {
+	}
+    };
+
+    enum { reap_batch = 8 };
+
+    PerThreadCuckooTable<IPFlow5ID, Stream> _tables;
+    PerThread<ThreadState> _state;
+    uint32_t _capacity;
+    uint32_t _flow_memory;
+    uint32_t _memory;
+    size_t _thread_memory;
+    click_jiffies_t _timeout_j;
+    bool _keep_last;
+
+    static inline uint32_t charge(Packet *p) {
+	return sizeof(Segment) + p->buffer_length();
+    }
+    bool hold(Segment **pp, Stream &s, ThreadState &ts, Packet *p, bool clone,
+	      uint32_t seq, uint32_t end, uint32_t pseq, uint32_t plen);
+    Packet *unhold(Segment **pp, Stream &s, ThreadState &ts);
+    bool insert_first(Stream &s, ThreadState &ts, Packet *p,
+		      uint32_t seq, uint32_t end, uint32_t pseq, uint32_t plen);
+    bool insert_last(Stream &s, ThreadState &ts, Packet *p,
+		     uint32_t seq, uint32_t end, uint32_t pseq, uint32_t plen);
+    Packet *trim(Packet *p, uint32_t seq, uint32_t end, uint32_t pseq,
+		 uint32_t plen, ThreadState &ts);
+    void drain(Stream &s, ThreadState &ts);
+    void skip_hole(Stream &s, ThreadState &ts);
+    void flush(Stream &s, ThreadState &ts);
+    void release(Stream &s, ThreadState &ts);
+    void evict(Table &table, ThreadState &ts);
+    struct Expired;
+    void reap(Table &table, ThreadState &ts, click_jiffies_t now);
+
+    enum { h_count, h_held, h_in_order, h_reordered, h_duplicates,
+	   h_trimmed, h_holes, h_hole_bytes, h_evictions, h_untracked,
+	   h_memory, h_flush };
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -138,11 +138,8 @@ TCPRewriter::TCPFlow::apply_sack(bool direction, click_tcp *tcph, int len)
 	}
 
   done:
-    if (csum_delta) {
-	uint32_t sum = (~tcph->th_sum & 0xFFFF) + csum_delta;
-	sum = (sum & 0xFFFF) + (sum >> 16);
-	tcph->th_sum = ~(sum + (sum >> 16));
-    }
+    if (csum_delta)
+	click_update_in_cksum_sum(&tcph->th_sum, csum_delta);
 }
 
 void
@@ -203,15 +200,13 @@ TCPRewriter::TCPFlow::apply(WritablePacket *p, bool direction, unsigned annos)
 
     if (_dt->delta[direction] || _dt->has_trigger(direction)) {
 	uint32_t newval = htonl(new_seq(direction, ntohl(tcph->th_seq)));
-	click_update_in_cksum(&tcph->th_sum, tcph->th_seq >> 16, newval >> 16);
-	click_update_in_cksum(&tcph->th_sum, tcph->th_seq, newval);
+	click_update_in_cksum32(&tcph->th_sum, tcph->th_seq, newval);
 	tcph->th_seq = newval;
     }
 
     if (_dt->delta[!direction] || _dt->has_trigger(!direction)) {
 	uint32_t newval = htonl(new_ack(direction, ntohl(tcph->th_ack)));
-	click_update_in_cksum(&tcph->th_sum, tcph->th_ack >> 16, newval >> 16);
-	click_update_in_cksum(&tcph->th_sum, tcph->th_ack, newval);
+	click_update_in_cksum32(&tcph->th_sum, tcph->th_ack, newval);
 	tcph->th_ack = newval;
 
 	// update SACK sequence numbers
@@ -235,11 +230,13 @@ TCPRewriter::TCPFlow::unparse(StringAccum &sa, bool direction, click_jiffies_t n
 // TCPRewriter
 
 TCPRewriter::TCPRewriter()
+    : _allocator(0)
 {
 }
 
 TCPRewriter::~TCPRewriter()
 {
+    delete[] _allocator;
 }
 
 void *
@@ -278,27 +275,32 @@ TCPRewriter::configure(Vector<String> &conf, ErrorHandler *errh)
     _tcp_data_timeout *= CLICK_HZ; // IPRewriterBase handles the others
     _tcp_done_timeout *= CLICK_HZ;
 
-    return IPRewriterBase::configure(conf, errh);
+    if (IPRewriterBase::configure(conf, errh) < 0)
+	return -1;
+    _allocator = new SizedHashAllocator<sizeof(TCPFlow)>[_nthreads];
+    return 0;
 }
 
 IPRewriterEntry *
 TCPRewriter::add_flow(int /*ip_p*/, const IPFlowID &flowid,
 		      const IPFlowID &rewritten_flowid, int input)
 {
+    int thread = thread_index();
     void *data;
-    if (!(data = _allocator.allocate()))
+    if (!(data = _allocator[thread].allocate()))
 	return 0;
 
     TCPFlow *flow = new(data) TCPFlow
 	(&_input_specs[input], flowid, rewritten_flowid,
 	 !!_timeouts[1], click_jiffies() + relevant_timeout(_timeouts));
 
-    return store_flow(flow, input, _map);
+    return store_flow(flow, input, thread, map(thread));
 }
 
 void
 TCPRewriter::push(int port, Packet *p_in)
 {
+    int thread = thread_index();
     WritablePacket *p = p_in->uniqueify();
     click_ip *iph = p->ip_header();
 
@@ -315,7 +317,7 @@ TCPRewriter::push(int port, Packet *p_in)
     }
 
     IPFlowID flowid(p);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
 
     if (!m) {			// create new mapping
 	IPRewriterInput &is = _input_specs.unchecked_at(port);
@@ -335,9 +337,9 @@ TCPRewriter::push(int port, Packet *p_in)
 
     click_jiffies_t now_j = click_jiffies();
     if (_timeouts[1])
-	mf->change_expiry(_heap, true, now_j + _timeouts[1]);
+	mf->change_expiry(heap(thread), true, now_j + _timeouts[1]);
     else
-	mf->change_expiry(_heap, false, now_j + tcp_flow_timeout(mf));
+	mf->change_expiry(heap(thread), false, now_j + tcp_flow_timeout(mf));
 
     output(m->output()).push(p);
 }
@@ -349,11 +351,12 @@ TCPRewriter::tcp_mappings_handler(Element *e, void *)
     TCPRewriter *rw = (TCPRewriter *)e;
     click_jiffies_t now = click_jiffies();
     StringAccum sa;
-    for (Map::iterator iter = rw->_map.begin(); iter.live(); ++iter) {
-	TCPFlow *f = static_cast<TCPFlow *>(iter->flow());
-	f->unparse(sa, iter->direction(), now);
-	sa << '\n';
-    }
+    for (int t = 0; t < rw->nthreads(); ++t)
+	for (Map::iterator iter = rw->map(t).begin(); iter.live(); ++iter) {
+	    TCPFlow *f = static_cast<TCPFlow *>(iter->flow());
+	    f->unparse(sa, iter->direction(), now);
+	    sa << '\n';
+	}
     return sa.take_string();
 }
 
@@ -372,18 +375,20 @@ TCPRewriter::tcp_lookup_handler(int, String &str, Element *e, const Handler *, E
 	.complete() < 0)
 	return -1;
 
-    HashContainer<IPRewriterEntry> *map = rw->get_map(IPRewriterInput::mapid_default);
-    if (!map)
-	return errh->error("no map!");
-
     StringAccum sa;
     IPFlowID flow(saddr, htons(sport), daddr, htons(dport));
-    if (Map::iterator iter = map->find(flow)) {
-	TCPFlow *f = static_cast<TCPFlow *>(iter->flow());
-	const IPFlowID &flowid = f->entry(iter->direction()).rewritten_flowid();
-
-	sa << flowid.saddr() << " " << ntohs(flowid.sport()) << " "
-	   << flowid.daddr() << " " << ntohs(flowid.dport());
+    for (int t = 0; t < rw->nthreads(); ++t) {
+	Map *map = rw->get_map(IPRewriterInput::mapid_default, t);
+	if (!map)
+	    return errh->error("no map!");
+	if (IPRewriterEntry *m = map->get(flow)) {
+	    TCPFlow *f = static_cast<TCPFlow *>(m->flow());
+	    const IPFlowID &flowid = f->entry(m->direction()).rewritten_flowid();
+
+	    sa << flowid.saddr() << " " << ntohs(flowid.sport()) << " "
+	       << flowid.daddr() << " " << ntohs(flowid.dport());
+	    break;
+	}
     }
 
     str = sa.take_string();
@@ -60,7 +60,7 @@ dropped if an TCPRewriter's mapping table is full of guaranteed flows.
 
 =item REAP_INTERVAL I<time>
 
-Reap timed-out connections every I<time> seconds. Default is 15 minutes.
+Reap timed-out connections every I<time> seconds. Default is 1 second.
 
 =item MAPPING_CAPACITY I<capacity>
 
@@ -68,6 +68,12 @@ Set the maximum number of mappings this rewriter can hold to I<capacity>.
 I<Capacity> can either be an integer or the name of another rewriter-like
 element, in which case this element will share the other element's capacity.
 
+=item PER_THREAD
+
+Boolean. If true, keep a separate mapping table per Click thread, and give
+each thread its own slice of every pattern's port range. See IPRewriter.
+Default is false.
+
 =item DST_ANNO
 
 Boolean. If true, then set the destination IP address annotation on passing
@@ -164,7 +170,11 @@ class TCPRewriter : public IPRewriterBase { public:
 
     IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 			      const IPFlowID &rewritten_flowid, int input);
-    void destroy_flow(IPRewriterFlow *flow);
+    void destroy_flow(IPRewriterFlow *flow, int thread);
+    void memory_stats(MemoryStats &ms) const {
+	allocator_stats(ms, _allocator, sizeof(TCPFlow));
+	IPRewriterBase::memory_stats(ms);
+    }
     click_jiffies_t best_effort_expiry(const IPRewriterFlow *flow) {
 	return flow->expiry() + tcp_flow_timeout(static_cast<const TCPFlow *>(flow)) - _timeouts[1];
     }
@@ -175,7 +185,7 @@ class TCPRewriter : public IPRewriterBase { public:
 
  protected:
 
-    SizedHashAllocator<sizeof(TCPFlow)> _allocator;
+    SizedHashAllocator<sizeof(TCPFlow)> *_allocator;	// one per thread
     unsigned _annos;
     uint32_t _tcp_data_timeout;
     uint32_t _tcp_done_timeout;
@@ -195,11 +205,11 @@ class TCPRewriter : public IPRewriterBase { public:
 };
 
 inline void
-TCPRewriter::destroy_flow(IPRewriterFlow *flow)
+TCPRewriter::destroy_flow(IPRewriterFlow *flow, int thread)
 {
-    unmap_flow(flow, _map);
+    unmap_flow(flow, thread, map(thread));
     static_cast<TCPFlow *>(flow)->~TCPFlow();
-    _allocator.deallocate(flow);
+    _allocator[thread].deallocate(flow);
 }
 
 inline tcp_seq_t
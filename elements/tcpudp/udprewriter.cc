@@ -67,11 +67,13 @@ UDPRewriter::UDPFlow::apply(WritablePacket *p, bool direction, unsigned annos)
 }
 
 UDPRewriter::UDPRewriter()
+    : _allocator(0)
 {
 }
 
 UDPRewriter::~UDPRewriter()
 {
+    delete[] _allocator;
 }
 
 void *
@@ -109,27 +111,32 @@ UDPRewriter::configure(Vector<String> &conf, ErrorHandler *errh)
 	_udp_streaming_timeout = _timeouts[0];
     _udp_streaming_timeout *= CLICK_HZ; // IPRewriterBase handles the others
 
-    return IPRewriterBase::configure(conf, errh);
+    if (IPRewriterBase::configure(conf, errh) < 0)
+	return -1;
+    _allocator = new SizedHashAllocator<sizeof(UDPFlow)>[_nthreads];
+    return 0;
 }
 
 IPRewriterEntry *
 UDPRewriter::add_flow(int ip_p, const IPFlowID &flowid,
 		      const IPFlowID &rewritten_flowid, int input)
 {
+    int thread = thread_index();
     void *data;
-    if (!(data = _allocator.allocate()))
+    if (!(data = _allocator[thread].allocate()))
 	return 0;
 
     UDPFlow *flow = new(data) UDPFlow
 	(&_input_specs[input], flowid, rewritten_flowid, ip_p,
 	 !!_timeouts[1], click_jiffies() + relevant_timeout(_timeouts));
 
-    return store_flow(flow, input, _map);
+    return store_flow(flow, input, thread, map(thread));
 }
 
 void
 UDPRewriter::push(int port, Packet *p_in)
 {
+    int thread = thread_index();
     WritablePacket *p = p_in->uniqueify();
     if (!p)
 	return;
@@ -149,7 +156,7 @@ UDPRewriter::push(int port, Packet *p_in)
     }
 
     IPFlowID flowid(p);
-    IPRewriterEntry *m = _map.get(flowid);
+    IPRewriterEntry *m = map(thread).get(flowid);
 
     if (!m) {			// create new mapping
 	IPRewriterInput &is = _input_specs.unchecked_at(port);
@@ -169,9 +176,9 @@ UDPRewriter::push(int port, Packet *p_in)
 
     click_jiffies_t now_j = click_jiffies();
     if (_timeouts[1])
-	mf->change_expiry(_heap, true, now_j + _timeouts[1]);
+	mf->change_expiry(heap(thread), true, now_j + _timeouts[1]);
     else
-	mf->change_expiry(_heap, false, now_j + udp_flow_timeout(mf));
+	mf->change_expiry(heap(thread), false, now_j + udp_flow_timeout(mf));
 
     output(m->output()).push(p);
 }
@@ -183,10 +190,11 @@ UDPRewriter::dump_mappings_handler(Element *e, void *)
     UDPRewriter *rw = (UDPRewriter *)e;
     click_jiffies_t now = click_jiffies();
     StringAccum sa;
-    for (Map::iterator iter = rw->_map.begin(); iter.live(); ++iter) {
-	iter->flow()->unparse(sa, iter->direction(), now);
-	sa << '\n';
-    }
+    for (int t = 0; t < rw->nthreads(); ++t)
+	for (Map::iterator iter = rw->map(t).begin(); iter.live(); ++iter) {
+	    iter->flow()->unparse(sa, iter->direction(), now);
+	    sa << '\n';
+	}
     return sa.take_string();
 }
 
@@ -137,7 +137,7 @@ dropped if a UDPRewriter's mapping table is full of guaranteed flows.
 
 =item REAP_INTERVAL I<time>
 
-Reap timed-out connections every I<time> seconds. Default is 15 minutes.
+Reap timed-out connections every I<time> seconds. Default is 1 second.
 
 =item MAPPING_CAPACITY I<capacity>
 
@@ -145,6 +145,12 @@ Set the maximum number of mappings this rewriter can hold to I<capacity>.
 I<Capacity> can either be an integer or the name of another rewriter-like
 element, in which case this element will share the other element's capacity.
 
+=item PER_THREAD
+
+Boolean. If true, keep a separate mapping table per Click thread, and give
+each thread its own slice of every pattern's port range. See IPRewriter.
+Default is false.
+
 =item DST_ANNO
 
 Boolean. If true, then set the destination IP address annotation on passing
@@ -189,7 +195,11 @@ class UDPRewriter : public IPRewriterBase { public:
 
     IPRewriterEntry *add_flow(int ip_p, const IPFlowID &flowid,
 			      const IPFlowID &rewritten_flowid, int input);
-    void destroy_flow(IPRewriterFlow *flow);
+    void destroy_flow(IPRewriterFlow *flow, int thread);
+    void memory_stats(MemoryStats &ms) const {
+	allocator_stats(ms, _allocator, sizeof(UDPFlow));
+	IPRewriterBase::memory_stats(ms);
+    }
     click_jiffies_t best_effort_expiry(const IPRewriterFlow *flow) {
 	return flow->expiry() + udp_flow_timeout(static_cast<const UDPFlow *>(flow)) - _timeouts[1];
     }
@@ -200,7 +210,7 @@ class UDPRewriter : public IPRewriterBase { public:
 
   private:
 
-    SizedHashAllocator<sizeof(UDPFlow)> _allocator;
+    SizedHashAllocator<sizeof(UDPFlow)> *_allocator;	// one per thread
     unsigned _annos;
     uint32_t _udp_streaming_timeout;
 
@@ -219,11 +229,11 @@ class UDPRewriter : public IPRewriterBase { public:
 
 
 inline void
-UDPRewriter::destroy_flow(IPRewriterFlow *flow)
+UDPRewriter::destroy_flow(IPRewriterFlow *flow, int thread)
 {
-    unmap_flow(flow, _map);
+    unmap_flow(flow, thread, map(thread));
     flow->~IPRewriterFlow();
-    _allocator.deallocate(flow);
+    _allocator[thread].deallocate(flow);
 }
 
 CLICK_ENDDECLS
@@ -0,0 +1,155 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * cuckootabletest.{cc,hh} -- regression test element for CuckooTable<K, V>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "cuckootabletest.hh"
+#include <click/cuckootable.hh>
+#include <click/ipflowid.hh>
+#if HAVE_IP6
+# include <click/ip6flowid.hh>
+#endif
+#include <click/error.hh>
+CLICK_DECLS
+
+CuckooTableTest::CuckooTableTest()
+{
+}
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test `%s' failed", __FILE__, __LINE__, #x);
+
+static IPFlow5ID
+make_flow(uint32_t i)
+{
+    return IPFlow5ID(IPAddress(htonl(0x0A000000 + (i >> 8))), htons(i & 0xFFFF),
+		     IPAddress(htonl(0xC0A80001)), htons(80), IP_PROTO_TCP);
+}
+
+int
+CuckooTableTest::initialize(ErrorHandler *errh)
+{
+    {
+	CuckooTable<int, int> t;
+	CHECK(t.find(1) == 0);
+	CHECK(t.reserve(100) == 0);
+	CHECK(t.capacity() == 100);
+	CHECK(t.empty());
+	bool inserted;
+	int *v = t.find_insert(1, inserted);
+	CHECK(v && inserted && *v == 0);
+	*v = 10;
+	CHECK(t.find_insert(1, inserted) == v && !inserted);
+	CHECK(t.insert(2, 20) && t.size() == 2);
+	CHECK(*t.find(1) == 10 && *t.find(2) == 20 && !t.find(3));
+	int x;
+	CHECK(t.find_shared(2, x) && x == 20);
+	CHECK(!t.find_shared(3, x));
+	CHECK(t.erase(1) && !t.erase(1) && t.size() == 1);
+	CHECK(!t.find(1) && *t.find(2) == 20);
+	t.clear();
+	CHECK(t.empty() && !t.find(2));
+    }
+
+    // fill to capacity with flow IDs; cuckoo displacement must cope
+    {
+	enum { N = 50000 };
+	CuckooTable<IPFlow5ID, uint32_t> t;
+	CHECK(t.reserve(N) == 0);
+	uint32_t n;
+	for (n = 0; n < N; ++n)
+	    if (!t.insert(make_flow(n), n + 1))
+		break;
+	CHECK(n == N);
+	CHECK(t.size() == N);
+	CHECK(!t.insert(make_flow(N), 1));
+	for (uint32_t i = 0; i < N; ++i) {
+	    uint32_t *v = t.find(make_flow(i));
+	    CHECK(v && *v == i + 1);
+	}
+	CHECK(!t.find(make_flow(N)));
+	IPFlow5ID other = make_flow(7);
+	other.set_proto(IP_PROTO_UDP);
+	CHECK(!t.find(other));
+
+	// batch lookups agree with single lookups
+	IPFlow5ID keys[37];
+	uint32_t *values[37];
+	for (int i = 0; i < 37; ++i)
+	    keys[i] = make_flow(i * 1999 % (N + 100));
+	t.find_batch(keys, 37, values);
+	for (int i = 0; i < 37; ++i)
+	    CHECK(values[i] == t.find(keys[i]));
+
+	// erase every other entry, then refill; iteration sees all entries
+	for (uint32_t i = 0; i < N; i += 2)
+	    t.erase(make_flow(i));
+	CHECK(t.size() == N / 2);
+	for (uint32_t i = N; i < N + N / 2; ++i)
+	    CHECK(t.insert(make_flow(i), i + 1));
+	CHECK(t.size() == N);
+	uint32_t count = 0;
+	for (uint32_t i = 0; i != t.index_limit(); ++i)
+	    if (t.live(i)) {
+		CHECK(t.find_index(t.key(i)) == i);
+		CHECK(*t.find(t.key(i)) == t.value(i));
+		++count;
+	    }
+	CHECK(count == N);
+	for (uint32_t i = 0; i != t.index_limit(); ++i)
+	    if (t.live(i))
+		t.erase_index(i);
+	CHECK(t.empty());
+    }
+
+#if HAVE_IP6
+    {
+	CuckooTable<IP6FlowID, int> t;
+	CHECK(t.reserve(1000) == 0);
+	for (int i = 0; i < 1000; ++i)
+	    CHECK(t.insert(IP6FlowID(IPAddress(htonl(i)), htons(i), IPAddress(htonl(i + 1)), htons(80)), i));
+	CHECK(t.size() == 1000);
+	CHECK(*t.find(IP6FlowID(IPAddress(htonl(500)), htons(500), IPAddress(htonl(501)), htons(80))) == 500);
+	CHECK(!t.find(IP6FlowID(IPAddress(htonl(500)), htons(500), IPAddress(htonl(502)), htons(80))));
+    }
+#endif
+
+    {
+	PerThreadCuckooTable<IPFlowID, int> pt;
+	CHECK(pt.reserve(10, 2) == 0);
+	CHECK(pt.nthreads() == 2);
+	pt[0].insert(IPFlowID(), 1);
+	pt[1].insert(IPFlowID(), 2);
+	CHECK(pt.size() == 2);
+	CHECK(*pt[0].find(IPFlowID()) == 1 && *pt[1].find(IPFlowID()) == 2);
+    }
+
+    {
+	PerThread<uint64_t> c;
+	CHECK(c.resize(3) == 0);
+	CHECK(c.size() == 3);
+	for (int i = 0; i < 3; ++i) {
+	    CHECK(c[i] == 0);
+	    CHECK((reinterpret_cast<uintptr_t>(&c[i]) & (CLICK_CACHE_LINE_SIZE - 1)) == 0);
+	}
+	CHECK(reinterpret_cast<uintptr_t>(&c[1]) - reinterpret_cast<uintptr_t>(&c[0]) == CLICK_CACHE_LINE_SIZE);
+	c.clear();
+	CHECK(c.size() == 0);
+    }
+
+    errh->message("All tests pass!");
+    return 0;
+}
+
+EXPORT_ELEMENT(CuckooTableTest)
+CLICK_ENDDECLS
@@ -0,0 +1,182 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * incksumtest.{cc,hh} -- regression test element for Internet checksums
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "incksumtest.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/timestamp.hh>
+#include <click/straccum.hh>
+#include <clicknet/ip.h>
+CLICK_DECLS
+
+InCksumTest::InCksumTest()
+{
+}
+
+int
+InCksumTest::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _benchmark = false;
+    _iterations = 1000000;
+    return Args(conf, this, errh)
+#if CLICK_USERLEVEL
+	.read("BENCHMARK", _benchmark)
+	.read("ITERATIONS", _iterations)
+#endif
+	.complete();
+}
+
+static uint16_t
+default_cksum(const unsigned char *x, int len)
+{
+    return click_in_cksum(x, len);
+}
+
+// the classic 16-bit loop
+static uint16_t
+reference_cksum(const unsigned char *x, int len)
+{
+    uint32_t sum = 0;
+    for (; len > 1; x += 2, len -= 2) {
+	uint16_t w;
+	memcpy(&w, x, 2);
+	sum += w;
+    }
+    if (len == 1) {
+	uint16_t w = 0;
+	*reinterpret_cast<unsigned char *>(&w) = *x;
+	sum += w;
+    }
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum += sum >> 16;
+    return ~sum;
+}
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test `%s' failed", __FILE__, __LINE__, #x);
+
+int
+InCksumTest::initialize(ErrorHandler *errh)
+{
+    enum { maxlen = 9000 };
+    Vector<unsigned char> bufv(maxlen + 8, 0);
+    unsigned char *buf = bufv.begin();
+    uint32_t r = 0x12345678;
+    for (int i = 0; i < maxlen + 8; ++i) {
+	r = r * 1103515245 + 12345;
+	buf[i] = r >> 16;
+    }
+
+    int rv = 0;
+#if !CLICK_LINUXMODULE
+    for (const click_in_cksum_impl *impl = click_in_cksum_impls();
+	 impl->name && rv == 0; ++impl) {
+	if (!click_in_cksum_impl_supported(impl))
+	    continue;
+	for (int len = 0; len <= 2100 && rv == 0; ++len)
+	    for (int off = 0; off < 8; ++off)
+		if (impl->cksum(buf + off, len) != reference_cksum(buf + off, len)) {
+		    rv = errh->error("%s: wrong checksum at offset %d length %d", impl->name, off, len);
+		    break;
+		}
+	// all-ones data stresses carries
+	memset(buf, 0xFF, maxlen);
+	if (rv == 0 && impl->cksum(buf, maxlen) != reference_cksum(buf, maxlen))
+	    rv = errh->error("%s: wrong checksum of 0xFF bytes", impl->name);
+	for (int i = 0; i < maxlen; ++i) {
+	    r = r * 1103515245 + 12345;
+	    buf[i] = r >> 16;
+	}
+    }
+#endif
+    for (int len = 0; len <= maxlen && rv == 0; len += 13)
+	if (click_in_cksum(buf, len) != reference_cksum(buf, len))
+	    rv = errh->error("click_in_cksum: wrong checksum at length %d", len);
+    if (rv < 0)
+	return rv;
+
+    // incremental updates must agree with recomputation
+    uint16_t *hw = reinterpret_cast<uint16_t *>(buf);
+    for (int trial = 0; trial < 1000; ++trial) {
+	hw[0] = 0;
+	hw[0] = click_in_cksum(buf, 64);
+	uint16_t csum32 = hw[0], csum_sum = hw[0], csum16 = hw[0];
+	r = r * 1103515245 + 12345;
+	int i = 1 + (r >> 16) % 30;
+	uint32_t old_w, new_w = r;
+	memcpy(&old_w, &hw[i], 4);
+	click_update_in_cksum(&csum16, hw[i], new_w);
+	click_update_in_cksum(&csum16, hw[i + 1], new_w >> 16);
+	click_update_in_cksum32(&csum32, old_w, new_w);
+	click_update_in_cksum_sum(&csum_sum, (~hw[i] & 0xFFFF) + (new_w & 0xFFFF)
+				  + (~hw[i + 1] & 0xFFFF) + (new_w >> 16));
+	memcpy(&hw[i], &new_w, 4);
+	hw[0] = 0;
+	uint16_t csum = click_in_cksum(buf, 64);
+	CHECK(csum16 == csum32 && csum16 == csum_sum);
+	// RFC 1624 never produces 0xFFFF, where recomputation produces 0
+	CHECK(csum16 == csum || (csum16 == 0xFFFF && csum == 0)
+	      || (csum16 == 0 && csum == 0xFFFF));
+    }
+
+#if CLICK_USERLEVEL
+    if (_benchmark) {
+	static const int sizes[] = { 20, 64, 128, 256, 512, 1024, 1500, 4096, 9000 };
+	const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+	StringAccum sa;
+	sa << "size";
+	for (int s = 0; s < nsizes; ++s)
+	    sa << '\t' << sizes[s];
+	errh->message("%s", sa.c_str());
+	volatile uint16_t sink = 0;
+	for (int which = -1; ; ++which) {
+	    const char *name = "click_in_cksum";
+	    uint16_t (*f)(const unsigned char *, int) = default_cksum;
+	    if (which == 0) {
+		name = "reference";
+		f = reference_cksum;
+	    }
+	    else if (which > 0) {
+		const click_in_cksum_impl *impl = click_in_cksum_impls() + which - 1;
+		if (!impl->name)
+		    break;
+		if (!click_in_cksum_impl_supported(impl))
+		    continue;
+		name = impl->name;
+		f = impl->cksum;
+	    }
+	    sa.clear();
+	    sa << name;
+	    for (int s = 0; s < nsizes; ++s) {
+		Timestamp t0 = Timestamp::now_steady();
+		for (uint32_t it = 0; it < _iterations; ++it)
+		    sink += f(buf, sizes[s]);
+		Timestamp t1 = Timestamp::now_steady();
+		double ns = (t1 - t0).doubleval() * 1e9 / (_iterations ? _iterations : 1);
+		sa << '\t';
+		sa.snprintf(16, "%.1f", ns);
+	    }
+	    errh->message("%s", sa.c_str());
+	}
+	(void) sink;
+    }
+#endif
+
+    errh->message("All tests pass!");
+    return 0;
+}
+
+EXPORT_ELEMENT(InCksumTest)
+CLICK_ENDDECLS
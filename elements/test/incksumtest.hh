@@ -0,0 +1,64 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_INCKSUMTEST_HH
+#define CLICK_INCKSUMTEST_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+InCksumTest([keywords])
+
+=s test
+
+runs regression tests and benchmarks for Internet checksums
+
+=d
+
+InCksumTest runs regression tests for click_in_cksum and the incremental
+checksum helpers at initialization time. Every click_in_cksum
+implementation the CPU supports is checked against a simple 16-bit
+reference loop over many lengths and alignments. It does not route
+packets.
+
+Keyword arguments are:
+
+=over 8
+
+=item BENCHMARK
+
+Boolean. If true, also time each implementation, and the reference loop,
+on data of several sizes from 20 to 9000 bytes, and print the results in
+nanoseconds per checksum. Default is false. User-level only.
+
+=item ITERATIONS
+
+Unsigned integer. Number of checksums per size in benchmark mode. Default is
+1000000.
+
+=back
+
+=e
+
+  click -qe 'InCksumTest(BENCHMARK true)'
+
+*/
+
+class InCksumTest : public Element { public:
+
+    InCksumTest() CLICK_COLD;
+
+    const char *class_name() const		{ return "InCksumTest"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+
+  private:
+
+    bool _benchmark;
+    uint32_t _iterations;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -10,6 +10,16 @@ CLICK_DECLS
 #define FAKE_PCAP_VERSION_MAJOR		2
 #define FAKE_PCAP_VERSION_MINOR		4
 
+/* pcapng (pcap next generation) block types */
+#define FAKE_PCAPNG_SHB			0x0A0D0D0A	/* section header */
+#define FAKE_PCAPNG_IDB			1	/* interface description */
+#define FAKE_PCAPNG_PB			2	/* packet (obsolete) */
+#define FAKE_PCAPNG_SPB			3	/* simple packet */
+#define FAKE_PCAPNG_EPB			6	/* enhanced packet */
+#define FAKE_PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+#define FAKE_PCAPNG_OPT_TSRESOL		9	/* if_tsresol */
+#define FAKE_PCAPNG_OPT_TSOFFSET	14	/* if_tsoffset */
+
 /* Canonical (pcap file) data link types (may differ from host versions) */
 #define FAKE_DLT_NONE			(-1)	/* Unknown */
 #define FAKE_DLT_NULL			0	/* Null encapsulation */
@@ -86,6 +96,7 @@ int fake_pcap_canonical_dlt(int, bool from_file);
 
 // Handling FORCE_IP.
 bool fake_pcap_dlt_force_ipable(int);
+const click_ip *fake_pcap_find_ip(const uint8_t *, const uint8_t *, int);
 bool fake_pcap_force_ip(Packet*&, int);
 bool fake_pcap_force_ip(WritablePacket*&, int);
 
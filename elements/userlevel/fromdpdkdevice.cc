@@ -29,7 +29,7 @@ CLICK_DECLS
 
 FromDPDKDevice::FromDPDKDevice() :
     _port_id(0), _queue_id(0), _promisc(true), _burst_size(32), _count(0),
-    _task(this)
+    _timestamp(false), _task(this)
 {
 }
 
@@ -47,6 +47,7 @@ int FromDPDKDevice::configure(Vector<String> &conf, ErrorHandler *errh)
         .read("PROMISC", _promisc)
         .read("BURST", _burst_size)
         .read("NDESC", n_desc)
+        .read("TIMESTAMP", _timestamp)
         .complete() < 0)
         return -1;
 
@@ -68,8 +69,11 @@ void FromDPDKDevice::cleanup(CleanupStage)
 bool FromDPDKDevice::run_task(Task * t)
 {
     struct rte_mbuf *pkts[_burst_size];
+    Timestamp now;
 
     unsigned n = rte_eth_rx_burst(_port_id, _queue_id, pkts, _burst_size);
+    if (_timestamp && n)
+        now = Timestamp::now();
     for (unsigned i = 0; i < n; ++i) {
         rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
         WritablePacket *p =
@@ -77,6 +81,8 @@ bool FromDPDKDevice::run_task(Task * t)
                          rte_pktmbuf_data_len(pkts[i]), DPDKDevice::free_pkt,
                          pkts[i]);
         p->set_packet_type_anno(Packet::HOST);
+        if (_timestamp)
+            p->set_timestamp_anno(now);
 
         output(0).push(p);
     }
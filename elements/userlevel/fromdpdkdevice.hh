@@ -13,7 +13,7 @@ CLICK_DECLS
 
 =c
 
-FromDPDKDevice(PORT [, QUEUE [, I<keywords> PROMISC, BURST, NDESC]])
+FromDPDKDevice(PORT [, QUEUE [, I<keywords> PROMISC, BURST, NDESC, TIMESTAMP]])
 
 =s netdevices
 
@@ -54,6 +54,13 @@ The default is 32.
 
 Integer.  Number of descriptors per ring. The default is 256.
 
+=item TIMESTAMP
+
+Boolean.  If true, FromDPDKDevice sets each packet's timestamp annotation to
+the system time at which the packet's burst was read from the device. These
+are software timestamps; hardware receive timestamps are not supported. The
+default is false.
+
 =back
 
 This element is only available at user level, when compiled with DPDK
@@ -71,7 +78,7 @@ Returns the number of packets read by the device.
 
 Resets "count" to zero.
 
-=a DPDKInfo, ToDPDKDevice */
+=a DPDKInfo, ToDPDKDevice, LatencyStamp */
 
 class FromDPDKDevice : public Element {
 public:
@@ -104,6 +111,7 @@ private:
     bool _promisc;
     unsigned int _burst_size;
     unsigned long _count;
+    bool _timestamp;
 
     Task _task;
 };
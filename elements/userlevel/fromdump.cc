@@ -47,7 +47,9 @@ CLICK_DECLS
 	( (((y)&0xff)<<8) | ((u_short)((y)&0xff00)>>8) )
 
 FromDump::FromDump()
-    : _packet(0), _end_h(0), _count(0), _timer(this), _task(this)
+    : _packet(0), _pcapng(false), _end_h(0), _count(0), _timer(this),
+      _task(this), _data_start(0), _index_seek(false), _partition(0),
+      _feed(0), _feed_packet(0)
 {
 }
 
@@ -87,7 +89,8 @@ FromDump::configure(Vector<String> &conf, ErrorHandler *errh)
 #endif
     _packet_filepos = 0;
 
-    if (_ff.configure_keywords(conf, this, errh) < 0)
+    if (_ff.configure_keywords(conf, this, errh) < 0
+	|| _index.configure_keywords(conf, this, errh) < 0)
 	return -1;
     if (Args(conf, this, errh)
 	.read_mp("FILENAME", FilenameArg(), _ff.filename())
@@ -188,6 +191,219 @@ swap_packet_header(const fake_pcap_pkthdr *hp, fake_pcap_pkthdr *outp)
     outp->len = SWAPLONG(hp->len);
 }
 
+bool
+FromDump::read_pcapng_section(uint32_t length, uint32_t byte_order,
+			      uint32_t consumed, ErrorHandler *errh)
+{
+    // The block type is a palindrome; the byte-order magic says how to
+    // read the rest of the section.
+    if (byte_order == FAKE_PCAPNG_BYTE_ORDER_MAGIC)
+	_swapped = false;
+    else if (byte_order == SWAPLONG(FAKE_PCAPNG_BYTE_ORDER_MAGIC)) {
+	_swapped = true;
+	length = SWAPLONG(length);
+    } else {
+	_ff.error(errh, "not a pcapng file (bad byte-order magic)");
+	return false;
+    }
+    if (length < 28 || (length & 3)) {
+	_ff.error(errh, "bad pcapng section header");
+	return false;
+    }
+    _interfaces.clear();
+    _ff.shift_pos(length - consumed);
+    return true;
+}
+
+bool
+FromDump::read_pcapng_interface(const String &body, ErrorHandler *errh)
+{
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(body.data());
+    const uint8_t *end = data + body.length();
+    if (body.length() < 8) {
+	_ff.error(errh, "bad pcapng interface description");
+	return false;
+    }
+
+    PcapngInterface iface;
+    uint16_t linktype;
+    memcpy(&linktype, data, 2);
+    memcpy(&iface.snaplen, data + 4, 4);
+    if (_swapped) {
+	linktype = SWAPSHORT(linktype);
+	iface.snaplen = SWAPLONG(iface.snaplen);
+    }
+    iface.linktype = fake_pcap_canonical_dlt(linktype, true);
+    iface.tsresol = 6;
+    iface.tsoffset = 0;
+
+    // options are 4-byte aligned (code, length, value)
+    for (data += 8; data + 4 <= end; ) {
+	uint16_t code, olen;
+	memcpy(&code, data, 2);
+	memcpy(&olen, data + 2, 2);
+	if (_swapped) {
+	    code = SWAPSHORT(code);
+	    olen = SWAPSHORT(olen);
+	}
+	data += 4;
+	if (code == 0 || data + olen > end)
+	    break;
+	if (code == FAKE_PCAPNG_OPT_TSRESOL && olen == 1)
+	    iface.tsresol = data[0];
+	else if (code == FAKE_PCAPNG_OPT_TSOFFSET && olen == 8) {
+	    uint32_t w[2];
+	    memcpy(w, data, 8);
+	    if (_swapped)
+		iface.tsoffset = (int64_t) (((uint64_t) SWAPLONG(w[0]) << 32) | SWAPLONG(w[1]));
+	    else
+		memcpy(&iface.tsoffset, data, 8);
+	}
+	data += (olen + 3) & ~3;
+    }
+
+    if ((iface.tsresol & 0x80) ? (iface.tsresol & 0x7F) > 63 : iface.tsresol > 19) {
+	_ff.error(errh, "unsupported pcapng timestamp resolution %d", iface.tsresol);
+	return false;
+    }
+    if (_force_ip && !fake_pcap_dlt_force_ipable(iface.linktype)) {
+	_ff.error(errh, "unknown linktype %d; can't force IP packets", iface.linktype);
+	return false;
+    }
+    if (!_interfaces.size())
+	_linktype = iface.linktype;
+    _interfaces.push_back(iface);
+    return true;
+}
+
+Timestamp
+FromDump::pcapng_timestamp(const PcapngInterface &iface,
+			   uint32_t high, uint32_t low) const
+{
+    uint64_t t = ((uint64_t) high << 32) | low;
+    uint64_t sec;
+    uint32_t nsec;
+    int r = iface.tsresol & 0x7F;
+    if (iface.tsresol & 0x80) {
+	sec = t >> r;
+	uint64_t frac = t & ((1ULL << r) - 1);
+	if (r > 32)
+	    nsec = ((frac >> (r - 32)) * 1000000000) >> 32;
+	else
+	    nsec = (frac * 1000000000) >> r;
+    } else if (r == 6) {
+	sec = t / 1000000;
+	nsec = (t % 1000000) * 1000;
+    } else {
+	uint64_t units = 1;
+	for (int i = 0; i < r; ++i)
+	    units *= 10;
+	sec = t / units;
+	uint64_t frac = t % units;
+	for (; r < 9; ++r)
+	    frac *= 10;
+	for (; r > 9; --r)
+	    frac /= 10;
+	nsec = frac;
+    }
+    return Timestamp::make_nsec(sec + iface.tsoffset, nsec);
+}
+
+int
+FromDump::read_pcapng_block(Timestamp &ts, int &caplen, int &len,
+			    int &skiplen, ErrorHandler *errh)
+{
+    // Returns 1 after reading a packet header, 0 after reading another
+    // block, and -1 at the end of the file or on error.
+    uint32_t swapped[5];
+    const uint32_t *bh = reinterpret_cast<const uint32_t *>(_ff.get_aligned(8, swapped, errh));
+    if (!bh)
+	return -1;
+
+    uint32_t type = bh[0], length = bh[1];
+    if (type == FAKE_PCAPNG_SHB) {
+	// the index cannot seek past a change of interfaces
+	_index.invalidate();
+	if (!(bh = reinterpret_cast<const uint32_t *>(_ff.get_aligned(4, swapped + 2, errh))))
+	    return -1;
+	return read_pcapng_section(length, bh[0], 12, errh) ? 0 : -1;
+    }
+    if (_swapped) {
+	type = SWAPLONG(type);
+	length = SWAPLONG(length);
+    }
+    if (length < 12 || (length & 3)) {
+	_ff.error(errh, "bad pcapng block length; giving up");
+	return -1;
+    }
+    uint32_t body = length - 12;
+
+    if (type == FAKE_PCAPNG_IDB) {
+	_index.invalidate();
+	String s = _ff.get_string(body, errh);
+	if (s.length() != (int) body || !read_pcapng_interface(s, errh))
+	    return -1;
+	_ff.shift_pos(4);
+	return 0;
+    }
+
+    const PcapngInterface *iface;
+    if (type == FAKE_PCAPNG_EPB || type == FAKE_PCAPNG_PB) {
+	const uint32_t *ph;
+	if (body < 20
+	    || !(ph = reinterpret_cast<const uint32_t *>(_ff.get_aligned(20, swapped, errh))))
+	    goto bad;
+	uint32_t w[5];
+	for (int i = 0; i < 5; ++i)
+	    w[i] = _swapped ? SWAPLONG(ph[i]) : ph[i];
+	// the obsolete packet block has a 16-bit interface ID
+	uint32_t ifid = w[0];
+	if (type == FAKE_PCAPNG_PB) {
+	    uint16_t ifid16;
+	    memcpy(&ifid16, ph, 2);
+	    ifid = _swapped ? SWAPSHORT(ifid16) : ifid16;
+	}
+	if (ifid >= (uint32_t) _interfaces.size()) {
+	    _ff.error(errh, "packet from unknown pcapng interface %u", ifid);
+	    return -1;
+	}
+	iface = &_interfaces[ifid];
+	caplen = w[3];
+	len = w[4];
+	if ((uint32_t) caplen > body - 20)
+	    goto bad;
+	ts = pcapng_timestamp(*iface, w[1], w[2]);
+	skiplen = body - 20 - caplen + 4;
+    } else if (type == FAKE_PCAPNG_SPB) {
+	const uint32_t *ph;
+	if (body < 4 || !_interfaces.size()
+	    || !(ph = reinterpret_cast<const uint32_t *>(_ff.get_aligned(4, swapped, errh))))
+	    goto bad;
+	iface = &_interfaces[0];
+	len = _swapped ? SWAPLONG(ph[0]) : ph[0];
+	caplen = len;
+	if (iface->snaplen && (uint32_t) caplen > iface->snaplen)
+	    caplen = iface->snaplen;
+	if ((uint32_t) caplen > body - 4)
+	    caplen = body - 4;
+	ts = _pcapng_last_ts;
+	skiplen = body - 4 - caplen + 4;
+    } else {
+	_ff.shift_pos(body + 4);
+	return 0;
+    }
+
+    if (len < caplen)
+	len = caplen;
+    _linktype = iface->linktype;
+    _pcapng_last_ts = ts;
+    return 1;
+
+  bad:
+    _ff.error(errh, "bad pcapng packet block; giving up");
+    return -1;
+}
+
 FromDump *
 FromDump::hotswap_element() const
 {
@@ -211,13 +427,31 @@ FromDump::initialize(ErrorHandler *errh)
     if (output_is_push(0))
 	ScheduleInfo::initialize_task(this, &_task, _active, errh);
     _timer.initialize(this);
+    _partition = router()->trace_partition();
 
     // skip if hotswapping
     if (hotswap_element())
 	return 0;
 
+    // in a parallel trace, the first copy reads the file for all copies
+    if (_partition && (_feed = _partition->feed(name()))) {
+	FromDump *fd;
+	if (_partition->index() == 0)
+	    _feed->set_source(this, output_is_push(0) ? &_task : 0);
+	else if (_feed->source()
+		 && (fd = static_cast<FromDump *>(_feed->source()->cast("FromDump")))
+		 && fd->_ff.filename() == _ff.filename()) {
+	    _feed->attach(_partition->index(), output_is_push(0) ? &_task : 0);
+	    _linktype = fd->_linktype;
+	    _force_ip = fd->_force_ip;
+	    return 0;
+	} else
+	    _feed = 0;
+    }
+
     // open file
-    if (_ff.initialize(errh) < 0)
+    if (_ff.initialize(errh) < 0
+	|| _index.initialize(_ff.filename(), errh) < 0)
 	return -1;
 
     // check magic number
@@ -226,6 +460,32 @@ FromDump::initialize(ErrorHandler *errh)
     if (!fh)
 	return _ff.error(errh, "not a tcpdump file (too short)");
 
+    if (fh->magic == FAKE_PCAPNG_SHB) {
+	const uint32_t *shb = reinterpret_cast<const uint32_t *>(fh);
+	_pcapng = true;
+	_have_nanosecond_timestamps = false;
+	_linktype = FAKE_DLT_NONE;
+	if (!read_pcapng_section(shb[1], shb[2], sizeof(*fh), errh))
+	    return -1;
+	// read the interface descriptions that precede the first packet
+	while (1) {
+	    off_t pos = _ff.file_pos();
+	    const uint32_t *bh = reinterpret_cast<const uint32_t *>(_ff.get_aligned(4, &swapped_fh, errh));
+	    if (!bh)
+		break;
+	    bool idb = *bh == (_swapped ? SWAPLONG(FAKE_PCAPNG_IDB) : FAKE_PCAPNG_IDB);
+	    if (_ff.seek(pos, errh) < 0)
+		return -1;
+	    Timestamp ts;
+	    int caplen, len, skiplen;
+	    if (!idb)
+		break;
+	    else if (read_pcapng_block(ts, caplen, len, skiplen, errh) < 0)
+		return -1;
+	}
+	goto skip_ahead;
+    }
+
     if (fh->magic == FAKE_PCAP_MAGIC || fh->magic == FAKE_PCAP_MAGIC_NANO || fh->magic == FAKE_MODIFIED_PCAP_MAGIC)
 	_swapped = false;
     else {
@@ -257,12 +517,18 @@ FromDump::initialize(ErrorHandler *errh)
 	_force_ip = true;
 
     // maybe skip ahead in the file
+  skip_ahead:
+    _data_start = _ff.file_pos();
+    _index.begin(_data_start);
     if (_packet_filepos != 0) {
+	_index.invalidate();
 	int result = _ff.seek(_packet_filepos, errh);
 	_packet_filepos = 0;
 	return result;
-    } else
+    } else {
+	_index_seek = _have_first_time && _index.enabled();
 	return 0;
+    }
 }
 
 void
@@ -278,6 +544,10 @@ FromDump::take_state(Element *e, ErrorHandler *errh)
     _swapped = o->_swapped;
     _extra_pkthdr_crap = o->_extra_pkthdr_crap;
     _minor_version = o->_minor_version;
+    _have_nanosecond_timestamps = o->_have_nanosecond_timestamps;
+    _pcapng = o->_pcapng;
+    _interfaces.swap(o->_interfaces);
+    _pcapng_last_ts = o->_pcapng_last_ts;
 
     _linktype = o->_linktype;
     if (_linktype == FAKE_DLT_RAW)
@@ -287,15 +557,22 @@ FromDump::take_state(Element *e, ErrorHandler *errh)
 
     _timing_offset = o->_timing_offset;
     _packet_filepos = o->_packet_filepos;
+    _data_start = o->_data_start;
+    _index.begin(_data_start);
+    _index.invalidate();
 }
 
 void
 FromDump::cleanup(CleanupStage)
 {
+    _index.cleanup(ErrorHandler::default_handler());
     _ff.cleanup();
     if (_packet)
 	_packet->kill();
     _packet = 0;
+    if (_feed_packet)
+	_feed_packet->kill();
+    _feed_packet = 0;
 }
 
 void
@@ -324,6 +601,50 @@ FromDump::prepare_times(const Timestamp &ts)
     _have_any_times = true;
 }
 
+void
+FromDump::seek_index(ErrorHandler *errh)
+{
+    // Jump to the START time, which for START_AFTER depends on the first
+    // timestamp in the file.
+    _index_seek = false;
+    if (_first_time_relative) {
+	if (!_index.has_first_time())
+	    return;
+	prepare_times(_index.first_time());
+    }
+    int i = _index.lookup(_first_time);
+    if (i == 0)
+	return;
+    if (_ff.seek(_index.offset(i), errh) >= 0)
+	_index.resume(i);
+    else
+	_index.invalidate();
+}
+
+int
+FromDump::seek_time(const Timestamp &t, ErrorHandler *errh)
+{
+    int i = 0;
+    off_t pos = _data_start;
+    if (_index.enabled()) {
+	i = _index.lookup(t);
+	pos = _index.offset(i);
+    }
+    if (_ff.seek(pos, errh) < 0)
+	return -1;
+    if (_index.enabled())
+	_index.resume(i);
+    if (_packet)
+	_packet->kill();
+    _packet = 0;
+    _index_seek = false;
+    _first_time = t;
+    _have_first_time = true;
+    _first_time_relative = false;
+    set_active(_active);
+    return 0;
+}
+
 bool
 FromDump::read_packet(ErrorHandler *errh)
 {
@@ -334,12 +655,46 @@ FromDump::read_packet(ErrorHandler *errh)
     Packet *p;
     assert(!_packet);
 
+    if (_feed) {
+	if (_partition->index() != 0) {
+	    // take packets from the first copy, and its timing
+	    bool more = true;
+	    if ((_packet = _feed->pull(_partition->index(), more))
+		&& !_have_any_times) {
+		_timing_offset = static_cast<FromDump *>(_feed->source())->_timing_offset;
+		_have_any_times = true;
+	    }
+	    return more;
+	} else if (_feed_packet) {
+	    if (!_feed->push(_feed_index, _feed_packet))
+		return true;
+	    _feed_packet = 0;
+	}
+    }
+
+    if (_index_seek)
+	seek_index(errh);
+
     // record file position
     _packet_filepos = _ff.file_pos();
 
+    if (_pcapng) {
+	int r;
+	while ((r = read_pcapng_block(ts, caplen, len, skiplen, errh)) == 0)
+	    _packet_filepos = _ff.file_pos();
+	if (r < 0) {
+	    _index.finish(_packet_filepos);
+	    return false;
+	}
+	_index.note(_packet_filepos, ts);
+	goto check_times;
+    }
+
     // read the packet header
-    if (!(ph = reinterpret_cast<const fake_pcap_pkthdr *>(_ff.get_aligned(sizeof(*ph), &swapped_ph))))
+    if (!(ph = reinterpret_cast<const fake_pcap_pkthdr *>(_ff.get_aligned(sizeof(*ph), &swapped_ph)))) {
+	_index.finish(_packet_filepos);
 	return false;
+    }
     if (_swapped) {
 	swap_packet_header(ph, &swapped_ph);
 	ph = &swapped_ph;
@@ -369,10 +724,11 @@ FromDump::read_packet(ErrorHandler *errh)
 
     // compensate for modified pcap versions
     _ff.shift_pos(_extra_pkthdr_crap);
+    ts = fake_bpf_timeval_union::make_timestamp(&ph->ts, _have_nanosecond_timestamps);
 
     // check times
+    _index.note(_packet_filepos, ts);
   check_times:
-    ts = fake_bpf_timeval_union::make_timestamp(&ph->ts, _have_nanosecond_timestamps);
     if (!_have_any_times)
 	prepare_times(ts);
     if (_have_first_time) {
@@ -404,10 +760,26 @@ FromDump::read_packet(ErrorHandler *errh)
     p = _ff.get_packet(caplen, ts.sec(), ts.subsec(), errh);
     if (!p)
 	return false;
+
     SET_EXTRA_LENGTH_ANNO(p, len - caplen);
     _ff.shift_pos(skiplen);
-
     p->set_mac_header(p->data());
+
+    // in a parallel trace, hand other copies' packets to them, or skip them
+    // if those copies read the file themselves
+    if (_partition) {
+	int i = _partition->partition_of(fake_pcap_find_ip(p->data(), p->end_data(), _linktype), p->end_data());
+	if (i != _partition->index()) {
+	    if (!_feed || !_feed->attached(i))
+		p->kill();
+	    else if (!_feed->push(i, p)) {
+		_feed_packet = p;
+		_feed_index = i;
+	    }
+	    return true;
+	}
+    }
+
     _packet = p;
     return true;
 }
@@ -452,19 +824,39 @@ FromDump::run_task(Task *)
     int retry_count = 0;
   again:
     if (!_packet && !read_packet(0)) {
+	if (_feed)
+	    _feed->finish();
 	if (_end_h)
 	    _end_h->call_write(ErrorHandler::default_handler());
 	return false;
     }
-    if (_packet && _timing && !check_timing(_packet))
+    if (_packet && _timing && !check_timing(_packet)) {
+	if (_feed && _partition->index() == 0)
+	    _feed->wake_pullers();
 	return false;
-    if (_packet && _force_ip && !fake_pcap_force_ip(_packet, _linktype)) {
+    }
+    if (_packet && (_force_ip || _linktype == FAKE_DLT_RAW)
+	&& !fake_pcap_force_ip(_packet, _linktype)) {
 	checked_output_push(1, _packet);
 	_packet = 0;
     }
-    if (!_packet && ++retry_count < 16)
+    if (!_packet && !_feed_packet && ++retry_count < 16)
 	goto again;
 
+    // in a parallel trace, wake the other side of the feed, and sleep while
+    // there is nothing to pull or no room to push
+    if (_feed) {
+	int i = _partition->index();
+	bool sleep = !_packet && (_feed_packet ? _feed->sleep_push(_feed_index)
+				  : i != 0 && _feed->sleep_pull(i));
+	if (i == 0)
+	    _feed->wake_pullers(sleep || _timing ? 1 : TraceFeed::wake_batch);
+	else
+	    _feed->wake_pusher(i);
+	if (sleep)
+	    return false;
+    }
+
     _task.fast_reschedule();
     if (_packet) {
 	output(0).push(_packet);
@@ -488,13 +880,16 @@ FromDump::pull(int)
 	more = read_packet(0);
     if (_packet && _timing && !check_timing(_packet))
 	return 0;
-    if (_packet && _force_ip && !fake_pcap_force_ip(_packet, _linktype)) {
+    if (_packet && (_force_ip || _linktype == FAKE_DLT_RAW)
+	&& !fake_pcap_force_ip(_packet, _linktype)) {
 	checked_output_push(1, _packet);
 	_packet = 0;
     }
 
     // notify presence/absence of more packets
     _notifier.set_active(more, true);
+    if (!more && _feed)
+	_feed->finish();
     if (!more && _end_h)
 	_end_h->call_write(ErrorHandler::default_handler());
 
@@ -508,7 +903,8 @@ FromDump::pull(int)
 
 enum {
     H_SAMPLING_PROB, H_ACTIVE, H_ENCAP, H_STOP, H_PACKET_FILEPOS,
-    H_EXTEND_INTERVAL, H_COUNT, H_RESET_COUNTS, H_RESET_TIMING
+    H_EXTEND_INTERVAL, H_COUNT, H_RESET_COUNTS, H_RESET_TIMING, H_FILEPOS,
+    H_SEEK_TIME
 };
 
 String
@@ -561,6 +957,20 @@ FromDump::write_handler(const String &s_in, Element *e, void *thunk, ErrorHandle
 	fd->_last_time_relative = fd->_last_time_interval = false;
 	fd->_have_any_times = false;
 	return 0;
+      case H_FILEPOS: {
+	  off_t offset;
+	  if (!cp_file_offset(s, &offset))
+	      return errh->error("argument must be file offset");
+	  fd->_index_seek = false;
+	  fd->_index.invalidate();
+	  return fd->_ff.seek(offset, errh);
+      }
+      case H_SEEK_TIME: {
+	  Timestamp t;
+	  if (!cp_time(s, &t))
+	      return errh->error("'seek_time' takes a timestamp");
+	  return fd->seek_time(t, errh);
+      }
       default:
 	return -EINVAL;
     }
@@ -569,7 +979,8 @@ FromDump::write_handler(const String &s_in, Element *e, void *thunk, ErrorHandle
 void
 FromDump::add_handlers()
 {
-    _ff.add_handlers(this, true);
+    _ff.add_handlers(this);
+    add_write_handler("filepos", write_handler, H_FILEPOS);
     add_read_handler("sampling_prob", read_handler, H_SAMPLING_PROB);
     add_data_handlers("active", Handler::OP_READ | Handler::CHECKBOX, &_active);
     add_write_handler("active", write_handler, H_ACTIVE);
@@ -580,10 +991,11 @@ FromDump::add_handlers()
     add_data_handlers("count", Handler::OP_READ, &_count);
     add_write_handler("reset_counts", write_handler, H_RESET_COUNTS, Handler::BUTTON);
     add_write_handler("reset_timing", write_handler, H_RESET_TIMING, Handler::BUTTON);
+    add_write_handler("seek_time", write_handler, H_SEEK_TIME);
     if (output_is_push(0))
 	add_task_handlers(&_task);
 }
 
 CLICK_ENDDECLS
-ELEMENT_REQUIRES(userlevel|ns FakePcap)
+ELEMENT_REQUIRES(userlevel|ns FakePcap TimeIndex)
 EXPORT_ELEMENT(FromDump)
@@ -6,13 +6,15 @@
 #include <click/timer.hh>
 #include <click/notifier.hh>
 #include <click/fromfile.hh>
+#include <click/tracepartition.hh>
+#include "timeindex.hh"
 CLICK_DECLS
 class HandlerCall;
 
 /*
 =c
 
-FromDump(FILENAME [, I<keywords> STOP, TIMING, SAMPLE, FORCE_IP, START, START_AFTER, END, END_AFTER, INTERVAL, END_CALL, FILEPOS, MMAP])
+FromDump(FILENAME [, I<keywords> STOP, TIMING, SAMPLE, FORCE_IP, START, START_AFTER, END, END_AFTER, INTERVAL, END_CALL, FILEPOS, MMAP, INDEX])
 
 =s traces
 
@@ -24,8 +26,16 @@ Reads packets from a file produced by `tcpdump -w FILENAME' or ToDump and
 emits them from the output, optionally stopping the driver when there are no
 more packets.
 
-FromDump also transparently reads gzip- and bzip2-compressed tcpdump files, if
-you have zcat(1) and bzcat(1) installed.
+FromDump reads classic pcap files, with microsecond or nanosecond
+timestamps, and pcapng files. A pcapng file may contain several sections
+and interfaces; each interface has its own link type and timestamp
+resolution, and FromDump emits the packets of all interfaces in file order.
+Simple packet blocks, which carry no timestamp, are given the timestamp of
+the preceding packet.
+
+FromDump also transparently reads gzip-, xz-, zstd-, and bzip2-compressed
+tcpdump files (see FromFile's compression support; some formats require
+zcat(1) or bzcat(1)).
 
 Keyword arguments are:
 
@@ -104,15 +114,63 @@ FromDump will emit garbage.
 =item MMAP
 
 Boolean. If true, then FromDump will use mmap(2) to access the tcpdump file.
-This can result in slightly better performance on some machines. FromDump's
-regular file discipline is pretty optimized, so the difference is often small
-in practice. Default is true on most operating systems, but false on Linux.
+Packets then refer directly to the mapped file, without copying: each
+mapping is unmapped when the last packet that refers to it is freed. Such
+packets are shared, so an element that modifies one first makes a private
+copy. Default is true.
+
+=item INDEX
+
+Boolean. If true, then FromDump uses a time index of the file, stored in
+FILENAME.tidx, to find the START time (or the time written to C<seek_time>)
+without reading the file up to that point. If the index does not exist, or
+the file has changed since it was built, FromDump builds it as it reads, and
+saves it when the router is cleaned up. The index covers as much of the
+file as FromDump read sequentially from its beginning. Default is false.
+
+=item INDEX_FILE
+
+Filename. Time index file to use instead of FILENAME.tidx. Implies INDEX.
+
+=item INDEX_INTERVAL
+
+Time in seconds. The index has an entry for roughly every INDEX_INTERVAL
+seconds of trace time. Default is 1 second.
 
 =back
 
 You can supply at most one of START and START_AFTER, and at most one of END,
 END_AFTER, and INTERVAL.
 
+=head2 Time Indexes
+
+A time index lists, for regularly spaced file offsets, the largest packet
+timestamp before each offset. To start at time I<T>, FromDump seeks to the
+last offset before which every packet is earlier than I<T>, and reads on from
+there, skipping any packets earlier than I<T> as usual. Pulling a
+one-minute slice from the end of a day-long trace thus reads little more
+than that minute. The same holds for unsorted traces. Indexes work on compressed
+files too, but then FromDump must still decompress the data it skips.
+
+To build a trace's index ahead of time, read it once:
+
+  FromDump(trace.pcap, INDEX true, STOP true) -> Discard;
+
+An index built from a pcapng file stops at the first section header or
+interface description after the first packet.
+
+=head2 Parallel Traces
+
+In parallel trace mode (C<click --parallel-trace N>), Click runs N copies of
+the configuration, each on its own thread. Only the first copy's FromDump
+reads the file. It emits the packets in its own share of the trace and hands
+each other packet to the copy whose share holds it, as chosen by a symmetric
+hash of the packets' IP addresses. Non-IP packets go to the first copy. The
+other copies' FromDump elements emit the packets handed to them, and stop
+when the first copy reaches the end of the trace. Settings that choose
+packets, such as START, END, and SAMPLE, take effect in the first copy. See
+click(1).
+
 Only available in user-level processes.
 
 =n
@@ -128,7 +186,8 @@ FromDump is a notifier signal, active when the element is active and the dump
 contains more packets.
 
 If FromDump uses mmap, then a corrupt file might cause Click to crash with a
-segmentation violation.
+segmentation violation. Packets that refer to the mapped file keep it mapped
+while they are queued or stored.
 
 =h count read-only
 
@@ -148,7 +207,8 @@ Value is a Boolean.
 
 =h encap read-only
 
-Returns the file's encapsulation type.
+Returns the file's encapsulation type. For pcapng files, returns the
+encapsulation of the interface of the most recently read packet.
 
 =h filename read-only
 
@@ -163,6 +223,13 @@ cannot be determined (because the file was compressed, for example).
 
 Returns or sets FromDump's position in the (uncompressed) file, in bytes.
 
+=h seek_time write-only
+
+Text is an absolute timestamp. Writing it restarts reading at the first
+packet whose timestamp is at or after that time, as if it were the START
+time, using the time index if INDEX is true and otherwise reading from the
+beginning of the file. Seeking backward requires an uncompressed file.
+
 =h packet_filepos read-only
 
 Returns the (uncompressed) file position of the last packet emitted, in bytes.
@@ -228,6 +295,7 @@ class FromDump : public Element { public:
     bool _last_time_relative : 1;
     bool _last_time_interval : 1;
     bool _have_nanosecond_timestamps : 1;
+    bool _pcapng : 1;
     bool _active;
     unsigned _extra_pkthdr_crap;
     unsigned _sampling_prob;
@@ -251,11 +319,38 @@ class FromDump : public Element { public:
 
     Timestamp _timing_offset;
     off_t _packet_filepos;
+    off_t _data_start;		// offset of the first packet
+
+    TimeIndex _index;
+    bool _index_seek;		// seek to START on the first read
+
+    const TracePartition *_partition;
+    TraceFeed *_feed;
+    Packet *_feed_packet;	// waiting for room in _feed
+    int _feed_index;
+
+    struct PcapngInterface {
+	int linktype;
+	uint32_t snaplen;
+	uint8_t tsresol;	// if_tsresol: 10^-n, or 2^-n if the top bit is set
+	int64_t tsoffset;	// if_tsoffset, in seconds
+    };
+    Vector<PcapngInterface> _interfaces;
+    Timestamp _pcapng_last_ts;
 
     bool read_packet(ErrorHandler *);
+    bool read_pcapng_section(uint32_t length, uint32_t byte_order,
+			     uint32_t consumed, ErrorHandler *);
+    bool read_pcapng_interface(const String &body, ErrorHandler *);
+    int read_pcapng_block(Timestamp &ts, int &caplen, int &len, int &skiplen,
+			  ErrorHandler *);
+    Timestamp pcapng_timestamp(const PcapngInterface &iface,
+			       uint32_t high, uint32_t low) const;
 
     void prepare_times(const Timestamp &);
     bool check_timing(Packet *p);
+    void seek_index(ErrorHandler *);
+    int seek_time(const Timestamp &, ErrorHandler *);
 
     static String read_handler(Element *, void *) CLICK_COLD;
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
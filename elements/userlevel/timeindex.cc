@@ -0,0 +1,267 @@
+// -*- mode: c++; c-basic-offset: 4 -*-
+/*
+ * timeindex.{cc,hh} -- sidecar index from trace timestamps to file offsets
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "timeindex.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/userutils.hh>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+CLICK_DECLS
+
+// File layout, big-endian: a header of magic, version, flags, trace size,
+// trace mtime, first timestamp and entry count, then the entries.
+static const char index_magic[] = "ClickTIX";
+enum {
+    HEADER_SIZE = 40, ENTRY_SIZE = 16, VERSION = 1,
+    F_HAVE_FIRST = 1, F_COMPLETE = 2
+};
+
+static inline uint32_t
+get4(const uint8_t *p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint64_t
+get8(const uint8_t *p)
+{
+    return ((uint64_t) get4(p) << 32) | get4(p + 4);
+}
+
+static inline void
+put4(StringAccum &sa, uint32_t x)
+{
+    if (char *s = sa.extend(4)) {
+	s[0] = x >> 24;
+	s[1] = x >> 16;
+	s[2] = x >> 8;
+	s[3] = x;
+    }
+}
+
+static inline void
+put8(StringAccum &sa, uint64_t x)
+{
+    put4(sa, x >> 32);
+    put4(sa, x);
+}
+
+TimeIndex::TimeIndex()
+    : _interval(1, 0), _trace_size(-1), _end(-1), _trace_mtime(0),
+      _enabled(false), _have_first(false), _building(false), _dirty(false)
+{
+}
+
+int
+TimeIndex::configure_keywords(Vector<String> &conf, Element *e, ErrorHandler *errh)
+{
+    bool index = false;
+    String filename;
+    Timestamp interval = _interval;
+    if (Args(e, errh).bind(conf)
+	.read("INDEX", index)
+	.read("INDEX_FILE", FilenameArg(), filename)
+	.read("INDEX_INTERVAL", interval)
+	.consume() < 0)
+	return -1;
+    if (interval <= Timestamp())
+	return errh->error("INDEX_INTERVAL must be positive");
+    _interval = interval;
+    _filename = filename;
+    _enabled = index || filename;
+    return 0;
+}
+
+int
+TimeIndex::initialize(const String &trace_filename, ErrorHandler *errh)
+{
+    if (!_enabled)
+	return 0;
+    struct stat s;
+    if (!trace_filename || trace_filename == "-"
+	|| stat(trace_filename.c_str(), &s) < 0 || !S_ISREG(s.st_mode))
+	return errh->error("INDEX requires a regular trace file");
+    if (!_filename)
+	_filename = trace_filename + ".tidx";
+    _trace_size = s.st_size;
+    _trace_mtime = s.st_mtime;
+    return read(errh);
+}
+
+int
+TimeIndex::read(ErrorHandler *errh)
+{
+    _entries.clear();
+    _have_first = false;
+    _end = -1;
+    if (access(_filename.c_str(), F_OK) < 0)
+	return 0;
+
+    String data = file_string(_filename, errh);
+    const uint8_t *s = reinterpret_cast<const uint8_t *>(data.data());
+    uint32_t n;
+    if (data.length() < HEADER_SIZE
+	|| memcmp(s, index_magic, 8) != 0
+	|| get4(s + 8) != VERSION
+	|| (n = get4(s + 36)) != (uint32_t) (data.length() - HEADER_SIZE) / ENTRY_SIZE
+	|| (data.length() - HEADER_SIZE) % ENTRY_SIZE != 0) {
+	errh->warning("%s: bad time index, rebuilding", _filename.c_str());
+	return 0;
+    }
+    // an index of an older version of the trace is useless
+    if ((off_t) get8(s + 16) != _trace_size || get4(s + 24) != _trace_mtime)
+	return 0;
+
+    uint32_t flags = get4(s + 12);
+    _have_first = (flags & F_HAVE_FIRST) != 0;
+    _first = Timestamp::make_nsec((int32_t) get4(s + 28), get4(s + 32));
+    for (s += HEADER_SIZE; n; --n, s += ENTRY_SIZE) {
+	Entry e;
+	e.pos = get8(s);
+	e.max = Timestamp::make_nsec((int32_t) get4(s + 8), get4(s + 12));
+	if (_entries.size() && e.pos <= _entries.back().pos) {
+	    errh->warning("%s: bad time index, rebuilding", _filename.c_str());
+	    _entries.clear();
+	    _have_first = false;
+	    return 0;
+	}
+	_entries.push_back(e);
+    }
+    if ((flags & F_COMPLETE) && _entries.size())
+	_end = _entries.back().pos;
+    return 0;
+}
+
+void
+TimeIndex::cleanup(ErrorHandler *errh)
+{
+    _building = false;
+    if (!_dirty || !_entries.size())
+	return;
+    _dirty = false;
+
+    StringAccum sa;
+    sa.append(index_magic, 8);
+    put4(sa, VERSION);
+    put4(sa, (_have_first ? F_HAVE_FIRST : 0) | (_end >= 0 ? F_COMPLETE : 0));
+    put8(sa, _trace_size);
+    put4(sa, _trace_mtime);
+    put4(sa, _first.sec());
+    put4(sa, _first.nsec());
+    put4(sa, _entries.size());
+    for (const Entry *e = _entries.begin(); e != _entries.end(); ++e) {
+	put8(sa, e->pos);
+	put4(sa, e->max.sec());
+	put4(sa, e->max.nsec());
+    }
+
+    // write a temporary file and rename it, so readers never see a partial
+    // index
+    String tmp = _filename + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+	errh->warning("%s: %s", tmp.c_str(), strerror(errno));
+	return;
+    }
+    size_t w = fwrite(sa.data(), 1, sa.length(), f);
+    if (fclose(f) != 0 || w != (size_t) sa.length()
+	|| rename(tmp.c_str(), _filename.c_str()) < 0) {
+	errh->warning("%s: %s", _filename.c_str(), strerror(errno));
+	(void) unlink(tmp.c_str());
+    }
+}
+
+/** @brief Start indexing at the first record, at offset @a pos.
+ *
+ * An index loaded from a file whose first entry is elsewhere is discarded. */
+void
+TimeIndex::begin(off_t pos)
+{
+    if (!_enabled)
+	return;
+    if (_entries.size() && _entries[0].pos != pos) {
+	_entries.clear();
+	_have_first = false;
+	_end = -1;
+    }
+    if (!_entries.size()) {
+	Entry e;
+	e.pos = pos;
+	_entries.push_back(e);
+    }
+    resume(0);
+}
+
+/** @brief Return the last entry before which every record is earlier than
+ * @a t.
+ *
+ * The first entry, at the first record, always qualifies. */
+int
+TimeIndex::lookup(const Timestamp &t) const
+{
+    int l = 1, r = _entries.size();
+    while (l < r) {
+	int m = l + (r - l) / 2;
+	if (_entries[m].max < t)
+	    l = m + 1;
+	else
+	    r = m;
+    }
+    return l - 1;
+}
+
+/** @brief Note that reading continues from entry @a i. */
+void
+TimeIndex::resume(int i)
+{
+    _max = _entries[i].max;
+    const Entry &last = _entries.back();
+    _next = (_entries.size() == 1 ? _first : last.max) + _interval;
+    _building = _end < 0;
+}
+
+void
+TimeIndex::add_entry(off_t pos)
+{
+    Entry e;
+    e.pos = pos;
+    e.max = _max;
+    _entries.push_back(e);
+    _next = _max + _interval;
+    _dirty = true;
+}
+
+/** @brief Note the end of the trace, at offset @a pos. */
+void
+TimeIndex::finish(off_t pos)
+{
+    if (_building) {
+	if (pos > _entries.back().pos)
+	    add_entry(pos);
+	_end = _entries.back().pos;
+	_building = false;
+	_dirty = true;
+    }
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel|ns)
+ELEMENT_PROVIDES(TimeIndex)
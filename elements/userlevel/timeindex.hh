@@ -0,0 +1,95 @@
+// -*- related-file-name: "timeindex.cc"; c-basic-offset: 4 -*-
+#ifndef CLICK_TIMEINDEX_HH
+#define CLICK_TIMEINDEX_HH
+#include <click/string.hh>
+#include <click/vector.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+class ErrorHandler;
+class Element;
+
+/** @class TimeIndex
+ * @brief Sidecar index from trace timestamps to file offsets.
+ *
+ * A TimeIndex lets a trace reader such as FromDump start reading at a given
+ * time without scanning the trace from the beginning. It is a list of
+ * entries, each holding a record offset and the largest timestamp of any
+ * record before that offset. Every record before the offset of lookup(@a
+ * t) is therefore earlier than @a t, even in traces that are not sorted by
+ * time.
+ *
+ * The reader calls begin() with the offset of the first record, note() for
+ * each record it reads, and finish() at the end of the file. While the
+ * reader's records are consecutive, note() adds an entry every interval of
+ * trace time; seeking elsewhere must be followed by resume() or
+ * invalidate(). cleanup() saves the index file if it grew, so the first
+ * read of a trace builds its index and later reads use it. An index whose
+ * trace has changed size or modification time is ignored and rebuilt. */
+class TimeIndex { public:
+
+    TimeIndex();
+
+    bool enabled() const		{ return _enabled; }
+    const String &filename() const	{ return _filename; }
+
+    int configure_keywords(Vector<String> &conf, Element *e, ErrorHandler *errh);
+    int initialize(const String &trace_filename, ErrorHandler *errh);
+    void cleanup(ErrorHandler *errh);
+
+    bool usable() const			{ return _entries.size() != 0; }
+    bool has_first_time() const		{ return _have_first; }
+    const Timestamp &first_time() const	{ return _first; }
+
+    void begin(off_t pos);
+    int lookup(const Timestamp &t) const;
+    off_t offset(int i) const		{ return _entries[i].pos; }
+    void resume(int i);
+    void invalidate()			{ _building = false; }
+
+    inline void note(off_t pos, const Timestamp &ts);
+    void finish(off_t pos);
+
+  private:
+
+    struct Entry {
+	off_t pos;
+	Timestamp max;		// largest timestamp of any record before pos
+    };
+
+    String _filename;
+    Timestamp _interval;
+    Vector<Entry> _entries;
+    Timestamp _first;
+    Timestamp _max;		// largest timestamp noted since resume()
+    Timestamp _next;		// _max that triggers the next entry
+    off_t _trace_size;
+    off_t _end;			// end of the trace, once read to the end
+    uint32_t _trace_mtime;
+    bool _enabled;
+    bool _have_first;
+    bool _building;
+    bool _dirty;
+
+    int read(ErrorHandler *errh);
+    void add_entry(off_t pos);
+
+};
+
+inline void
+TimeIndex::note(off_t pos, const Timestamp &ts)
+{
+    if (_building) {
+	if (pos > _entries.back().pos && _max >= _next && _have_first)
+	    add_entry(pos);
+	else if (!_have_first) {
+	    _first = ts;
+	    _next = ts + _interval;
+	    _have_first = _dirty = true;
+	}
+	if (ts > _max)
+	    _max = ts;
+    }
+}
+
+CLICK_ENDDECLS
+#endif
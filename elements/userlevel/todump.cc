@@ -32,20 +32,490 @@
 #include <click/packet_anno.hh>
 #include "fakepcap.hh"
 #include <click/userutils.hh>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#if HAVE_POLL_H
+# include <poll.h>
+#endif
 #if HAVE_PCAP
 extern "C" {
 # include <pcap.h>
 }
 #endif
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+#if HAVE_USER_MULTITHREAD
+# include <pthread.h>
+#endif
 CLICK_DECLS
 
+/** @class ToDump::Writer
+ * @brief Writes packet records to files in large batches.
+ *
+ * The filling thread appends records to a buffer and hands full buffers to
+ * the writer, which writes them with one call each, rotating and
+ * compressing files as needed.  With multithreading, a writer thread does
+ * the writing; otherwise buffers are written when they are handed over.
+ * The filling side is not locked, so callers serialize it themselves. */
+class ToDump::Writer { public:
+
+    Writer(const String &pattern, const String &header, uint32_t buffer_size,
+	   int nbuffers, uint64_t rotate_size, const Timestamp &rotate_interval);
+    ~Writer();
+
+    int initialize(ErrorHandler *errh);
+
+    inline bool append(const fake_pcap_pkthdr &ph, const unsigned char *data,
+		       uint32_t length);
+    void flush();
+    void rotate();
+
+    String filename() const;
+    bool failed() const			{ return _failed; }
+    String error() const;
+
+  private:
+
+    struct Buffer {
+	unsigned char *data;
+	uint32_t length;
+	bool rotate;		// start a new file before writing
+    };
+
+    String _pattern;
+    String _header;
+    uint32_t _buffer_size;
+    int _nbuffers;
+    uint64_t _rotate_size;
+    Timestamp _rotate_interval;
+
+    Buffer *_buffers;
+    Buffer *_cur;		// buffer being filled
+    Buffer **_free;		// stack of empty buffers
+    int _nfree;
+    Buffer **_full;		// ring of buffers to write
+    int _full_head;
+    int _nfull;
+    bool _rotate_next;
+
+    // writing side
+    String _current;
+    int _index;
+    int _fd;
+    FILE *_pipe;
+#if HAVE_ZLIB
+    gzFile _gz;
+#endif
+    uint64_t _file_bytes;
+    Timestamp _file_opened;
+    volatile bool _failed;
+    String _error;
+
+#if HAVE_USER_MULTITHREAD
+    mutable pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    pthread_t _thread;
+    bool _threaded;
+    bool _stop;
+
+    static void *thread_hook(void *);
+    void run();
+#endif
+
+    void lock() const;
+    void unlock() const;
+    Buffer *take();
+    void submit(Buffer *b);
+    String file_name(int index) const;
+    void fail(const String &name, int err);
+    int open_file(int index);
+    void close_file();
+    int write_data(const unsigned char *data, uint32_t length);
+    void write_buffer(Buffer *b);
+
+};
+
+ToDump::Writer::Writer(const String &pattern, const String &header,
+		       uint32_t buffer_size, int nbuffers,
+		       uint64_t rotate_size, const Timestamp &rotate_interval)
+    : _pattern(pattern), _header(header), _buffer_size(buffer_size),
+      _nbuffers(nbuffers), _rotate_size(rotate_size),
+      _rotate_interval(rotate_interval), _buffers(0), _cur(0), _free(0),
+      _nfree(0), _full(0), _full_head(0), _nfull(0), _rotate_next(false),
+      _index(0), _fd(-1), _pipe(0),
+#if HAVE_ZLIB
+      _gz(0),
+#endif
+      _file_bytes(0), _failed(false)
+#if HAVE_USER_MULTITHREAD
+    , _threaded(false), _stop(false)
+#endif
+{
+}
+
+ToDump::Writer::~Writer()
+{
+    if (_cur && _cur->length)
+	submit(_cur);
+    _cur = 0;
+#if HAVE_USER_MULTITHREAD
+    if (_threaded) {
+	pthread_mutex_lock(&_lock);
+	_stop = true;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_lock);
+	pthread_join(_thread, 0);
+	pthread_mutex_destroy(&_lock);
+	pthread_cond_destroy(&_cond);
+    }
+#endif
+    close_file();
+    if (_buffers)
+	for (int i = 0; i < _nbuffers; ++i)
+	    free(_buffers[i].data);
+    delete[] _buffers;
+    delete[] _free;
+    delete[] _full;
+}
+
+int
+ToDump::Writer::initialize(ErrorHandler *errh)
+{
+    _buffers = new Buffer[_nbuffers];
+    _free = new Buffer *[_nbuffers];
+    _full = new Buffer *[_nbuffers];
+    for (int i = 0; i < _nbuffers; ++i)
+	_buffers[i].data = 0;
+    for (int i = 0; i < _nbuffers; ++i) {
+	void *data;
+	if (posix_memalign(&data, 4096, _buffer_size) != 0)
+	    return errh->error("out of memory");
+	_buffers[i].data = (unsigned char *) data;
+	_free[_nfree++] = &_buffers[i];
+    }
+
+    if (open_file(0) < 0)
+	return errh->error("%s", _error.c_str());
+
+#if HAVE_USER_MULTITHREAD
+    // If the thread cannot start, write buffers as they are handed over.
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_cond, 0);
+    if (pthread_create(&_thread, 0, thread_hook, this) == 0)
+	_threaded = true;
+    else {
+	pthread_mutex_destroy(&_lock);
+	pthread_cond_destroy(&_cond);
+    }
+#endif
+    return 0;
+}
+
+inline void
+ToDump::Writer::lock() const
+{
+#if HAVE_USER_MULTITHREAD
+    if (_threaded)
+	pthread_mutex_lock(&_lock);
+#endif
+}
+
+inline void
+ToDump::Writer::unlock() const
+{
+#if HAVE_USER_MULTITHREAD
+    if (_threaded)
+	pthread_mutex_unlock(&_lock);
+#endif
+}
+
+ToDump::Writer::Buffer *
+ToDump::Writer::take()
+{
+    Buffer *b = 0;
+    lock();
+    if (_nfree)
+	b = _free[--_nfree];
+    unlock();
+    if (b) {
+	b->length = 0;
+	b->rotate = _rotate_next;
+	_rotate_next = false;
+    }
+    return b;
+}
+
+void
+ToDump::Writer::submit(Buffer *b)
+{
+#if HAVE_USER_MULTITHREAD
+    if (_threaded) {
+	pthread_mutex_lock(&_lock);
+	_full[(_full_head + _nfull) % _nbuffers] = b;
+	++_nfull;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_lock);
+	return;
+    }
+#endif
+    write_buffer(b);
+    _free[_nfree++] = b;
+}
+
+inline bool
+ToDump::Writer::append(const fake_pcap_pkthdr &ph, const unsigned char *data,
+		       uint32_t length)
+{
+    uint32_t need = sizeof(ph) + length;
+    if (!_cur || _cur->length + need > _buffer_size) {
+	if (need > _buffer_size)
+	    return false;
+	if (_cur)
+	    submit(_cur);
+	if (!(_cur = take()))
+	    return false;
+    }
+    memcpy(_cur->data + _cur->length, &ph, sizeof(ph));
+    memcpy(_cur->data + _cur->length + sizeof(ph), data, length);
+    _cur->length += need;
+    return true;
+}
+
+void
+ToDump::Writer::flush()
+{
+    if (_cur && _cur->length) {
+	submit(_cur);
+	_cur = 0;
+    }
+}
+
+void
+ToDump::Writer::rotate()
+{
+    flush();
+    if (_cur || (_cur = take())) {
+	// An empty buffer carries the request to the writer.
+	_cur->rotate = true;
+	submit(_cur);
+	_cur = 0;
+    } else
+	_rotate_next = true;
+}
+
+String
+ToDump::Writer::filename() const
+{
+    lock();
+    String s = _current;
+    unlock();
+    return s;
+}
+
+String
+ToDump::Writer::error() const
+{
+    lock();
+    String s = _error;
+    unlock();
+    return s;
+}
+
+String
+ToDump::Writer::file_name(int index) const
+{
+    String name = _pattern;
+    if (name.find_left('%') >= 0) {
+	time_t now = time(0);
+	struct tm tm;
+	char buf[4096];
+	if (localtime_r(&now, &tm)
+	    && strftime(buf, sizeof(buf), name.c_str(), &tm) > 0)
+	    name = String(buf);
+    }
+    if (index > 0) {
+	int pos = name.length();
+	if (compressed_filename(name) > 0)
+	    pos = name.find_right('.');
+	name = name.substring(0, pos) + String(index) + name.substring(pos);
+    }
+    return name;
+}
+
+void
+ToDump::Writer::fail(const String &name, int err)
+{
+    lock();
+    _error = name + ": " + strerror(err);
+    unlock();
+    _failed = true;
+}
+
+int
+ToDump::Writer::open_file(int index)
+{
+    String name = file_name(index);
+    if (name == "-") {
+	_fd = STDOUT_FILENO;
+	name = "<stdout>";
+    } else if (compressed_filename(name) > 0) {
+#if HAVE_ZLIB
+	if (name.length() >= 3 && name.substring(-3) == ".gz") {
+	    _fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	    if (_fd >= 0 && !(_gz = gzdopen(_fd, "wb1"))) {
+		close(_fd);
+		_fd = -1;
+		errno = ENOMEM;
+	    }
+	} else
+#endif
+	if (!(_pipe = open_compress_pipe(name, ErrorHandler::silent_handler()))
+	    && !errno)
+	    errno = EINVAL;
+    } else
+	_fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (_fd < 0 && !_pipe) {
+	fail(name, errno);
+	return -1;
+    }
+
+    lock();
+    _current = name;
+    unlock();
+    _index = index;
+    _file_bytes = 0;
+    _file_opened = Timestamp::now();
+    return write_data((const unsigned char *) _header.data(), _header.length());
+}
+
+void
+ToDump::Writer::close_file()
+{
+#if HAVE_ZLIB
+    if (_gz) {
+	gzclose(_gz);		// also closes _fd
+	_gz = 0;
+	_fd = -1;
+    }
+#endif
+    if (_pipe) {
+	pclose(_pipe);
+	_pipe = 0;
+    }
+    if (_fd >= 0 && _fd != STDOUT_FILENO)
+	close(_fd);
+    _fd = -1;
+}
+
+int
+ToDump::Writer::write_data(const unsigned char *data, uint32_t length)
+{
+    _file_bytes += length;
+#if HAVE_ZLIB
+    if (_gz) {
+	if (length && gzwrite(_gz, data, length) <= 0) {
+	    int err;
+	    gzerror(_gz, &err);
+	    fail(_current, err == Z_ERRNO ? errno : EIO);
+	    return -1;
+	}
+	return 0;
+    }
+#endif
+    if (_pipe) {
+	if (length && fwrite(data, 1, length, _pipe) != length) {
+	    fail(_current, errno);
+	    return -1;
+	}
+	return 0;
+    }
+    while (length) {
+	ssize_t w = write(_fd, data, length);
+	if (w > 0) {
+	    data += w;
+	    length -= w;
+	} else if (w < 0 && errno == EAGAIN) {
+	    // The descriptor is nonblocking, as a shared standard output may
+	    // be: wait until it can take more.
+#if HAVE_POLL_H
+	    struct pollfd pfd;
+	    pfd.fd = _fd;
+	    pfd.events = POLLOUT;
+	    pfd.revents = 0;
+	    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+		fail(_current, errno);
+		return -1;
+	    }
+#else
+	    usleep(1000);
+#endif
+	} else if (w == 0 || errno != EINTR) {
+	    fail(_current, w == 0 ? EIO : errno);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+void
+ToDump::Writer::write_buffer(Buffer *b)
+{
+    if (_failed)
+	return;
+    // Rotate only files that hold packets.
+    if (_file_bytes > (uint64_t) _header.length()
+	&& (b->rotate
+	    || (_rotate_size && _file_bytes + b->length > _rotate_size)
+	    || (_rotate_interval
+		&& Timestamp::now() >= _file_opened + _rotate_interval))) {
+	close_file();
+	if (open_file(_index + 1) < 0)
+	    return;
+    }
+    write_data(b->data, b->length);
+}
+
+#if HAVE_USER_MULTITHREAD
+void *
+ToDump::Writer::thread_hook(void *arg)
+{
+    static_cast<Writer *>(arg)->run();
+    return 0;
+}
+
+void
+ToDump::Writer::run()
+{
+    pthread_mutex_lock(&_lock);
+    while (1) {
+	while (!_nfull && !_stop)
+	    pthread_cond_wait(&_cond, &_lock);
+	if (!_nfull)
+	    break;
+	Buffer *b = _full[_full_head];
+	_full_head = (_full_head + 1) % _nbuffers;
+	--_nfull;
+	pthread_mutex_unlock(&_lock);
+	write_buffer(b);
+	pthread_mutex_lock(&_lock);
+	_free[_nfree++] = b;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+#endif
+
+
 ToDump::ToDump()
-    : _fp(0), _count(0), _task(this), _use_encap_from(0)
+    : _fp(0), _count(0), _drops(0), _writer(0), _flush_timer(this),
+      _task(this), _use_encap_from(0)
 {
 }
 
 ToDump::~ToDump()
 {
+    delete _writer;
 }
 
 int
@@ -56,6 +526,12 @@ ToDump::configure(Vector<String> &conf, ErrorHandler *errh)
     _snaplen = 2000;
     _extra_length = true;
     _unbuffered = false;
+    _async = false;
+    _buffer_size = 1048576;
+    _nbuffers = 16;
+    _rotate_size = 0;
+    _rotate_interval = Timestamp();
+    _flush_interval = Timestamp(1, 0);
     _nano = Timestamp::subsec_per_sec == Timestamp::nsec_per_sec;
 #if HAVE_PCAP && !defined(PCAP_TSTAMP_PRECISION_NANO)
     _nano = false;
@@ -72,6 +548,12 @@ ToDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("EXTRA_LENGTH", _extra_length)
 	.read("UNBUFFERED", _unbuffered)
         .read("NANO", _nano)
+	.read("ASYNC", _async)
+	.read("BUFFER", _buffer_size)
+	.read("BUFFERS", _nbuffers)
+	.read("FLUSH_INTERVAL", _flush_interval)
+	.read("ROTATE_SIZE", _rotate_size)
+	.read("ROTATE_INTERVAL", _rotate_interval)
 #if CLICK_NS
 	.read("PER_NODE", per_node)
 #endif
@@ -80,6 +562,21 @@ ToDump::configure(Vector<String> &conf, ErrorHandler *errh)
 
     if (_snaplen == 0)
 	_snaplen = 0xFFFFFFFFU;
+    if (_rotate_size || _rotate_interval)
+	_async = true;
+    // The largest record is a maximum-size packet cut to SNAPLEN.
+    uint32_t min_buffer = sizeof(fake_pcap_pkthdr)
+	+ (_snaplen < 65535 ? _snaplen : 65535);
+    if (min_buffer < 65536)
+	min_buffer = 65536;
+    if (_async && _buffer_size < min_buffer)
+	return errh->error("BUFFER must be at least %u", min_buffer);
+    if (_async && _nbuffers < 2)
+	return errh->error("BUFFERS must be at least 2");
+    if (_async && !_flush_interval)
+	return errh->error("FLUSH_INTERVAL must be positive");
+    if ((_rotate_size || _rotate_interval) && _filename == "-")
+	return errh->error("cannot rotate the standard output");
 
     if (use_encap_from && encap_type)
 	return errh->error("specify at most one of 'ENCAP' and 'USE_ENCAP_FROM'");
@@ -116,7 +613,8 @@ ToDump::hotswap_element() const
     if (Element *e = Element::hotswap_element())
 	if (ToDump *td = (ToDump *)e->cast("ToDump"))
 	    if (td->_filename == _filename
-		&& td->_linktype == _linktype)
+		&& td->_linktype == _linktype
+		&& td->_async == _async)
 		return td;
     return 0;
 }
@@ -153,9 +651,26 @@ ToDump::initialize(ErrorHandler *errh)
     // skip initialization if we're hotswapping later
     if (!hotswap_element()) {
 
+	struct fake_pcap_file_header h;
+
+	h.magic = _nano ? FAKE_PCAP_MAGIC_NANO : FAKE_PCAP_MAGIC;
+	h.version_major = FAKE_PCAP_VERSION_MAJOR;
+	h.version_minor = FAKE_PCAP_VERSION_MINOR;
+
+	h.thiszone = 0;		// timestamps are in GMT
+	h.sigfigs = 0;		// XXX accuracy of timestamps?
+	h.snaplen = _snaplen;
+	h.linktype = _linktype;
+
 	// prepare files
-	assert(!_fp);
-	if (_filename != "-") {
+	assert(!_fp && !_writer);
+	if (_async) {
+	    _writer = new Writer(_filename, String((const char *) &h, sizeof(h)),
+				 _buffer_size, _nbuffers, _rotate_size,
+				 _rotate_interval);
+	    if (_writer->initialize(errh) < 0)
+		return -1;
+	} else if (_filename != "-") {
 	    if (compressed_filename(_filename) > 0)
 		_fp = open_compress_pipe(_filename, errh);
 	    else
@@ -167,23 +682,19 @@ ToDump::initialize(ErrorHandler *errh)
 	    _filename = "<stdout>";
 	}
 
-	if (_unbuffered)
-	    setvbuf(_fp, (char *) 0, _IONBF, 0);
+	if (_fp) {
+	    if (_unbuffered)
+		setvbuf(_fp, (char *) 0, _IONBF, 0);
 
-	struct fake_pcap_file_header h;
-
-	h.magic = _nano ? FAKE_PCAP_MAGIC_NANO : FAKE_PCAP_MAGIC;
-	h.version_major = FAKE_PCAP_VERSION_MAJOR;
-	h.version_minor = FAKE_PCAP_VERSION_MINOR;
-
-	h.thiszone = 0;		// timestamps are in GMT
-	h.sigfigs = 0;		// XXX accuracy of timestamps?
-	h.snaplen = _snaplen;
-	h.linktype = _linktype;
+	    size_t wrote_header = fwrite(&h, sizeof(h), 1, _fp);
+	    if (wrote_header != 1)
+		return errh->error("%s: unable to write file header", _filename.c_str());
+	}
+    }
 
-	size_t wrote_header = fwrite(&h, sizeof(h), 1, _fp);
-	if (wrote_header != 1)
-	    return errh->error("%s: unable to write file header", _filename.c_str());
+    if (_async) {
+	_flush_timer.initialize(this);
+	_flush_timer.schedule_after(_flush_interval);
     }
 
     if (input_is_pull(0) && noutputs() == 0) {
@@ -200,6 +711,10 @@ ToDump::take_state(Element *e, ErrorHandler *)
     ToDump *td = static_cast<ToDump *>(e); // result of hotswap_element()
     _fp = td->_fp;
     td->_fp = 0;
+    td->_writer_lock.acquire();
+    _writer = td->_writer;
+    td->_writer = 0;
+    td->_writer_lock.release();
 }
 
 void
@@ -208,6 +723,8 @@ ToDump::cleanup(CleanupStage)
     if (_fp && _fp != stdout)
 	fclose(_fp);
     _fp = 0;
+    delete _writer;		// writes remaining buffers
+    _writer = 0;
 }
 
 void
@@ -227,6 +744,16 @@ ToDump::write_packet(Packet *p)
 	to_write = _snaplen;
     ph.caplen = to_write;
 
+    if (_async) {
+	_writer_lock.acquire();
+	if (_writer && _writer->append(ph, p->data(), to_write))
+	    _count++;
+	else
+	    _drops++;
+	_writer_lock.release();
+	return;
+    }
+
     // XXX writing to pipe?
     if (fwrite(&ph, sizeof(ph), 1, _fp) == 0
 	|| (to_write > 0 && fwrite(p->data(), 1, to_write, _fp) == 0)) {
@@ -270,7 +797,22 @@ ToDump::run_task(Task *)
     return p != 0;
 }
 
-enum { H_FILENAME = 0, H_COUNT = 1, H_RESET_COUNTS = 2 };
+void
+ToDump::run_timer(Timer *)
+{
+    _writer_lock.acquire();
+    if (_writer)
+	_writer->flush();
+    _writer_lock.release();
+    if (_writer && _writer->failed() && _active) {
+	_active = false;
+	click_chatter("%p{element}: %s", this, _writer->error().c_str());
+    }
+    _flush_timer.reschedule_after(_flush_interval);
+}
+
+enum { H_FILENAME = 0, H_COUNT = 1, H_RESET_COUNTS = 2, H_DROPS = 3,
+       H_ROTATE = 4 };
 
 String
 ToDump::read_handler(Element *e, void *thunk)
@@ -278,20 +820,33 @@ ToDump::read_handler(Element *e, void *thunk)
     ToDump *td = static_cast<ToDump *>(e);
     switch ((uintptr_t) thunk) {
     case H_FILENAME:
-	return td->_filename;
+	return td->_writer ? td->_writer->filename() : td->_filename;
     case H_COUNT:
 	return String(td->_count);
+    case H_DROPS:
+	return String(td->_drops);
     default:
 	return "<error>";
     }
 }
 
 int
-ToDump::write_handler(const String &, Element *e, void *, ErrorHandler *)
+ToDump::write_handler(const String &, Element *e, void *thunk, ErrorHandler *)
 {
     ToDump *td = static_cast<ToDump *>(e);
-    td->_count = 0;
-    return 0;
+    switch ((uintptr_t) thunk) {
+    case H_RESET_COUNTS:
+	td->_count = td->_drops = 0;
+	return 0;
+    case H_ROTATE:
+	td->_writer_lock.acquire();
+	if (td->_writer)
+	    td->_writer->rotate();
+	td->_writer_lock.release();
+	return 0;
+    default:
+	return -1;
+    }
 }
 
 void
@@ -299,7 +854,10 @@ ToDump::add_handlers()
 {
     add_read_handler("filename", read_handler, H_FILENAME);
     add_read_handler("count", read_handler, H_COUNT);
+    add_read_handler("drops", read_handler, H_DROPS);
     add_write_handler("reset_counts", write_handler, H_RESET_COUNTS, Handler::BUTTON);
+    if (_async)
+	add_write_handler("rotate", write_handler, H_ROTATE, Handler::BUTTON);
     if (input_is_pull(0) && noutputs() == 0)
 	add_task_handlers(&_task);
 }
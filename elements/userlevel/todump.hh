@@ -5,13 +5,14 @@
 #include <click/element.hh>
 #include <click/task.hh>
 #include <click/notifier.hh>
+#include <click/sync.hh>
 #include <stdio.h>
 CLICK_DECLS
 
 /*
 =c
 
-ToDump(FILENAME [, I<keywords> SNAPLEN, ENCAP, USE_ENCAP_FROM, EXTRA_LENGTH, NANO])
+ToDump(FILENAME [, I<keywords> SNAPLEN, ENCAP, USE_ENCAP_FROM, EXTRA_LENGTH, NANO, ASYNC, ...])
 
 =s traces
 
@@ -35,6 +36,30 @@ ToDump may have zero or one output. If it has an output, then it emits all
 received packets on that output. ToDump will schedule itself on the task list
 if it is used as a pull element with no outputs.
 
+By default, ToDump writes each packet to the file as it arrives, so a slow
+disk slows down the thread that runs ToDump. If ASYNC is true, ToDump
+instead copies each packet's record, truncated to SNAPLEN, into one of
+BUFFERS page-aligned buffers of BUFFER bytes. Full buffers are written by a
+separate writer thread, with one system call per buffer. If every buffer
+is waiting to be written, ToDump drops the packet from the file rather than
+waiting; the C<drops> handler counts these packets. Packets are passed
+downstream either way. A partly filled buffer is handed to the writer every
+FLUSH_INTERVAL, so the file lags the packets by at most that long. In
+asynchronous mode, ToDump may be used from several threads, and a FILENAME
+ending in C<.gz> is compressed by the writer thread itself, at a low
+compression level, rather than by an external B<gzip>. Without
+multithreading support, buffers are written by the thread that fills them.
+
+ToDump can also rotate files, which implies ASYNC. A new file is started
+when the current one would grow beyond ROTATE_SIZE bytes (measured before
+compression), or when it has been open for ROTATE_INTERVAL. Files are
+rotated at buffer boundaries, and every file starts with its own file
+header. If FILENAME contains C<%>, each file's name is produced by passing
+FILENAME to strftime(3) with the time the file is opened. As with tcpdump's
+B<-C> option, every file after the first also gets a sequence number,
+inserted before any compression suffix: C<trace.pcap.gz> is followed by
+C<trace.pcap1.gz>, C<trace.pcap2.gz>, and so on.
+
 Keyword arguments are:
 
 =over 8
@@ -71,6 +96,37 @@ false.
 Boolean. Set to true to write nanosecond-precision timestamps. Default depends
 on the version of tcpdump/pcap on the machine.
 
+=item ASYNC
+
+Boolean. Set to true to write the file from a separate writer thread, as
+described above. Default is false.
+
+=item BUFFER
+
+Unsigned integer. Size of each buffer in bytes, at least 65536, and at
+least SNAPLEN plus 16, the size of the record header, so that every packet up
+to 65535 bytes long fits. Default is 1048576 (1 MB). Packets whose records do
+not fit in a buffer are dropped.
+
+=item BUFFERS
+
+Unsigned integer. Number of buffers, at least 2. Default is 16.
+
+=item FLUSH_INTERVAL
+
+Time in seconds. How often a partly filled buffer is handed to the writer.
+Default is 1 second.
+
+=item ROTATE_SIZE
+
+Unsigned integer. Rotate files that would grow beyond this many bytes.
+Default is 0, meaning no size limit.
+
+=item ROTATE_INTERVAL
+
+Time in seconds. Rotate files that have been open this long. Default is 0,
+meaning no time limit.
+
 =back
 
 This element is only available at user level.
@@ -83,13 +139,33 @@ ToDump stores packets' true length annotations when available.
 
 Returns the number of packets emitted so far.
 
+=h drops read-only
+
+Returns the number of packets dropped from the file because no buffer was
+free, or because they did not fit in a buffer. Only asynchronous mode drops
+packets.
+
 =h reset_counts write-only
 
-Resets "count" to 0.
+Resets "count" and "drops" to 0.
 
 =h filename read-only
 
-Returns the filename.
+Returns the name of the file being written.
+
+=h rotate write-only
+
+Starts a new file, as if ROTATE_SIZE had been reached. Only available in
+asynchronous mode.
+
+=e
+
+Capture at full rate, writing 1 GB files without delaying forwarding:
+
+  FromDevice(eth0, SNAPLEN 128, BURST 32)
+    -> ToDump(/data/trace.pcap, SNAPLEN 128, ASYNC true,
+              BUFFERS 64, ROTATE_SIZE 1000000000)
+    -> Discard;
 
 =a
 
@@ -116,9 +192,12 @@ class ToDump : public Element { public:
     void push(int, Packet *);
     Packet *pull(int);
     bool run_task(Task *);
+    void run_timer(Timer *);
 
   private:
 
+    class Writer;
+
     String _filename;
     FILE *_fp;
     unsigned _snaplen;
@@ -127,6 +206,7 @@ class ToDump : public Element { public:
     bool _extra_length;
     bool _unbuffered;
     bool _nano;
+    bool _async;
 
 #if HAVE_INT64_TYPES
     typedef uint64_t counter_t;
@@ -134,6 +214,16 @@ class ToDump : public Element { public:
     typedef uint32_t counter_t;
 #endif
     counter_t _count;
+    counter_t _drops;
+
+    Writer *_writer;
+    Spinlock _writer_lock;	// protects the buffer being filled
+    uint32_t _buffer_size;
+    uint32_t _nbuffers;
+    uint64_t _rotate_size;
+    Timestamp _rotate_interval;
+    Timestamp _flush_interval;
+    Timer _flush_timer;
 
     Task _task;
     NotifierSignal _signal;
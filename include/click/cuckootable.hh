@@ -0,0 +1,768 @@
+#ifndef CLICK_CUCKOOTABLE_HH
+#define CLICK_CUCKOOTABLE_HH
+#include <click/glue.hh>
+#include <click/hashcode.hh>
+#include <click/machine.hh>
+CLICK_DECLS
+
+/** @class CuckooTable
+  @brief Open-addressed cuckoo hash table for exact-match lookups.
+
+  The CuckooTable template maps keys, typically IPFlow5ID or IP6FlowID, to
+  values.  It is meant for flow tables on the packet path,
+  where HashContainer's chained buckets cost a cache miss per link.
+
+  Keys and values are stored in an entry array of fixed capacity, chosen by
+  reserve().  Each entry keeps its index until it is erased, so an index can
+  serve as a compact flow handle.  A separate array of cache-line-sized
+  buckets indexes the entries.  Each bucket holds up to bucket_slots entry
+  indexes together with 16-bit signatures of their keys' hashes.  A key may
+  live in one of two buckets, its primary bucket or its alternate bucket;
+  insert() makes room by moving existing entries to their other bucket.  A
+  successful lookup usually touches one bucket and one entry.
+
+  CuckooTable does not grow.  Once size() reaches capacity(), or when no
+  displacement path can be found (rare below about 90% occupancy), insert()
+  and find_insert() fail by returning a null pointer.
+
+  K must support equality and CLICK_NAME(hashcode)().  The hash code's bits
+  must be well distributed: keys with equal hash codes always share both
+  candidate buckets, so a weak hash function makes inserts fail early.
+  IPFlow5ID's hash function is suitable; IPFlowID's is not.  K and V must be
+  default-constructible and assignable; an erased entry's value is reset to
+  V().
+
+  <h3>Batches</h3>
+
+  find_batch() looks up many keys at once.  It computes all hashes and
+  prefetches all candidate buckets, then all candidate entries, before
+  comparing any keys, overlapping the memory accesses of the whole batch.
+
+  <h3>Concurrency</h3>
+
+  A CuckooTable is not locked.  Either use it from one thread only (see
+  PerThreadCuckooTable), or restrict modifications to a single writer thread
+  and have other threads read with find_shared().  Every bucket carries a
+  version number that writers make odd while they modify the bucket;
+  find_shared() retries until it sees both candidate buckets unchanged.
+  find_shared() returns a copy of the value, which is consistent as long as
+  the writer changes values only through insert() or erase().
+*/
+template <typename K, typename V>
+class CuckooTable { public:
+
+    /** @brief Key type. */
+    typedef K key_type;
+
+    /** @brief Value type. */
+    typedef V mapped_type;
+
+    /** @brief Type of sizes and entry indexes. */
+    typedef uint32_t size_type;
+
+    enum {
+	bucket_slots = 8,		///< Number of entries per bucket.
+	max_path = 64,			///< Longest displacement path.
+	batch_size = 16,		///< Keys per find_batch() round.
+	invalid_index = 0xFFFFFFFFU	///< Returned by find_index() on failure.
+    };
+
+    /** @brief Construct an empty CuckooTable with zero capacity.
+     *
+     * Call reserve() before inserting. */
+    CuckooTable()
+	: _buckets(0), _bucket_mem(0), _entries(0), _live(0), _free(0),
+	  _mask(0), _size(0), _capacity(0), _nfree(0), _rand(2463534242U) {
+    }
+
+    /** @brief Destroy the CuckooTable. */
+    ~CuckooTable() {
+	deallocate();
+    }
+
+    /** @brief Set the table's capacity to at least @a capacity entries.
+     * @return 0 on success, -ENOMEM on allocation failure
+     *
+     * The table is cleared. */
+    int reserve(size_type capacity);
+
+    /** @brief Return the number of entries stored. */
+    size_type size() const {
+	return _size;
+    }
+
+    /** @brief Return true iff size() == 0. */
+    bool empty() const {
+	return _size == 0;
+    }
+
+    /** @brief Return the maximum number of entries. */
+    size_type capacity() const {
+	return _capacity;
+    }
+
+    /** @brief Return the number of buckets. */
+    size_type bucket_count() const {
+	return _mask + 1;
+    }
+
+    /** @brief Return the number of bytes allocated by the table. */
+    size_t memory_size() const {
+	return bucket_count() * sizeof(Bucket)
+	    + _capacity * (sizeof(Entry) + sizeof(uint32_t) + 1);
+    }
+
+
+    /** @brief Return the index of the entry for @a key, or invalid_index. */
+    inline size_type find_index(const K &key) const {
+	return find_index(key, hash_key(key));
+    }
+
+    /** @brief Return a pointer to the value for @a key, or null. */
+    inline V *find(const K &key) {
+	size_type i = find_index(key);
+	return i != invalid_index ? &_entries[i].value : 0;
+    }
+
+    /** @overload */
+    inline const V *find(const K &key) const {
+	size_type i = find_index(key);
+	return i != invalid_index ? &_entries[i].value : 0;
+    }
+
+    /** @brief Look up @a key, inserting it if absent.
+     * @param key key
+     * @param[out] inserted set to true iff @a key was inserted
+     * @return pointer to the value for @a key, or null if the table is full
+     *
+     * A newly inserted value equals V(). */
+    V *find_insert(const K &key, bool &inserted);
+
+    /** @brief Set the value for @a key to @a value.
+     * @return pointer to the stored value, or null if the table is full */
+    V *insert(const K &key, const V &value) {
+	bool inserted;
+	V *v = find_insert(key, inserted);
+	if (v) {
+	    // let concurrent readers see the change
+	    size_type h = hash_key(key);
+	    Bucket &b = _buckets[h & _mask];
+	    write_begin(b);
+	    *v = value;
+	    write_end(b);
+	}
+	return v;
+    }
+
+    /** @brief Remove the entry for @a key.
+     * @return true iff an entry was removed */
+    bool erase(const K &key) {
+	size_type i = find_index(key);
+	if (i == invalid_index)
+	    return false;
+	erase_index(i);
+	return true;
+    }
+
+    /** @brief Remove the entry with index @a i.
+     * @pre live(@a i) */
+    void erase_index(size_type i);
+
+    /** @brief Remove all entries. */
+    void clear();
+
+
+    /** @brief Look up @a n keys at once.
+     * @param keys array of @a n keys
+     * @param n number of keys
+     * @param[out] values array of @a n value pointers, each set as by find()
+     */
+    void find_batch(const K *keys, int n, V **values);
+
+    /** @brief Look up @a key while another thread may be writing.
+     * @param key key
+     * @param[out] value set to a copy of the value, if found
+     * @return true iff @a key was found */
+    bool find_shared(const K &key, V &value) const;
+
+
+    /** @brief Return one more than the highest possible entry index.
+     *
+     * Iterate over entries with:
+     * @code
+     * for (size_type i = 0; i != t.index_limit(); ++i)
+     *     if (t.live(i))
+     *         ... t.key(i) ... t.value(i) ...
+     * @endcode */
+    size_type index_limit() const {
+	return _capacity;
+    }
+
+    /** @brief Return true iff entry @a i is in use. */
+    bool live(size_type i) const {
+	return _live[i];
+    }
+
+    /** @brief Return entry @a i's key. */
+    const K &key(size_type i) const {
+	return _entries[i].key;
+    }
+
+    /** @brief Return entry @a i's value. */
+    V &value(size_type i) {
+	return _entries[i].value;
+    }
+
+    /** @overload */
+    const V &value(size_type i) const {
+	return _entries[i].value;
+    }
+
+    /** @brief Examine @a n entries starting at @a cursor, erasing those
+     * that @a expired accepts.
+     * @param[in,out] cursor index of the next entry to examine
+     * @param n number of entries to examine
+     * @param expired function object called as expired(key, value) on
+     *   each live entry; the entry is erased if it returns true
+     * @return true iff the cursor wrapped around to index 0
+     *
+     * Calling reap_step() with a small @a n on every packet expires old
+     * entries incrementally, without ever scanning the whole table at once.
+     * @a expired may release resources held by the value before returning
+     * true. */
+    template <typename F>
+    bool reap_step(size_type &cursor, size_type n, F expired) {
+	if (!_capacity)
+	    return false;
+	bool wrapped = false;
+	size_type i = cursor < _capacity ? cursor : 0;
+	for (; n; --n) {
+	    if (_live[i] && expired(_entries[i].key, _entries[i].value))
+		erase_index(i);
+	    if (++i == _capacity) {
+		i = 0;
+		wrapped = true;
+	    }
+	}
+	cursor = i;
+	return wrapped;
+    }
+
+
+    /** @brief Return the table hash of @a key. */
+    static inline uint32_t hash_key(const K &key) {
+	// Finish CLICK_NAME(hashcode) with MurmurHash3's mixer: cuckoo
+	// hashing needs every bit of the hash to be good.
+	uint32_t h = CLICK_NAME(hashcode)(key);
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	return h;
+    }
+
+  private:
+
+    struct Bucket {
+	uint16_t sig[bucket_slots];	// 0 means the slot is empty
+	uint32_t index[bucket_slots];
+	uint32_t version;
+	uint32_t padding[3];
+    };
+
+    struct Entry {
+	K key;
+	V value;
+    };
+
+    Bucket *_buckets;
+    void *_bucket_mem;
+    Entry *_entries;
+    uint8_t *_live;
+    uint32_t *_free;
+    uint32_t _mask;
+    size_type _size;
+    size_type _capacity;
+    size_type _nfree;
+    uint32_t _rand;
+
+    static inline uint16_t hash_sig(uint32_t h) {
+	return (h >> 16) ? (h >> 16) : 1;
+    }
+    inline uint32_t alt_bucket(uint32_t b, uint16_t sig) const {
+	return (b ^ (sig * 0x5BD1E995U)) & _mask;
+    }
+    static inline void write_begin(Bucket &b) {
+	++b.version;
+	click_write_fence();
+    }
+    static inline void write_end(Bucket &b) {
+	click_write_fence();
+	++b.version;
+    }
+    static inline int free_slot(const Bucket &b) {
+	for (int s = 0; s != bucket_slots; ++s)
+	    if (!b.sig[s])
+		return s;
+	return -1;
+    }
+
+    inline size_type find_in_bucket(const Bucket &b, uint16_t sig, const K &key) const {
+	for (int s = 0; s != bucket_slots; ++s)
+	    if (b.sig[s] == sig && _entries[b.index[s]].key == key)
+		return b.index[s];
+	return invalid_index;
+    }
+    inline size_type find_index(const K &key, uint32_t h) const {
+	if (!_capacity)
+	    return invalid_index;
+	uint16_t sig = hash_sig(h);
+	uint32_t b1 = h & _mask;
+	size_type i = find_in_bucket(_buckets[b1], sig, key);
+	if (i == invalid_index)
+	    i = find_in_bucket(_buckets[alt_bucket(b1, sig)], sig, key);
+	return i;
+    }
+
+    bool make_room(uint32_t b1, uint32_t b2, uint32_t &bucket, int &slot);
+    void deallocate();
+
+    CuckooTable(const CuckooTable<K, V> &);
+    CuckooTable<K, V> &operator=(const CuckooTable<K, V> &);
+
+};
+
+template <typename K, typename V>
+void CuckooTable<K, V>::deallocate()
+{
+    if (_bucket_mem)
+	CLICK_LFREE(_bucket_mem, (_mask + 1) * sizeof(Bucket) + CLICK_CACHE_LINE_SIZE);
+    delete[] _entries;
+    delete[] _live;
+    delete[] _free;
+    _buckets = 0;
+    _bucket_mem = 0;
+    _entries = 0;
+    _live = 0;
+    _free = 0;
+    _mask = _size = _capacity = _nfree = 0;
+}
+
+template <typename K, typename V>
+int CuckooTable<K, V>::reserve(size_type capacity)
+{
+    deallocate();
+    if (capacity == 0)
+	return 0;
+
+    // aim for at most 80% bucket occupancy
+    uint32_t nbuckets = 2;
+    while (nbuckets * bucket_slots * 4 < capacity * 5 && nbuckets < 0x80000000U)
+	nbuckets *= 2;
+
+    _bucket_mem = CLICK_LALLOC(nbuckets * sizeof(Bucket) + CLICK_CACHE_LINE_SIZE);
+    _entries = new Entry[capacity];
+    _live = new uint8_t[capacity];
+    _free = new uint32_t[capacity];
+    _mask = nbuckets - 1;
+    if (!_bucket_mem || !_entries || !_live || !_free) {
+	deallocate();
+	return -ENOMEM;
+    }
+    uintptr_t bm = reinterpret_cast<uintptr_t>(_bucket_mem);
+    _buckets = reinterpret_cast<Bucket *>((bm + CLICK_CACHE_LINE_SIZE - 1) & ~(uintptr_t) (CLICK_CACHE_LINE_SIZE - 1));
+    _capacity = capacity;
+    memset(_buckets, 0, nbuckets * sizeof(Bucket));
+    clear();
+    return 0;
+}
+
+template <typename K, typename V>
+void CuckooTable<K, V>::clear()
+{
+    if (!_capacity)
+	return;
+    for (uint32_t b = 0; b <= _mask; ++b) {
+	write_begin(_buckets[b]);
+	memset(_buckets[b].sig, 0, sizeof(_buckets[b].sig));
+	write_end(_buckets[b]);
+    }
+    for (size_type i = 0; i != _capacity; ++i) {
+	if (_live[i])
+	    _entries[i].value = V();
+	_live[i] = 0;
+	// hand out low indexes first
+	_free[i] = _capacity - 1 - i;
+    }
+    _nfree = _capacity;
+    _size = 0;
+}
+
+template <typename K, typename V>
+bool CuckooTable<K, V>::make_room(uint32_t b1, uint32_t b2, uint32_t &bucket, int &slot)
+{
+    struct { uint32_t bucket; int slot; } path[max_path];
+    uint32_t b = (_rand & 1) ? b1 : b2;
+    int depth;
+
+    // Walk from b, recording the displaced slots, until some slot's
+    // alternate bucket has room.  Never displace the same slot twice: the
+    // moves below rely on each path position holding its original entry.
+    for (depth = 0; depth != max_path; ++depth) {
+	Bucket &bk = _buckets[b];
+	int s;
+	for (s = 0; s != bucket_slots; ++s)
+	    if (free_slot(_buckets[alt_bucket(b, bk.sig[s])]) >= 0)
+		break;
+	if (s != bucket_slots) {
+	    path[depth].bucket = b;
+	    path[depth].slot = s;
+	    break;
+	}
+
+	_rand ^= _rand << 13;
+	_rand ^= _rand >> 17;
+	_rand ^= _rand << 5;
+	int tries;
+	for (tries = 0; tries != bucket_slots; ++tries) {
+	    s = (_rand + tries) % bucket_slots;
+	    int j = 0;
+	    while (j != depth && (path[j].bucket != b || path[j].slot != s))
+		++j;
+	    if (j == depth)
+		break;
+	}
+	if (tries == bucket_slots)
+	    return false;
+	path[depth].bucket = b;
+	path[depth].slot = s;
+	b = alt_bucket(b, bk.sig[s]);
+    }
+    if (depth == max_path)
+	return false;
+
+    // Move entries from the end of the path backwards.  Each entry is
+    // copied into its new bucket before it leaves its old one, so a
+    // concurrent reader can always find it (find_shared checks versions).
+    for (; depth >= 0; --depth) {
+	Bucket &from = _buckets[path[depth].bucket];
+	int fs = path[depth].slot;
+	Bucket &to = _buckets[alt_bucket(path[depth].bucket, from.sig[fs])];
+	int ts = free_slot(to);
+	assert(ts >= 0);
+	write_begin(to);
+	to.index[ts] = from.index[fs];
+	to.sig[ts] = from.sig[fs];
+	write_end(to);
+	write_begin(from);
+	from.sig[fs] = 0;
+	write_end(from);
+    }
+    bucket = path[0].bucket;
+    slot = path[0].slot;
+    return true;
+}
+
+template <typename K, typename V>
+V *CuckooTable<K, V>::find_insert(const K &key, bool &inserted)
+{
+    uint32_t h = hash_key(key);
+    size_type i = find_index(key, h);
+    inserted = false;
+    if (i != invalid_index)
+	return &_entries[i].value;
+    else if (!_nfree)
+	return 0;
+
+    uint16_t sig = hash_sig(h);
+    uint32_t b1 = h & _mask, b2 = alt_bucket(b1, sig), b = b1;
+    int s = free_slot(_buckets[b1]);
+    if (s < 0) {
+	b = b2;
+	s = free_slot(_buckets[b2]);
+    }
+    if (s < 0 && !make_room(b1, b2, b, s))
+	return 0;
+
+    i = _free[--_nfree];
+    _entries[i].key = key;
+    _live[i] = 1;
+    ++_size;
+    Bucket &bk = _buckets[b];
+    write_begin(bk);
+    bk.index[s] = i;
+    bk.sig[s] = sig;
+    write_end(bk);
+    inserted = true;
+    return &_entries[i].value;
+}
+
+template <typename K, typename V>
+void CuckooTable<K, V>::erase_index(size_type i)
+{
+    assert(i < _capacity && _live[i]);
+    uint32_t h = hash_key(_entries[i].key);
+    uint16_t sig = hash_sig(h);
+    uint32_t b = h & _mask;
+    for (int round = 0; round != 2; ++round, b = alt_bucket(b, sig)) {
+	Bucket &bk = _buckets[b];
+	for (int s = 0; s != bucket_slots; ++s)
+	    if (bk.sig[s] == sig && bk.index[s] == i) {
+		write_begin(bk);
+		bk.sig[s] = 0;
+		write_end(bk);
+		_entries[i].value = V();
+		_live[i] = 0;
+		_free[_nfree++] = i;
+		--_size;
+		return;
+	    }
+    }
+    assert(0 && "CuckooTable entry not found in its buckets");
+}
+
+template <typename K, typename V>
+void CuckooTable<K, V>::find_batch(const K *keys, int n, V **values)
+{
+    uint32_t hash[batch_size];
+    size_type cand[batch_size];
+
+    for (int base = 0; base < n; base += batch_size) {
+	int m = (n - base < (int) batch_size ? n - base : (int) batch_size);
+	if (!_capacity) {
+	    for (int j = 0; j != m; ++j)
+		values[base + j] = 0;
+	    continue;
+	}
+
+	// Round 1: hash, prefetch both candidate buckets.
+	for (int j = 0; j != m; ++j) {
+	    uint32_t h = hash[j] = hash_key(keys[base + j]);
+	    click_prefetch(&_buckets[h & _mask]);
+	    click_prefetch(&_buckets[alt_bucket(h & _mask, hash_sig(h))]);
+	}
+
+	// Round 2: match signatures, prefetch candidate entries.
+	for (int j = 0; j != m; ++j) {
+	    uint16_t sig = hash_sig(hash[j]);
+	    uint32_t b = hash[j] & _mask;
+	    cand[j] = invalid_index;
+	    for (int round = 0; round != 2 && cand[j] == invalid_index;
+		 ++round, b = alt_bucket(b, sig)) {
+		const Bucket &bk = _buckets[b];
+		for (int s = 0; s != bucket_slots; ++s)
+		    if (bk.sig[s] == sig) {
+			cand[j] = bk.index[s];
+			click_prefetch(&_entries[cand[j]]);
+			break;
+		    }
+	    }
+	}
+
+	// Round 3: compare keys; fall back on signature collisions.
+	for (int j = 0; j != m; ++j) {
+	    size_type i = cand[j];
+	    if (i != invalid_index && !(_entries[i].key == keys[base + j]))
+		i = find_index(keys[base + j], hash[j]);
+	    values[base + j] = (i != invalid_index ? &_entries[i].value : 0);
+	}
+    }
+}
+
+template <typename K, typename V>
+bool CuckooTable<K, V>::find_shared(const K &key, V &value) const
+{
+    if (!_capacity)
+	return false;
+    uint32_t h = hash_key(key);
+    uint16_t sig = hash_sig(h);
+    const Bucket &b1 = _buckets[h & _mask];
+    const Bucket &b2 = _buckets[alt_bucket(h & _mask, sig)];
+    const volatile uint32_t &v1 = b1.version, &v2 = b2.version;
+
+    while (1) {
+	uint32_t x1 = v1, x2 = v2;
+	if ((x1 | x2) & 1) {
+	    click_relax_fence();
+	    continue;
+	}
+	click_read_fence();
+	bool found = false;
+	for (int round = 0; round != 2 && !found; ++round) {
+	    const Bucket &bk = (round ? b2 : b1);
+	    for (int s = 0; s != bucket_slots; ++s)
+		if (bk.sig[s] == sig) {
+		    const Entry &e = _entries[bk.index[s]];
+		    if (e.key == key) {
+			value = e.value;
+			found = true;
+			break;
+		    }
+		}
+	}
+	click_read_fence();
+	if (v1 == x1 && v2 == x2)
+	    return found;
+    }
+}
+
+
+/** @class PerThread
+  @brief Per-thread copies of a value, each on its own cache lines.
+
+  A plain array of per-thread structures puts neighboring threads' fields on
+  the same cache line, so counters updated on every packet bounce between
+  CPUs.  PerThread pads each copy to a multiple of CLICK_CACHE_LINE_SIZE and
+  aligns the array, so no two threads ever write the same line.  local()
+  returns the calling thread's copy, as determined by click_current_cpu_id().
+
+  T must be default-constructible.  The copies are not constructed until
+  resize() is called. */
+template <typename T>
+class PerThread { public:
+
+    PerThread()
+	: _mem(0), _v(0), _n(0) {
+    }
+
+    ~PerThread() {
+	clear();
+    }
+
+    /** @brief Destroy any existing copies and create @a n new ones.
+     * @return 0 on success, -ENOMEM on allocation failure */
+    int resize(int n = click_max_cpu_ids()) {
+	clear();
+	if (n <= 0)
+	    return 0;
+	if (!(_mem = CLICK_LALLOC(n * stride + CLICK_CACHE_LINE_SIZE)))
+	    return -ENOMEM;
+	uintptr_t m = reinterpret_cast<uintptr_t>(_mem);
+	_v = reinterpret_cast<char *>((m + CLICK_CACHE_LINE_SIZE - 1) & ~(uintptr_t) (CLICK_CACHE_LINE_SIZE - 1));
+	_n = n;
+	for (int i = 0; i != n; ++i)
+	    new((void *) (_v + i * stride)) T();
+	return 0;
+    }
+
+    /** @brief Destroy all copies. */
+    void clear() {
+	if (!_mem)
+	    return;
+	for (int i = 0; i != _n; ++i)
+	    (*this)[i].~T();
+	CLICK_LFREE(_mem, _n * stride + CLICK_CACHE_LINE_SIZE);
+	_mem = 0;
+	_v = 0;
+	_n = 0;
+    }
+
+    /** @brief Return the number of copies. */
+    int size() const {
+	return _n;
+    }
+
+    /** @brief Return the calling thread's copy. */
+    T &local() {
+	return (*this)[click_current_cpu_id()];
+    }
+
+    /** @brief Return thread @a i's copy. */
+    T &operator[](int i) {
+	return *reinterpret_cast<T *>(_v + i * stride);
+    }
+
+    /** @overload */
+    const T &operator[](int i) const {
+	return *reinterpret_cast<const T *>(_v + i * stride);
+    }
+
+  private:
+
+    enum { stride = (sizeof(T) + CLICK_CACHE_LINE_SIZE - 1) & ~(CLICK_CACHE_LINE_SIZE - 1) };
+
+    void *_mem;
+    char *_v;
+    int _n;
+
+    PerThread(const PerThread<T> &);
+    PerThread<T> &operator=(const PerThread<T> &);
+
+};
+
+
+/** @class PerThreadCuckooTable
+  @brief One CuckooTable per thread.
+
+  Elements that see each flow on only one thread (for instance because an
+  upstream NIC or software RSS steers flows) can give each thread its own
+  table and avoid any sharing.  local() returns the calling thread's table,
+  as determined by click_current_cpu_id(). */
+template <typename K, typename V>
+class PerThreadCuckooTable { public:
+
+    typedef CuckooTable<K, V> table_type;
+    typedef typename table_type::size_type size_type;
+
+    PerThreadCuckooTable() {
+    }
+
+    /** @brief Allocate @a nthreads tables of @a capacity entries each.
+     * @return 0 on success, -ENOMEM on allocation failure */
+    int reserve(size_type capacity, int nthreads = click_max_cpu_ids()) {
+	if (_tables.resize(nthreads) < 0)
+	    return -ENOMEM;
+	for (int i = 0; i != nthreads; ++i)
+	    if (_tables[i].reserve(capacity) < 0)
+		return -ENOMEM;
+	return 0;
+    }
+
+    /** @brief Return the number of tables. */
+    int nthreads() const {
+	return _tables.size();
+    }
+
+    /** @brief Return the calling thread's table. */
+    table_type &local() {
+	return _tables.local();
+    }
+
+    /** @brief Return thread @a i's table. */
+    table_type &operator[](int i) {
+	return _tables[i];
+    }
+
+    /** @overload */
+    const table_type &operator[](int i) const {
+	return _tables[i];
+    }
+
+    /** @brief Return the total number of entries in all tables. */
+    size_type size() const {
+	size_type s = 0;
+	for (int i = 0; i != _tables.size(); ++i)
+	    s += _tables[i].size();
+	return s;
+    }
+
+    /** @brief Return the total number of bytes allocated by all tables. */
+    size_t memory_size() const {
+	size_t s = 0;
+	for (int i = 0; i != _tables.size(); ++i)
+	    s += _tables[i].memory_size();
+	return s;
+    }
+
+  private:
+
+    PerThread<table_type> _tables;
+
+    PerThreadCuckooTable(const PerThreadCuckooTable<K, V> &);
+    PerThreadCuckooTable<K, V> &operator=(const PerThreadCuckooTable<K, V> &);
+
+};
+
+CLICK_ENDDECLS
+#endif
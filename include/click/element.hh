@@ -93,6 +93,7 @@ class Element { public:
 
     virtual void take_state(Element *old_element, ErrorHandler *errh);
     virtual Element *hotswap_element() const;
+    virtual void merge_state(Element *other, ErrorHandler *errh);
 
     enum CleanupStage {
 	CLEANUP_NO_ROUTER,
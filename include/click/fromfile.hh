@@ -27,6 +27,7 @@ class FromFile { public:
     void set_lineno(int lineno)		{ _lineno = lineno; }
 
     off_t file_pos() const		{ return _file_offset + _pos; }
+    off_t file_size() const;
 
     int configure_keywords(Vector<String>& conf, Element* e, ErrorHandler* errh);
     int set_data(const String& data, ErrorHandler* errh);
@@ -55,6 +56,8 @@ class FromFile { public:
 
     enum { BUFFER_SIZE = 32768 };
 
+    class Decoder;
+
     int _fd;
     const uint8_t *_buffer;
     uint32_t _pos;
@@ -74,14 +77,17 @@ class FromFile { public:
 
     String _filename;
     FILE *_pipe;
+    Decoder *_decoder;
     off_t _file_offset;
     String _landmark_pattern;
     int _lineno;
 
 #ifdef ALLOW_MMAP
     int read_buffer_mmap(ErrorHandler *);
+    int remap_buffer(ErrorHandler *);
 #endif
     int read_buffer(ErrorHandler *);
+    int read_buffer_decoder(ErrorHandler *);
     bool read_packet(ErrorHandler *);
     int skip_ahead(ErrorHandler *);
 
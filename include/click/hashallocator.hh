@@ -19,6 +19,13 @@ class HashAllocator { public:
     inline void *allocate();
     inline void deallocate(void *p);
 
+    /** @brief Return the number of objects currently allocated. */
+    size_t nallocated() const {
+	return _nallocated;
+    }
+    /** @brief Return the number of bytes obtained from the system. */
+    size_t memory() const;
+
     void swap(HashAllocator &x);
 
   private:
@@ -46,6 +53,7 @@ class HashAllocator { public:
     link *_free;
     buffer *_buffer;
     size_t _size;
+    size_t _nallocated;
 
     void *hard_allocate();
 
@@ -67,6 +75,7 @@ class SizedHashAllocator : public HashAllocator { public:
 
 inline void *HashAllocator::allocate()
 {
+    ++_nallocated;
     if (link *l = _free) {
 #ifdef VALGRIND_MEMPOOL_ALLOC
 	VALGRIND_MEMPOOL_ALLOC(this, l, _size);
@@ -91,6 +100,7 @@ inline void *HashAllocator::allocate()
 inline void HashAllocator::deallocate(void *p)
 {
     if (p) {
+	--_nallocated;
 	reinterpret_cast<link *>(p)->next = _free;
 	_free = reinterpret_cast<link *>(p);
 #ifdef VALGRIND_MEMPOOL_FREE
@@ -188,5 +188,104 @@ inline String IPFlowID::s() const
     return unparse();
 }
 
+
+/** @class IPFlow5ID
+ * @brief An IPFlowID together with its IP protocol: the classic 5-tuple.
+ *
+ * IPFlowID ignores the protocol, so a TCP and a UDP flow with the same
+ * addresses and ports have equal IPFlowIDs.  Flow tables that see every
+ * protocol should key on IPFlow5ID instead. */
+class IPFlow5ID : public IPFlowID { public:
+
+    /** @brief Construct an empty flow ID. */
+    IPFlow5ID()
+	: _proto(0) {
+    }
+
+    /** @brief Construct a flow ID with the given parts.
+     * @param saddr source address
+     * @param sport source port, in network order
+     * @param daddr destination address
+     * @param dport destination port, in network order
+     * @param proto IP protocol */
+    IPFlow5ID(IPAddress saddr, uint16_t sport, IPAddress daddr, uint16_t dport,
+	      uint8_t proto)
+	: IPFlowID(saddr, sport, daddr, dport), _proto(proto) {
+    }
+
+    /** @brief Construct a flow ID from @a flow and @a proto. */
+    IPFlow5ID(const IPFlowID &flow, uint8_t proto)
+	: IPFlowID(flow), _proto(proto) {
+    }
+
+    /** @brief Construct a flow ID from @a p's ip_header().
+     * @param p input packet
+     * @param reverse if true, use the reverse of @a p's flow ID
+     *
+     * @pre @a p's ip_header() must point to an IPv4 header.
+     *
+     * Ports are taken from the transport header for TCP, UDP, DCCP, SCTP and
+     * UDP-Lite first fragments, and are zero otherwise. */
+    explicit IPFlow5ID(const Packet *p, bool reverse = false);
+
+    /** @brief Return this flow's IP protocol. */
+    uint8_t proto() const {
+	return _proto;
+    }
+
+    /** @brief Set this flow's IP protocol to @a proto. */
+    void set_proto(uint8_t proto) {
+	_proto = proto;
+    }
+
+    /** @brief Return this flow's reverse, which swaps sources and destinations. */
+    IPFlow5ID reverse() const {
+	return IPFlow5ID(_daddr, _dport, _saddr, _sport, _proto);
+    }
+
+    /** @brief Hash function.
+     *
+     * Unlike IPFlowID::hashcode(), every field affects every bit of the
+     * result, as open-addressed tables such as CuckooTable require. */
+    inline hashcode_t hashcode() const {
+	uint32_t h = mix(0, _saddr.addr());
+	h = mix(h, _daddr.addr());
+	h = mix(h, (uint32_t) _sport | ((uint32_t) _dport << 16));
+	return mix(h, _proto);
+    }
+
+    /** @brief Unparse this flow ID into a String.
+     *
+     * Returns a string formatted like "(SADDR, SPORT, DADDR, DPORT, PROTO)". */
+    String unparse() const;
+
+  private:
+
+    uint8_t _proto;
+
+    // MurmurHash3's block step
+    static inline uint32_t mix(uint32_t h, uint32_t k) {
+	k *= 0xCC9E2D51U;
+	k = (k << 15) | (k >> 17);
+	k *= 0x1B873593U;
+	h ^= k;
+	h = (h << 13) | (h >> 19);
+	return h * 5 + 0xE6546B64U;
+    }
+
+};
+
+inline bool operator==(const IPFlow5ID &a, const IPFlow5ID &b)
+{
+    return a.sport() == b.sport() && a.dport() == b.dport()
+	&& a.saddr() == b.saddr() && a.daddr() == b.daddr()
+	&& a.proto() == b.proto();
+}
+
+inline bool operator!=(const IPFlow5ID &a, const IPFlow5ID &b)
+{
+    return !(a == b);
+}
+
 CLICK_ENDDECLS
 #endif
@@ -37,6 +37,19 @@ click_relax_fence()
 #endif
 }
 
+/** @brief Prefetch the cache line containing @a p for reading.
+
+    A hint only: @a p need not be a valid address. */
+inline void
+click_prefetch(const void *p)
+{
+#if __GNUC__
+    __builtin_prefetch(p);
+#else
+    (void) p;
+#endif
+}
+
 /** @brief Full memory fence. */
 inline void
 click_fence()
@@ -17,6 +17,7 @@ class RouterThread;
 class HashMap_ArenaFactory;
 class NotifierSignal;
 class ThreadSched;
+class TracePartition;
 class Handler;
 class NameInfo;
 
@@ -91,6 +92,9 @@ class Router { public:
     inline void set_thread_sched(ThreadSched* scheduler);
     inline int home_thread_id(const Element *e) const;
 
+    inline const TracePartition* trace_partition() const;
+    inline void set_trace_partition(const TracePartition* partition);
+
     /** @cond never */
     // Needs to be public for NameInfo, but not useful outside
     inline NameInfo* name_info() const;
@@ -128,6 +132,7 @@ class Router { public:
 
     inline Router* hotswap_router() const;
     void set_hotswap_router(Router* router);
+    void merge_state(Router* other, ErrorHandler* errh);
 
     int initialize(ErrorHandler* errh);
     void activate(bool foreground, ErrorHandler* errh);
@@ -290,6 +295,7 @@ class Router { public:
     HashMap_ArenaFactory* _arena_factory;
     Router* _hotswap_router;
     ThreadSched* _thread_sched;
+    const TracePartition* _trace_partition;
     mutable NameInfo* _name_info;
     Vector<int> _flow_code_override_eindex;
     Vector<String> _flow_code_override;
@@ -443,6 +449,24 @@ Router::set_thread_sched(ThreadSched* ts)
     _thread_sched = ts;
 }
 
+/** @brief Return the router's share of a parallel trace, if any.
+ *
+ * In parallel trace mode, the driver runs several copies of a configuration
+ * and gives each copy's router a TracePartition. Trace sources use it to
+ * emit only their copy's share of the trace. Returns null outside parallel
+ * trace mode. */
+inline const TracePartition*
+Router::trace_partition() const
+{
+    return _trace_partition;
+}
+
+inline void
+Router::set_trace_partition(const TracePartition* partition)
+{
+    _trace_partition = partition;
+}
+
 inline int
 Router::home_thread_id(const Element *e) const
 {
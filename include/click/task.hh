@@ -352,7 +352,7 @@ class Task : private TaskLink { public:
  private:
 #endif
 
-    inline void add_pending_locked(RouterThread *thread);
+    inline bool add_pending_locked(RouterThread *thread);
     void add_pending();
     inline void remove_pending_locked(RouterThread *thread);
     void remove_pending();
@@ -0,0 +1,311 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_TRACEPARTITION_HH
+#define CLICK_TRACEPARTITION_HH
+#include <click/packet.hh>
+#include <click/hashmap.hh>
+#include <click/string.hh>
+#include <click/machine.hh>
+#include <click/task.hh>
+#include <clicknet/ip.h>
+#include <clicknet/ip6.h>
+CLICK_DECLS
+class TraceFeed;
+
+/** @class TracePartition
+ * @brief Share of a trace processed by one copy of a configuration.
+ *
+ * In parallel trace mode (<tt>click --parallel-trace</tt>), the driver runs
+ * several copies of one configuration, each on its own thread, and attaches
+ * a TracePartition to each copy's router (see Router::trace_partition()).
+ * Each packet is processed by exactly one copy. Trace sources such as
+ * FromDump read the trace only in copy 0, which hands the other copies'
+ * packets to them through a TraceFeed (see feed()).
+ *
+ * Packets are partitioned by a symmetric hash of their IP source and
+ * destination addresses. Both directions of a flow, and all of its
+ * fragments, therefore land in the same partition. Non-IP packets belong to
+ * partition 0. */
+class TracePartition { public:
+
+    typedef HashMap<String, TraceFeed *> feed_map_type;
+
+    TracePartition(int index = 0, int count = 1, feed_map_type *feeds = 0)
+	: _index(index), _count(count), _feeds(feeds) {
+    }
+
+    int index() const			{ return _index; }
+    int count() const			{ return _count; }
+
+    static inline uint32_t hash(const void *iph, const uint8_t *end_data);
+
+    /** @brief Return the partition holding the IP packet whose IP header
+     * starts at @a iph, which need not be aligned.
+     * @param iph IP header, or null for non-IP packets
+     * @param end_data end of the packet data */
+    int partition_of(const void *iph, const uint8_t *end_data) const {
+	return hash(iph, end_data) % _count;
+    }
+
+    /** @brief Return the partition holding @a p.
+     *
+     * @a p's network header annotation must point to its IP header. */
+    int partition_of(const Packet *p) const {
+	return partition_of(p->has_network_header() ? p->network_header() : 0,
+			    p->end_data());
+    }
+
+    /** @brief Test whether the IP packet whose IP header starts at @a iph,
+     * which need not be aligned, belongs to this partition.
+     * @param iph IP header, or null for non-IP packets
+     * @param end_data end of the packet data */
+    bool contains(const void *iph, const uint8_t *end_data) const {
+	return partition_of(iph, end_data) == _index;
+    }
+
+    /** @brief Test whether @a p belongs to this partition.
+     *
+     * @a p's network header annotation must point to its IP header. */
+    bool contains(const Packet *p) const {
+	return partition_of(p) == _index;
+    }
+
+    /** @brief Return the feed shared by every copy's trace source named
+     * @a name, creating it if necessary.
+     *
+     * Returns null if the driver provided no feeds. */
+    inline TraceFeed *feed(const String &name) const;
+
+  private:
+
+    int _index;
+    int _count;
+    feed_map_type *_feeds;
+
+    static inline uint32_t load32(const uint8_t *x) {
+	return (x[0] << 24) | (x[1] << 16) | (x[2] << 8) | x[3];
+    }
+    static inline uint32_t mix(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+    }
+
+};
+
+/** @brief Return a flow hash of the IPv4 or IPv6 header at @a iph.
+ *
+ * The hash covers only the addresses, and is the same for both directions.
+ * It is 0 for non-IP packets and truncated headers. */
+inline uint32_t
+TracePartition::hash(const void *iph, const uint8_t *end_data)
+{
+    const uint8_t *x = reinterpret_cast<const uint8_t *>(iph);
+    uint32_t h;
+    if (!x || x >= end_data)
+	return 0;
+    else if ((x[0] >> 4) == 4 && x + sizeof(click_ip) <= end_data)
+	// XOR is commutative, so both directions hash alike
+	h = load32(x + 12) ^ load32(x + 16);
+    else if ((x[0] >> 4) == 6 && x + sizeof(click_ip6) <= end_data) {
+	h = 0;
+	for (int i = 8; i < 40; i += 4)
+	    h ^= load32(x + i);
+    } else
+	return 0;
+    return mix(h);
+}
+
+
+/** @class TraceFeed
+ * @brief Hands packets from the copy that reads a trace to the other copies.
+ *
+ * In parallel trace mode, only copy 0's trace source reads the trace. It
+ * emits its own packets and pushes each other packet onto the ring of the
+ * copy whose partition holds it. The other copies' sources pull their
+ * packets from their rings. Each ring has one producer and one consumer, so
+ * no locks are needed. A task with nothing to do sleeps rather than spins:
+ * a consumer whose ring is empty, or a source whose next ring is full, calls
+ * sleep_pull() or sleep_push(), and the other side reschedules it with
+ * wake_pullers() or wake_pusher(). Waking a task costs a system call and
+ * usually a context switch, so a running source wakes consumers only once
+ * their rings hold wake_batch packets, and consumers wake the source only
+ * once its ring has wake_batch free slots. */
+class TraceFeed { public:
+
+    enum { ring_size = 1024, ring_mask = ring_size - 1,
+	   wake_batch = ring_size / 8 };
+
+    explicit TraceFeed(int count)
+	: _rings(new Ring[count]), _count(count), _source(0), _source_task(0),
+	  _source_ring(0), _source_waiting(false), _done(false) {
+	for (int i = 0; i < count; ++i) {
+	    _rings[i].head = _rings[i].tail = 0;
+	    _rings[i].task = 0;
+	    _rings[i].waiting = _rings[i].attached = false;
+	}
+    }
+
+    ~TraceFeed() {
+	for (int i = 0; i < _count; ++i)
+	    while (_rings[i].head != _rings[i].tail)
+		_rings[i].slot[_rings[i].head++ & ring_mask]->kill();
+	delete[] _rings;
+    }
+
+    /** @brief Return the element that reads the trace, or null. */
+    Element *source() const		{ return _source; }
+    /** @brief Set the element that reads the trace.
+     * @param task the element's task, or null if it has none */
+    void set_source(Element *e, Task *task) {
+	_source = e;
+	_source_task = task;
+    }
+
+    /** @brief Note that copy @a index pulls its packets from this feed.
+     * @param task the copy's task, or null if it has none
+     *
+     * Copies that don't attach read the trace themselves. */
+    void attach(int index, Task *task) {
+	_rings[index].attached = true;
+	_rings[index].task = task;
+    }
+    bool attached(int index) const	{ return _rings[index].attached; }
+
+    /** @brief Append @a p to copy @a index's ring.
+     * @return false if the ring is full; @a p is not consumed */
+    bool push(int index, Packet *p) {
+	Ring &r = _rings[index];
+	unsigned t = r.tail;
+	if (t - r.head == ring_size)
+	    return false;
+	r.slot[t & ring_mask] = p;
+	click_write_fence();
+	r.tail = t + 1;
+	return true;
+    }
+
+    /** @brief Mark the trace as finished; no more packets will be pushed. */
+    void finish() {
+	click_write_fence();
+	_done = true;
+	wake_pullers();
+    }
+
+    /** @brief Remove and return the next packet on copy @a index's ring.
+     * @param[out] more set to false if no packets remain and none will be
+     * pushed; otherwise unchanged
+     *
+     * Returns null if the ring is empty. */
+    Packet *pull(int index, bool &more) {
+	Ring &r = _rings[index];
+	bool done = _done;
+	click_read_fence();
+	unsigned h = r.head;
+	if (h == r.tail) {
+	    if (done)
+		more = false;
+	    return 0;
+	}
+	Packet *p = r.slot[h & ring_mask];
+	click_read_fence();
+	r.head = h + 1;
+	return p;
+    }
+
+    /** @brief Prepare copy @a index's task to sleep until its ring has
+     * packets or the trace is finished.
+     * @return true if the task should sleep */
+    bool sleep_pull(int index) {
+	Ring &r = _rings[index];
+	if (!r.task)
+	    return false;
+	r.waiting = true;
+	click_fence();
+	if (r.head == r.tail && !_done)
+	    return true;
+	r.waiting = false;
+	return false;
+    }
+
+    /** @brief Prepare the source's task to sleep until copy @a index's ring
+     * has room.
+     * @return true if the task should sleep */
+    bool sleep_push(int index) {
+	Ring &r = _rings[index];
+	if (!_source_task)
+	    return false;
+	_source_ring = index;
+	_source_waiting = true;
+	click_fence();
+	if (r.tail - r.head == ring_size)
+	    return true;
+	_source_waiting = false;
+	return false;
+    }
+
+    /** @brief Wake the sleeping copies that have at least @a batch packets
+     * to pull, or that have packets and the trace is finished.
+     *
+     * A source about to stop running should pass a @a batch of 1. */
+    void wake_pullers(unsigned batch = 1) {
+	click_fence();
+	for (int i = 0; i < _count; ++i) {
+	    Ring &r = _rings[i];
+	    if (r.waiting && (r.tail - r.head >= batch || _done)) {
+		r.waiting = false;
+		r.task->reschedule();
+	    }
+	}
+    }
+
+    /** @brief Wake the source if it is sleeping until copy @a index's ring
+     * has room, and the ring has wake_batch free slots. */
+    void wake_pusher(int index) {
+	click_fence();
+	if (_source_waiting && _source_ring == index
+	    && _rings[index].tail - _rings[index].head <= ring_size - wake_batch) {
+	    _source_waiting = false;
+	    _source_task->reschedule();
+	}
+    }
+
+  private:
+
+    struct Ring {
+	volatile unsigned head;
+	volatile unsigned tail;
+	Task *task;
+	volatile bool waiting;
+	bool attached;
+	Packet *slot[ring_size];
+    };
+
+    Ring *_rings;
+    int _count;
+    Element *_source;
+    Task *_source_task;
+    int _source_ring;
+    volatile bool _source_waiting;
+    volatile bool _done;
+
+    TraceFeed(const TraceFeed &);
+    TraceFeed &operator=(const TraceFeed &);
+
+};
+
+inline TraceFeed *
+TracePartition::feed(const String &name) const
+{
+    if (!_feeds)
+	return 0;
+    TraceFeed *&f = _feeds->find_force(name);
+    if (!f)
+	f = new TraceFeed(_count);
+    return f;
+}
+
+CLICK_ENDDECLS
+#endif
@@ -76,7 +76,7 @@ String shell_command_output_string(String command_line, const String &command_st
  * @param buf buffer
  * @param len number of characters in @a buf, should be >= 10
  *
- * Checks @a buf for signatures corresponding to zip, gzip, and bzip2
+ * Checks @a buf for signatures corresponding to zip, gzip, bzip2, xz, and zstd
  * compressed data, returning true iff a signature matches.  @a len can be any
  * number, but should be relatively large or compression might not be
  * detected.  Currently it must be at least 10 to detect bzip2 compression. */
@@ -130,6 +130,24 @@ struct click_ip {
  * @a x must be two-byte aligned. */
 uint16_t click_in_cksum(const unsigned char *x, int len);
 uint16_t click_in_cksum_pseudohdr_raw(uint32_t csum, uint32_t src, uint32_t dst, int proto, int packet_len);
+
+/** @brief An implementation of click_in_cksum().
+ *
+ * click_in_cksum() chooses the fastest implementation the CPU supports the
+ * first time it checksums long data.  The others remain available for
+ * testing and benchmarking. */
+struct click_in_cksum_impl {
+    const char *name;
+    uint16_t (*cksum)(const unsigned char *x, int len);
+};
+
+/** @brief Return the checksum implementations, fastest first.
+ *
+ * The array is terminated by an entry with null name. */
+const struct click_in_cksum_impl *click_in_cksum_impls(void);
+
+/** @brief Return true iff @a impl can run on this CPU. */
+int click_in_cksum_impl_supported(const struct click_in_cksum_impl *impl);
 #else
 # define click_in_cksum(addr, len) \
 		ip_compute_csum((unsigned char *)(addr), (len))
@@ -182,6 +200,38 @@ click_update_in_cksum(uint16_t *csum, uint16_t old_hw, uint16_t new_hw)
     *csum = ~(sum + (sum >> 16));
 }
 
+/** @brief Incrementally adjust an Internet checksum for a changed word.
+ * @param[in, out] csum points to checksum
+ * @param old_w old 32-bit word
+ * @param new_w new 32-bit word
+ *
+ * Equivalent to calling click_update_in_cksum() on both halfwords of the
+ * word, as when an IP address or TCP sequence number changes. */
+static inline void
+click_update_in_cksum32(uint16_t *csum, uint32_t old_w, uint32_t new_w)
+{
+    uint32_t sum = (~*csum & 0xFFFF) + (~old_w & 0xFFFF) + (~old_w >> 16)
+	+ (new_w & 0xFFFF) + (new_w >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    *csum = ~(sum + (sum >> 16));
+}
+
+/** @brief Incrementally adjust an Internet checksum by a sum of changes.
+ * @param[in, out] csum points to checksum
+ * @param delta one's-complement sum of changes
+ *
+ * @a delta is the sum, in any order and without folding, of ~old_hw & 0xFFFF
+ * and new_hw for every changed halfword.  Use this when many halfwords
+ * change at once, for example when rewriting TCP SACK blocks. */
+static inline void
+click_update_in_cksum_sum(uint16_t *csum, uint32_t delta)
+{
+    uint32_t sum = (delta & 0xFFFF) + (delta >> 16);
+    sum += ~*csum & 0xFFFF;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    *csum = ~(sum + (sum >> 16));
+}
+
 /** @brief Potentially fix a zero-valued Internet checksum.
  * @param[in, out] csum points to checksum
  * @param x data to checksum
@@ -1528,6 +1528,36 @@ Element::hotswap_element() const
     return 0;
 }
 
+/** @brief Fold the state of @a other, a copy of this element, into this
+ * element.
+ *
+ * @param other element in a copy of this element's router; it has the same
+ * name() and class_name() as this element
+ * @param errh error handler
+ *
+ * The merge_state() method supports parallel trace processing, where the
+ * driver runs several copies of a configuration, each on its own thread and
+ * each processing part of a trace (see TracePartition). When every copy has
+ * stopped, the driver calls Router::merge_state() to merge the copies into
+ * the first, and then calls any requested handlers on the first copy.
+ *
+ * The default merge_state() implementation does nothing, so the first
+ * copy's state stands for the whole trace. Elements with mergeable state,
+ * such as counters, override it. For example, a packet counter adds @a
+ * other's counts to its own. merge_state() should leave @a other in a state
+ * that's safe to cleanup().
+ *
+ * merge_state() is called after both routers have stopped. None of their
+ * tasks or timers are running.
+ *
+ * @sa Router::merge_state, take_state
+ */
+void
+Element::merge_state(Element *other, ErrorHandler *errh)
+{
+    (void) other, (void) errh;
+}
+
 /** @brief Clean up the element's state.
  *
  * @param stage this element's maximum initialization stage
@@ -31,6 +31,18 @@
 #ifdef ALLOW_MMAP
 # include <sys/mman.h>
 #endif
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+#if HAVE_LZMA
+# include <lzma.h>
+#endif
+#if HAVE_ZSTD
+# include <zstd.h>
+#endif
+#if HAVE_USER_MULTITHREAD
+# include <pthread.h>
+#endif
 CLICK_DECLS
 
 FromFile::FromFile()
@@ -38,7 +50,7 @@ FromFile::FromFile()
 #ifdef ALLOW_MMAP
       _mmap(true),
 #endif
-      _filename(), _pipe(0), _landmark_pattern("%f"), _lineno(0)
+      _filename(), _pipe(0), _decoder(0), _landmark_pattern("%f"), _lineno(0)
 {
 }
 
@@ -116,6 +128,417 @@ FromFile::warning(ErrorHandler *errh, const char *format, ...) const
     return r;
 }
 
+/** @class FromFile::Decoder
+ * @brief Decompresses a file in process.
+ *
+ * A Decoder reads compressed data from a file descriptor and produces
+ * decompressed blocks in packets.  With multithreading, a decoder thread
+ * fills one block while FromFile consumes the previous one; otherwise
+ * blocks are decompressed on demand.  Packets are allocated and freed only
+ * by the caller's thread. */
+class FromFile::Decoder { public:
+
+    enum { f_gzip = 1, f_xz = 2, f_zstd = 3 };
+    enum { BLOCK_SIZE = 262144, INPUT_SIZE = 131072 };
+
+    static int format(const uint8_t *buf, uint32_t len);
+
+    Decoder(int fd, int format);
+    ~Decoder();
+
+    int start(const uint8_t *data, uint32_t len);
+    WritablePacket *next(int &len);
+    const String &error() const		{ return _error; }
+
+  private:
+
+    int _fd;
+    int _format;
+    uint8_t *_in;
+    uint32_t _in_pos;
+    uint32_t _in_len;
+    uint32_t _in_cap;
+    bool _in_eof;
+    bool _boundary;		// at the end of a gzip member or zstd frame
+    bool _done;
+    bool _failed;
+    bool _codec;		// codec state was initialized
+    int _result;		// 0 at the end of the data, < 0 after an error
+    String _error;
+
+#if HAVE_ZLIB
+    z_stream _zs;
+#endif
+#if HAVE_LZMA
+    lzma_stream _ls;
+#endif
+#if HAVE_ZSTD
+    ZSTD_DStream *_zds;
+#endif
+
+#if HAVE_USER_MULTITHREAD
+    pthread_t _thread;
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    WritablePacket *_empty;	// block for the decoder thread to fill
+    WritablePacket *_ready;	// block filled by the decoder thread
+    int _ready_len;
+    bool _threaded;
+    bool _stop;
+
+    static void *thread_hook(void *);
+    void run();
+#endif
+
+    int fill();
+    int step(uint8_t *&out, uint8_t *out_end, bool eof);
+    int decode(uint8_t *out, uint32_t cap);
+
+};
+
+int
+FromFile::Decoder::format(const uint8_t *buf, uint32_t len)
+{
+#if HAVE_ZLIB
+    if (len >= 3 && buf[0] == 037 && buf[1] == 0213)
+	return f_gzip;
+#endif
+#if HAVE_LZMA
+    if (len >= 6 && memcmp(buf, "\xFD" "7zXZ\0", 6) == 0)
+	return f_xz;
+#endif
+#if HAVE_ZSTD
+    if (len >= 4 && memcmp(buf, "\x28\xB5\x2F\xFD", 4) == 0)
+	return f_zstd;
+#endif
+    (void) buf, (void) len;
+    return 0;
+}
+
+FromFile::Decoder::Decoder(int fd, int format)
+    : _fd(fd), _format(format), _in(0), _in_pos(0), _in_len(0), _in_cap(0),
+      _in_eof(false), _boundary(false), _done(false), _failed(false),
+      _codec(false), _result(1)
+#if HAVE_ZSTD
+    , _zds(0)
+#endif
+#if HAVE_USER_MULTITHREAD
+    , _empty(0), _ready(0), _ready_len(0), _threaded(false), _stop(false)
+#endif
+{
+}
+
+FromFile::Decoder::~Decoder()
+{
+#if HAVE_USER_MULTITHREAD
+    if (_threaded) {
+	pthread_mutex_lock(&_lock);
+	_stop = true;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_lock);
+	pthread_join(_thread, 0);
+	pthread_mutex_destroy(&_lock);
+	pthread_cond_destroy(&_cond);
+    }
+    if (_empty)
+	_empty->kill();
+    if (_ready)
+	_ready->kill();
+#endif
+    if (_codec)
+	switch (_format) {
+#if HAVE_ZLIB
+	case f_gzip:
+	    inflateEnd(&_zs);
+	    break;
+#endif
+#if HAVE_LZMA
+	case f_xz:
+	    lzma_end(&_ls);
+	    break;
+#endif
+#if HAVE_ZSTD
+	case f_zstd:
+	    ZSTD_freeDStream(_zds);
+	    break;
+#endif
+	}
+    delete[] _in;
+}
+
+int
+FromFile::Decoder::start(const uint8_t *data, uint32_t len)
+{
+    // data was read from the file before compression was detected
+    _in_cap = len > (uint32_t) INPUT_SIZE ? len : (uint32_t) INPUT_SIZE;
+    if (!(_in = new uint8_t[_in_cap]))
+	return -ENOMEM;
+    memcpy(_in, data, len);
+    _in_len = len;
+
+    switch (_format) {
+#if HAVE_ZLIB
+    case f_gzip:
+	memset(&_zs, 0, sizeof(_zs));
+	if (inflateInit2(&_zs, 15 + 16) != Z_OK)
+	    return -ENOMEM;
+	break;
+#endif
+#if HAVE_LZMA
+    case f_xz: {
+	lzma_stream init = LZMA_STREAM_INIT;
+	_ls = init;
+	if (lzma_stream_decoder(&_ls, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+	    return -ENOMEM;
+	break;
+    }
+#endif
+#if HAVE_ZSTD
+    case f_zstd:
+	if (!(_zds = ZSTD_createDStream())
+	    || ZSTD_isError(ZSTD_initDStream(_zds))) {
+	    ZSTD_freeDStream(_zds);
+	    return -ENOMEM;
+	}
+	break;
+#endif
+    default:
+	return -EINVAL;
+    }
+    _codec = true;
+
+#if HAVE_USER_MULTITHREAD
+    // If the thread cannot start, decompress on demand.
+    if ((_empty = Packet::make(0, 0, BLOCK_SIZE, 0))) {
+	pthread_mutex_init(&_lock, 0);
+	pthread_cond_init(&_cond, 0);
+	if (pthread_create(&_thread, 0, thread_hook, this) == 0)
+	    _threaded = true;
+	else {
+	    pthread_mutex_destroy(&_lock);
+	    pthread_cond_destroy(&_cond);
+	    _empty->kill();
+	    _empty = 0;
+	}
+    }
+#endif
+    return 0;
+}
+
+int
+FromFile::Decoder::fill()
+{
+    _in_pos = _in_len = 0;
+    while (1) {
+	ssize_t got = ::read(_fd, _in, _in_cap);
+	if (got > 0) {
+	    _in_len = got;
+	    return got;
+	} else if (got == 0) {
+	    _in_eof = true;
+	    return 0;
+	} else if (errno != EINTR && errno != EAGAIN) {
+	    _error = strerror(errno);
+	    return -1;
+	}
+    }
+}
+
+int
+FromFile::Decoder::step(uint8_t *&out, uint8_t *out_end, bool eof)
+{
+    // Returns 0 to continue, 1 at the end of the data, or -1 on error.
+    uint8_t *in = _in + _in_pos;
+    size_t in_avail = _in_len - _in_pos;
+    switch (_format) {
+#if HAVE_ZLIB
+    case f_gzip: {
+	if (eof && _boundary)
+	    return 1;
+	_zs.next_in = in;
+	_zs.avail_in = in_avail;
+	_zs.next_out = out;
+	_zs.avail_out = out_end - out;
+	int r = inflate(&_zs, Z_NO_FLUSH);
+	_in_pos += in_avail - _zs.avail_in;
+	out = _zs.next_out;
+	if (r == Z_STREAM_END) {
+	    // gzip files may hold several members
+	    inflateReset(&_zs);
+	    _boundary = true;
+	    return 0;
+	} else if (r == Z_OK || (r == Z_BUF_ERROR && !eof)) {
+	    if (_zs.avail_in != in_avail)
+		_boundary = false;
+	    return 0;
+	} else if (r == Z_DATA_ERROR && _boundary)
+	    // ignore trailing garbage, as gzip does
+	    return 1;
+	else if (r == Z_BUF_ERROR)
+	    _error = "gzip: unexpected end of file";
+	else
+	    _error = String("gzip: ") + (_zs.msg ? _zs.msg : "decompression error");
+	return -1;
+    }
+#endif
+#if HAVE_LZMA
+    case f_xz: {
+	_ls.next_in = in;
+	_ls.avail_in = in_avail;
+	_ls.next_out = out;
+	_ls.avail_out = out_end - out;
+	lzma_ret r = lzma_code(&_ls, eof ? LZMA_FINISH : LZMA_RUN);
+	_in_pos += in_avail - _ls.avail_in;
+	out = _ls.next_out;
+	if (r == LZMA_STREAM_END)
+	    return 1;
+	else if (r == LZMA_OK || (r == LZMA_BUF_ERROR && !eof))
+	    return 0;
+	else if (r == LZMA_BUF_ERROR)
+	    _error = "xz: unexpected end of file";
+	else if (r == LZMA_MEM_ERROR)
+	    _error = strerror(ENOMEM);
+	else
+	    _error = "xz: corrupt data";
+	return -1;
+    }
+#endif
+#if HAVE_ZSTD
+    case f_zstd: {
+	if (eof && _boundary)
+	    return 1;
+	ZSTD_inBuffer ib = { in, in_avail, 0 };
+	ZSTD_outBuffer ob = { out, (size_t) (out_end - out), 0 };
+	size_t r = ZSTD_decompressStream(_zds, &ob, &ib);
+	_in_pos += ib.pos;
+	out += ob.pos;
+	if (ZSTD_isError(r)) {
+	    _error = String("zstd: ") + ZSTD_getErrorName(r);
+	    return -1;
+	} else if (eof && ib.pos == 0 && ob.pos == 0 && r != 0) {
+	    _error = "zstd: unexpected end of file";
+	    return -1;
+	}
+	// r == 0 means a frame was completely decoded and flushed
+	_boundary = (r == 0);
+	return 0;
+    }
+#endif
+    default:
+	(void) in, (void) in_avail, (void) out, (void) out_end, (void) eof;
+	_error = "unknown format";
+	return -1;
+    }
+}
+
+int
+FromFile::Decoder::decode(uint8_t *out, uint32_t cap)
+{
+    // Data decoded before an error is returned first.
+    uint8_t *o = out, *e = out + cap;
+    while (o < e && !_done && !_failed) {
+	int r = 0;
+	if (_in_pos == _in_len && !_in_eof && fill() < 0)
+	    r = -1;
+	else
+	    r = step(o, e, _in_pos == _in_len && _in_eof);
+	if (r < 0)
+	    _failed = true;
+	else if (r > 0)
+	    _done = true;
+    }
+    if (o == out && _failed)
+	return -1;
+    return o - out;
+}
+
+#if HAVE_USER_MULTITHREAD
+void *
+FromFile::Decoder::thread_hook(void *arg)
+{
+    static_cast<Decoder *>(arg)->run();
+    return 0;
+}
+
+void
+FromFile::Decoder::run()
+{
+    pthread_mutex_lock(&_lock);
+    while (1) {
+	while (!_empty && !_stop)
+	    pthread_cond_wait(&_cond, &_lock);
+	if (_stop)
+	    break;
+	WritablePacket *p = _empty;
+	_empty = 0;
+	pthread_mutex_unlock(&_lock);
+
+	int len = decode(p->data(), BLOCK_SIZE);
+
+	pthread_mutex_lock(&_lock);
+	_ready = p;
+	_ready_len = len;
+	pthread_cond_signal(&_cond);
+	if (len <= 0)
+	    break;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+#endif
+
+WritablePacket *
+FromFile::Decoder::next(int &len)
+{
+    // Returns a block of len bytes. At the end of the data, returns null
+    // with len 0; on error, returns null with len < 0.
+    if (_result <= 0) {
+	len = _result;
+	return 0;
+    }
+    WritablePacket *p = Packet::make(0, 0, BLOCK_SIZE, 0);
+#if HAVE_USER_MULTITHREAD
+    if (_threaded) {
+	bool handed = false;
+	pthread_mutex_lock(&_lock);
+	while (!_ready)
+	    pthread_cond_wait(&_cond, &_lock);
+	WritablePacket *q = _ready;
+	len = _ready_len;
+	_ready = 0;
+	if (len > 0 && p) {
+	    // decode the next block while the caller uses this one
+	    _empty = p;
+	    handed = true;
+	    pthread_cond_signal(&_cond);
+	}
+	pthread_mutex_unlock(&_lock);
+	if (!handed) {
+	    if (p)
+		p->kill();
+	    if (len > 0) {
+		// the decoder thread has no block to fill, so stop
+		len = -1;
+		_error = strerror(ENOMEM);
+	    }
+	}
+	p = q;
+    } else
+#endif
+    if (p)
+	len = decode(p->data(), BLOCK_SIZE);
+    else {
+	len = -1;
+	_error = strerror(ENOMEM);
+    }
+    if (len <= 0) {
+	if (p)
+	    p->kill();
+	p = 0;
+	_result = len;
+    }
+    return p;
+}
+
 #ifdef ALLOW_MMAP
 static void
 munmap_destructor(unsigned char *data, size_t amount, void*)
@@ -168,6 +591,31 @@ FromFile::read_buffer_mmap(ErrorHandler *errh)
 
     return 1;
 }
+
+int
+FromFile::remap_buffer(ErrorHandler *errh)
+{
+    // Map a new window that starts at the page holding the current
+    // position, so data that crosses the end of the old window is mapped
+    // rather than copied. Packets cloned from the old window keep it
+    // mapped until they die.
+    off_t want = _file_offset + _pos;
+    size_t page_size = getpagesize();
+    if (_data_packet)
+	_data_packet->kill();
+    _data_packet = 0;
+    _mmap_off = (want / page_size) * page_size;
+    int result = read_buffer_mmap(errh);
+    if (result <= 0) {
+	_mmap = false;
+	(void) lseek(_fd, want, SEEK_SET);
+	_file_offset = want;
+	_pos = _len = 0;
+	return result;
+    }
+    _pos = want - _file_offset;
+    return result;
+}
 #endif
 
 int
@@ -185,6 +633,9 @@ FromFile::read_buffer(ErrorHandler *errh)
     if (_fd < 0)
 	return _fd == -1 ? -EBADF : _len;
 
+    if (_decoder)
+	return read_buffer_decoder(errh);
+
 #ifdef ALLOW_MMAP
     if (_mmap) {
 	int result = read_buffer_mmap(errh);
@@ -217,6 +668,20 @@ FromFile::read_buffer(ErrorHandler *errh)
     return _len;
 }
 
+int
+FromFile::read_buffer_decoder(ErrorHandler *errh)
+{
+    int len;
+    if (!(_data_packet = _decoder->next(len))) {
+	if (len < 0)
+	    return error(errh, "%s", _decoder->error().c_str());
+	return 0;
+    }
+    _buffer = _data_packet->data();
+    _len = len;
+    return _len;
+}
+
 int
 FromFile::read(void *vdata, uint32_t dlen, ErrorHandler *errh)
 {
@@ -242,6 +707,13 @@ FromFile::read(void *vdata, uint32_t dlen, ErrorHandler *errh)
 int
 FromFile::read_line(String &result, ErrorHandler *errh, bool temporary)
 {
+    // a seek may leave the position beyond the current buffer
+    if (_pos > _len) {
+	int errcode = read_buffer(errh);
+	if (errcode <= 0)
+	    return errcode;
+    }
+
     // first, try to read a line from the current buffer
     const unsigned char *s = _buffer + _pos;
     const unsigned char *e = _buffer + _len;
@@ -316,7 +788,7 @@ int
 FromFile::seek(off_t want, ErrorHandler* errh)
 {
     if (want >= _file_offset && want < (off_t) (_file_offset + _len)) {
-	_pos = want;
+	_pos = want - _file_offset;
 	return 0;
     }
 
@@ -331,18 +803,24 @@ FromFile::seek(off_t want, ErrorHandler* errh)
     if (_fd < 0)
         return _fd == -1 ? -EBADF : 0;
 
-    // check length of file
-    struct stat statbuf;
-    if (fstat(_fd, &statbuf) < 0)
-	return error(errh, "stat: %s", strerror(errno));
-    if (S_ISREG(statbuf.st_mode) && statbuf.st_size && want > statbuf.st_size)
-	return errh->error("FILEPOS out of range");
+    if (_decoder) {
+	// decompressed data can only be skipped
+	if (want < _file_offset)
+	    return error(errh, "cannot seek backward in compressed file");
+    } else {
+	// check length of file
+	struct stat statbuf;
+	if (fstat(_fd, &statbuf) < 0)
+	    return error(errh, "stat: %s", strerror(errno));
+	if (S_ISREG(statbuf.st_mode) && statbuf.st_size && want > statbuf.st_size)
+	    return errh->error("FILEPOS out of range");
 
-    // try to seek
-    if (lseek(_fd, want, SEEK_SET) != (off_t) -1) {
-	_pos = _len;
-	_file_offset = want - _len;
-	return 0;
+	// try to seek
+	if (lseek(_fd, want, SEEK_SET) != (off_t) -1) {
+	    _pos = _len;
+	    _file_offset = want - _len;
+	    return 0;
+	}
     }
 
     // otherwise, read data
@@ -404,9 +882,28 @@ FromFile::initialize(ErrorHandler *errh, bool allow_nonexistent)
 	return -ENOENT;
     }
 
-    // check for a gziped or bzip2d dump
-    if (_fd == STDIN_FILENO || _pipe)
-	/* cannot handle gzip or bzip2 */;
+    // check for a compressed dump: decompress it here if we can, otherwise
+    // through a pipe
+    if (_pipe || _decoder)
+	/* already decompressing */;
+    else if (int format = Decoder::format(_buffer, _len)) {
+#ifdef ALLOW_MMAP
+	// the decoder reads the file after the data it already has; seek
+	// there before its thread starts reading
+	if (_mmap) {
+	    (void) lseek(_fd, _mmap_off, SEEK_SET);
+	    _mmap = false;
+	}
+#endif
+	_decoder = new Decoder(_fd, format);
+	if (_decoder->start(_buffer, _len) < 0) {
+	    delete _decoder;
+	    _decoder = 0;
+	    return error(errh, "decompression: %s", strerror(ENOMEM));
+	}
+	goto retry_file;
+    } else if (_fd == STDIN_FILENO)
+	/* cannot handle this compression format */;
     else if (compressed_data(_buffer, _len)) {
 	close(_fd);
 	_fd = -1;
@@ -426,6 +923,8 @@ FromFile::take_state(FromFile &o, ErrorHandler *errh)
     o._fd = -1;
     _pipe = o._pipe;
     o._pipe = 0;
+    _decoder = o._decoder;
+    o._decoder = 0;
 
     _buffer = o._buffer;
     _pos = o._pos;
@@ -450,6 +949,9 @@ FromFile::take_state(FromFile &o, ErrorHandler *errh)
 void
 FromFile::cleanup()
 {
+    // stop the decoder thread before closing its file
+    delete _decoder;
+    _decoder = 0;
     if (_pipe)
 	pclose(_pipe);
     else if (_fd >= 0 && _fd != STDIN_FILENO)
@@ -519,6 +1021,11 @@ FromFile::get_string(size_t size, ErrorHandler *errh)
 Packet *
 FromFile::get_packet(size_t size, uint32_t sec, uint32_t subsec, ErrorHandler *errh)
 {
+#ifdef ALLOW_MMAP
+    if (_pos + size > _len && _mmap && _fd >= 0 && _pos < _len
+	&& _mmap_unit >= size)
+	(void) remap_buffer(errh);
+#endif
     if (_pos + size <= _len) {
 	if (Packet *p = _data_packet->clone()) {
 	    p->shrink_data(_buffer + _pos, size);
@@ -574,13 +1081,27 @@ FromFile::filename_handler(Element *e, void *thunk)
     return fd->print_filename();
 }
 
+/** @brief Return the size of the file, or -1 if it is not a regular file.
+ *
+ * Compressed files and pipes have no known size. */
+off_t
+FromFile::file_size() const
+{
+    struct stat s;
+    if (_fd >= 0 && !_decoder && !_pipe && fstat(_fd, &s) >= 0
+	&& S_ISREG(s.st_mode))
+	return s.st_size;
+    else
+	return -1;
+}
+
 String
 FromFile::filesize_handler(Element *e, void *thunk)
 {
     FromFile *fd = reinterpret_cast<FromFile *>((uint8_t *)e + (intptr_t)thunk);
-    struct stat s;
-    if (fd->_fd >= 0 && fstat(fd->_fd, &s) >= 0 && S_ISREG(s.st_mode))
-	return String(s.st_size);
+    off_t size = fd->file_size();
+    if (size >= 0)
+	return String(size);
     else
 	return "-";
 }
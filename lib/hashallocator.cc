@@ -23,7 +23,7 @@
 CLICK_DECLS
 
 HashAllocator::HashAllocator(size_t size)
-    : _free(0), _buffer(0), _size(size)
+    : _free(0), _buffer(0), _size(size), _nallocated(0)
 {
 #ifdef VALGRIND_CREATE_MEMPOOL
     VALGRIND_CREATE_MEMPOOL(this, 0, 0);
@@ -68,8 +68,18 @@ void *HashAllocator::hard_allocate()
 	VALGRIND_MEMPOOL_ALLOC(this, data, _size);
 #endif
 	return data;
-    } else
+    } else {
+	--_nallocated;
 	return 0;
+    }
+}
+
+size_t HashAllocator::memory() const
+{
+    size_t n = 0;
+    for (buffer *b = _buffer; b; b = b->next)
+	n += b->maxpos;
+    return n;
 }
 
 void HashAllocator::swap(HashAllocator &x)
@@ -86,6 +96,10 @@ void HashAllocator::swap(HashAllocator &x)
     _buffer = x._buffer;
     x._buffer = xbuffer;
 
+    size_t xnallocated = _nallocated;
+    _nallocated = x._nallocated;
+    x._nallocated = xnallocated;
+
 #ifdef VALGRIND_MOVE_MEMPOOL
     VALGRIND_MOVE_MEMPOOL(this, reinterpret_cast<HashAllocator *>(100));
     VALGRIND_MOVE_MEMPOOL(&x, this);
@@ -17,37 +17,206 @@
 #endif
 
 #if !CLICK_LINUXMODULE
-uint16_t
-click_in_cksum(const unsigned char *addr, int len)
+/*
+ * The Internet checksum is a one's-complement sum of 16-bit words.  Since
+ * 2^16 == 1 (mod 2^16 - 1), it can also be computed by adding wider words
+ * into a wider accumulator and folding at the end; each implementation
+ * below does so.  All of them sum words in host byte order, like the
+ * classic 16-bit loop, so results match it bit for bit.
+ */
+
+static inline uint16_t
+cksum_fold(uint64_t sum)
 {
-    int nleft = len;
-    const uint16_t *w = (const uint16_t *)addr;
-    uint32_t sum = 0;
-    uint16_t answer = 0;
-
-    /*
-     * Our algorithm is simple, using a 32 bit accumulator (sum), we add
-     * sequential 16 bit words to it, and at the end, fold back all the
-     * carry bits from the top 16 bits into the lower 16 bits.
-     */
-    while (nleft > 1)  {
-	sum += *w++;
-	nleft -= 2;
-    }
+    sum = (sum & 0xFFFFFFFFU) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFFU) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+/* Add the bytes in [x, x+len) to sum, 8 bytes at a time. */
+static inline uint64_t
+cksum_add_words(uint64_t sum, const unsigned char *x, int len)
+{
+    uint64_t w, w2, w3, w4;
+    uint32_t w32;
+    uint16_t w16;
 
+    while (len >= 32) {
+	memcpy(&w, x, 8);
+	memcpy(&w2, x + 8, 8);
+	memcpy(&w3, x + 16, 8);
+	memcpy(&w4, x + 24, 8);
+	sum += w;
+	sum += (sum < w);
+	sum += w2;
+	sum += (sum < w2);
+	sum += w3;
+	sum += (sum < w3);
+	sum += w4;
+	sum += (sum < w4);
+	x += 32;
+	len -= 32;
+    }
+    while (len >= 8) {
+	memcpy(&w, x, 8);
+	sum += w;
+	sum += (sum < w);
+	x += 8;
+	len -= 8;
+    }
+    /* fold so the narrower additions below cannot overflow */
+    sum = (sum & 0xFFFFFFFFU) + (sum >> 32);
+    if (len >= 4) {
+	memcpy(&w32, x, 4);
+	sum += w32;
+	x += 4;
+	len -= 4;
+    }
+    if (len >= 2) {
+	memcpy(&w16, x, 2);
+	sum += w16;
+	x += 2;
+	len -= 2;
+    }
     /* mop up an odd byte, if necessary */
-    if (nleft == 1) {
-	*(unsigned char *)(&answer) = *(const unsigned char *)w ;
-	sum += answer;
+    if (len == 1) {
+	w16 = 0;
+	*(unsigned char *) &w16 = *x;
+	sum += w16;
+    }
+    return sum;
+}
+
+static uint16_t
+cksum_generic(const unsigned char *x, int len)
+{
+    return cksum_fold(cksum_add_words(0, x, len));
+}
+
+#if CLICK_USERLEVEL && defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))) && (__GNUC__ >= 5 || defined(__clang__))
+# define CLICK_CKSUM_X86 1
+# include <immintrin.h>
+
+/* Vector versions zero-extend 32-bit lanes into 64-bit accumulators, so
+   they can run 2^32 iterations before overflowing. */
+
+static uint16_t
+cksum_sse2(const unsigned char *x, int len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    uint64_t sum;
+    while (len >= 32) {
+	__m128i a = _mm_loadu_si128((const __m128i *) x);
+	__m128i b = _mm_loadu_si128((const __m128i *) (x + 16));
+	acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+	acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+	acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+	acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+	x += 32;
+	len -= 32;
+    }
+    acc0 = _mm_add_epi64(acc0, acc1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi64(acc0, acc0));
+# if defined(__x86_64__)
+    sum = _mm_cvtsi128_si64(acc0);
+# else
+    _mm_storel_epi64((__m128i *) &sum, acc0);
+# endif
+    sum = (sum & 0xFFFFFFFFU) + (sum >> 32);
+    return cksum_fold(cksum_add_words(sum, x, len));
+}
+
+__attribute__((target("avx2"))) static uint16_t
+cksum_avx2(const unsigned char *x, int len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    __m128i acc;
+    uint64_t sum;
+    while (len >= 64) {
+	__m256i a = _mm256_loadu_si256((const __m256i *) x);
+	__m256i b = _mm256_loadu_si256((const __m256i *) (x + 32));
+	acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+	acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+	acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+	acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+	x += 64;
+	len -= 64;
+    }
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    acc = _mm_add_epi64(_mm256_castsi256_si128(acc0),
+			_mm256_extracti128_si256(acc0, 1));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+# if defined(__x86_64__)
+    sum = _mm_cvtsi128_si64(acc);
+# else
+    _mm_storel_epi64((__m128i *) &sum, acc);
+# endif
+    sum = (sum & 0xFFFFFFFFU) + (sum >> 32);
+    return cksum_fold(cksum_add_words(sum, x, len));
+}
+#endif
+
+static const struct click_in_cksum_impl cksum_impls[] = {
+#if CLICK_CKSUM_X86
+    { "avx2", cksum_avx2 },
+    { "sse2", cksum_sse2 },
+#endif
+    { "generic", cksum_generic },
+    { 0, 0 }
+};
+
+static int
+cksum_impl_supported(const struct click_in_cksum_impl *impl)
+{
+#if CLICK_CKSUM_X86
+    if (impl->cksum == cksum_avx2) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
     }
+#endif
+    (void) impl;
+    return 1;
+}
+
+static uint16_t cksum_dispatch(const unsigned char *x, int len);
+static uint16_t (*cksum_long)(const unsigned char *, int) = cksum_dispatch;
+
+static uint16_t
+cksum_dispatch(const unsigned char *x, int len)
+{
+    /* Pick the first supported implementation.  Racing threads all pick
+       the same one, so the unsynchronized store is harmless. */
+    const struct click_in_cksum_impl *impl = cksum_impls;
+    while (!cksum_impl_supported(impl))
+	++impl;
+    cksum_long = impl->cksum;
+    return cksum_long(x, len);
+}
+
+uint16_t
+click_in_cksum(const unsigned char *x, int len)
+{
+    /* Short data, such as IP headers, isn't worth an indirect call. */
+    if (len < 128)
+	return cksum_generic(x, len);
+    else
+	return cksum_long(x, len);
+}
 
-    /* add back carry outs from top 16 bits to low 16 bits */
-    sum = (sum & 0xffff) + (sum >> 16);
-    sum += (sum >> 16);
-    /* guaranteed now that the lower 16 bits of sum are correct */
+const struct click_in_cksum_impl *
+click_in_cksum_impls(void)
+{
+    return cksum_impls;
+}
 
-    answer = ~sum;              /* truncate to 16 bits */
-    return answer;
+int
+click_in_cksum_impl_supported(const struct click_in_cksum_impl *impl)
+{
+    return cksum_impl_supported(impl);
 }
 
 uint16_t
@@ -54,6 +54,38 @@ IPFlowID::IPFlowID(const click_ip *iph, bool reverse)
 	       iph->ip_src.s_addr, udph->uh_sport);
 }
 
+IPFlow5ID::IPFlow5ID(const Packet *p, bool reverse)
+{
+    const click_ip *iph = p->ip_header();
+    assert(p->has_network_header());
+    _proto = iph->ip_p;
+    uint16_t sport = 0, dport = 0;
+    if ((_proto == IP_PROTO_TCP || _proto == IP_PROTO_UDP
+	 || _proto == IP_PROTO_DCCP || _proto == IP_PROTO_SCTP
+	 || _proto == IP_PROTO_UDPLITE)
+	&& IP_FIRSTFRAG(iph)) {
+	const uint8_t *th = reinterpret_cast<const uint8_t *>(iph) + (iph->ip_hl << 2);
+	if (th + 4 <= p->end_data()) {
+	    const click_udp *udph = reinterpret_cast<const click_udp *>(th);
+	    sport = udph->uh_sport;
+	    dport = udph->uh_dport;
+	}
+    }
+
+    if (likely(!reverse))
+	assign(iph->ip_src.s_addr, sport, iph->ip_dst.s_addr, dport);
+    else
+	assign(iph->ip_dst.s_addr, dport, iph->ip_src.s_addr, sport);
+}
+
+String
+IPFlow5ID::unparse() const
+{
+    char tmp[72];
+    int len = IPFlowID::unparse(tmp);
+    return String(tmp, len - 1) + ", " + String((int) _proto) + ")";
+}
+
 int
 IPFlowID::unparse(char *s) const
 {
@@ -83,7 +83,8 @@ Router::Router(const String &configuration, Master *master)
       _configuration(configuration),
       _notifier_signals(0),
       _arena_factory(new HashMap_ArenaFactory),
-      _hotswap_router(0), _thread_sched(0), _name_info(0), _next_router(0)
+      _hotswap_router(0), _thread_sched(0), _trace_partition(0),
+      _name_info(0), _next_router(0)
 {
     _refcount = 0;
     _runcount = 0;
@@ -1278,6 +1279,29 @@ Router::set_hotswap_router(Router *r)
 }
 
 
+/** @brief Merge state from @a other, a copy of this router.
+ *
+ * @a other must have been created from the same configuration as this
+ * router. For each element, merge_state() finds the element in @a other with
+ * the same name and class, and calls Element::merge_state() to fold that
+ * element's state into this one. The parallel trace driver uses it to
+ * combine the results of several copies of one configuration, each of which
+ * processed part of a trace. Neither router may be running. */
+void
+Router::merge_state(Router *other, ErrorHandler *errh)
+{
+    assert(other != this && _state == ROUTER_LIVE && other->_state == ROUTER_LIVE);
+    for (int i = 0; i < _elements.size(); i++) {
+	Element *e = _elements[_element_configure_order[i]];
+	Element *o = other->find(e->name());
+	if (o && strcmp(o->class_name(), e->class_name()) == 0) {
+	    RouterContextErrh cerrh(errh, "While merging state into", e);
+	    e->merge_state(o, &cerrh);
+	}
+    }
+}
+
+
 // HANDLERS
 
 /** @class Handler
@@ -123,29 +123,36 @@ Task::master() const
 }
 
 
-inline void
+// Returns true if the task was added, in which case the caller should wake
+// the thread after releasing its _pending_lock.  Waking the thread while
+// holding the lock can let it run and spin on the lock until we release it.
+inline bool
 Task::add_pending_locked(RouterThread *thread)
 {
     if (!_pending_nextptr.x) {
 	_pending_nextptr.x = 1;
 	thread->_pending_tail->t = this;
 	thread->_pending_tail = &_pending_nextptr;
-	thread->add_pending();
-    }
+	return true;
+    } else
+	return false;
 }
 
 void
 Task::add_pending()
 {
-    bool thread_match;
+    bool thread_match, added = false;
+    RouterThread *thread;
     do {
-	RouterThread *thread = _thread;
+	thread = _thread;
 	SpinlockIRQ::flags_t flags = thread->_pending_lock.acquire();
 	thread_match = thread == _thread;
 	if (thread_match && thread->thread_id() >= 0)
-	    add_pending_locked(thread);
+	    added = add_pending_locked(thread);
 	thread->_pending_lock.release(flags);
     } while (!thread_match);
+    if (added)
+	thread->add_pending();
 }
 
 inline void
@@ -298,8 +305,10 @@ Task::move_thread_second_half()
 	if (_status.is_scheduled)
 	    add_pending();
     } else {
-	add_pending_locked(old_thread);
+	bool added = add_pending_locked(old_thread);
 	old_thread->_pending_lock.release(flags);
+	if (added)
+	    old_thread->add_pending();
     }
 }
 
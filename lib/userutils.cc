@@ -709,6 +709,11 @@ compressed_data(const unsigned char *buf, int len)
 	if (len >= 10 && memcmp(buf + 4, "1AY&SY", 6) == 0)
 	    return true;
     }
+    // check for xz and zstd signatures
+    if (len >= 6 && memcmp(buf, "\xFD" "7zXZ\0", 6) == 0)
+	return true;
+    if (len >= 4 && memcmp(buf, "\x28\xB5\x2F\xFD", 4) == 0)
+	return true;
     // otherwise unknown
     return false;
 }
@@ -720,6 +725,10 @@ open_uncompress_pipe(const String &filename, const unsigned char *buf, int len,
     StringAccum cmd;
     if (buf[0] == 'B')
 	cmd << "bzcat";
+    else if (buf[0] == 0xFD)
+	cmd << "xz -dc";
+    else if (buf[0] == 0x28)
+	cmd << "zstd -dcq";
     else if (access("/usr/bin/gzcat", X_OK) >= 0)
 	cmd << "/usr/bin/gzcat";
     else
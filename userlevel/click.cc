@@ -58,6 +58,8 @@
 #include <click/userutils.hh>
 #include <click/args.hh>
 #include <click/handlercall.hh>
+#include <click/tracepartition.hh>
+#include <click/standard/threadsched.hh>
 #include "elements/standard/quitwatcher.hh"
 #include "elements/userlevel/controlsocket.hh"
 CLICK_USING_DECLS
@@ -81,6 +83,7 @@ CLICK_USING_DECLS
 #define SIMTIME_OPT             317
 #define SOCKET_OPT              318
 #define THREADS_AFF_OPT         319
+#define PARALLEL_TRACE_OPT      320
 
 static const Clp_Option options[] = {
     { "allow-reconfigure", 'R', ALLOW_RECONFIG_OPT, 0, Clp_Negate },
@@ -90,6 +93,7 @@ static const Clp_Option options[] = {
     { "handler", 'h', HANDLER_OPT, Clp_ValString, 0 },
     { "help", 0, HELP_OPT, 0, 0 },
     { "output", 'o', OUTPUT_OPT, Clp_ValString, 0 },
+    { "parallel-trace", 0, PARALLEL_TRACE_OPT, Clp_ValInt, 0 },
     { "socket", 0, SOCKET_OPT, Clp_ValInt, 0 },
     { "port", 'p', PORT_OPT, Clp_ValString, 0 },
     { "quit", 'q', QUIT_OPT, 0, 0 },
@@ -128,7 +132,9 @@ Usage: %s [OPTION]... [ROUTERFILE]\n\
 Options:\n\
   -f, --file FILE               Read router configuration from FILE.\n\
   -e, --expression EXPR         Use EXPR as router configuration.\n\
-  -j, --threads N               Start N threads (default 1).\n", program_name);
+  -j, --threads N               Start N threads (default 1).\n\
+      --parallel-trace N        Run N copies of the configuration on N threads,\n\
+                                each on its own share of the input traces.\n", program_name);
 #if HAVE_DECL_PTHREAD_SETAFFINITY_NP
     printf("\
   -a, --affinity                Pin threads to CPUs (default no).\n");
@@ -140,6 +146,8 @@ Options:\n\
   -R, --allow-reconfigure       Provide a writable 'hotconfig' handler.\n\
   -h, --handler ELEMENT.H       Call ELEMENT's read handler H after running\n\
                                 driver and print result to standard output.\n\
+  -h, --handler ELEMENT.H=VAL   Call ELEMENT's write handler H with VAL after\n\
+                                running driver.\n\
   -x, --exit-handler ELEMENT.H  Use handler ELEMENT.H value for exit status.\n\
   -o, --output FILE             Write flat configuration to FILE.\n\
   -q, --quit                    Do not run driver.\n\
@@ -155,6 +163,7 @@ Report bugs to <click@librelist.com>.\n");
 
 static Master* click_master;
 static Router* click_router;
+static Vector<Router*> parallel_copies;
 static ErrorHandler* errh;
 static bool running = false;
 
@@ -167,8 +176,11 @@ stop_signal_handler(int sig)
 #endif
     if (!running)
         kill(getpid(), sig);
-    else
+    else {
         click_router->set_runcount(Router::STOP_RUNCOUNT);
+        for (int i = 0; i < parallel_copies.size(); ++i)
+            parallel_copies[i]->set_runcount(Router::STOP_RUNCOUNT);
+    }
 }
 
 #if HAVE_EXECINFO_H
@@ -221,9 +233,23 @@ call_read_handler(Element *e, String handler_name,
   return 0;
 }
 
+static int
+call_write_handler(Element *e, String handler_name, const String &value,
+                   ErrorHandler *errh)
+{
+  const Handler *h = Router::handler(e, handler_name);
+  String full_name = Handler::unparse_name(e, handler_name);
+  if (!h || !h->visible())
+    return errh->error("no %<%s%> handler", full_name.c_str());
+  else if (!h->write_visible())
+    return errh->error("%<%s%> is a read handler", full_name.c_str());
+  ContextErrorHandler cerrh(errh, "In write handler %<%s%>:", full_name.c_str());
+  return h->call_write(value, e, &cerrh);
+}
+
 static int
 expand_handler_elements(const String& pattern, const String& handler_name,
-                        Vector<Element*>& elements, Router* router)
+                        bool write, Vector<Element*>& elements, Router* router)
 {
     // first try element name
     if (Element* e = router->find(pattern)) {
@@ -245,7 +271,7 @@ expand_handler_elements(const String& pattern, const String& handler_name,
             : router->element(i)->cast(pattern.c_str()) != 0) {
             any = true;
             const Handler* h = Router::handler(router->element(i), handler_name);
-            if (h && h->read_visible())
+            if (h && (write ? h->write_visible() : h->read_visible()))
                 elements.push_back(router->element(i));
         }
     if (!any)
@@ -274,13 +300,26 @@ call_read_handlers(Vector<String> &handlers, ErrorHandler *errh)
         String element_name = handlers[i].substring(handlers[i].begin(), dot);
         String handler_name = handlers[i].substring(dot + 1, handlers[i].end());
 
+        // ELEMENT.H=VALUE writes VALUE to a write handler
+        const char *eq = find(handler_name, '=');
+        bool write = (eq != handler_name.end());
+        String value;
+        if (write) {
+            value = handler_name.substring(eq + 1, handler_name.end());
+            handler_name = handler_name.substring(handler_name.begin(), eq);
+        }
+
         Vector<Element*> elements;
-        int retval = expand_handler_elements(element_name, handler_name,
+        int retval = expand_handler_elements(element_name, handler_name, write,
                                              elements, click_router);
         if (retval >= 0)
-            for (int j = 0; j < elements.size(); j++)
-                call_read_handler(elements[j], handler_name,
-                                  print_names || retval > 1, errh);
+            for (int j = 0; j < elements.size(); j++) {
+                if (write)
+                    call_write_handler(elements[j], handler_name, value, errh);
+                else
+                    call_read_handler(elements[j], handler_name,
+                                      print_names || retval > 1, errh);
+            }
     }
 
     return (errh->nerrors() == before ? 0 : -1);
@@ -325,6 +364,26 @@ static void* hotswap_threadfunc(void*)
 }
 #endif
 
+// parallel traces
+
+// Each copy of the configuration runs on its own thread and processes its
+// own share of the trace. The copies' trace sources share feeds, through
+// which the first copy hands the other copies their packets.
+static TracePartition::feed_map_type parallel_feeds;
+
+class ParallelCopy : public ThreadSched { public:
+    ParallelCopy(int index, int count)
+        : partition(index, count, &parallel_feeds) {
+    }
+    int initial_home_thread_id(const Element *) {
+        return partition.index();
+    }
+    TracePartition partition;
+};
+
+static int parallel_trace = 1;
+static Vector<ParallelCopy*> parallel_info;
+
 // switching configurations
 
 static Vector<String> cs_unix_sockets;
@@ -344,26 +403,37 @@ click_driver_control_socket_name(int number)
 
 static Router *
 parse_configuration(const String &text, bool text_is_expr, bool hotswap,
-                    ErrorHandler *errh)
+                    ErrorHandler *errh, int copy = 0)
 {
     int before_errors = errh->nerrors();
+    if (parallel_trace > 1)
+        click_lexer()->global_scope().define("PARALLEL_INDEX", String(copy), true);
     Router *router = click_read_router(text, text_is_expr, errh, false,
                                        click_master);
     if (!router)
         return 0;
 
-    // add new ControlSockets
+    if (parallel_trace > 1) {
+        ParallelCopy *pc = new ParallelCopy(copy, parallel_trace);
+        parallel_info.push_back(pc);
+        router->set_trace_partition(&pc->partition);
+        router->set_thread_sched(pc);
+    }
+
+    // add new ControlSockets (to the first parallel trace copy only)
     String retries = (hotswap ? ", RETRIES 1, RETRY_WARNINGS false" : "");
     int ncs = 0;
-    for (String *it = cs_ports.begin(); it != cs_ports.end(); ++it, ++ncs)
-        router->add_element(new ControlSocket, click_driver_control_socket_name(ncs), "TCP, " + *it + retries, "click", 0);
-    for (String *it = cs_unix_sockets.begin(); it != cs_unix_sockets.end(); ++it, ++ncs)
-        router->add_element(new ControlSocket, click_driver_control_socket_name(ncs), "UNIX, " + *it + retries, "click", 0);
-    for (String *it = cs_sockets.begin(); it != cs_sockets.end(); ++it, ++ncs)
-        router->add_element(new ControlSocket, click_driver_control_socket_name(ncs), "SOCKET, " + *it + retries, "click", 0);
+    if (!copy) {
+        for (String *it = cs_ports.begin(); it != cs_ports.end(); ++it, ++ncs)
+            router->add_element(new ControlSocket, click_driver_control_socket_name(ncs), "TCP, " + *it + retries, "click", 0);
+        for (String *it = cs_unix_sockets.begin(); it != cs_unix_sockets.end(); ++it, ++ncs)
+            router->add_element(new ControlSocket, click_driver_control_socket_name(ncs), "UNIX, " + *it + retries, "click", 0);
+        for (String *it = cs_sockets.begin(); it != cs_sockets.end(); ++it, ++ncs)
+            router->add_element(new ControlSocket, click_driver_control_socket_name(ncs), "SOCKET, " + *it + retries, "click", 0);
+    }
 
   // catch signals (only need to do the first time)
-  if (!hotswap) {
+  if (!hotswap && !copy) {
       // catch control-C and SIGTERM
       click_signal(SIGINT, stop_signal_handler, true);
       click_signal(SIGTERM, stop_signal_handler, true);
@@ -482,9 +552,18 @@ static int thread_driver(void *user_data)
 static int
 cleanup(Clp_Parser *clp, int exit_value)
 {
+    for (int i = 0; i < parallel_copies.size(); ++i)
+        parallel_copies[i]->unuse();
+    parallel_copies.clear();
+    for (TracePartition::feed_map_type::iterator it = parallel_feeds.begin();
+         it.live(); ++it)
+        delete it.value();
+    parallel_feeds.clear();
     Clp_DeleteParser(clp);
     click_static_cleanup();
     delete click_master;
+    for (int i = 0; i < parallel_info.size(); ++i)
+        delete parallel_info[i];
     return exit_value;
 }
 
@@ -651,6 +730,14 @@ main(int argc, char **argv)
 #endif
       break;
 
+    case PARALLEL_TRACE_OPT:
+      if (clp->val.i < 1) {
+          Clp_OptionError(clp, "%<%O%> expects a positive number of copies");
+          goto bad_option;
+      }
+      parallel_trace = clp->val.i;
+      break;
+
     case SIMTIME_OPT: {
         Timestamp::warp_set_class(Timestamp::warp_simulation);
         Timestamp simbegin(clp->have_val ? clp->val.d : 1000000000);
@@ -698,12 +785,43 @@ particular purpose.\n");
   if (Timestamp::warp_class() != Timestamp::warp_simulation)
       Router::add_write_handler(0, "timewarp", timewarp_write_handler, 0);
 
+  // each parallel trace copy needs its own thread
+  if (parallel_trace > 1) {
+#if !HAVE_MULTITHREAD
+      errh->error("Click was built without multithread support, can't run a parallel trace");
+      return cleanup(clp, 1);
+#else
+      if (allow_reconfigure) {
+          errh->error("--parallel-trace and --allow-reconfigure are incompatible");
+          return cleanup(clp, 1);
+      }
+# if HAVE_DPDK
+      if (click_nthreads < parallel_trace) {
+          errh->error("--parallel-trace needs %d threads, but the EAL core mask gives %d", parallel_trace, click_nthreads);
+          return cleanup(clp, 1);
+      }
+# else
+      if (click_nthreads < parallel_trace)
+          click_nthreads = parallel_trace;
+# endif
+#endif
+  }
+
   // parse configuration
   click_master = new Master(click_nthreads);
   click_router = parse_configuration(router_file, file_is_expr, false, errh);
   if (!click_router)
     return cleanup(clp, 1);
   click_router->use();
+  for (int i = 1; i < parallel_trace; ++i) {
+      Router *r = parse_configuration(router_file, file_is_expr, false, errh, i);
+      if (!r) {
+          click_router->unuse();
+          return cleanup(clp, 1);
+      }
+      r->use();
+      parallel_copies.push_back(r);
+  }
 
   int exit_value = 0;
 #if (HAVE_MULTITHREAD && !HAVE_DPDK)
@@ -741,6 +859,8 @@ particular purpose.\n");
   if (!quit_immediately && click_router->nelements()) {
     running = true;
     click_router->activate(errh);
+    for (int i = 0; i < parallel_copies.size(); ++i)
+      parallel_copies[i]->activate(errh);
     if (allow_reconfigure) {
       hotswap_thunk_router = new Router("", click_master);
       hotswap_thunk_router->initialize(errh);
@@ -774,6 +894,10 @@ particular purpose.\n");
     // now that the driver has stopped, SIGINT gets default handling
     running = false;
     click_fence();
+
+    // fold the parallel trace copies' results into the first copy
+    for (int i = 0; i < parallel_copies.size(); ++i)
+      click_router->merge_state(parallel_copies[i], errh);
   } else if (!quit_immediately && warnings)
     errh->warning("%s: configuration has no elements, exiting", filename_landmark(router_file, file_is_expr));
 